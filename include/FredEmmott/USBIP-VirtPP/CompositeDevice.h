@@ -0,0 +1,74 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "Core.h"
+#include "Device.h"
+#include "Request.h"
+
+#ifdef __cplusplus
+#include <cinttypes>
+extern "C" {
+#else
+#include <inttypes.h>
+#endif
+
+/* A USB composite device: several independent functions - e.g. gamepads -
+ * presented as one device, so they're imported and attached together.
+ *
+ * Each function is implemented like a raw `Device`: it provides callbacks,
+ * and its descriptors as if it were the only function. Interfaces and
+ * endpoints are renumbered in the composite device's configuration
+ * descriptor, and translated back before the function's callbacks are
+ * invoked. In those callbacks, `Request_GetDeviceUserData()` returns the
+ * function's `mUserData`.
+ *
+ * USB limits a device to 15 endpoint numbers, shared by all functions; an
+ * IN and OUT endpoint with the same number in one function use one.
+ */
+struct FredEmmott_USBIP_VirtPP_CompositeDevice;
+typedef struct FredEmmott_USBIP_VirtPP_CompositeDevice*
+  FredEmmott_USBIP_VirtPP_CompositeDeviceHandle;
+
+struct FredEmmott_USBIP_VirtPP_CompositeDevice_Function {
+  void* mUserData;
+  struct FredEmmott_USBIP_VirtPP_Device_Callbacks mCallbacks;
+
+  /* The function's interface, endpoint, and class-specific descriptors, as
+   * they'd follow the configuration descriptor.
+   *
+   * Interface numbers start at 0. Class-specific descriptors are copied
+   * as-is, so must not contain interface numbers. If there's more than one
+   * interface and no interface association descriptor, one is added.
+   */
+  const void* mDescriptors;
+  size_t mDescriptorsLength;
+};
+
+struct FredEmmott_USBIP_VirtPP_CompositeDevice_InitData {
+  void* mUserData;
+  BOOL mAutoAttach;
+
+  uint16_t mVendorID;
+  uint16_t mProductID;
+  uint16_t mDeviceVersion;
+
+  size_t mFunctionCount;
+  const struct FredEmmott_USBIP_VirtPP_CompositeDevice_Function* mFunctions;
+};
+
+FredEmmott_USBIP_VirtPP_CompositeDeviceHandle
+FredEmmott_USBIP_VirtPP_CompositeDevice_Create(
+  FredEmmott_USBIP_VirtPP_InstanceHandle,
+  const struct FredEmmott_USBIP_VirtPP_CompositeDevice_InitData*);
+void FredEmmott_USBIP_VirtPP_CompositeDevice_Destroy(
+  FredEmmott_USBIP_VirtPP_CompositeDeviceHandle);
+void* FredEmmott_USBIP_VirtPP_CompositeDevice_GetUserData(
+  FredEmmott_USBIP_VirtPP_CompositeDeviceHandle);
+FredEmmott_USBIP_VirtPP_DeviceHandle
+FredEmmott_USBIP_VirtPP_CompositeDevice_GetDevice(
+  FredEmmott_USBIP_VirtPP_CompositeDeviceHandle);
+
+#ifdef __cplusplus
+}// extern "C"
+#endif
@@ -4,13 +4,13 @@
 
 #include <FredEmmott/USBSpec.h>
 
-#ifdef __cplusplus
-#include <cstdint>
-
 #define FredEmmott_USBIP_VirtPP_LogSeverity_Debug (-16)
 #define FredEmmott_USBIP_VirtPP_LogSeverity_Default (0)
 #define FredEmmott_USBIP_VirtPP_LogSeverity_Error (16)
 
+#ifdef __cplusplus
+#include <cstdint>
+
 extern "C" {
 #else
 #include <stdint.h>
@@ -38,16 +38,94 @@ typedef struct FredEmmott_USBIP_VirtPP_Instance*
 FredEmmott_USBIP_VirtPP_InstanceHandle;
 
 struct FredEmmott_USBIP_VirtPP_Instance_Callbacks {
+  /* Called from a background thread, one message at a time; `message` is only
+   * valid for the duration of the call.
+   *
+   * If null, messages are written to stdout or stderr, from the same thread.
+   */
   void (*OnLogMessage)(int severity, const char* message, size_t messageLength);
 };
 
 
+/* What to do when a client isn't reading replies as fast as we produce them,
+ * and its outbound queue reaches `mMaxQueuedBytesPerConnection`.
+ *
+ * With every policy, we also stop reading new requests from that client until
+ * its queue has drained; other clients are unaffected.
+ */
+// Threads other than the `Instance_Run()` thread wait in `Request_SendReply()`
+#define FredEmmott_USBIP_VirtPP_BackpressurePolicy_Block (0)
+// Complete interrupt IN requests with no data, instead of queueing the
+// report; the host will resubmit, and receive a later report. Only affects
+// endpoints listed in `Device_InitData::mSupersededInputEndpoints`, e.g. a
+// gamepad's; other replies are still queued
+#define FredEmmott_USBIP_VirtPP_BackpressurePolicy_DropSupersededInputReports \
+  (1)
+// Drop the connection
+#define FredEmmott_USBIP_VirtPP_BackpressurePolicy_Disconnect (2)
+
 struct FredEmmott_USBIP_VirtPP_Instance_InitData {
   void* mUserData;
   struct FredEmmott_USBIP_VirtPP_Instance_Callbacks mCallbacks;
 
   uint16_t mPortNumber;// set to zero to auto-assign
   BOOL mAllowRemoteConnections;
+
+  int32_t mBackpressurePolicy;// FredEmmott_USBIP_VirtPP_BackpressurePolicy_*
+  uint32_t mMaxQueuedBytesPerConnection;// set to zero for the default
+
+  /* Linux only: the sysfs directory of the first `vhci_hcd` controller, for
+   * attaching devices. Null for `/sys/devices/platform/vhci_hcd.0`.
+   */
+  const char* mVHCISysfsPath;
+
+  /* FredEmmott_USBIP_VirtPP_LogSeverity_*; anything less severe is discarded
+   * before it's formatted. Zero is `_Default`, which leaves out `_Debug`.
+   */
+  int32_t mMinLogSeverity;
+
+  /* Record when each URB is received, dispatched, parked, and answered, and
+   * when replies are written; see `Instance_WriteTrace()`.
+   */
+  BOOL mEnableTracing;
+
+  /* If set, every URB is written to this pcap file, with the Linux usbmon
+   * link type, for Wireshark. Cheap enough to leave on.
+   */
+  const char* mCapturePath;
+
+  /* If set, the exact bytes sent and received on each connection are written
+   * to this file, with timestamps, for replaying with `usbip_virtpp_replay`.
+   * Not for production use.
+   */
+  const char* mRecordPath;
+};
+
+/* Counters for a client connection, since it was accepted; see
+ * `Instance_GetConnectionStats()`.
+ */
+struct FredEmmott_USBIP_VirtPP_Connection_Stats {
+  // Unique for the lifetime of the instance
+  uint64_t mConnectionID;
+
+  uint64_t mURBs;// CMD_SUBMITs received
+  uint64_t mUnlinks;// CMD_UNLINKs received
+  // Everything we've queued, including RET_UNLINKs and OP_REP_*s
+  uint64_t mReplies;
+
+  // Bytes received from and sent to the socket
+  uint64_t mBytesReceived;
+  uint64_t mBytesSent;
+
+  // URBs that haven't been answered or unlinked yet
+  uint64_t mPendingURBs;
+  uint64_t mPendingURBsHighWater;
+
+  // See `InitData::mMaxQueuedBytesPerConnection`
+  uint64_t mQueuedBytes;
+  uint64_t mQueuedBytesHighWater;
+  // Replies completed without data by `DropSupersededInputReports`
+  uint64_t mDroppedReplies;
 };
 
 /****** Instance:: methods *****/
@@ -65,6 +143,27 @@ void FredEmmott_USBIP_VirtPP_Instance_RequestStop(
   FredEmmott_USBIP_VirtPP_InstanceHandle);
 void FredEmmott_USBIP_VirtPP_Instance_Destroy(
   FredEmmott_USBIP_VirtPP_InstanceHandle);
+/* Snapshot every open connection; thread-safe.
+ *
+ * Writes up to `capacity` entries, and returns the number of open
+ * connections; if that's more than `capacity`, call again with more space.
+ */
+size_t FredEmmott_USBIP_VirtPP_Instance_GetConnectionStats(
+  FredEmmott_USBIP_VirtPP_InstanceHandle,
+  struct FredEmmott_USBIP_VirtPP_Connection_Stats* stats,
+  size_t capacity);
+/* Write the most recent trace events to `path`, in Chrome's trace event
+ * format; open it with `chrome://tracing` or https://ui.perfetto.dev
+ *
+ * Requires `InitData::mEnableTracing`. Thread-safe, and tracing continues.
+ */
+FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Instance_WriteTrace(
+  FredEmmott_USBIP_VirtPP_InstanceHandle,
+  const char* path);
+// Thread-safe; see `InitData::mMinLogSeverity`
+void FredEmmott_USBIP_VirtPP_Instance_SetMinLogSeverity(
+  FredEmmott_USBIP_VirtPP_InstanceHandle,
+  int32_t severity);
 
 /***** END *****/
 
@@ -27,7 +27,11 @@ struct FredEmmott_USBIP_VirtPP_Device_Callbacks {
     uint16_t value,
     uint16_t index,
     uint16_t length);
-  /* `data` *may* be a null pointer if `dataLength` is 0. */
+  /* `data` *may* be a null pointer if `dataLength` is 0.
+   *
+   * `data` is only valid until the callback returns; to use it later without
+   * copying it, call `FredEmmott_USBIP_VirtPP_Request_RetainPayload()`.
+   */
   FredEmmott_USBIP_VirtPP_Result (*OnOutputRequest)(
     FredEmmott_USBIP_VirtPP_RequestHandle,
     uint32_t endpoint,
@@ -48,15 +52,74 @@ struct FredEmmott_USBIP_VirtPP_Device_InitData {
   FredEmmott_USBSpec_DeviceDescriptor const* mDeviceDescriptor;
   uint8_t mNumInterfaces;
   FredEmmott_USBSpec_InterfaceDescriptor const* mInterfaceDescriptors;
+
+  /* Bit N is set if endpoint N is an interrupt IN endpoint whose reports
+   * each supersede the last, e.g. a gamepad's state.
+   *
+   * With the `DropSupersededInputReports` backpressure policy, only replies
+   * on these endpoints are dropped; bulk data and reports that can't be
+   * skipped are always queued. Endpoint 0 is ignored.
+   */
+  uint16_t mSupersededInputEndpoints;
+};
+
+#define FredEmmott_USBIP_VirtPP_Device_Stats_EndpointCount (16)
+
+/* Counters since the device was created; see `Device_GetStats()`.
+ *
+ * "In" and "out" are from the host's point of view, as in USB.
+ */
+struct FredEmmott_USBIP_VirtPP_Device_Stats {
+  // URBs received, by endpoint number
+  uint64_t mInURBs[FredEmmott_USBIP_VirtPP_Device_Stats_EndpointCount];
+  uint64_t mOutURBs[FredEmmott_USBIP_VirtPP_Device_Stats_EndpointCount];
+
+  // Including error replies
+  uint64_t mReplies;
+  // Replies with a non-zero status, including stalls
+  uint64_t mErrorReplies;
+  // Replies with `-EPIPE`
+  uint64_t mStallReplies;
+  // URBs the host cancelled before the device replied
+  uint64_t mUnlinks;
+
+  // OUT data received, and IN data sent
+  uint64_t mBytesOut;
+  uint64_t mBytesIn;
+
+  // URBs that haven't been answered or unlinked yet, e.g. because the device
+  // has cloned and parked them
+  uint64_t mPendingURBs;
+  uint64_t mPendingURBsHighWater;
 };
 
 /***** Device:: methods *****/
 
+/* Devices can be created and destroyed from any thread, including while
+ * `Instance_Run()` is active.
+ *
+ * `Destroy()` unplugs the device: it waits until the device's callbacks have
+ * returned, and URBs that haven't been answered yet fail with `-ESHUTDOWN`.
+ * Cloned requests for the device can still be answered or destroyed
+ * afterwards, but replies are discarded, and `Request_GetDevice()` and
+ * `Request_GetDeviceUserData()` must not be used.
+ */
 FredEmmott_USBIP_VirtPP_DeviceHandle FredEmmott_USBIP_VirtPP_Device_Create(
   FredEmmott_USBIP_VirtPP_InstanceHandle,
   FredEmmott_USBIP_VirtPP_Device_InitData const*);
 FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Device_Attach(
   FredEmmott_USBIP_VirtPP_DeviceHandle);
+/* Attach several devices at once; this takes about as long as attaching one.
+ *
+ * The devices must belong to the same instance. `results` must have space for
+ * `count` results, which are in the same order as `devices`.
+ *
+ * Returns success if every device was attached.
+ */
+FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Device_AttachAll(
+  const FredEmmott_USBIP_VirtPP_DeviceHandle* devices,
+  size_t count,
+  FredEmmott_USBIP_VirtPP_Result* results);
 void FredEmmott_USBIP_VirtPP_Device_Destroy(
   FredEmmott_USBIP_VirtPP_DeviceHandle);
 void* FredEmmott_USBIP_VirtPP_Device_GetUserData(
@@ -66,6 +129,12 @@ FredEmmott_USBIP_VirtPP_Device_GetInstance(
   FredEmmott_USBIP_VirtPP_DeviceHandle);
 void* FredEmmott_USBIP_VirtPP_Device_GetInstanceUserData(
   FredEmmott_USBIP_VirtPP_DeviceHandle);
+/* Thread-safe, and cheap enough to poll; the counters are updated
+ * independently, so they may be very slightly out of step with each other.
+ */
+void FredEmmott_USBIP_VirtPP_Device_GetStats(
+  FredEmmott_USBIP_VirtPP_DeviceHandle,
+  struct FredEmmott_USBIP_VirtPP_Device_Stats*);
 
 /***** END *****/
 
@@ -18,6 +18,49 @@ struct FredEmmott_USBIP_VirtPP_Request;
 typedef struct FredEmmott_USBIP_VirtPP_Request*
   FredEmmott_USBIP_VirtPP_RequestHandle;
 
+struct FredEmmott_USBIP_VirtPP_Payload;
+typedef struct FredEmmott_USBIP_VirtPP_Payload*
+  FredEmmott_USBIP_VirtPP_PayloadHandle;
+
+// `transfer_flags` from Linux's `struct urb`
+// For IN requests: a reply shorter than the request is an error (-EREMOTEIO)
+#define FredEmmott_USBIP_VirtPP_TransferFlags_ShortNotOK (0x0001)
+// For OUT requests: the host terminates the transfer with a zero-length
+// packet if it's a multiple of the endpoint's packet size
+#define FredEmmott_USBIP_VirtPP_TransferFlags_ZeroPacket (0x0040)
+
+struct FredEmmott_USBIP_VirtPP_Buffer {
+  const void* mData;
+  size_t mSize;
+};
+
+/* An isochronous packet; see `Request_GetIsoPackets()`.
+ *
+ * Like Linux's `struct usb_iso_packet_descriptor`.
+ */
+struct FredEmmott_USBIP_VirtPP_IsoPacket {
+  // Where the packet's data is in the transfer buffer
+  uint32_t mOffset;
+  uint32_t mLength;
+  // Set by the device when replying
+  uint32_t mActualLength;
+  int32_t mStatus;
+};
+
+/* Produces the data for `Request_SendStreamingReply()`, a chunk at a time.
+ *
+ * Both callbacks are called on the `Instance_Run()` thread, except that
+ * `OnComplete` may be called from any thread if the client disconnects.
+ */
+struct FredEmmott_USBIP_VirtPP_StreamProducer {
+  void* mUserData;
+  // Write exactly `size` bytes to `buffer`; the next `size` bytes of the reply
+  void (*OnRead)(void* userData, void* buffer, size_t size);
+  // Called once, after the last `OnRead()`, or if the reply is abandoned.
+  // May be null.
+  void (*OnComplete)(void* userData);
+};
+
 /****** Request:: methods *****/
 
 FredEmmott_USBIP_VirtPP_DeviceHandle FredEmmott_USBIP_VirtPP_Request_GetDevice(
@@ -30,6 +73,43 @@ FredEmmott_USBIP_VirtPP_InstanceHandle
 void* FredEmmott_USBIP_VirtPP_Request_GetInstanceUserData(
   FredEmmott_USBIP_VirtPP_RequestHandle);
 
+/** Whether the host is still waiting for a reply.
+ *
+ * False once the request has been answered, if the host has cancelled it with
+ * `CMD_UNLINK`, or if the client has disconnected. Replies to requests that
+ * are no longer pending are discarded.
+ *
+ * This is useful to skip cancelled requests that you've parked for an async
+ * response.
+ */
+BOOL FredEmmott_USBIP_VirtPP_Request_IsPending(
+  FredEmmott_USBIP_VirtPP_RequestHandle);
+
+// The maximum length of the reply to an IN request, or the length of the data
+// for an OUT request
+uint32_t FredEmmott_USBIP_VirtPP_Request_GetTransferBufferLength(
+  FredEmmott_USBIP_VirtPP_RequestHandle);
+// `FredEmmott_USBIP_VirtPP_TransferFlags_*`
+uint32_t FredEmmott_USBIP_VirtPP_Request_GetTransferFlags(
+  FredEmmott_USBIP_VirtPP_RequestHandle);
+
+// The number of packets in an isochronous request; 0 for other requests
+uint32_t FredEmmott_USBIP_VirtPP_Request_GetIsoPacketCount(
+  FredEmmott_USBIP_VirtPP_RequestHandle);
+/** Copy up to `count` of the packets of an isochronous request to `packets`,
+ * and return how many were copied.
+ *
+ * For OUT requests, each packet's data is at `mOffset` in the `data` passed
+ * to `OnOutputRequest`.
+ *
+ * Like `data`, the packets are only available during the callback; this
+ * returns 0 for clones.
+ */
+size_t FredEmmott_USBIP_VirtPP_Request_GetIsoPackets(
+  FredEmmott_USBIP_VirtPP_RequestHandle,
+  struct FredEmmott_USBIP_VirtPP_IsoPacket* packets,
+  size_t count);
+
 /** If you're using C++, there's an overload that takes `const T& data`, and
  * infers the size */
 FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Request_SendReply(
@@ -40,6 +120,49 @@ FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Request_SendStringReply(
   FredEmmott_USBIP_VirtPP_RequestHandle,
   wchar_t const* data,
   size_t charCount);
+/** Scatter-gather version of `SendReply()`: the reply is the concatenation of
+ * `buffers`.
+ *
+ * As with `SendReply()`, the reply is truncated to the length of the request;
+ * the buffers are copied before this returns.
+ */
+FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Request_SendReplyV(
+  FredEmmott_USBIP_VirtPP_RequestHandle,
+  const struct FredEmmott_USBIP_VirtPP_Buffer* buffers,
+  size_t bufferCount);
+/** Reply with `length` bytes, produced by `producer` as the client can accept
+ * them, instead of all at once.
+ *
+ * Useful for large bulk IN transfers; other replies to the same client are
+ * sent after this one is complete. `length` is truncated to the length of the
+ * request.
+ *
+ * If this fails, `producer->OnComplete` has already been called.
+ */
+FredEmmott_USBIP_VirtPP_Result
+  FredEmmott_USBIP_VirtPP_Request_SendStreamingReply(
+    FredEmmott_USBIP_VirtPP_RequestHandle,
+    size_t length,
+    const struct FredEmmott_USBIP_VirtPP_StreamProducer* producer);
+/** Reply to an isochronous request.
+ *
+ * `packets` must have an entry for every packet of the request - usually
+ * the packets from `Request_GetIsoPackets()`, with `mActualLength` and
+ * `mStatus` filled in. For IN requests, each packet's data is read from
+ * `data + mOffset`; for OUT requests, `data` is ignored, and may be null.
+ *
+ * The reply is held back until the request's frames have passed - 1ms per
+ * packet, times the request's interval - so the host streams in real time,
+ * however quickly you reply. Transfers on the same endpoint are scheduled
+ * back-to-back.
+ *
+ * `data` is copied before this returns.
+ */
+FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Request_SendIsoReply(
+  FredEmmott_USBIP_VirtPP_RequestHandle,
+  const void* data,
+  const struct FredEmmott_USBIP_VirtPP_IsoPacket* packets,
+  size_t packetCount);
 // Use -32 (linux -EPIPE) for 'STALL', e.g. for bad USB string descriptor
 // requests
 FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
@@ -63,6 +186,28 @@ FredEmmott_USBIP_VirtPP_RequestHandle FredEmmott_USBIP_VirtPP_Request_Clone(
 void FredEmmott_USBIP_VirtPP_Request_Destroy(
   FredEmmott_USBIP_VirtPP_RequestHandle);
 
+/** Keep the `data` passed to `OnOutputRequest` alive after the callback
+ * returns, without copying it.
+ *
+ * Only valid for the handle passed to `OnOutputRequest`, during the callback;
+ * returns null otherwise, or if there is no data.
+ *
+ * You must call `FredEmmott_USBIP_VirtPP_Payload_Release()` on the returned
+ * handle when you are done with it, and before destroying the instance.
+ */
+FredEmmott_USBIP_VirtPP_PayloadHandle
+  FredEmmott_USBIP_VirtPP_Request_RetainPayload(
+    FredEmmott_USBIP_VirtPP_RequestHandle);
+
+/****** Payload:: methods *****/
+
+const void* FredEmmott_USBIP_VirtPP_Payload_GetData(
+  FredEmmott_USBIP_VirtPP_PayloadHandle);
+size_t FredEmmott_USBIP_VirtPP_Payload_GetSize(
+  FredEmmott_USBIP_VirtPP_PayloadHandle);
+void FredEmmott_USBIP_VirtPP_Payload_Release(
+  FredEmmott_USBIP_VirtPP_PayloadHandle);
+
 /***** END *****/
 
 #ifdef __cplusplus
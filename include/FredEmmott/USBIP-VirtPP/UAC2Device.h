@@ -0,0 +1,93 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "Core.h"
+#include "Request.h"
+
+#ifdef __cplusplus
+#include <cinttypes>
+extern "C" {
+#else
+#include <inttypes.h>
+#endif
+
+/* A USB Audio Class 2.0 device, with 48kHz 16-bit stereo playback (a
+ * speaker) and capture (a microphone).
+ *
+ * Samples are interleaved, left channel first, and exchanged through
+ * lock-free rings: `ReadPlayback()` returns what the host has played, and
+ * `WriteCapture()` provides what the host records. If the capture ring runs
+ * dry, the host gets silence.
+ */
+struct FredEmmott_USBIP_VirtPP_UAC2Device;
+typedef struct FredEmmott_USBIP_VirtPP_UAC2Device*
+  FredEmmott_USBIP_VirtPP_UAC2DeviceHandle;
+
+#define FredEmmott_USBIP_VirtPP_UAC2Device_SampleRate (48000)
+#define FredEmmott_USBIP_VirtPP_UAC2Device_ChannelCount (2)
+
+struct FredEmmott_USBIP_VirtPP_UAC2Device_InitData {
+  void* mUserData;
+  BOOL mAutoAttach;
+  /* The capacity of each ring, in frames - one sample per channel.
+   *
+   * 0 for the default, 100ms.
+   */
+  uint32_t mRingFrames;
+};
+
+/* Counters since the device was created.
+ *
+ * The jitter is how far the gap between two consecutive transfers in the
+ * same direction has been from the length of the first transfer; this
+ * includes both the server's pacing, and the host's.
+ */
+struct FredEmmott_USBIP_VirtPP_UAC2Device_Stats {
+  uint64_t mPlaybackFrames;
+  // Frames the host played while the playback ring was full; discarded
+  uint64_t mPlaybackOverrunFrames;
+  uint64_t mPlaybackMaxJitterMicroseconds;
+
+  uint64_t mCaptureFrames;
+  // Frames of silence sent because the capture ring was empty
+  uint64_t mCaptureUnderrunFrames;
+  uint64_t mCaptureMaxJitterMicroseconds;
+};
+
+FredEmmott_USBIP_VirtPP_UAC2DeviceHandle
+FredEmmott_USBIP_VirtPP_UAC2Device_Create(
+  FredEmmott_USBIP_VirtPP_InstanceHandle,
+  const struct FredEmmott_USBIP_VirtPP_UAC2Device_InitData*);
+void FredEmmott_USBIP_VirtPP_UAC2Device_Destroy(
+  FredEmmott_USBIP_VirtPP_UAC2DeviceHandle);
+void* FredEmmott_USBIP_VirtPP_UAC2Device_GetUserData(
+  FredEmmott_USBIP_VirtPP_UAC2DeviceHandle);
+
+/** Take up to `frameCount` frames that the host has played.
+ *
+ * Returns the number of frames written to `samples`. Only call this from one
+ * thread at a time.
+ */
+size_t FredEmmott_USBIP_VirtPP_UAC2Device_ReadPlayback(
+  FredEmmott_USBIP_VirtPP_UAC2DeviceHandle,
+  int16_t* samples,
+  size_t frameCount);
+
+/** Queue up to `frameCount` frames for the host to record.
+ *
+ * Returns the number of frames that fit in the ring. Only call this from one
+ * thread at a time.
+ */
+size_t FredEmmott_USBIP_VirtPP_UAC2Device_WriteCapture(
+  FredEmmott_USBIP_VirtPP_UAC2DeviceHandle,
+  const int16_t* samples,
+  size_t frameCount);
+
+void FredEmmott_USBIP_VirtPP_UAC2Device_GetStats(
+  FredEmmott_USBIP_VirtPP_UAC2DeviceHandle,
+  struct FredEmmott_USBIP_VirtPP_UAC2Device_Stats*);
+
+#ifdef __cplusplus
+}// extern "C"
+#endif
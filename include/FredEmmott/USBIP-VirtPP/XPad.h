@@ -32,7 +32,13 @@ struct FredEmmott_USBIP_VirtPP_XPad_InitData {
   BOOL mAutoAttach;
 };
 
-enum FredEmmott_USBIP_VirtPP_XPad_Buttons : uint16_t {
+/* C only has fixed underlying types from C23; the values fit in an `int`
+ * either way. */
+enum FredEmmott_USBIP_VirtPP_XPad_Buttons
+#ifdef __cplusplus
+  : uint16_t
+#endif
+{
   FredEmmott_USBIP_VirtPP_XPad_Button_DPadUp = (1 << 0),
   FredEmmott_USBIP_VirtPP_XPad_Button_DPadDown = (1 << 1),
   FredEmmott_USBIP_VirtPP_XPad_Button_DPadLeft = (1 << 2),
@@ -61,11 +61,11 @@ static_assert(sizeof(bei32_t) == 4);
 using bei64_t = BigEndian<int64_t>;
 static_assert(sizeof(bei64_t) == 8);
 
-constexpr auto operator""_beu16(const uint64_t value) {
+constexpr auto operator""_beu16(const unsigned long long value) {
   return std::bit_cast<uint16_t>(BigEndian<uint16_t>(value));
 }
 
-constexpr auto operator""_beu32(const uint64_t value) {
+constexpr auto operator""_beu32(const unsigned long long value) {
   return std::bit_cast<uint32_t>(BigEndian<uint32_t>(value));
 }
 
@@ -211,9 +211,19 @@ struct USBIP_CMD_UNLINK {
 
 struct USBIP_RET_UNLINK {
   BasicHeader mHeader {CommandCode::USBIP_RET_UNLINK};
-  beu32_t mStatus {};
+  bei32_t mStatus {};
   const char mPadding[24] {};
 };
+
+// For isochronous transfers, CMD_SUBMIT and RET_SUBMIT are followed by one of
+// these per packet, after the transfer buffer
+struct USBIP_ISO_PACKET_DESCRIPTOR {
+  beu32_t mOffset {};
+  beu32_t mLength {};
+  beu32_t mActualLength {};
+  bei32_t mStatus {};
+};
+static_assert(sizeof(USBIP_ISO_PACKET_DESCRIPTOR) == 16);
 }// namespace FredEmmott::USBIP
 
 #pragma pack(pop)
\ No newline at end of file
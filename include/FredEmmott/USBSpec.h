@@ -5,5 +5,5 @@
 #ifdef _WIN32
 #include "USBSpec/win32.h"
 #else
-#error "To add support for Linux, use the definitions in usb/ch9.h. Alternatively, use the libusb struct definitions"
+#include "USBSpec/posix.h"
 #endif
\ No newline at end of file
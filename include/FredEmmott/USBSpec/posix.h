@@ -0,0 +1,101 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+/* The standard USB descriptors, with the same field names as `<Usb100.h>`,
+ * so the same code builds against either. */
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+// As in `<Windows.h>`, which provides this on Windows
+typedef int BOOL;
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#pragma pack(push, 1)
+
+typedef struct FredEmmott_USBSpec_ConfigurationDescriptor {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint16_t wTotalLength;
+  uint8_t bNumInterfaces;
+  uint8_t bConfigurationValue;
+  uint8_t iConfiguration;
+  uint8_t bmAttributes;
+  uint8_t MaxPower;
+} FredEmmott_USBSpec_ConfigurationDescriptor;
+#define FredEmmott_USBSpec_ConfigurationDescriptor_Size (9)
+
+typedef struct FredEmmott_USBSpec_DeviceDescriptor {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint16_t bcdUSB;
+  uint8_t bDeviceClass;
+  uint8_t bDeviceSubClass;
+  uint8_t bDeviceProtocol;
+  uint8_t bMaxPacketSize0;
+  uint16_t idVendor;
+  uint16_t idProduct;
+  uint16_t bcdDevice;
+  uint8_t iManufacturer;
+  uint8_t iProduct;
+  uint8_t iSerialNumber;
+  uint8_t bNumConfigurations;
+} FredEmmott_USBSpec_DeviceDescriptor;
+#define FredEmmott_USBSpec_DeviceDescriptor_Size (18)
+
+typedef struct FredEmmott_USBSpec_InterfaceDescriptor {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bInterfaceNumber;
+  uint8_t bAlternateSetting;
+  uint8_t bNumEndpoints;
+  uint8_t bInterfaceClass;
+  uint8_t bInterfaceSubClass;
+  uint8_t bInterfaceProtocol;
+  uint8_t iInterface;
+} FredEmmott_USBSpec_InterfaceDescriptor;
+#define FredEmmott_USBSpec_InterfaceDescriptor_Size (9)
+
+// Without the audio-only `bRefresh` and `bSynchAddress`, as on Windows
+typedef struct FredEmmott_USBSpec_EndpointDescriptor {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bEndpointAddress;
+  uint8_t bmAttributes;
+  uint16_t wMaxPacketSize;
+  uint8_t bInterval;
+} FredEmmott_USBSpec_EndpointDescriptor;
+#define FredEmmott_USBSpec_EndPointDescriptor_Size (7)
+
+// `bString` is UTF-16LE, and `bLength` bytes long with the header
+typedef struct FredEmmott_USBSpec_StringDescriptor {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint16_t bString[1];
+} FredEmmott_USBSpec_StringDescriptor;
+
+typedef struct FredEmmott_USBSpec_DeviceQualifierDescriptor {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint16_t bcdUSB;
+  uint8_t bDeviceClass;
+  uint8_t bDeviceSubClass;
+  uint8_t bDeviceProtocol;
+  uint8_t bMaxPacketSize0;
+  uint8_t bNumConfigurations;
+  uint8_t bReserved;
+} FredEmmott_USBSpec_DeviceQualifierDescriptor;
+#define FredEmmott_USBSpec_DeviceQualifierDescriptor_Size (10)
+
+#pragma pack(pop)
@@ -21,5 +21,7 @@ typedef USB_ENDPOINT_DESCRIPTOR FredEmmott_USBSpec_EndpointDescriptor;
  */
 #define FredEmmott_USBSpec_EndPointDescriptor_Size sizeof(USB_ENDPOINT_DESCRIPTOR)
 
+typedef USB_STRING_DESCRIPTOR FredEmmott_USBSpec_StringDescriptor;
+
 typedef USB_DEVICE_QUALIFIER_DESCRIPTOR FredEmmott_USBSpec_DeviceQualifierDescriptor;
 #define FredEmmott_USBSpec_DeviceQualifierDescriptor_Size sizeof(USB_DEVICE_QUALIFIER_DESCRIPTOR)
\ No newline at end of file
@@ -4,7 +4,11 @@
 
 #include "logging.hpp"
 
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include "posix-compat.hpp"
+#endif
 
 #include <FredEmmott/USBIP-VirtPP/Core.h>
 
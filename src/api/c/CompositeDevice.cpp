@@ -0,0 +1,468 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+#include "detail-CompositeDevice.hpp"
+#include "detail-RequestType.hpp"
+#include "detail.hpp"
+
+#include <FredEmmott/USBIP-VirtPP/CompositeDevice.h>
+#include <FredEmmott/USBIP-VirtPP/Device.h>
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <utility>
+
+using namespace FredEmmott::USBVirtPP;
+
+namespace {
+enum class StringIndex : uint8_t {
+  LangID = 0,
+  Manufacturer = 1,
+  Product = 2,
+};
+
+enum class DescriptorType : uint8_t {
+  Device = 0x01,
+  Configuration = 0x02,
+  String = 0x03,
+  Interface = 0x04,
+  Endpoint = 0x05,
+  InterfaceAssociation = 0x0B,
+};
+
+#pragma pack(push, 1)
+struct InterfaceAssociationDescriptor {
+  uint8_t bLength {sizeof(InterfaceAssociationDescriptor)};
+  uint8_t bDescriptorType {
+    std::to_underlying(DescriptorType::InterfaceAssociation)};
+  uint8_t bFirstInterface {};
+  uint8_t bInterfaceCount {};
+  uint8_t bFunctionClass {};
+  uint8_t bFunctionSubClass {};
+  uint8_t bFunctionProtocol {};
+  uint8_t iFunction {};
+};
+static_assert(sizeof(InterfaceAssociationDescriptor) == 8);
+#pragma pack(pop)
+
+// Endpoint 0 is the default control pipe
+constexpr uint8_t MaxEndpointNumber = 15;
+}// namespace
+
+FredEmmott_USBIP_VirtPP_CompositeDeviceHandle
+FredEmmott_USBIP_VirtPP_CompositeDevice_Create(
+  const FredEmmott_USBIP_VirtPP_InstanceHandle instance,
+  const FredEmmott_USBIP_VirtPP_CompositeDevice_InitData* initData) {
+  if (!instance) {
+    return nullptr;
+  }
+  if (!initData) {
+    instance->LogError("CompositeDevice_InitData is required");
+    return nullptr;
+  }
+  auto ret = std::make_unique<FredEmmott_USBIP_VirtPP_CompositeDevice>(
+    instance, *initData);
+  if (ret->mUSBDevice) {
+    return ret.release();
+  }
+  return nullptr;
+}
+
+void FredEmmott_USBIP_VirtPP_CompositeDevice_Destroy(
+  const FredEmmott_USBIP_VirtPP_CompositeDeviceHandle handle) {
+  delete handle;
+}
+
+void* FredEmmott_USBIP_VirtPP_CompositeDevice_GetUserData(
+  const FredEmmott_USBIP_VirtPP_CompositeDeviceHandle handle) {
+  return handle->mUserData;
+}
+
+FredEmmott_USBIP_VirtPP_DeviceHandle
+FredEmmott_USBIP_VirtPP_CompositeDevice_GetDevice(
+  const FredEmmott_USBIP_VirtPP_CompositeDeviceHandle handle) {
+  return handle->mUSBDevice;
+}
+
+FredEmmott_USBIP_VirtPP_CompositeDevice::
+  FredEmmott_USBIP_VirtPP_CompositeDevice(
+    FredEmmott_USBIP_VirtPP_InstanceHandle instance,
+    const FredEmmott_USBIP_VirtPP_CompositeDevice_InitData& initData)
+  : mUserData(initData.mUserData), mInstance(instance) {
+  if (initData.mFunctionCount == 0 || !initData.mFunctions) {
+    instance->LogError("Can't create a composite device without functions");
+    return;
+  }
+
+  mDeviceDescriptor = {
+    .bLength = FredEmmott_USBSpec_DeviceDescriptor_Size,
+    .bDescriptorType = std::to_underlying(DescriptorType::Device),
+    .bcdUSB = 0x02'00,
+    // Defined by interface association descriptors
+    .bDeviceClass = 0xEF,
+    .bDeviceSubClass = 0x02,
+    .bDeviceProtocol = 0x01,
+    .bMaxPacketSize0 = 0x40,
+    .idVendor = initData.mVendorID,
+    .idProduct = initData.mProductID,
+    .bcdDevice = initData.mDeviceVersion,
+    .iManufacturer = std::to_underlying(StringIndex::Manufacturer),
+    .iProduct = std::to_underlying(StringIndex::Product),
+    .bNumConfigurations = 1,
+  };
+
+  // Filled in once we know the totals
+  mConfigurationDescriptor.resize(
+    FredEmmott_USBSpec_ConfigurationDescriptor_Size);
+  for (auto&& function:
+       std::span {initData.mFunctions, initData.mFunctionCount}) {
+    if (!AddFunction(function)) {
+      instance->LogError(
+        "Invalid descriptors for composite device function {}",
+        mFunctions.size());
+      return;
+    }
+  }
+
+  const FredEmmott_USBSpec_ConfigurationDescriptor configuration {
+    .bLength = FredEmmott_USBSpec_ConfigurationDescriptor_Size,
+    .bDescriptorType = std::to_underlying(DescriptorType::Configuration),
+    .wTotalLength = static_cast<uint16_t>(mConfigurationDescriptor.size()),
+    .bNumInterfaces = static_cast<uint8_t>(mInterfaceFunctions.size()),
+    .bConfigurationValue = 1,
+    .bmAttributes = 0x80,// bus-powered
+    .MaxPower = 0xFA,// 500mA
+  };
+  std::memcpy(
+    mConfigurationDescriptor.data(),
+    &configuration,
+    FredEmmott_USBSpec_ConfigurationDescriptor_Size);
+
+  const FredEmmott_USBIP_VirtPP_Device_InitData usbDeviceInit {
+    .mUserData = this,
+    .mCallbacks = {&OnUSBInputRequestCallback, &OnUSBOutputRequestCallback},
+    .mAutoAttach = static_cast<bool>(initData.mAutoAttach),
+    .mDeviceDescriptor = &mDeviceDescriptor,
+    .mNumInterfaces = static_cast<uint8_t>(mInterfaces.size()),
+    .mInterfaceDescriptors = mInterfaces.data(),
+  };
+  mUSBDevice = FredEmmott_USBIP_VirtPP_Device_Create(instance, &usbDeviceInit);
+}
+
+FredEmmott_USBIP_VirtPP_CompositeDevice::
+  ~FredEmmott_USBIP_VirtPP_CompositeDevice() {
+  if (mUSBDevice) {
+    FredEmmott_USBIP_VirtPP_Device_Destroy(mUSBDevice);
+  }
+}
+
+bool FredEmmott_USBIP_VirtPP_CompositeDevice::AddFunction(
+  const FredEmmott_USBIP_VirtPP_CompositeDevice_Function& init) {
+  if (
+    !(init.mCallbacks.OnInputRequest && init.mCallbacks.OnOutputRequest
+      && init.mDescriptors)) {
+    return false;
+  }
+  if (mFunctions.size() > 0xff || mInterfaceFunctions.size() > 0xff) {
+    return false;
+  }
+  const auto functionIndex = static_cast<uint8_t>(mFunctions.size());
+  auto& function = mFunctions.emplace_back(Function {
+    .mUserData = init.mUserData,
+    .mCallbacks = init.mCallbacks,
+    .mFirstInterface = static_cast<uint8_t>(mInterfaceFunctions.size()),
+  });
+
+  std::vector<std::byte> descriptors(
+    static_cast<const std::byte*>(init.mDescriptors),
+    static_cast<const std::byte*>(init.mDescriptors)
+      + init.mDescriptorsLength);
+  std::size_t interfaceCount {};
+  bool hasAssociation = false;
+  // In `mInterfaces`
+  std::optional<std::size_t> firstInterface;
+
+  for (std::size_t offset = 0; offset < descriptors.size();) {
+    const auto remaining = descriptors.size() - offset;
+    const auto bytes = reinterpret_cast<uint8_t*>(descriptors.data() + offset);
+    const auto length = bytes[0];
+    if (remaining < 2 || length < 2 || length > remaining) {
+      return false;
+    }
+    switch (static_cast<DescriptorType>(bytes[1])) {
+      case DescriptorType::Interface: {
+        if (length < FredEmmott_USBSpec_InterfaceDescriptor_Size) {
+          return false;
+        }
+        FredEmmott_USBSpec_InterfaceDescriptor descriptor {};
+        std::memcpy(&descriptor, bytes, sizeof(descriptor));
+        const auto number = std::size_t {function.mFirstInterface}
+          + descriptor.bInterfaceNumber;
+        if (number > 0xff) {
+          return false;
+        }
+        interfaceCount = std::max<std::size_t>(
+          interfaceCount, descriptor.bInterfaceNumber + 1);
+        descriptor.bInterfaceNumber = static_cast<uint8_t>(number);
+        // Our string descriptors are the device's, not the function's
+        descriptor.iInterface = 0;
+        std::memcpy(bytes, &descriptor, sizeof(descriptor));
+        if (descriptor.bAlternateSetting == 0) {
+          if (!firstInterface) {
+            firstInterface = mInterfaces.size();
+          }
+          mInterfaces.push_back(descriptor);
+        }
+        break;
+      }
+      case DescriptorType::Endpoint: {
+        if (length < 7) {
+          return false;
+        }
+        auto& address = bytes[2];
+        const auto functionEndpoint = address & 0x0f;
+        if (functionEndpoint == 0) {
+          return false;
+        }
+        auto& endpoint = function.mEndpoints.at(functionEndpoint);
+        if (!endpoint) {
+          const auto it = std::ranges::find_if(
+            mEndpointRoutes.begin() + 1,
+            mEndpointRoutes.end(),
+            [](const auto& route) { return !route.has_value(); });
+          if (it == mEndpointRoutes.end()) {
+            // Out of endpoint numbers
+            return false;
+          }
+          endpoint = static_cast<uint8_t>(it - mEndpointRoutes.begin());
+          *it = EndpointRoute {
+            .mFunction = functionIndex,
+            .mFunctionEndpoint = static_cast<uint8_t>(functionEndpoint),
+          };
+        }
+        address = static_cast<uint8_t>((address & 0x80) | endpoint);
+        break;
+      }
+      case DescriptorType::InterfaceAssociation: {
+        if (length < sizeof(InterfaceAssociationDescriptor)) {
+          return false;
+        }
+        hasAssociation = true;
+        bytes[2] += function.mFirstInterface;
+        break;
+      }
+      default:
+        break;
+    }
+    offset += length;
+  }
+
+  if (interfaceCount == 0 || !firstInterface) {
+    return false;
+  }
+  mInterfaceFunctions.resize(
+    mInterfaceFunctions.size() + interfaceCount, functionIndex);
+
+  if (interfaceCount > 1 && !hasAssociation) {
+    const auto& first = mInterfaces.at(*firstInterface);
+    const InterfaceAssociationDescriptor association {
+      .bFirstInterface = function.mFirstInterface,
+      .bInterfaceCount = static_cast<uint8_t>(interfaceCount),
+      .bFunctionClass = first.bInterfaceClass,
+      .bFunctionSubClass = first.bInterfaceSubClass,
+      .bFunctionProtocol = first.bInterfaceProtocol,
+    };
+    const auto bytes = std::as_bytes(std::span {&association, 1});
+    mConfigurationDescriptor.insert(
+      mConfigurationDescriptor.end(), bytes.begin(), bytes.end());
+  }
+  mConfigurationDescriptor.insert(
+    mConfigurationDescriptor.end(), descriptors.begin(), descriptors.end());
+  return mConfigurationDescriptor.size() <= 0xffff;
+}
+
+const FredEmmott_USBIP_VirtPP_CompositeDevice::Function*
+FredEmmott_USBIP_VirtPP_CompositeDevice::Route(
+  uint32_t& endpoint,
+  const uint8_t rawRequestType,
+  uint16_t& index) const {
+  if (endpoint != 0) {
+    const auto& route = mEndpointRoutes.at(endpoint & MaxEndpointNumber);
+    if (!route) {
+      return nullptr;
+    }
+    endpoint = route->mFunctionEndpoint;
+    return &mFunctions.at(route->mFunction);
+  }
+
+  const auto [direction, requestType, recipient]
+    = RequestType::Parse(rawRequestType);
+  switch (recipient) {
+    case RequestType::Recipient::Interface: {
+      const auto interfaceNumber = index & 0xff;
+      if (interfaceNumber >= mInterfaceFunctions.size()) {
+        return nullptr;
+      }
+      const auto& function
+        = mFunctions.at(mInterfaceFunctions.at(interfaceNumber));
+      index = static_cast<uint16_t>(
+        (index & 0xff00) | (interfaceNumber - function.mFirstInterface));
+      return &function;
+    }
+    case RequestType::Recipient::Endpoint: {
+      const auto& route = mEndpointRoutes.at(index & MaxEndpointNumber);
+      if (!route) {
+        return nullptr;
+      }
+      index = static_cast<uint16_t>(
+        (index & 0xff80) | route->mFunctionEndpoint);
+      return &mFunctions.at(route->mFunction);
+    }
+    default:
+      return nullptr;
+  }
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_CompositeDevice::OnDeviceInputRequest(
+  FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint8_t rawRequestType,
+  uint8_t requestCode,
+  uint16_t value) {
+  const auto [direction, requestType, recipient]
+    = RequestType::Parse(rawRequestType);
+  if (
+    requestType != RequestType::Type::Standard
+    || recipient != RequestType::Recipient::Device) {
+    return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+
+  switch (requestCode) {
+    case 0x00:// GET_STATUS
+      return FredEmmott_USBIP_VirtPP_Request_SendReply(request, uint16_t {});
+    case 0x06: /* GET_DESCRIPTOR */ {
+      const auto descriptorType = static_cast<DescriptorType>(value >> 8);
+      const auto descriptorIndex = static_cast<uint8_t>(value & 0xff);
+      switch (descriptorType) {
+        case DescriptorType::Device:
+          return FredEmmott_USBIP_VirtPP_Request_SendReply(
+            request, mDeviceDescriptor);
+        case DescriptorType::Configuration:
+          return FredEmmott_USBIP_VirtPP_Request_SendReply(
+            request,
+            mConfigurationDescriptor.data(),
+            mConfigurationDescriptor.size());
+        case DescriptorType::String:
+          switch (static_cast<StringIndex>(descriptorIndex)) {
+            case StringIndex::LangID:
+              return FredEmmott_USBIP_VirtPP_Request_SendStringReply(
+                request, L"\x0409");// en_US
+            case StringIndex::Manufacturer:
+              return FredEmmott_USBIP_VirtPP_Request_SendStringReply(
+                request, L"Fred Emmott");
+            case StringIndex::Product:
+              return FredEmmott_USBIP_VirtPP_Request_SendStringReply(
+                request, L"USBIP-VirtPP Composite Device");
+          }
+          // e.g. MS OS descriptors
+          return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
+            request, -EPIPE);
+        default:
+          // DEVICE_QUALIFIER, BOS, etc
+          return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
+            request, -EPIPE);
+      }
+    }
+    case 0x08:// GET_CONFIGURATION
+      return FredEmmott_USBIP_VirtPP_Request_SendReply(request, uint8_t {1});
+    default:
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_CompositeDevice::OnDeviceOutputRequest(
+  FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint8_t rawRequestType,
+  uint8_t requestCode) {
+  const auto [direction, requestType, recipient]
+    = RequestType::Parse(rawRequestType);
+  if (
+    requestType != RequestType::Type::Standard
+    || recipient != RequestType::Recipient::Device) {
+    return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+
+  switch (requestCode) {
+    case 0x01:// CLEAR_FEATURE: no-op
+    case 0x03:// SET_FEATURE: no-op
+    case 0x09:// SET_CONFIGURATION no-op, we only support 1 configuration
+      // Not actually an error with code 0
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, 0);
+    default:
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_CompositeDevice::OnUSBInputRequestCallback(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint32_t endpoint,
+  const uint8_t requestType,
+  const uint8_t requestCode,
+  const uint16_t value,
+  uint16_t index,
+  const uint16_t length) {
+  auto& self = *static_cast<FredEmmott_USBIP_VirtPP_CompositeDevice*>(
+    FredEmmott_USBIP_VirtPP_Request_GetDeviceUserData(request));
+  const auto function = self.Route(endpoint, requestType, index);
+  if (!function) {
+    if (endpoint != 0) {
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+    }
+    return self.OnDeviceInputRequest(request, requestType, requestCode, value);
+  }
+
+  // Callbacks are passed the request itself, not a pooled clone handle, so
+  // we can copy it
+  auto functionRequest = *request;
+  functionRequest.mDeviceUserData = function->mUserData;
+  return function->mCallbacks.OnInputRequest(
+    &functionRequest, endpoint, requestType, requestCode, value, index, length);
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_CompositeDevice::OnUSBOutputRequestCallback(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint32_t endpoint,
+  const uint8_t requestType,
+  const uint8_t requestCode,
+  const uint16_t value,
+  uint16_t index,
+  const uint16_t length,
+  const void* data,
+  const uint32_t dataLength) {
+  auto& self = *static_cast<FredEmmott_USBIP_VirtPP_CompositeDevice*>(
+    FredEmmott_USBIP_VirtPP_Request_GetDeviceUserData(request));
+  const auto function = self.Route(endpoint, requestType, index);
+  if (!function) {
+    if (endpoint != 0) {
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+    }
+    return self.OnDeviceOutputRequest(request, requestType, requestCode);
+  }
+
+  auto functionRequest = *request;
+  functionRequest.mDeviceUserData = function->mUserData;
+  return function->mCallbacks.OnOutputRequest(
+    &functionRequest,
+    endpoint,
+    requestType,
+    requestCode,
+    value,
+    index,
+    length,
+    data,
+    dataLength);
+}
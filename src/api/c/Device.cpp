@@ -2,15 +2,12 @@
 // SPDX-License-Identifier: MIT
 
 #include "detail.hpp"
-#include "send-recv.hpp"
-#include "win32-attach.hpp"
 
 #include <FredEmmott/USBIP-VirtPP/Core.h>
 
-#include <print>
-#include <ranges>
+#include <span>
+#include <vector>
 
-namespace USBIP = FredEmmott::USBIP;
 using namespace FredEmmott::USBVirtPP;
 
 FredEmmott_USBIP_VirtPP_InstanceHandle
@@ -63,11 +60,27 @@ FredEmmott_USBIP_VirtPP_Device::FredEmmott_USBIP_VirtPP_Device(
   for (auto i = 0; i < initData->mNumInterfaces; ++i) {
     mInterfaces.emplace_back(initData->mInterfaceDescriptors[i]);
   }
+  // Endpoint 0 is the control pipe
+  mSupersededInputEndpoints = initData->mSupersededInputEndpoints & ~1u;
   mUserData = initData->mUserData;
-  if (instance->mBusses.empty()) {
-    instance->mBusses.emplace_back();
+  mDeviceID = instance->mDevices.Add(this);
+  if (!mDeviceID) {
+    instance->LogError("Can't create device: the device table is full");
+    mInstance = nullptr;
+    return;
+  }
+}
+
+FredEmmott_USBIP_VirtPP_Device::~FredEmmott_USBIP_VirtPP_Device() {
+  if (!(mInstance && mDeviceID)) {
+    return;
   }
-  instance->mBusses.back().emplace_back(this);
+  // Waits for the `Run()` thread to stop using this device. The ID stays
+  // reserved until `ServiceRemovedDevices()` has cleaned up after it;
+  // otherwise, a new device could be given it first, and have its imports
+  // and URBs torn down instead.
+  mInstance->mDevices.Remove(mDeviceID);
+  mInstance->OnDeviceRemoved(mDeviceID, mStats);
 }
 
 FredEmmott_USBIP_VirtPP_DeviceHandle FredEmmott_USBIP_VirtPP_Device_Create(
@@ -91,34 +104,41 @@ FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Device_Attach(
   return handle->Attach();
 }
 
-FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Device::Attach(
-  std::string_view busID) const {
-  std::string generatedBusID;
-  if (busID.empty()) {
-    // Need parent-scoped storage
-    const auto generated = GetBusID();
-    if (!generated) {
-      return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
-    }
-    busID = std::move(generated).value();
-  }
-  const auto usbPort = USBIP::Win2Client::Attach(
-    mInstance->GetPortNumber(), busID.data(), busID.size());
-  if (usbPort) {
-    mInstance->Log(
-      "+ Attached device {} to local server, on USB port {}", busID, *usbPort);
+FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Device_AttachAll(
+  const FredEmmott_USBIP_VirtPP_DeviceHandle* devices,
+  const size_t count,
+  FredEmmott_USBIP_VirtPP_Result* results) {
+  if (count == 0) {
     return FredEmmott_USBIP_VirtPP_SUCCESS;
   }
-  return usbPort.error().hr;
-}
+  const auto instance = devices[0]->mInstance;
+  std::vector<uint32_t> deviceIDs;
+  deviceIDs.reserve(count);
+  for (auto&& device: std::span {devices, count}) {
+    if (device->mInstance != instance) {
+      instance->LogError("Can't attach devices from different instances");
+      return E_INVALIDARG;
+    }
+    deviceIDs.push_back(device->mDeviceID);
+  }
 
-std::optional<std::string> FredEmmott_USBIP_VirtPP_Device::GetBusID() const {
-  for (auto&& [i, bus]: std::views::enumerate(mInstance->mBusses)) {
-    for (auto&& [j, device]: std::views::enumerate(bus)) {
-      if (device == this) {
-        return std::format("{}-{}", i + 1, j + 1);
-      }
+  instance->Attach(deviceIDs, std::span {results, count});
+  for (auto&& result: std::span {results, count}) {
+    if (!FredEmmott_USBIP_VirtPP_SUCCEEDED(result)) {
+      return result;
     }
   }
-  return std::nullopt;
-}
\ No newline at end of file
+  return FredEmmott_USBIP_VirtPP_SUCCESS;
+}
+
+void FredEmmott_USBIP_VirtPP_Device_GetStats(
+  const FredEmmott_USBIP_VirtPP_DeviceHandle handle,
+  FredEmmott_USBIP_VirtPP_Device_Stats* const stats) {
+  handle->mStats->Get(*stats);
+}
+
+FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Device::Attach() const {
+  FredEmmott_USBIP_VirtPP_Result ret {};
+  mInstance->Attach({&mDeviceID, 1}, {&ret, 1});
+  return ret;
+}
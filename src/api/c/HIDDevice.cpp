@@ -12,7 +12,6 @@
 #include <FredEmmott/USBSpec.h>
 
 #include <algorithm>
-#include <print>
 #include <vector>
 
 namespace {
@@ -63,6 +62,9 @@ FredEmmott_USBIP_VirtPP_HIDDevice::FredEmmott_USBIP_VirtPP_HIDDevice(
     .mDeviceDescriptor = &mDeviceDescriptor,
     .mNumInterfaces = 1,
     .mInterfaceDescriptors = mInterfaceDescriptors,
+    // Reports are built from the current state when they're sent, so a
+    // later one carries everything a dropped one would have
+    .mSupersededInputEndpoints = 1 << 1,
   };
 
   mUSBDevice = FredEmmott_USBIP_VirtPP_Device_Create(instance, &usbDeviceInit);
@@ -101,14 +103,12 @@ void FredEmmott_USBIP_VirtPP_HIDDevice::InitializeDeviceDescriptor() {
 }
 
 void FredEmmott_USBIP_VirtPP_HIDDevice::MarkDirty() {
-  auto queue = mInputQueue.lock();
-  if (queue->empty()) {
+  const auto pending = PopPendingInputRequest();
+  if (!pending) {
     return;
   }
 
-  const auto [request, length] = std::move(queue->front());
-  queue->pop();
-  queue.unlock();
+  const auto& [request, length] = *pending;
 
   const auto result
     = mInit.mCallbacks.OnGetInputReport(request.get(), 0, length);
@@ -120,6 +120,17 @@ void FredEmmott_USBIP_VirtPP_HIDDevice::MarkDirty() {
     "[HIDDevice] Failed to call OnGetInputReport callback: {}", result);
 }
 
+std::optional<FredEmmott_USBIP_VirtPP_HIDDevice::PendingInputRequest>
+FredEmmott_USBIP_VirtPP_HIDDevice::PopPendingInputRequest() {
+  auto pending = mInputQueue.TryPop();
+  while (pending
+         && !FredEmmott_USBIP_VirtPP_Request_IsPending(
+           pending->mHandle.get())) {
+    pending = mInputQueue.TryPop();
+  }
+  return pending;
+}
+
 // Builds descriptors inside wrapper
 void FredEmmott_USBIP_VirtPP_HIDDevice::InitializeDescriptors() {
   InitializeDeviceDescriptor();
@@ -241,11 +252,11 @@ FredEmmott_USBIP_VirtPP_HIDDevice::OnUSBInputRequest(
       const auto descriptorIndex = static_cast<uint8_t>(value & 0xff);
       switch (descriptorType) {
         case 0x01:// DEVICE
-          std::println(stdout, "-> DEVICE descriptor ({})", length);
+          mInstance->LogDebug("-> DEVICE descriptor ({})", length);
           return FredEmmott_USBIP_VirtPP_Request_SendReply(
             request, mDeviceDescriptor);
         case 0x02: {
-          std::println(stdout, "-> CONFIGURATION descriptor ({})", length);
+          mInstance->LogDebug("-> CONFIGURATION descriptor ({})", length);
           // CONFIGURATION
           return FredEmmott_USBIP_VirtPP_Request_SendReply(
             request,
@@ -253,8 +264,7 @@ FredEmmott_USBIP_VirtPP_HIDDevice::OnUSBInputRequest(
             mConfigurationDescriptorBlob.size());
         }
         case 0x03: {
-          std::println(
-            stdout,
+          mInstance->LogDebug(
             "-> STRING descriptor ({} bytes, id {})",
             length,
             descriptorIndex);
@@ -263,7 +273,7 @@ FredEmmott_USBIP_VirtPP_HIDDevice::OnUSBInputRequest(
           const auto sendString
             = [request]<std::size_t N>(const wchar_t(&buf)[N]) {
                 return FredEmmott_USBIP_VirtPP_Request_SendStringReply(
-                  request, buf, wcsnlen_s(buf, N));
+                  request, buf, std::ranges::find(buf, L'\0') - buf);
               };
           switch (static_cast<StringIndex>(descriptorIndex)) {
             case LangID:// LangID list
@@ -285,7 +295,7 @@ FredEmmott_USBIP_VirtPP_HIDDevice::OnUSBInputRequest(
         }
         case 0x22: {
           // HID descriptor
-          std::println(stdout, "-> HID report descriptor ({})", length);
+          mInstance->LogDebug("-> HID report descriptor ({})", length);
           // Report descriptor
           const auto [data, size] = mHIDReportDescriptors.at(descriptorIndex);
           return FredEmmott_USBIP_VirtPP_Request_SendReply(request, data, size);
@@ -310,8 +320,26 @@ FredEmmott_USBIP_VirtPP_HIDDevice::OnUSBInputRequest(
   // Interrupt IN endpoint (EP1 IN)
   if (endpoint == 1) {
     if (mInit.mCallbacks.OnGetInputReport) {
-      mInputQueue.lock()->emplace(
-        FredEmmott_USBIP_VirtPP_Request_Clone(request), length);
+      PendingInputRequest pending {
+        FredEmmott_USBIP_VirtPP_Request_Clone(request), length};
+      if (mInputQueue.TryPush(std::move(pending))) [[likely]] {
+        return FredEmmott_USBIP_VirtPP_SUCCESS;
+      }
+      // Hosts that cancel and resubmit, e.g. on suspend, leave unlinked
+      // requests behind until the next report; they're the oldest, so this
+      // drops them. If the oldest is still wanted, the host has more in
+      // flight than we allow for, so fail that one instead of this one.
+      if (const auto oldest = PopPendingInputRequest()) {
+        mInstance->LogError("[HIDDevice] Too many pending input requests");
+        std::ignore = FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
+          oldest->mHandle.get(), -EPIPE);
+      }
+      // This can still fail: a feeder thread's pop may have claimed a slot
+      // without releasing it yet. The host resubmits failed requests.
+      if (!mInputQueue.TryPush(std::move(pending))) [[unlikely]] {
+        return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
+          pending.mHandle.get(), -EPIPE);
+      }
       return FredEmmott_USBIP_VirtPP_SUCCESS;
     }
     __debugbreak();
@@ -434,15 +462,18 @@ void* FredEmmott_USBIP_VirtPP_HIDDevice_GetInstanceUserData(
 FredEmmott_USBIP_VirtPP_HIDDeviceHandle
 FredEmmott_USBIP_VirtPP_Request_GetHIDDevice(
   const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
+  const auto request = FredEmmott::USBVirtPP::GetRequest(handle);
+  if (!request) [[unlikely]] {
+    return nullptr;
+  }
   return static_cast<FredEmmott_USBIP_VirtPP_HIDDevice*>(
-    handle->mDevice->mUserData);
+    request->mDevice->mUserData);
 }
 
 void* FredEmmott_USBIP_VirtPP_Request_GetHIDDeviceUserData(
   const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
-  return static_cast<FredEmmott_USBIP_VirtPP_HIDDevice*>(
-           handle->mDevice->mUserData)
-    ->mInit.mUserData;
+  const auto device = FredEmmott_USBIP_VirtPP_Request_GetHIDDevice(handle);
+  return device ? device->mInit.mUserData : nullptr;
 }
 
 void FredEmmott_USBIP_VirtPP_HIDDevice_MarkDirty(
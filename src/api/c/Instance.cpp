@@ -3,45 +3,68 @@
 
 #include "detail-RequestType.hpp"
 #include "detail.hpp"
+#include "pdu-parser.hpp"
+#include "scope-exit.hpp"
 #include "send-recv.hpp"
 
 #include <FredEmmott/USBIP-VirtPP/Core.h>
 #include <FredEmmott/USBIP.hpp>
 
 #include <algorithm>
+#include <array>
+#include <fstream>
 #include <future>
-#include <print>
 #include <ranges>
+#include <span>
 
+#ifdef _WIN32
+#include <timeapi.h>
 #include <ws2tcpip.h>
 
+#pragma comment(lib, "winmm.lib")
 #pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
 
 namespace USBIP = FredEmmott::USBIP;
 using namespace FredEmmott::USBVirtPP;
 
 namespace {
-auto MakeUSBIPDevice(
-  uint32_t busId,
-  uint32_t deviceId,
-  const FredEmmott_USBSpec_DeviceDescriptor& deviceDescriptor,
-  const uint8_t numInterfaces) {
-  USBIP::Device ret {
-    .mBusNum = busId,
-    .mDevNum = deviceId,
-    .mSpeed = USBIP::Speed::Full,
-    .mVendorID = deviceDescriptor.idVendor,
-    .mProductID = deviceDescriptor.idProduct,
-    .mDeviceVersion = deviceDescriptor.bcdDevice,
-    .mDeviceClass = deviceDescriptor.bDeviceClass,
-    .mDeviceSubClass = deviceDescriptor.bDeviceSubClass,
-    .mDeviceProtocol = deviceDescriptor.bDeviceProtocol,
-    .mNumConfigurations = deviceDescriptor.bNumConfigurations,
-    .mNumInterfaces = numInterfaces};
-  std::format_to(
-    ret.mPath, "/github.com/fredemmott/USBIP-VirtPP/{}/{}", busId, deviceId);
-  std::format_to(ret.mBusID, "{}-{}", busId, deviceId);
-  return ret;
+// Maximum PDUs handled per connection before moving on to the next one
+constexpr std::size_t PDUBudgetPerRound = 16;
+// Used if `InitData::mMaxQueuedBytesPerConnection` is zero
+constexpr std::size_t DefaultMaxQueuedBytesPerConnection = 256 * 1024;
+// Linux's value; `<errno.h>` on Windows has a different one
+constexpr int32_t LinuxECONNRESET = 104;
+constexpr int32_t LinuxENODEV = 19;
+constexpr int32_t LinuxESHUTDOWN = 108;
+// Streaming replies are pulled from the producer this much at a time...
+constexpr std::size_t StreamChunkSize = 64 * 1024;
+// ... and this many chunks per connection before moving on to the next one
+constexpr std::size_t StreamChunksPerRound = 16;
+
+[[nodiscard]] Capture::URB GetCaptureURB(
+  const Connection& connection,
+  const uint32_t sequenceNumber,
+  const PendingURB& urb) {
+  return {
+    .mID = Tracer::GetURBID(connection.mID, sequenceNumber),
+    .mDeviceID = urb.mDeviceID,
+    .mEndpointAddress = urb.mEndpointAddress,
+    .mIsochronous = urb.mIsochronous,
+  };
+}
+
+// IN data in a deferred isochronous reply; for OUT, only the packet
+// descriptors follow the RET_SUBMIT
+std::size_t GetIsoInBytes(Reply& reply) {
+  const auto& header = PDUAs<USBIP::USBIP_RET_SUBMIT>(reply.GetData());
+  return reply.mSize - sizeof(header)
+    - (header.mNumberOfPackets.NativeValue()
+       * sizeof(USBIP::USBIP_ISO_PACKET_DESCRIPTOR));
 }
 }// namespace
 
@@ -56,27 +79,75 @@ FredEmmott_USBIP_VirtPP_Instance_Create(
 }
 
 FredEmmott_USBIP_VirtPP_Instance::~FredEmmott_USBIP_VirtPP_Instance() {
+#ifdef _WIN32
+  if (mRaisedTimerResolution.load(std::memory_order_relaxed)) {
+    timeEndPeriod(1);
+  }
   if (mNeedWSACleanup)
     WSACleanup();
+#endif
 }
 
 FredEmmott_USBIP_VirtPP_Instance::FredEmmott_USBIP_VirtPP_Instance(
   const FredEmmott_USBIP_VirtPP_Instance_InitData* initData)
-  : mInitData(*initData) {
+  : mInitData(*initData),
+    mLogger(initData->mCallbacks.OnLogMessage, initData->mMinLogSeverity),
+    mTracer(initData->mEnableTracing) {
+  if (initData->mCapturePath) {
+    mCapture = Capture::Create(mLogger, initData->mCapturePath);
+  }
+  if (initData->mRecordPath) {
+    mRecorder = SessionRecorder::Create(mLogger, initData->mRecordPath);
+  }
+  switch (initData->mBackpressurePolicy) {
+    case FredEmmott_USBIP_VirtPP_BackpressurePolicy_Block:
+    case FredEmmott_USBIP_VirtPP_BackpressurePolicy_DropSupersededInputReports:
+    case FredEmmott_USBIP_VirtPP_BackpressurePolicy_Disconnect:
+      break;
+    default:
+      LogError(
+        "Invalid backpressure policy: {}", initData->mBackpressurePolicy);
+      return;
+  }
+  mMaxQueuedBytesPerConnection = initData->mMaxQueuedBytesPerConnection
+    ? initData->mMaxQueuedBytesPerConnection
+    : DefaultMaxQueuedBytesPerConnection;
+
+#ifdef _WIN32
   WSADATA wsaData {};
   if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
     LogError("WSAStartup failed: {}", WSAGetLastError());
     return;
   }
   mNeedWSACleanup = true;
+#endif
+
+  auto eventLoop = CreateEventLoop();
+  if (!eventLoop) {
+    LogError("Failed to create event loop: {}", eventLoop.error());
+    return;
+  }
+  mEventLoop = std::move(eventLoop).value();
+  mAttachBackend = CreateAttachBackend(initData->mVHCISysfsPath);
 
-  wil::unique_socket listeningSocket {
+  unique_socket listeningSocket {
     socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)};
   if (!listeningSocket) {
     LogError(
       "Creating listening socket failed with error: {}", WSAGetLastError());
     return;
   }
+#ifndef _WIN32
+  // Otherwise, restarting on a fixed port fails until TIME_WAIT expires; on
+  // Windows, this would allow another process to take over the port
+  const int reuseAddress = 1;
+  setsockopt(
+    listeningSocket.get(),
+    SOL_SOCKET,
+    SO_REUSEADDR,
+    &reuseAddress,
+    sizeof(reuseAddress));
+#endif
 
   sockaddr_in server_addr {
     .sin_family = AF_INET,
@@ -138,169 +209,309 @@ void FredEmmott_USBIP_VirtPP_Instance_Run(
 void FredEmmott_USBIP_VirtPP_Instance::Run() {
   const auto future = std::async(
     std::launch::async, &FredEmmott_USBIP_VirtPP_Instance::AutoAttach, this);
-  const wil::unique_event stopEvent {
-    CreateEventW(nullptr, TRUE, FALSE, nullptr)};
   const std::stop_callback stopCallback(
-    mStopSource.get_token(), std::bind_front(&SetEvent, stopEvent.get()));
-
-  const wil::unique_event listenEvent {WSACreateEvent()};
-  WSAEventSelect(mListeningSocket.get(), listenEvent.get(), FD_ACCEPT);
+    mStopSource.get_token(), [this] { mEventLoop->Wake(); });
+  mLoopThread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+  mTracer.SetThreadName("Instance::Run()");
 
-  std::vector events {stopEvent.get(), listenEvent.get()};
+  // The listening socket is the only registration that isn't a Connection
+  if (const auto hr
+      = mEventLoop->Add(mListeningSocket.get(), &mListeningSocket);
+      FAILED(hr)) {
+    LogError("Failed to watch listening socket: {}", hr);
+    return;
+  }
+  const auto unwatchListeningSocket = scope_exit([this] {
+    mEventLoop->Remove(mListeningSocket.get(), &mListeningSocket);
+  });
 
-  std::vector<wil::unique_socket> clientSockets;
-  std::vector<wil::unique_event> clientEvents;
+  std::array<EventLoop::Event, 64> events {};
   Log("Listening for USB/IP connections on port {}", this->GetPortNumber());
   while (!mStopSource.stop_requested()) {
-    const auto wait
-      = WaitForMultipleObjects(events.size(), events.data(), FALSE, INFINITE);
-    const auto waitIdx = wait - WAIT_OBJECT_0;
-    if (waitIdx < 0 || waitIdx >= events.size()) {
+    const auto ready = mEventLoop->Wait(events, GetWaitTimeout());
+    if (!ready) [[unlikely]] {
+      LogError("Waiting for socket events failed: {}", ready.error());
       __debugbreak();
       break;
     }
+    // Devices can't be freed while we're using them; don't hold this while
+    // we're waiting, or unplugging would wait for us
+    const auto pin = mDevices.Pin();
 
-    ResetEvent(events.at(waitIdx));
-
-    switch (waitIdx) {
-      // stopEvent
-      case 0:
-        Log("Server stop requested, stopping");
-        return;
-      // listenEvent
-      case 1: {
-        // New connection
-        wil::unique_socket clientSocket {
-          accept(mListeningSocket.get(), nullptr, nullptr)};
-        if (!clientSocket) {
-          LogError("accept failed with error: {}", WSAGetLastError());
-          __debugbreak();
-          continue;
-        }
-        Log("USB/IP connection established");
-
-        wil::unique_event clientEvent {WSACreateEvent()};
-        WSAEventSelect(
-          clientSocket.get(), clientEvent.get(), FD_READ | FD_CLOSE);
-        events.push_back(clientEvent.get());
-        clientSockets.push_back(std::move(clientSocket));
-        clientEvents.push_back(std::move(clientEvent));
+    for (auto&& event: std::span {events}.first(*ready)) {
+      if (event.mKey == &mListeningSocket) {
+        AcceptConnections();
         continue;
       }
-      default: {
-        const auto socketIdx = waitIdx - 2;
-        const auto clientSocket = clientSockets.at(socketIdx).get();
-        WSANETWORKEVENTS socketEvents {};
-        if (const auto ret = WSAEnumNetworkEvents(
-              clientSocket, events.at(waitIdx), &socketEvents);
-            ret != 0) {
-          __debugbreak();
-        }
-        switch (socketEvents.lNetworkEvents) {
-          case 0:
-            // kernel race condition; even though we've just been told there's a
-            // read or a close on this socket, nope, there's not
-            continue;
-          case FD_CLOSE:
-            events.erase(events.begin() + waitIdx);
-            clientSockets.erase(clientSockets.begin() + socketIdx);
-            clientEvents.erase(clientEvents.begin() + socketIdx);
-            Log("Client disconnected");
-            continue;
-          case FD_READ:
-            break;
-          default:
-            __debugbreak();
-        }
 
-        if (const auto hr = this->OnClientSocketActive(clientSocket);
-            !SUCCEEDED(hr)) {
-          if (hr == HRESULT_FROM_WIN32(WSAECONNRESET)) {
-            Log("Client disconnected");
-            continue;
-          }
-          LogError("Failed to handle client socket: {}", hr);
-          __debugbreak();
-        }
+      auto& connection = *static_cast<Connection*>(event.mKey);
+      if (event.mClosed) {
+        Log("Client disconnected");
+        CloseConnection(connection);
         continue;
       }
+      if (event.mWritable) {
+        // The EventLoop can take more of what it couldn't take before
+        WriteReplies(connection, nullptr);
+      }
+      if (
+        event.mReadable && !connection.mInBacklog
+        && !connection.mClosed.load(std::memory_order_relaxed)) {
+        connection.mInBacklog = true;
+        mBacklog.push_back(&connection);
+      }
+    }
+    ServiceRemovedDevices();
+    ServiceConnections();
+    ServiceWriteBacklog();
+    SendDueReplies();
+    // Start every reply produced by this iteration
+    FlushReplies();
+    mClosedConnections.clear();
+  }
+
+  for (auto&& [key, connection]: mConnections) {
+    mEventLoop->Remove(connection->mSocket.get(), key);
+  }
+  for (auto&& [key, connection]: mConnections) {
+    if (mRecorder) {
+      mRecorder->OnClosed(connection->mID);
     }
+    connection->mClosed.store(true, std::memory_order_release);
+    // Wake up any producers waiting for queue space
+    connection->mQueuedBytes.store(0, std::memory_order_release);
+    connection->mQueuedBytes.notify_all();
   }
+  // Release the scheduled connections, and discard their replies
+  mIsoScheduler.Clear();
+  FlushReplies();
+  mConnections.clear();
+  mClosedConnections.clear();
+  mOpenConnections.lock()->clear();
+  mBacklog.clear();
+  mWriteBacklog.clear();
+  Log("Server stop requested, stopping");
 }
 
-HRESULT FredEmmott_USBIP_VirtPP_Instance::OnClientSocketActive(
-  const SOCKET clientSocket) {
-  if (mClientSocket != INVALID_SOCKET) {
-    LogError("Multiple clients active at the same time");
-    return HRESULT_FROM_WIN32(ERROR_INVALID_STATE);
+std::optional<std::chrono::milliseconds>
+FredEmmott_USBIP_VirtPP_Instance::GetWaitTimeout() {
+  // If a connection used up its budget last round, there's still work to do,
+  // so just check for new events
+  if (!(mBacklog.empty() && mWriteBacklog.empty())) {
+    return std::chrono::milliseconds::zero();
   }
-  if (clientSocket == INVALID_SOCKET || !clientSocket) {
-    LogError("Invalid client socket");
-    return HRESULT_FROM_WIN32(ERROR_BAD_ARGUMENTS);
+  const auto due = mIsoScheduler.GetNextDue();
+  if (!due) {
+    return std::nullopt;
   }
+  // Round up, so we don't wake up just before it's due
+  return std::max(
+    std::chrono::milliseconds::zero(),
+    std::chrono::ceil<std::chrono::milliseconds>(
+      *due - IsoScheduler::Clock::now()));
+}
 
-  mClientSocket = clientSocket;
-  const auto forgetSocketAtExit
-    = wil::scope_exit([this] { mClientSocket = INVALID_SOCKET; });
+void FredEmmott_USBIP_VirtPP_Instance::AcceptConnections() {
+  // Edge-triggered, so accept everything that's queued up
+  while (true) {
+    unique_socket clientSocket {
+      accept(mListeningSocket.get(), nullptr, nullptr)};
+    if (!clientSocket) {
+      if (const auto err = WSAGetLastError(); err != WSAEWOULDBLOCK) {
+        LogError("accept failed with error: {}", err);
+      }
+      return;
+    }
 
-  union {
-    USBIP::CommandCode mCommandCode {};
-    USBIP::OP_REQ_DEVLIST mOP_REQ_DEVLIST;
-    USBIP::OP_REQ_IMPORT mOP_REQ_IMPORT;
-    USBIP::USBIP_CMD_SUBMIT mUSBIP_CMD_SUBMIT;
-    USBIP::USBIP_CMD_UNLINK mUSBIP_CMD_UNLINK;
-  } request;
+    // Replies are small and paced - an isochronous reply may be due while
+    // the previous one is still unacknowledged; don't let Nagle's algorithm
+    // hold it back until the client's delayed ACK
+    const int noDelay = 1;
+    setsockopt(
+      clientSocket.get(),
+      IPPROTO_TCP,
+      TCP_NODELAY,
+      reinterpret_cast<const char*>(&noDelay),
+      sizeof(noDelay));
 
-  if (const auto ret = RecvAll(clientSocket, &request.mCommandCode); !ret) {
-    std::println(stderr, "Client disconnected or recv failed.");
-    return ret.error();
+    auto connection = std::make_shared<Connection>(
+      std::move(clientSocket), mNextConnectionID++);
+    if (const auto hr
+        = mEventLoop->Add(connection->mSocket.get(), connection.get());
+        FAILED(hr)) {
+      LogError("Failed to watch client socket, disconnecting: {}", hr);
+      continue;
+    }
+    Log("USB/IP connection established");
+    if (mRecorder) {
+      mRecorder->OnConnected(connection->mID);
+    }
+    const auto key = connection.get();
+    mOpenConnections.lock()->push_back(connection);
+    mConnections.emplace(key, std::move(connection));
   }
+}
 
-  const auto RecvRemainder = [this]<class T>(const SOCKET sock, T* what) {
-    const auto ret = RecvAll(
-      sock,
-      reinterpret_cast<char*>(what) + sizeof(USBIP::CommandCode),
-      sizeof(T) - sizeof(USBIP::CommandCode));
-    if (!ret) [[unlikely]] {
-      LogError("-> Failed to read required data: {}", ret.error());
+void FredEmmott_USBIP_VirtPP_Instance::ServiceConnections() {
+  // Round-robin: each connection with work to do gets one budget's worth of
+  // PDUs, then goes to the back of the queue. A client flooding us with
+  // interrupt polls can only delay the others by one budget per round.
+  std::swap(mBacklog, mServicing);
+  for (auto&& connection: mServicing) {
+    connection->mInBacklog = false;
+    if (IsOverQueueLimit(*connection)) {
+      // Stop reading requests until the client catches up with the replies;
+      // `WriteReplies()` puts it back in the backlog
+      connection->mReceivePaused = true;
+      continue;
     }
-    return ret;
-  };
+    const auto hr
+      = this->OnClientDataAvailable(*connection, PDUBudgetPerRound);
+    if (hr == S_FALSE) {
+      connection->mInBacklog = true;
+      mBacklog.push_back(connection);
+      continue;
+    }
+    if (SUCCEEDED(hr)) {
+      continue;
+    }
+
+    if (hr == HRESULT_FROM_WIN32(WSAECONNRESET)) {
+      Log("Client disconnected");
+      // It may have only shut down its side after its last request, so send
+      // the replies we already have
+      WriteReplies(*connection, connection->mReplies.TakeAll());
+    } else {
+      // e.g. a malformed or unexpected PDU; that's the client's problem, not
+      // ours, so just drop it
+      LogError("Failed to handle client socket, disconnecting: {}", hr);
+    }
+    CloseConnection(*connection);
+  }
+  mServicing.clear();
+}
+
+HRESULT FredEmmott_USBIP_VirtPP_Instance::OnClientDataAvailable(
+  Connection& connection,
+  std::size_t budget) {
+  auto& buffer = connection.mReceiveBuffer;
+  // Edge-triggered, so keep going until the socket's drained, or we're out of
+  // budget
+  while (true) {
+    // Hosts pipeline URBs, so there's often several complete PDUs; if the
+    // last one is incomplete, the parser remembers how far it got
+    while (true) {
+      if (budget == 0) {
+        return S_FALSE;
+      }
+      const auto readable = buffer.GetReadable();
+      const auto pduSize = connection.mParser.Parse(readable);
+      if (!pduSize) {
+        break;
+      }
+      if (const auto hr
+          = this->OnClientPDU(connection, readable.first(*pduSize));
+          FAILED(hr)) {
+        return hr;
+      }
+      buffer.Consume(*pduSize);
+      --budget;
+    }
+
+    // Large OUT payloads are received into a larger block, so that they're
+    // still contiguous
+    if (!buffer.Reserve(connection.mParser.GetNeeded())) [[unlikely]] {
+      LogError(
+        "-> {}-byte PDU is larger than the maximum of {} bytes",
+        connection.mParser.GetNeeded(),
+        ReceiveBuffer::MaxCapacity);
+      return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+    const auto writable = buffer.GetWritable();
+    if (writable.empty()) [[unlikely]] {
+      LogError("-> Receive buffer is full");
+      __debugbreak();
+      return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+    const auto received
+      = mEventLoop->Recv(connection.mSocket.get(), &connection, writable);
+    if (!received) {
+      return received.error();
+    }
+    if (*received == 0) {
+      return S_OK;
+    }
+    if (mRecorder) {
+      mRecorder->OnReceived(connection.mID, writable.first(*received));
+    }
+    buffer.Commit(*received);
+    connection.mBytesReceived.fetch_add(*received, std::memory_order_relaxed);
+  }
+}
+
+void FredEmmott_USBIP_VirtPP_Instance::CloseConnection(
+  Connection& connection) {
+  if (connection.mClosed.load(std::memory_order_relaxed)) {
+    return;
+  }
+  if (connection.mInBacklog) {
+    std::erase(mBacklog, &connection);
+  }
+  if (connection.mInWriteBacklog) {
+    std::erase(mWriteBacklog, &connection);
+  }
+  // If it's scheduled for a flush, it'll be kept alive until then, but
+  // no more replies will be sent
+  connection.mClosed.store(true, std::memory_order_release);
+  // Wake up any producers waiting for queue space
+  connection.mQueuedBytes.store(0, std::memory_order_release);
+  connection.mQueuedBytes.notify_all();
+  Log(
+    "Outbound queue peaked at {} bytes; {} superseded input reports dropped",
+    connection.mQueuedBytesHighWater.load(std::memory_order_relaxed),
+    connection.mDroppedReplies.load(std::memory_order_relaxed));
+  for (auto&& deviceID: connection.mImportedDevices) {
+    // The ID may have been reused since the device was unplugged
+    const auto entry = mDevices.Find(deviceID);
+    if (entry && entry->mDevice->mImportedBy == &connection) {
+      entry->mDevice->mImportedBy = nullptr;
+    }
+  }
+  if (mRecorder) {
+    mRecorder->OnClosed(connection.mID);
+  }
+  mEventLoop->Remove(connection.mSocket.get(), &connection);
+  std::erase_if(*mOpenConnections.lock(), [&](const auto& it) {
+    return it.get() == &connection;
+  });
+  // Callers up the stack may still be using it
+  const auto it = mConnections.find(&connection);
+  mClosedConnections.push_back(std::move(it->second));
+  mConnections.erase(it);
+}
 
-  switch (request.mCommandCode) {
+HRESULT FredEmmott_USBIP_VirtPP_Instance::OnClientPDU(
+  Connection& connection,
+  const std::span<const std::byte> pdu) {
+  const auto commandCode = GetCommandCode(pdu);
+  switch (commandCode) {
     case USBIP::CommandCode::OP_REQ_DEVLIST:
       Log("-> Received REQ_DEVLIST");
-      if (const auto ret
-          = RecvRemainder(clientSocket, &request.mOP_REQ_DEVLIST);
-          !ret) [[unlikely]]
-        return ret.error();
-      return this->OnDevListOp();
+      return this->OnDevListOp(connection);
     case USBIP::CommandCode::OP_REQ_IMPORT:
       Log("-> Received REQ_IMPORT");
-      if (const auto ret = RecvRemainder(clientSocket, &request.mOP_REQ_IMPORT);
-          !ret) [[unlikely]]
-        return ret.error();
-      return this->OnImportOp(request.mOP_REQ_IMPORT);
+      return this->OnImportOp(
+        connection, PDUAs<USBIP::OP_REQ_IMPORT>(pdu));
     case USBIP::CommandCode::USBIP_CMD_SUBMIT:
       // Not logging here, way too spammy :)
-      if (const auto ret
-          = RecvRemainder(clientSocket, &request.mUSBIP_CMD_SUBMIT);
-          !ret) [[unlikely]]
-        return ret.error();
-      return this->OnSubmitRequest(request.mUSBIP_CMD_SUBMIT);
-    case USBIP::CommandCode::USBIP_CMD_UNLINK: {
-      Log("-> Received CMD_UNLINK");
-      if (const auto ret
-          = RecvRemainder(clientSocket, &request.mUSBIP_CMD_UNLINK);
-          !ret) [[unlikely]]
-        return ret.error();
-      USBIP::USBIP_RET_UNLINK response {};
-      response.mHeader.mSequenceNumber
-        = request.mUSBIP_CMD_UNLINK.mHeader.mSequenceNumber;
-      if (const auto ret = SendAll(clientSocket, response); !ret) [[unlikely]]
-        return ret.error();
-      return S_OK;
-    }
+      return this->OnSubmitRequest(
+        connection,
+        PDUAs<USBIP::USBIP_CMD_SUBMIT>(pdu),
+        pdu.subspan(sizeof(USBIP::USBIP_CMD_SUBMIT)));
+    case USBIP::CommandCode::USBIP_CMD_UNLINK:
+      LogDebug("-> Received CMD_UNLINK");
+      return this->OnUnlinkRequest(
+        connection, PDUAs<USBIP::USBIP_CMD_UNLINK>(pdu));
     case USBIP::CommandCode::USBIP_RET_SUBMIT:
     case USBIP::CommandCode::USBIP_RET_UNLINK:
       LogError("-> Received a RET instead of a CMD");
@@ -308,71 +519,50 @@ HRESULT FredEmmott_USBIP_VirtPP_Instance::OnClientSocketActive(
     default:
       LogError(
         "-> Unhandled USB/IP command code: 0x{:x}",
-        std::to_underlying(request.mCommandCode));
+        std::to_underlying(commandCode));
       return HRESULT_FROM_WIN32(ERROR_BAD_COMMAND);
   }
 }
 
-FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Instance::OnDevListOp() {
-  const USBIP::OP_REP_DEVLIST header {
-    .mNumDevices = static_cast<uint32_t>(std::ranges::fold_left(
-      mBusses, 0, [](auto acc, const auto& bus) { return acc + bus.size(); })),
-  };
-  if (const auto ret = SendAll(mClientSocket, header); !ret)
-    return ret.error();
-  for (auto&& [busIdx, bus]: std::views::enumerate(mBusses)) {
-    for (auto&& [deviceIdx, device]: std::views::enumerate(bus)) {
-      const auto& config = device->mDescriptor;
-      const auto usbipDevice = MakeUSBIPDevice(
-        busIdx + 1, deviceIdx + 1, config, device->mInterfaces.size());
-      if (const auto ret = SendAll(mClientSocket, usbipDevice); !ret)
-        return ret.error();
-      for (auto&& iface: device->mInterfaces) {
-        const USBIP::Interface wireInterface {
-          .mClass = iface.bInterfaceClass,
-          .mSubClass = iface.bInterfaceSubClass,
-          .mProtocol = iface.bInterfaceProtocol,
-        };
-        if (const auto ret = SendAll(mClientSocket, wireInterface); !ret)
-          return ret.error();
-      }
-    }
-  }
-
-  return {};
+FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Instance::OnDevListOp(
+  Connection& connection) {
+  const auto reply = mDevices.GetDevListReply();
+  const std::span<const std::byte> buffers[] {*reply};
+  return Send(connection, buffers);
 }
 
 FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Instance::OnImportOp(
+  Connection& connection,
   const FredEmmott::USBIP::OP_REQ_IMPORT& request) {
   const std::string_view busId {request.mBusID};
 
-  for (auto&& [busIdx, bus]: std::views::enumerate(mBusses)) {
-    for (auto&& [deviceIdx, device]: std::views::enumerate(bus)) {
-      if (busId != std::format("{}-{}", busIdx + 1, deviceIdx + 1))
-        continue;
-
-      const auto usbipDevice = MakeUSBIPDevice(
-        busIdx + 1,
-        deviceIdx + 1,
-        device->mDescriptor,
-        device->mInterfaces.size());
+  const auto entry = mDevices.Find(busId);
+  if (!entry) {
+    LogError("Failed to find device with busID '{}'", busId);
+    USBIP::OP_REP_IMPORT reply {};
+    reply.mHeader.mStatus = 1;// per spec, 1 for error
+    return Send(connection, reply);
+  }
 
-      return SendAll(
-               mClientSocket, USBIP::OP_REP_IMPORT {.mDevice = usbipDevice})
-        .error_or(S_OK);
-    }
+  const auto device = entry->mDevice;
+  if (device->mImportedBy && device->mImportedBy != &connection) {
+    LogError("Device '{}' is already imported by another client", busId);
+    USBIP::OP_REP_IMPORT reply {};
+    reply.mHeader.mStatus = 2;// ST_DEV_BUSY
+    return Send(connection, reply);
   }
+  device->mImportedBy = &connection;
+  connection.mImportedDevices.emplace(entry->mDeviceID);
 
-  LogError("Failed to find device with busID '{}'", busId);
-  USBIP::OP_REP_IMPORT reply {};
-  reply.mHeader.mStatus = 1;// per spec, 1 for error
-  return SendAll(mClientSocket, reply).error_or(S_OK);
+  return Send(
+    connection, USBIP::OP_REP_IMPORT {.mDevice = entry->mUSBIPDevice});
 }
 
 FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Instance::OnInputRequest(
   FredEmmott_USBIP_VirtPP_Device& device,
   const FredEmmott::USBIP::USBIP_CMD_SUBMIT& request,
   FredEmmott_USBIP_VirtPP_Request& apiRequest) {
+  mTracer.OnURB(Tracer::URBStage::Dispatched, apiRequest.mTraceID);
   return device.mCallbacks.OnInputRequest(
     &apiRequest,
     request.mHeader.mEndpoint,
@@ -387,18 +577,10 @@ FredEmmott_USBIP_VirtPP_Result
 FredEmmott_USBIP_VirtPP_Instance::OnOutputRequest(
   FredEmmott_USBIP_VirtPP_Device& device,
   const FredEmmott::USBIP::USBIP_CMD_SUBMIT& request,
+  const std::span<const std::byte> payload,
   FredEmmott_USBIP_VirtPP_Request& apiRequest) {
-  thread_local uint8_t buffer[1024] {};
-  const auto dataLength = request.mTransferBufferLength.NativeValue();
-  if (dataLength > std::size(buffer)) {
-    __debugbreak();
-  }
-  if (dataLength > 0) {
-    if (const auto ret = RecvAll(mClientSocket, buffer, dataLength); !ret)
-      [[unlikely]] {
-      return ret.error();
-    }
-  }
+  const auto dataLength = static_cast<uint32_t>(payload.size());
+  mTracer.OnURB(Tracer::URBStage::Dispatched, apiRequest.mTraceID);
 
   return device.mCallbacks.OnOutputRequest(
     &apiRequest,
@@ -408,58 +590,620 @@ FredEmmott_USBIP_VirtPP_Instance::OnOutputRequest(
     request.mSetup.mValue,
     request.mSetup.mIndex,
     request.mSetup.mLength,
-    dataLength ? buffer : nullptr,
+    dataLength ? payload.data() : nullptr,
     dataLength);
 }
 
 FredEmmott_USBIP_VirtPP_Result
 FredEmmott_USBIP_VirtPP_Instance::OnSubmitRequest(
-  const FredEmmott::USBIP::USBIP_CMD_SUBMIT& request) {
-  const auto busIndex = (request.mHeader.mDeviceID.NativeValue() >> 16) - 1;
-  const auto deviceIndex
-    = (request.mHeader.mDeviceID & 0xffff) - 1;
-  if (busIndex >= mBusses.size() || deviceIndex >= mBusses[busIndex].size())
-    [[unlikely]] {
+  Connection& connection,
+  const FredEmmott::USBIP::USBIP_CMD_SUBMIT& request,
+  const std::span<const std::byte> payload) {
+  connection.mURBs.fetch_add(1, std::memory_order_relaxed);
+  const auto deviceID = request.mHeader.mDeviceID.NativeValue();
+  const auto urbID
+    = Tracer::GetURBID(connection.mID, request.mHeader.mSequenceNumber);
+  const auto isInput = request.mHeader.mDirection == USBIP::Direction::In;
+  // The PDU parser has already checked the sizes
+  const auto isoPacketCount = GetIsoPacketCount(request);
+  const auto isoPackets = payload.last(
+    isoPacketCount * sizeof(USBIP::USBIP_ISO_PACKET_DESCRIPTOR));
+  const auto data = payload.first(payload.size() - isoPackets.size());
+  const PendingURB pendingURB {
+    .mDeviceID = deviceID,
+    .mEndpointAddress = static_cast<uint8_t>(
+      request.mHeader.mEndpoint | (isInput ? 0x80 : 0)),
+    .mIsochronous = isoPacketCount > 0,
+  };
+
+  mTracer.OnURB(
+    Tracer::URBStage::Received,
+    urbID,
+    (int64_t {deviceID} << 8) | pendingURB.mEndpointAddress);
+  if (mCapture) {
+    mCapture->OnSubmit(
+      GetCaptureURB(connection, request.mHeader.mSequenceNumber, pendingURB),
+      request,
+      data,
+      isoPackets);
+  }
+
+  const auto entry = mDevices.Find(deviceID);
+  if (!entry) [[unlikely]] {
+    // Usually unplugged, with the client yet to notice. There are no
+    // `DeviceStats` to update: the URB was never counted as submitted.
     LogError(
       "Received submit request for invalid device: bus {}, device {}",
-      busIndex,
-      deviceIndex);
-    return HRESULT_FROM_WIN32(ERROR_INVALID_INDEX);
+      deviceID >> 16,
+      deviceID & 0xffff);
+    USBIP::USBIP_RET_SUBMIT response {
+      .mStatus = -LinuxENODEV,
+      .mNumberOfPackets = 0,
+    };
+    response.mHeader.mSequenceNumber = request.mHeader.mSequenceNumber;
+    mTracer.OnURB(Tracer::URBStage::Answered, urbID, -LinuxENODEV);
+    if (mCapture) {
+      mCapture->OnComplete(
+        GetCaptureURB(connection, request.mHeader.mSequenceNumber, pendingURB),
+        response,
+        {},
+        {});
+    }
+    return Send(connection, response);
+  }
+  auto& device = *entry->mDevice;
+  if (device.mImportedBy != &connection) [[unlikely]] {
+    LogError(
+      "Received submit request for device {}, which this client has not "
+      "imported",
+      entry->mBusID);
+    return HRESULT_FROM_WIN32(ERROR_INVALID_STATE);
   }
-  auto& device = *mBusses.at(busIndex).at(deviceIndex);
   FredEmmott_USBIP_VirtPP_Request apiRequest {
+    .mInstance = this,
     .mDevice = &device,
-    .mSocket = mClientSocket,
+    .mDeviceID = deviceID,
+    .mDeviceUserData = device.mUserData,
+    .mConnection = mConnections.at(&connection),
+    .mDeviceStats = device.mStats.get(),
     .mSequenceNumber = request.mHeader.mSequenceNumber,
+    .mTraceID = urbID,
     .mTransferBufferLength = request.mTransferBufferLength,
+    .mTransferFlags = request.mTransferFlags,
+    .mEndpoint = request.mHeader.mEndpoint,
+    .mDirection = request.mHeader.mDirection,
+    .mIsoPacketCount = isoPacketCount,
+    .mInterval = request.mInterval,
+    .mIsSupersededInput = isInput && request.mHeader.mEndpoint < 16
+      && (device.mSupersededInputEndpoints
+          & (1u << request.mHeader.mEndpoint)),
+    .mPayload = data,
+    .mPayloadBlock
+    = payload.empty() ? nullptr : connection.mReceiveBuffer.GetBlock(),
+    .mIsoPackets = {
+      reinterpret_cast<const USBIP::USBIP_ISO_PACKET_DESCRIPTOR*>(
+        isoPackets.data()),
+      isoPacketCount,
+    },
   };
+  {
+    const auto pending = connection.mPendingURBs.lock();
+    pending->emplace(request.mHeader.mSequenceNumber, pendingURB);
+    // Only this thread adds entries, so we're the only writer
+    if (
+      pending->size()
+      > connection.mPendingURBsHighWater.load(std::memory_order_relaxed)) {
+      connection.mPendingURBsHighWater.store(
+        pending->size(), std::memory_order_relaxed);
+    }
+  }
+  device.mStats->OnSubmit(request.mHeader.mEndpoint, isInput, data.size());
 
-  if (request.mHeader.mDirection == USBIP::Direction::In) {
+  if (isInput) {
     return OnInputRequest(device, request, apiRequest);
   }
 
-  return OnOutputRequest(device, request, apiRequest);
+  return OnOutputRequest(device, request, data, apiRequest);
 }
 
 FredEmmott_USBIP_VirtPP_Result
 FredEmmott_USBIP_VirtPP_Instance::OnUnlinkRequest(
+  Connection& connection,
   const USBIP::USBIP_CMD_UNLINK& request) {
-  USBIP::USBIP_RET_UNLINK response {};
+  // If the URB is parked by a device, it stays there, but the reply will be
+  // discarded; devices skip these with `Request_IsPending()`
+  connection.mUnlinks.fetch_add(1, std::memory_order_relaxed);
+  const auto unlinked
+    = connection.mPendingURBs.lock()->extract(request.mUnlinkSequenceNumber);
+  const auto wasPending = !unlinked.empty();
+  if (wasPending) {
+    mTracer.OnURB(
+      Tracer::URBStage::Unlinked,
+      Tracer::GetURBID(connection.mID, request.mUnlinkSequenceNumber));
+    if (const auto entry = mDevices.Find(unlinked.mapped().mDeviceID)) {
+      entry->mDevice->mStats->OnUnlink();
+    }
+    if (mCapture) {
+      // usbmon shows unlinked URBs as completed with -ECONNRESET
+      mCapture->OnComplete(
+        GetCaptureURB(
+          connection, request.mUnlinkSequenceNumber, unlinked.mapped()),
+        {.mStatus = -LinuxECONNRESET, .mNumberOfPackets = 0},
+        {},
+        {});
+    }
+  }
+
+  // Per the USB/IP spec, if we've already sent the RET_SUBMIT, the status is
+  // 0; otherwise, it's the status of the cancelled URB
+  USBIP::USBIP_RET_UNLINK response {
+    .mStatus = wasPending ? -LinuxECONNRESET : 0,
+  };
   response.mHeader.mSequenceNumber = request.mHeader.mSequenceNumber;
-  return SendAll(mClientSocket, response).error_or(S_OK);
+  return Send(connection, response);
 }
 
-void FredEmmott_USBIP_VirtPP_Instance::AutoAttach() {
-  for (auto&& [i, bus]: std::views::enumerate(mBusses)) {
-    for (auto&& [j, device]: std::views::enumerate(bus)) {
-      if (!device->mAutoAttach) {
+void FredEmmott_USBIP_VirtPP_Instance::OnDeviceRemoved(
+  const uint32_t deviceID,
+  std::shared_ptr<DeviceStats> stats) {
+  mRemovedDevices.lock()->emplace_back(deviceID, std::move(stats));
+  if (
+    mEventLoop
+    && mLoopThread.load(std::memory_order_relaxed)
+      != std::this_thread::get_id()) {
+    mEventLoop->Wake();
+  }
+}
+
+void FredEmmott_USBIP_VirtPP_Instance::ServiceRemovedDevices() {
+  mRemovedDevices.lock()->swap(mServicingRemovedDevices);
+  for (auto&& [deviceID, stats]: mServicingRemovedDevices) {
+    for (auto&& [key, connection]: mConnections) {
+      if (!connection->mImportedDevices.erase(deviceID)) {
         continue;
       }
-      const auto busID = std::format("{}-{}", i + 1, j + 1);
-      Log("Auto-attaching device {}", busID);
-      std::ignore = device->Attach(busID);
+      std::erase_if(*connection->mIsoStreams.lock(), [=](const auto& it) {
+        return it.first.first == deviceID;
+      });
+      // Anything the device replies to after this is discarded, as usual
+      std::erase_if(*connection->mPendingURBs.lock(), [&](const auto& it) {
+        if (it.second.mDeviceID != deviceID) {
+          return false;
+        }
+        mFailedURBs.push_back(it);
+        return true;
+      });
+      Log(
+        "- Device {}-{} unplugged; failing {} pending URBs",
+        deviceID >> 16,
+        deviceID & 0xffff,
+        mFailedURBs.size());
+      for (auto&& [sequenceNumber, urb]: mFailedURBs) {
+        // 0 packets is valid whether or not it's isochronous
+        USBIP::USBIP_RET_SUBMIT response {
+          .mStatus = -LinuxESHUTDOWN,
+          .mNumberOfPackets = 0,
+        };
+        response.mHeader.mSequenceNumber = sequenceNumber;
+        stats->OnReply(-LinuxESHUTDOWN, 0);
+        mTracer.OnURB(
+          Tracer::URBStage::Answered,
+          Tracer::GetURBID(connection->mID, sequenceNumber),
+          -LinuxESHUTDOWN);
+        if (mCapture) {
+          mCapture->OnComplete(
+            GetCaptureURB(*connection, sequenceNumber, urb), response, {}, {});
+        }
+        std::ignore = Send(*connection, response);
+      }
+      mFailedURBs.clear();
     }
+    // Nothing refers to the old device now
+    mDevices.Release(deviceID);
   }
+  mServicingRemovedDevices.clear();
+}
+
+HRESULT FredEmmott_USBIP_VirtPP_Instance::SendWhenDue(
+  std::shared_ptr<Connection> connection,
+  const uint32_t sequenceNumber,
+  const IsoScheduler::Clock::time_point due,
+  Reply* const reply) {
+  if (connection->mClosed.load(std::memory_order_acquire)) [[unlikely]] {
+    Reply::DestroyAll(reply);
+    return HRESULT_FROM_WIN32(WSAENOTCONN);
+  }
+#ifdef _WIN32
+  if (!mRaisedTimerResolution.exchange(true, std::memory_order_relaxed)) {
+    // The default timer resolution is ~15ms, which is longer than most
+    // isochronous transfers; Linux timers are already precise enough
+    timeBeginPeriod(1);
+  }
+#endif
+  const auto first = mIsoScheduler.Defer({
+    .mDue = due,
+    .mConnection = std::move(connection),
+    .mSequenceNumber = sequenceNumber,
+    .mReply = reply,
+  });
+  if (
+    first
+    && mLoopThread.load(std::memory_order_relaxed)
+      != std::this_thread::get_id()) {
+    // Recalculate the timeout
+    mEventLoop->Wake();
+  }
+  return S_OK;
+}
+
+void FredEmmott_USBIP_VirtPP_Instance::SendDueReplies() {
+  mIsoScheduler.TakeDue(mDueReplies);
+  for (auto&& [due, connection, sequenceNumber, reply]: mDueReplies) {
+    std::unordered_map<uint32_t, PendingURB>::node_type pending;
+    {
+      auto pendingURBs = connection->mPendingURBs.lock();
+      const auto it = pendingURBs->find(sequenceNumber);
+      if (it == pendingURBs->end()) {
+        // Unlinked while it was held back
+        Reply::DestroyAll(reply);
+        continue;
+      }
+      const auto entry = mDevices.Find(it->second.mDeviceID);
+      if (!entry) {
+        // Unplugged; leave the URB for `ServiceRemovedDevices()` to fail,
+        // so it's counted
+        Reply::DestroyAll(reply);
+        continue;
+      }
+      pending = pendingURBs->extract(it);
+      entry->mDevice->mStats->OnReply(0, GetIsoInBytes(*reply));
+    }
+    const auto wire = reply->GetData();
+    // Isochronous statuses are per-packet, so the URB's is always 0
+    mTracer.OnURB(
+      Tracer::URBStage::Answered,
+      Tracer::GetURBID(connection->mID, sequenceNumber),
+      PDUAs<USBIP::USBIP_RET_SUBMIT>(wire).mStatus.NativeValue());
+    if (mCapture) {
+      const auto inBytes = GetIsoInBytes(*reply);
+      const std::span<const std::byte> data[] {
+        wire.subspan(sizeof(USBIP::USBIP_RET_SUBMIT), inBytes),
+      };
+      mCapture->OnComplete(
+        GetCaptureURB(*connection, sequenceNumber, pending.mapped()),
+        PDUAs<USBIP::USBIP_RET_SUBMIT>(wire),
+        data,
+        wire.subspan(sizeof(USBIP::USBIP_RET_SUBMIT) + inBytes));
+    }
+    // Only fails if the client has disconnected
+    std::ignore = Send(*connection, reply);
+  }
+  // Release the connections
+  mDueReplies.clear();
+}
+
+HRESULT FredEmmott_USBIP_VirtPP_Instance::Send(
+  Connection& connection,
+  const std::span<const std::span<const std::byte>> buffers) {
+  if (connection.mClosed.load(std::memory_order_acquire)) [[unlikely]] {
+    return HRESULT_FROM_WIN32(WSAENOTCONN);
+  }
+  return Send(connection, Reply::Create(buffers));
+}
+
+HRESULT FredEmmott_USBIP_VirtPP_Instance::Send(
+  Connection& connection,
+  Reply* const reply) {
+  if (connection.mClosed.load(std::memory_order_acquire)) [[unlikely]] {
+    Reply::DestroyAll(reply);
+    return HRESULT_FROM_WIN32(WSAENOTCONN);
+  }
+  const auto onLoopThread
+    = mLoopThread.load(std::memory_order_relaxed) == std::this_thread::get_id();
+
+  if (
+    mInitData.mBackpressurePolicy
+      == FredEmmott_USBIP_VirtPP_BackpressurePolicy_Block
+    && !onLoopThread) {
+    // The loop thread can't wait for itself; for that, we rely on
+    // `ServiceConnections()` not reading more requests.
+    //
+    // Always let one reply through, even if it's larger than the limit.
+    auto queued = connection.mQueuedBytes.load(std::memory_order_acquire);
+    while (queued > 0 && queued + reply->mSize > mMaxQueuedBytesPerConnection
+           && !connection.mClosed.load(std::memory_order_acquire)) {
+      connection.mQueuedBytes.wait(queued, std::memory_order_acquire);
+      queued = connection.mQueuedBytes.load(std::memory_order_acquire);
+    }
+    if (connection.mClosed.load(std::memory_order_acquire)) {
+      Reply::DestroyAll(reply);
+      return HRESULT_FROM_WIN32(WSAENOTCONN);
+    }
+  }
+
+  connection.mRepliesSent.fetch_add(1, std::memory_order_relaxed);
+  const auto queued
+    = connection.mQueuedBytes.fetch_add(reply->mSize, std::memory_order_relaxed)
+    + reply->mSize;
+  auto highWater
+    = connection.mQueuedBytesHighWater.load(std::memory_order_relaxed);
+  while (queued > highWater
+         && !connection.mQueuedBytesHighWater.compare_exchange_weak(
+           highWater, queued, std::memory_order_relaxed)) {
+  }
+
+  if (!connection.mReplies.Push(reply)) {
+    // Already scheduled for the next flush
+    return S_OK;
+  }
+
+  // The queue was empty, so it's our job to schedule it; the ref is released
+  // by `FlushReplies()`, before it takes the replies
+  connection.mScheduledRef = connection.shared_from_this();
+  mScheduledConnections.Push(&connection);
+  if (!onLoopThread) {
+    mEventLoop->Wake();
+  }
+  return S_OK;
+}
+
+bool FredEmmott_USBIP_VirtPP_Instance::ShouldDropInputReport(
+  Connection& connection,
+  const std::size_t size) {
+  if (
+    mInitData.mBackpressurePolicy
+    != FredEmmott_USBIP_VirtPP_BackpressurePolicy_DropSupersededInputReports) {
+    return false;
+  }
+  const auto queued = connection.mQueuedBytes.load(std::memory_order_relaxed);
+  if (queued == 0 || queued + size <= mMaxQueuedBytesPerConnection) {
+    return false;
+  }
+  connection.mDroppedReplies.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool FredEmmott_USBIP_VirtPP_Instance::IsOverQueueLimit(
+  const Connection& connection) const {
+  return connection.mQueuedBytes.load(std::memory_order_relaxed)
+    > mMaxQueuedBytesPerConnection;
+}
+
+void FredEmmott_USBIP_VirtPP_Instance::FlushReplies() {
+  auto connection = mScheduledConnections.TakeAll();
+  while (connection) {
+    // Once we've taken the replies, a producer can schedule the connection
+    // again, changing these
+    const auto next = std::exchange(connection->mNextScheduled, nullptr);
+    const auto keepAlive = std::move(connection->mScheduledRef);
+
+    const auto replies = connection->mReplies.TakeAll();
+    if (connection->mClosed.load(std::memory_order_acquire)) {
+      Reply::DestroyAll(replies);
+    } else {
+      WriteReplies(*connection, replies);
+      if (
+        mInitData.mBackpressurePolicy
+          == FredEmmott_USBIP_VirtPP_BackpressurePolicy_Disconnect
+        && IsOverQueueLimit(*connection)) {
+        LogError(
+          "Client is not reading replies, disconnecting with {} bytes queued",
+          connection->mQueuedBytes.load(std::memory_order_relaxed));
+        CloseConnection(*connection);
+      }
+    }
+    connection = next;
+  }
+
+  mEventLoop->Flush();
+}
+
+void FredEmmott_USBIP_VirtPP_Instance::ServiceWriteBacklog() {
+  std::swap(mWriteBacklog, mWriting);
+  for (auto&& connection: mWriting) {
+    connection->mInWriteBacklog = false;
+    WriteReplies(*connection, nullptr);
+  }
+  mWriting.clear();
+}
+
+void FredEmmott_USBIP_VirtPP_Instance::WriteReplies(
+  Connection& connection,
+  Reply* const replies) {
+  connection.mUnwritten.Append(replies);
+  for (std::size_t i = 0; i < StreamChunksPerRound; ++i) {
+    if (!WriteSomeReplies(connection)) {
+      return;
+    }
+  }
+  // A large streaming reply; let other connections have a turn
+  if (!connection.mInWriteBacklog) {
+    connection.mInWriteBacklog = true;
+    mWriteBacklog.push_back(&connection);
+  }
+}
+
+bool FredEmmott_USBIP_VirtPP_Instance::WriteSomeReplies(
+  Connection& connection) {
+  // One gather-write for everything since the last flush
+  mFlushBuffers.clear();
+  std::size_t total {};
+  if (!connection.mUnsent.empty()) {
+    mFlushBuffers.push_back(connection.mUnsent);
+    total += connection.mUnsent.size();
+  }
+
+  // Replies that have been completely added to `mFlushBuffers`; destroyed
+  // once the EventLoop has taken or copied them
+  Reply* written {};
+  const auto destroyWritten
+    = scope_exit([&written] { Reply::DestroyAll(written); });
+  Reply** writtenTail = &written;
+  std::size_t pulled {};
+  // Each reply adds up to two buffers; the rest are left for the next pass,
+  // so this is a single gather-write
+  while (mFlushBuffers.size() + 2 <= MaxBuffersPerSend) {
+    const auto reply = connection.mUnwritten.Front();
+    if (!reply) {
+      break;
+    }
+    if (!reply->mStarted) {
+      reply->mStarted = true;
+      mFlushBuffers.push_back(reply->GetData());
+      total += reply->mSize;
+    }
+    if (reply->mStreamRemaining > 0) {
+      pulled = std::min(reply->mStreamRemaining, StreamChunkSize);
+      mStreamChunk.resize(pulled);
+      reply->mProducer.OnRead(
+        reply->mProducer.mUserData, mStreamChunk.data(), pulled);
+      reply->mStreamRemaining -= pulled;
+      mFlushBuffers.push_back(mStreamChunk);
+      total += pulled;
+      if (reply->mStreamRemaining == 0) {
+        *writtenTail = connection.mUnwritten.PopFront();
+      }
+      // There's only one chunk buffer; also, nothing else can be written
+      // until this reply is complete
+      break;
+    }
+    *writtenTail = connection.mUnwritten.PopFront();
+    writtenTail = &(*writtenTail)->mNext;
+  }
+  if (mFlushBuffers.empty()) {
+    return false;
+  }
+  if (pulled) {
+    connection.mQueuedBytes.fetch_add(pulled, std::memory_order_relaxed);
+  }
+
+  const auto writeStart = mTracer.IsEnabled() ? Tracer::Clock::now()
+                                               : Tracer::Clock::time_point {};
+  const auto sent
+    = mEventLoop->Send(connection.mSocket.get(), &connection, mFlushBuffers);
+  if (!sent) {
+    // Anything after a gap would corrupt the stream, so give up on the
+    // connection rather than dropping these replies
+    mTracer.OnSocketWrite(writeStart, 0);
+    mFlushBuffers.clear();
+    if (sent.error() == HRESULT_FROM_WIN32(WSAECONNRESET)) {
+      Log("Client disconnected");
+    } else {
+      LogError("Failed to send replies, disconnecting: {}", sent.error());
+    }
+    CloseConnection(connection);
+    return false;
+  }
+  const auto accepted = *sent;
+  mTracer.OnSocketWrite(writeStart, accepted);
+  if (mRecorder && accepted > 0) {
+    mRecorder->OnSent(connection.mID, mFlushBuffers, accepted);
+  }
+
+  // Keep whatever the EventLoop didn't take, until it's writable again
+  if (accepted == total) {
+    connection.mUnsent.clear();
+  } else {
+    std::vector<std::byte> unsent;
+    unsent.reserve(total - accepted);
+    auto skip = accepted;
+    for (auto&& buffer: mFlushBuffers) {
+      if (skip >= buffer.size()) {
+        skip -= buffer.size();
+        continue;
+      }
+      unsent.insert(unsent.end(), buffer.begin() + skip, buffer.end());
+      skip = 0;
+    }
+    connection.mUnsent = std::move(unsent);
+  }
+  mFlushBuffers.clear();
+
+  if (accepted == 0) {
+    return false;
+  }
+  connection.mBytesSent.fetch_add(accepted, std::memory_order_relaxed);
+  const auto queued
+    = connection.mQueuedBytes.fetch_sub(accepted, std::memory_order_acq_rel)
+    - accepted;
+  if (
+    mInitData.mBackpressurePolicy
+    == FredEmmott_USBIP_VirtPP_BackpressurePolicy_Block) {
+    connection.mQueuedBytes.notify_all();
+  }
+
+  // Hysteresis: don't resume reading until there's room for a burst
+  if (
+    connection.mReceivePaused && queued <= mMaxQueuedBytesPerConnection / 2) {
+    connection.mReceivePaused = false;
+    // Edge-triggered, so there may be requests we haven't read yet
+    if (!connection.mInBacklog) {
+      connection.mInBacklog = true;
+      mBacklog.push_back(&connection);
+    }
+  }
+
+  return accepted == total && connection.mUnwritten.Front();
+}
+
+void FredEmmott_USBIP_VirtPP_Instance::Attach(
+  const std::span<const uint32_t> deviceIDs,
+  const std::span<FredEmmott_USBIP_VirtPP_Result> results) {
+  if (results.size() != deviceIDs.size()) [[unlikely]] {
+    __debugbreak();
+    return;
+  }
+
+  // Copy the bus IDs, so devices can be unplugged while we're attaching
+  std::vector<std::string> busIDs;
+  std::vector<std::size_t> resultIndices;
+  busIDs.reserve(deviceIDs.size());
+  resultIndices.reserve(deviceIDs.size());
+  {
+    const auto pin = mDevices.Pin();
+    for (std::size_t i = 0; i < deviceIDs.size(); ++i) {
+      const auto entry = mDevices.Find(deviceIDs[i]);
+      if (!entry) {
+        results[i] = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+        continue;
+      }
+      busIDs.emplace_back(entry->mBusID);
+      resultIndices.push_back(i);
+    }
+  }
+
+  const auto usbPorts = mAttachBackend->AttachAll(GetPortNumber(), busIDs);
+  for (std::size_t i = 0; i < busIDs.size(); ++i) {
+    const auto& usbPort = usbPorts[i];
+    if (usbPort) {
+      Log(
+        "+ Attached device {} to local server, on USB port {}",
+        busIDs[i],
+        *usbPort);
+      results[resultIndices[i]] = FredEmmott_USBIP_VirtPP_SUCCESS;
+    } else {
+      LogError("Failed to attach device {}: {}", busIDs[i], usbPort.error());
+      results[resultIndices[i]] = usbPort.error();
+    }
+  }
+}
+
+void FredEmmott_USBIP_VirtPP_Instance::AutoAttach() {
+  std::vector<uint32_t> deviceIDs;
+  {
+    const auto pin = mDevices.Pin();
+    mDevices.ForEach([&deviceIDs](const DeviceTable::Entry& entry) {
+      if (entry.mDevice->mAutoAttach) {
+        deviceIDs.push_back(entry.mDeviceID);
+      }
+    });
+  }
+  if (deviceIDs.empty()) {
+    return;
+  }
+  Log("Auto-attaching {} devices", deviceIDs.size());
+  std::vector<FredEmmott_USBIP_VirtPP_Result> results(deviceIDs.size());
+  Attach(deviceIDs, results);
 }
 
 void FredEmmott_USBIP_VirtPP_Instance_RequestStop(
@@ -482,7 +1226,55 @@ void FredEmmott_USBIP_VirtPP_RequestStopInstance(
   instance->mStopSource.request_stop();
 }
 
-Logger GetLoggerCallback(
-  FredEmmott_USBIP_VirtPP_Instance const* instance) {
-  return instance->mInitData.mCallbacks.OnLogMessage;
+size_t FredEmmott_USBIP_VirtPP_Instance_GetConnectionStats(
+  const FredEmmott_USBIP_VirtPP_InstanceHandle handle,
+  FredEmmott_USBIP_VirtPP_Connection_Stats* const stats,
+  const size_t capacity) {
+  constexpr auto Relaxed = std::memory_order_relaxed;
+  const auto connections = handle->mOpenConnections.lock();
+  const auto count = std::min(capacity, connections->size());
+  for (std::size_t i = 0; i < count; ++i) {
+    auto& connection = *(*connections)[i];
+    stats[i] = {
+      .mConnectionID = connection.mID,
+      .mURBs = connection.mURBs.load(Relaxed),
+      .mUnlinks = connection.mUnlinks.load(Relaxed),
+      .mReplies = connection.mRepliesSent.load(Relaxed),
+      .mBytesReceived = connection.mBytesReceived.load(Relaxed),
+      .mBytesSent = connection.mBytesSent.load(Relaxed),
+      .mPendingURBs = connection.mPendingURBs.lock()->size(),
+      .mPendingURBsHighWater = connection.mPendingURBsHighWater.load(Relaxed),
+      .mQueuedBytes = connection.mQueuedBytes.load(Relaxed),
+      .mQueuedBytesHighWater = connection.mQueuedBytesHighWater.load(Relaxed),
+      .mDroppedReplies = connection.mDroppedReplies.load(Relaxed),
+    };
+  }
+  return connections->size();
+}
+
+FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Instance_WriteTrace(
+  const FredEmmott_USBIP_VirtPP_InstanceHandle handle,
+  const char* const path) {
+  if (!handle->mTracer.IsEnabled()) {
+    handle->LogError("WriteTrace() called without `mEnableTracing`");
+    return HRESULT_FROM_WIN32(ERROR_INVALID_STATE);
+  }
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    handle->LogError("Failed to open trace file `{}`", path);
+    return HRESULT_FROM_WIN32(ERROR_OPEN_FAILED);
+  }
+  handle->mTracer.Write(out);
+  out.close();
+  if (!out) {
+    handle->LogError("Failed to write trace file `{}`", path);
+    return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+  }
+  return FredEmmott_USBIP_VirtPP_SUCCESS;
+}
+
+void FredEmmott_USBIP_VirtPP_Instance_SetMinLogSeverity(
+  const FredEmmott_USBIP_VirtPP_InstanceHandle handle,
+  const int32_t severity) {
+  handle->mLogger.SetMinSeverity(severity);
 }
@@ -8,6 +8,8 @@
 #include <FredEmmott/USBIP-VirtPP/Mouse.h>
 #include <FredEmmott/USBIP-VirtPP/Request.h>
 
+#include <cstring>
+
 namespace {
 constexpr uint8_t HIDReportDescriptor[] = {
   0x05, 0x01,// Usage Page (Generic Desktop Ctrls)
@@ -2,109 +2,503 @@
 // SPDX-License-Identifier: MIT
 
 #include "detail.hpp"
-#include "send-recv.hpp"
+#include "scope-exit.hpp"
 
 #include <FredEmmott/USBIP-VirtPP/Core.h>
 #include <FredEmmott/USBIP.hpp>
 
 #include <algorithm>
+#include <cstring>
 #include <ranges>
+#include <span>
+#include <string>
+#include <vector>
 
 namespace USBIP = FredEmmott::USBIP;
 using namespace FredEmmott::USBVirtPP;
 
+namespace {
+// Linux's value; `<errno.h>` on Windows doesn't have it
+constexpr int32_t LinuxEREMOTEIO = 121;
+
+// RET_SUBMIT for a successful reply with `actualLength` bytes of data
+USBIP::USBIP_RET_SUBMIT MakeReplyHeader(
+  const FredEmmott_USBIP_VirtPP_Request& request,
+  const uint32_t actualLength) {
+  USBIP::USBIP_RET_SUBMIT ret {
+    .mActualLength = actualLength,
+  };
+  ret.mHeader.mSequenceNumber = request.mSequenceNumber;
+  if (
+    request.mDirection == USBIP::Direction::In
+    && (request.mTransferFlags
+        & FredEmmott_USBIP_VirtPP_TransferFlags_ShortNotOK)
+    && actualLength < request.mTransferBufferLength) {
+    // The data is still returned
+    ret.mStatus = -LinuxEREMOTEIO;
+  }
+  return ret;
+}
+
+[[nodiscard]] Capture::URB GetCaptureURB(
+  const FredEmmott_USBIP_VirtPP_Request& request) {
+  const auto isInput = request.mDirection == USBIP::Direction::In;
+  return {
+    .mID = request.mTraceID,
+    .mDeviceID = request.mDeviceID,
+    .mEndpointAddress
+    = static_cast<uint8_t>(request.mEndpoint | (isInput ? 0x80 : 0)),
+    .mIsochronous = request.mIsoPacketCount > 0,
+  };
+}
+}// namespace
+
 FredEmmott_USBIP_VirtPP_InstanceHandle
 FredEmmott_USBIP_VirtPP_Request_GetInstance(
   const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
-  return handle->mDevice->mInstance;
+  const auto request = GetRequest(handle);
+  return request ? request->mInstance : nullptr;
 }
 
 FredEmmott_USBIP_VirtPP_DeviceHandle FredEmmott_USBIP_VirtPP_Request_GetDevice(
   const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
-  return handle->mDevice;
+  const auto request = GetRequest(handle);
+  return request ? request->mDevice : nullptr;
 }
 
 void* FredEmmott_USBIP_VirtPP_Request_GetInstanceUserData(
   FredEmmott_USBIP_VirtPP_RequestHandle handle) {
-  return handle->mDevice->mInstance->mInitData.mUserData;
+  const auto request = GetRequest(handle);
+  return request ? request->mInstance->mInitData.mUserData : nullptr;
 }
 
 void* FredEmmott_USBIP_VirtPP_Request_GetDeviceUserData(
   const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
-  return handle->mDevice->mUserData;
+  const auto request = GetRequest(handle);
+  return request ? request->mDeviceUserData : nullptr;
+}
+
+uint32_t FredEmmott_USBIP_VirtPP_Request_GetTransferBufferLength(
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
+  const auto request = GetRequest(handle);
+  return request ? request->mTransferBufferLength : 0;
+}
+
+uint32_t FredEmmott_USBIP_VirtPP_Request_GetTransferFlags(
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
+  const auto request = GetRequest(handle);
+  return request ? request->mTransferFlags : 0;
+}
+
+uint32_t FredEmmott_USBIP_VirtPP_Request_GetIsoPacketCount(
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
+  const auto request = GetRequest(handle);
+  return request ? request->mIsoPacketCount : 0;
+}
+
+size_t FredEmmott_USBIP_VirtPP_Request_GetIsoPackets(
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle,
+  FredEmmott_USBIP_VirtPP_IsoPacket* const packets,
+  const size_t count) {
+  const auto request = GetRequest(handle);
+  if (!(request && packets)) [[unlikely]] {
+    return 0;
+  }
+  const auto ret = std::min(count, request->mIsoPackets.size());
+  for (std::size_t i = 0; i < ret; ++i) {
+    const auto& it = request->mIsoPackets[i];
+    packets[i] = {
+      .mOffset = it.mOffset,
+      .mLength = it.mLength,
+      .mActualLength = it.mActualLength,
+      .mStatus = it.mStatus,
+    };
+  }
+  return ret;
+}
+
+BOOL FredEmmott_USBIP_VirtPP_Request_IsPending(
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
+  const auto request = GetRequest(handle);
+  if (!request) {
+    return false;
+  }
+  const auto connection = request->mConnection.lock();
+  if (!connection) {
+    return false;
+  }
+  return connection->mPendingURBs.lock()->contains(request->mSequenceNumber);
 }
 
 FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Request_SendReply(
-  FredEmmott_USBIP_VirtPP_RequestHandle request,
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle,
   const void* const data,
   const size_t dataSize) {
-  const auto socket = request->mSocket;
+  const FredEmmott_USBIP_VirtPP_Buffer buffer {data, dataSize};
+  return FredEmmott_USBIP_VirtPP_Request_SendReplyV(handle, &buffer, 1);
+}
+
+FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Request_SendReplyV(
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle,
+  const FredEmmott_USBIP_VirtPP_Buffer* const buffers,
+  const size_t bufferCount) {
+  const auto request = GetRequest(handle);
+  if (!request) [[unlikely]] {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_HANDLE);
+  }
+  const auto connection = request->mConnection.lock();
+  if (!connection) [[unlikely]] {
+    return HRESULT_FROM_WIN32(WSAENOTCONN);
+  }
+  if (!connection->mPendingURBs.lock()->erase(request->mSequenceNumber)) {
+    // Unlinked, or already answered; the host isn't expecting a reply
+    return FredEmmott_USBIP_VirtPP_SUCCESS;
+  }
+  auto& instance = *request->mInstance;
+
+  std::size_t dataSize {};
+  for (auto&& buffer: std::span {buffers, bufferCount}) {
+    dataSize += buffer.mSize;
+  }
+  auto actualLength
+    = std::min<std::size_t>(dataSize, request->mTransferBufferLength);
+  // Every URB needs a reply, so rather than dropping a report entirely, we
+  // complete the URB with no data; the host resubmits it, and will get a
+  // newer report.
+  //
+  // Only endpoints the device has marked as superseding are affected;
+  // dropping anything else, e.g. bulk data, would lose it for good.
+  if (
+    request->mIsSupersededInput && actualLength > 0
+    && instance.ShouldDropInputReport(
+      *connection, sizeof(USBIP::USBIP_RET_SUBMIT) + actualLength)) {
+    actualLength = 0;
+  }
+  const auto response
+    = MakeReplyHeader(*request, static_cast<uint32_t>(actualLength));
+  request->mDeviceStats->OnReply(response.mStatus, actualLength);
+  instance.mTracer.OnURB(
+    Tracer::URBStage::Answered, request->mTraceID, response.mStatus);
+
+  // Kept to reuse the allocation
+  thread_local std::vector<std::span<const std::byte>> spans;
+  spans.clear();
+  spans.push_back(std::as_bytes(std::span {&response, 1}));
+  auto remaining = actualLength;
+  for (auto&& buffer: std::span {buffers, bufferCount}) {
+    if (remaining == 0) {
+      break;
+    }
+    const auto size = std::min(buffer.mSize, remaining);
+    spans.push_back({static_cast<const std::byte*>(buffer.mData), size});
+    remaining -= size;
+  }
+  if (instance.mCapture) {
+    instance.mCapture->OnComplete(
+      GetCaptureURB(*request), response, std::span {spans}.subspan(1), {});
+  }
+
+  return std::bit_cast<FredEmmott_USBIP_VirtPP_Result>(
+    instance.Send(*connection, spans));
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_Request_SendStreamingReply(
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle,
+  const size_t length,
+  const FredEmmott_USBIP_VirtPP_StreamProducer* const producer) {
+  const auto complete = scope_exit([producer] {
+    if (producer && producer->OnComplete) {
+      producer->OnComplete(producer->mUserData);
+    }
+  });
+  if (!(producer && producer->OnRead)) [[unlikely]] {
+    return E_INVALIDARG;
+  }
+  const auto request = GetRequest(handle);
+  if (!request) [[unlikely]] {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_HANDLE);
+  }
+  const auto connection = request->mConnection.lock();
+  if (!connection) [[unlikely]] {
+    return HRESULT_FROM_WIN32(WSAENOTCONN);
+  }
+  if (!connection->mPendingURBs.lock()->erase(request->mSequenceNumber)) {
+    // Unlinked, or already answered; the host isn't expecting a reply
+    return FredEmmott_USBIP_VirtPP_SUCCESS;
+  }
+
   const auto actualLength
-    = std::min<uint32_t>(dataSize, request->mTransferBufferLength);
-  USBIP::USBIP_RET_SUBMIT response {
-    .mActualLength = actualLength,
+    = std::min<std::size_t>(length, request->mTransferBufferLength);
+  const auto response
+    = MakeReplyHeader(*request, static_cast<uint32_t>(actualLength));
+  request->mDeviceStats->OnReply(response.mStatus, actualLength);
+  request->mInstance->mTracer.OnURB(
+    Tracer::URBStage::Answered, request->mTraceID, response.mStatus);
+  const std::span<const std::byte> buffers[] {
+    std::as_bytes(std::span {&response, 1}),
   };
-  response.mHeader.mSequenceNumber = request->mSequenceNumber;
-
-  const std::unique_lock lock(request->mDevice->mReplyMutex);
+  if (const auto& capture = request->mInstance->mCapture) {
+    // The data hasn't been produced yet
+    capture->OnComplete(GetCaptureURB(*request), response, {}, {});
+  }
+  // From here on, the reply calls `OnComplete`
+  complete.release();
+  return std::bit_cast<FredEmmott_USBIP_VirtPP_Result>(
+    request->mInstance->Send(
+      *connection, Reply::CreateStreaming(buffers, actualLength, *producer)));
+}
 
-  if (const auto ret = SendAll(socket, response); !ret) [[unlikely]] {
-    return std::bit_cast<FredEmmott_USBIP_VirtPP_Result>(ret.error());
+FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Request_SendIsoReply(
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle,
+  const void* const data,
+  const FredEmmott_USBIP_VirtPP_IsoPacket* const packets,
+  const size_t packetCount) {
+  const auto request = GetRequest(handle);
+  if (!request) [[unlikely]] {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_HANDLE);
+  }
+  const auto isInput = request->mDirection == USBIP::Direction::In;
+  if (
+    packetCount == 0 || packetCount != request->mIsoPacketCount || !packets
+    || (isInput && !data)) [[unlikely]] {
+    return E_INVALIDARG;
+  }
+  const auto connection = request->mConnection.lock();
+  if (!connection) [[unlikely]] {
+    return HRESULT_FROM_WIN32(WSAENOTCONN);
   }
-  if (actualLength == 0) {
+  if (!connection->mPendingURBs.lock()->contains(request->mSequenceNumber)) {
+    // Unlinked, or already answered; the host isn't expecting a reply
     return FredEmmott_USBIP_VirtPP_SUCCESS;
   }
 
-  if (const auto ret = SendAll(socket, data, actualLength); !ret) [[unlikely]] {
-    return std::bit_cast<FredEmmott_USBIP_VirtPP_Result>(ret.error());
+  // Kept to reuse the allocations
+  thread_local std::vector<USBIP::USBIP_ISO_PACKET_DESCRIPTOR> descriptors;
+  thread_local std::vector<std::span<const std::byte>> spans;
+  descriptors.clear();
+  spans.clear();
+  // The RET_SUBMIT, once we know the start frame
+  spans.emplace_back();
+
+  uint32_t actualLength {};
+  uint32_t errorCount {};
+  for (auto&& packet: std::span {packets, packetCount}) {
+    if (isInput) {
+      if (
+        packet.mOffset > request->mTransferBufferLength
+        || packet.mActualLength
+          > request->mTransferBufferLength - packet.mOffset) [[unlikely]] {
+        return E_INVALIDARG;
+      }
+      // IN data is packed; the client moves each packet back to `mOffset`
+      if (packet.mActualLength) {
+        spans.push_back({
+          static_cast<const std::byte*>(data) + packet.mOffset,
+          packet.mActualLength,
+        });
+      }
+    }
+    actualLength += packet.mActualLength;
+    if (packet.mStatus != 0) {
+      ++errorCount;
+    }
+    descriptors.push_back({
+      .mOffset = packet.mOffset,
+      .mLength = packet.mLength,
+      .mActualLength = packet.mActualLength,
+      .mStatus = packet.mStatus,
+    });
   }
+  spans.push_back(std::as_bytes(std::span {descriptors}));
+
+  auto& instance = *request->mInstance;
+  const auto transfer = instance.mIsoScheduler.Reserve(
+    *connection,
+    {request->mDeviceID, request->mEndpoint | (isInput ? 0x80 : 0)},
+    uint64_t {packetCount} * std::max<uint32_t>(request->mInterval, 1));
+
+  USBIP::USBIP_RET_SUBMIT response {
+    .mActualLength = actualLength,
+    .mStartFrame = static_cast<uint32_t>(transfer.mStartFrame)
+      & IsoScheduler::FrameNumberMask,
+    .mNumberOfPackets = static_cast<uint32_t>(packetCount),
+    .mErrorCount = errorCount,
+  };
+  response.mHeader.mSequenceNumber = request->mSequenceNumber;
+  spans.front() = std::as_bytes(std::span {&response, 1});
+  instance.mTracer.OnURB(Tracer::URBStage::Scheduled, request->mTraceID);
 
-  return FredEmmott_USBIP_VirtPP_SUCCESS;
+  return std::bit_cast<FredEmmott_USBIP_VirtPP_Result>(instance.SendWhenDue(
+    connection, request->mSequenceNumber, transfer.mDue, Reply::Create(spans)));
 }
 
 FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
-  FredEmmott_USBIP_VirtPP_RequestHandle request,
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle,
   const int32_t status) {
-  const auto socket = request->mDevice->mInstance->mClientSocket;
+  const auto request = GetRequest(handle);
+  if (!request) [[unlikely]] {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_HANDLE);
+  }
+  const auto connection = request->mConnection.lock();
+  if (!connection) [[unlikely]] {
+    return HRESULT_FROM_WIN32(WSAENOTCONN);
+  }
+  if (!connection->mPendingURBs.lock()->erase(request->mSequenceNumber)) {
+    // Unlinked, or already answered; the host isn't expecting a reply
+    return FredEmmott_USBIP_VirtPP_SUCCESS;
+  }
+  request->mDeviceStats->OnReply(status, 0);
+  request->mInstance->mTracer.OnURB(
+    Tracer::URBStage::Answered, request->mTraceID, status);
   USBIP::USBIP_RET_SUBMIT response {.mStatus = status};
   response.mHeader.mSequenceNumber = request->mSequenceNumber;
+  if (request->mIsoPacketCount) {
+    // No packet descriptors follow
+    response.mNumberOfPackets = 0;
+  }
 
-  const auto lock = std::unique_lock(request->mDevice->mReplyMutex);
-  if (const auto ret = SendAll(socket, response); !ret) [[unlikely]] {
-    return std::bit_cast<FredEmmott_USBIP_VirtPP_Result>(ret.error());
+  const std::span<const std::byte> buffers[] {
+    std::as_bytes(std::span {&response, 1}),
+  };
+  if (const auto& capture = request->mInstance->mCapture) {
+    capture->OnComplete(GetCaptureURB(*request), response, {}, {});
   }
-  return FredEmmott_USBIP_VirtPP_SUCCESS;
+
+  return std::bit_cast<FredEmmott_USBIP_VirtPP_Result>(
+    request->mInstance->Send(*connection, buffers));
 }
 
 FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_Request_SendStringReply(
   const FredEmmott_USBIP_VirtPP_RequestHandle handle,
   wchar_t const* data,
   size_t charCount) {
-  const auto byteCount
-    = (charCount * 2) + offsetof(_USB_STRING_DESCRIPTOR, bString);
-  // TODO: check byteCount <= 0xff
+  using Descriptor = FredEmmott_USBSpec_StringDescriptor;
+  // USB strings are UTF-16LE; `wchar_t` is UTF-32 on Linux
+  thread_local std::u16string utf16;
+  utf16.clear();
+  if constexpr (sizeof(wchar_t) == sizeof(char16_t)) {
+    utf16.assign(reinterpret_cast<const char16_t*>(data), charCount);
+  } else {
+    for (const auto c: std::span {data, charCount}) {
+      const auto codePoint = static_cast<char32_t>(c);
+      if (codePoint < 0x10000) {
+        utf16.push_back(static_cast<char16_t>(codePoint));
+        continue;
+      }
+      const auto offset = codePoint - 0x10000;
+      utf16.push_back(static_cast<char16_t>(0xd800 + (offset >> 10)));
+      utf16.push_back(static_cast<char16_t>(0xdc00 + (offset & 0x3ff)));
+    }
+  }
+
   thread_local union {
-    _USB_STRING_DESCRIPTOR descriptor;
+    Descriptor descriptor;
     std::byte bytes[128];
   } reply;
+  constexpr auto HeaderSize = offsetof(Descriptor, bString);
+  const auto stringBytes = std::min(
+    utf16.size() * sizeof(char16_t), sizeof(reply.bytes) - HeaderSize);
+  const auto byteCount = HeaderSize + stringBytes;
   reply.descriptor = {
     .bLength = static_cast<uint8_t>(byteCount),
     .bDescriptorType = 0x03,// STRING
   };
-  memcpy(reply.descriptor.bString, data, charCount * 2);
+  memcpy(reply.bytes + HeaderSize, utf16.data(), stringBytes);
   return FredEmmott_USBIP_VirtPP_Request_SendReply(
     handle, reply.bytes, byteCount);
 }
 
 FredEmmott_USBIP_VirtPP_RequestHandle FredEmmott_USBIP_VirtPP_Request_Clone(
-  const FredEmmott_USBIP_VirtPP_RequestHandle orig) {
-  if (!orig) {
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
+  if (!handle) {
+    return nullptr;
+  }
+  const auto orig = GetRequest(handle);
+  if (!orig) [[unlikely]] {
+    __debugbreak();
     return nullptr;
   }
-  return new FredEmmott_USBIP_VirtPP_Request(*orig);
+  auto clone = *orig;
+  // Clones can outlive the callback, but the payload can't
+  clone.mPayload = {};
+  clone.mPayloadBlock = nullptr;
+  clone.mIsoPackets = {};
+  orig->mInstance->mTracer.OnURB(Tracer::URBStage::Parked, orig->mTraceID);
+  if (!clone.mDeviceStatsOwner) {
+    clone.mDeviceStatsOwner = orig->mDevice->mStats;
+  }
+  return orig->mInstance->mRequestPool.Create(clone);
 }
 
 void FredEmmott_USBIP_VirtPP_Request_Destroy(
-  FredEmmott_USBIP_VirtPP_RequestHandle handle) {
-  delete handle;
-}
\ No newline at end of file
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
+  if (!handle) {
+    return;
+  }
+  const auto request = GetRequest(handle);
+  if (!request || handle == request) [[unlikely]] {
+    // Stale, destroyed twice, or not from `_Clone()`
+    __debugbreak();
+    return;
+  }
+  const auto instance = request->mInstance;
+  if (!instance->mRequestPool.Destroy(handle)) [[unlikely]] {
+    // Raced with another `_Destroy()` for the same handle
+    instance->LogError("Request handle destroyed twice");
+    __debugbreak();
+  }
+}
+
+FredEmmott_USBIP_VirtPP_PayloadHandle
+FredEmmott_USBIP_VirtPP_Request_RetainPayload(
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle) {
+  const auto request = GetRequest(handle);
+  if (!request || !request->mPayloadBlock || request->mPayload.empty())
+    [[unlikely]] {
+    return nullptr;
+  }
+  // The receive buffer moves to another block instead of overwriting this
+  request->mPayloadBlock->AddRef();
+  const auto instance = request->mInstance;
+  return instance->mPayloadPool.Create({
+    .mInstance = instance,
+    .mBlock = request->mPayloadBlock,
+    .mData = request->mPayload,
+  });
+}
+
+const void* FredEmmott_USBIP_VirtPP_Payload_GetData(
+  const FredEmmott_USBIP_VirtPP_PayloadHandle handle) {
+  using Pool = HandlePool<FredEmmott_USBIP_VirtPP_Payload>;
+  const auto payload = Pool::Get(handle);
+  return payload ? payload->mData.data() : nullptr;
+}
+
+size_t FredEmmott_USBIP_VirtPP_Payload_GetSize(
+  const FredEmmott_USBIP_VirtPP_PayloadHandle handle) {
+  using Pool = HandlePool<FredEmmott_USBIP_VirtPP_Payload>;
+  const auto payload = Pool::Get(handle);
+  return payload ? payload->mData.size() : 0;
+}
+
+void FredEmmott_USBIP_VirtPP_Payload_Release(
+  const FredEmmott_USBIP_VirtPP_PayloadHandle handle) {
+  if (!handle) {
+    return;
+  }
+  using Pool = HandlePool<FredEmmott_USBIP_VirtPP_Payload>;
+  const auto payload = Pool::Get(handle);
+  if (!payload) [[unlikely]] {
+    // Stale, or released twice
+    __debugbreak();
+    return;
+  }
+  const auto block = payload->mBlock;
+  if (!payload->mInstance->mPayloadPool.Destroy(handle)) [[unlikely]] {
+    // Raced with another `_Release()` for the same handle
+    __debugbreak();
+    return;
+  }
+  block->Release();
+}
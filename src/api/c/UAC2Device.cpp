@@ -0,0 +1,752 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+#include "detail-RequestType.hpp"
+#include "detail-UAC2Device.hpp"
+#include "detail.hpp"
+
+#include <FredEmmott/USBIP-VirtPP/Device.h>
+#include <FredEmmott/USBIP-VirtPP/UAC2Device.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace {
+enum class Interface : uint8_t {
+  AudioControl = 0,
+  Playback = 1,
+  Capture = 2,
+};
+enum class Endpoint : uint8_t {
+  Control = 0,
+  Playback = 1,
+  Capture = 2,
+};
+enum class StringIndex : uint8_t {
+  LangID = 0,
+  Manufacturer = 1,
+  Product = 2,
+};
+// IDs of the clock, units, and terminals of the audio function
+enum class Entity : uint8_t {
+  Clock = 1,
+  PlaybackStream = 2,
+  Speaker = 3,
+  Microphone = 4,
+  CaptureStream = 5,
+};
+
+constexpr uint32_t SampleRate = FredEmmott_USBIP_VirtPP_UAC2Device_SampleRate;
+constexpr uint8_t ChannelCount
+  = FredEmmott_USBIP_VirtPP_UAC2Device_ChannelCount;
+constexpr uint16_t BytesPerFrame = ChannelCount * sizeof(int16_t);
+// Audio frames per 1ms USB frame
+constexpr uint16_t FramesPerPacket = SampleRate / 1000;
+constexpr uint16_t MaxPacketSize = FramesPerPacket * BytesPerFrame;
+constexpr uint32_t DefaultRingFrames = SampleRate / 10;
+// Hosts queue several transfers when a stream starts, so the first few
+// arrive back-to-back; they're left out of the jitter measurement
+constexpr uint32_t JitterWarmUpTransfers = 16;
+
+// Linux's value; `<errno.h>` on Windows has a different one
+constexpr int32_t LinuxEOVERFLOW = 75;
+
+// USB Audio Class 2.0 request codes and control selectors
+constexpr uint8_t CUR = 0x01;
+constexpr uint8_t RANGE = 0x02;
+constexpr uint8_t SamplingFrequencyControl = 0x01;
+constexpr uint8_t ClockValidControl = 0x02;
+
+#pragma pack(push, 1)
+struct InterfaceAssociationDescriptor {
+  uint8_t bLength {sizeof(InterfaceAssociationDescriptor)};
+  uint8_t bDescriptorType {0x0B};// INTERFACE_ASSOCIATION
+  uint8_t bFirstInterface {};
+  uint8_t bInterfaceCount {};
+  uint8_t bFunctionClass {0x01};// AUDIO
+  uint8_t bFunctionSubClass {0x00};
+  uint8_t bFunctionProtocol {0x20};// IP_VERSION_02_00
+  uint8_t iFunction {};
+};
+static_assert(sizeof(InterfaceAssociationDescriptor) == 8);
+
+struct AudioControlHeaderDescriptor {
+  uint8_t bLength {sizeof(AudioControlHeaderDescriptor)};
+  uint8_t bDescriptorType {0x24};// CS_INTERFACE
+  uint8_t bDescriptorSubtype {0x01};// HEADER
+  uint16_t bcdADC {0x02'00};
+  uint8_t bCategory {0x08};// I/O box
+  uint16_t wTotalLength {};
+  uint8_t bmControls {};
+};
+static_assert(sizeof(AudioControlHeaderDescriptor) == 9);
+
+struct ClockSourceDescriptor {
+  uint8_t bLength {sizeof(ClockSourceDescriptor)};
+  uint8_t bDescriptorType {0x24};// CS_INTERFACE
+  uint8_t bDescriptorSubtype {0x0A};// CLOCK_SOURCE
+  uint8_t bClockID {std::to_underlying(Entity::Clock)};
+  uint8_t bmAttributes {0x01};// internal fixed clock
+  uint8_t bmControls {0b0101};// frequency and validity are read-only
+  uint8_t bAssocTerminal {};
+  uint8_t iClockSource {};
+};
+static_assert(sizeof(ClockSourceDescriptor) == 8);
+
+struct InputTerminalDescriptor {
+  uint8_t bLength {sizeof(InputTerminalDescriptor)};
+  uint8_t bDescriptorType {0x24};// CS_INTERFACE
+  uint8_t bDescriptorSubtype {0x02};// INPUT_TERMINAL
+  uint8_t bTerminalID {};
+  uint16_t wTerminalType {};
+  uint8_t bAssocTerminal {};
+  uint8_t bCSourceID {std::to_underlying(Entity::Clock)};
+  uint8_t bNrChannels {ChannelCount};
+  uint32_t bmChannelConfig {0b11};// front left, front right
+  uint8_t iChannelNames {};
+  uint16_t bmControls {};
+  uint8_t iTerminal {};
+};
+static_assert(sizeof(InputTerminalDescriptor) == 17);
+
+struct OutputTerminalDescriptor {
+  uint8_t bLength {sizeof(OutputTerminalDescriptor)};
+  uint8_t bDescriptorType {0x24};// CS_INTERFACE
+  uint8_t bDescriptorSubtype {0x03};// OUTPUT_TERMINAL
+  uint8_t bTerminalID {};
+  uint16_t wTerminalType {};
+  uint8_t bAssocTerminal {};
+  uint8_t bSourceID {};
+  uint8_t bCSourceID {std::to_underlying(Entity::Clock)};
+  uint16_t bmControls {};
+  uint8_t iTerminal {};
+};
+static_assert(sizeof(OutputTerminalDescriptor) == 12);
+
+struct AudioStreamingGeneralDescriptor {
+  uint8_t bLength {sizeof(AudioStreamingGeneralDescriptor)};
+  uint8_t bDescriptorType {0x24};// CS_INTERFACE
+  uint8_t bDescriptorSubtype {0x01};// AS_GENERAL
+  uint8_t bTerminalLink {};
+  uint8_t bmControls {};
+  uint8_t bFormatType {0x01};// FORMAT_TYPE_I
+  uint32_t bmFormats {0x01};// PCM
+  uint8_t bNrChannels {ChannelCount};
+  uint32_t bmChannelConfig {0b11};// front left, front right
+  uint8_t iChannelNames {};
+};
+static_assert(sizeof(AudioStreamingGeneralDescriptor) == 16);
+
+struct FormatTypeIDescriptor {
+  uint8_t bLength {sizeof(FormatTypeIDescriptor)};
+  uint8_t bDescriptorType {0x24};// CS_INTERFACE
+  uint8_t bDescriptorSubtype {0x02};// FORMAT_TYPE
+  uint8_t bFormatType {0x01};// FORMAT_TYPE_I
+  uint8_t bSubslotSize {sizeof(int16_t)};
+  uint8_t bBitResolution {16};
+};
+static_assert(sizeof(FormatTypeIDescriptor) == 6);
+
+struct AudioStreamingEndpointDescriptor {
+  uint8_t bLength {sizeof(AudioStreamingEndpointDescriptor)};
+  uint8_t bDescriptorType {0x25};// CS_ENDPOINT
+  uint8_t bDescriptorSubtype {0x01};// EP_GENERAL
+  uint8_t bmAttributes {};
+  uint8_t bmControls {};
+  uint8_t bLockDelayUnits {};
+  uint16_t wLockDelay {};
+};
+static_assert(sizeof(AudioStreamingEndpointDescriptor) == 8);
+
+// Alternate setting 0 has no endpoints, so the host can stop the stream
+struct AudioStreamingInterface {
+  FredEmmott_USBSpec_InterfaceDescriptor mIdle {};
+  FredEmmott_USBSpec_InterfaceDescriptor mActive {};
+  AudioStreamingGeneralDescriptor mGeneral {};
+  FormatTypeIDescriptor mFormat {};
+  FredEmmott_USBSpec_EndpointDescriptor mEndpoint {};
+  AudioStreamingEndpointDescriptor mClassEndpoint {};
+};
+
+constexpr AudioStreamingInterface MakeAudioStreamingInterface(
+  const Interface interfaceNumber,
+  const Entity terminal,
+  const uint8_t endpointAddress,
+  const uint8_t endpointAttributes) {
+  const FredEmmott_USBSpec_InterfaceDescriptor idle {
+    .bLength = FredEmmott_USBSpec_InterfaceDescriptor_Size,
+    .bDescriptorType = 0x04,// INTERFACE
+    .bInterfaceNumber = std::to_underlying(interfaceNumber),
+    .bAlternateSetting = 0,
+    .bNumEndpoints = 0,
+    .bInterfaceClass = 0x01,// AUDIO
+    .bInterfaceSubClass = 0x02,// AUDIOSTREAMING
+    .bInterfaceProtocol = 0x20,// IP_VERSION_02_00
+  };
+  auto active = idle;
+  active.bAlternateSetting = 1;
+  active.bNumEndpoints = 1;
+  return {
+    .mIdle = idle,
+    .mActive = active,
+    .mGeneral = {.bTerminalLink = std::to_underlying(terminal)},
+    .mEndpoint = {
+      .bLength = FredEmmott_USBSpec_EndPointDescriptor_Size,
+      .bDescriptorType = 0x05,// ENDPOINT
+      .bEndpointAddress = endpointAddress,
+      .bmAttributes = endpointAttributes,
+      .wMaxPacketSize = MaxPacketSize,
+      .bInterval = 0x01,// every frame
+    },
+  };
+}
+
+// Reply to CUR/RANGE for the sampling frequency
+struct SamplingFrequencyRange {
+  uint16_t wNumSubRanges {1};
+  uint32_t dMIN {SampleRate};
+  uint32_t dMAX {SampleRate};
+  uint32_t dRES {};
+};
+static_assert(sizeof(SamplingFrequencyRange) == 14);
+#pragma pack(pop)
+}// namespace
+
+const FredEmmott_USBSpec_DeviceDescriptor&
+FredEmmott_USBIP_VirtPP_UAC2Device::GetDeviceDescriptor() {
+  static constexpr FredEmmott_USBSpec_DeviceDescriptor ConstDescriptor {
+    .bLength = sizeof(ConstDescriptor),
+    .bDescriptorType = 0x01,
+    .bcdUSB = 0x02'00,
+    // Defined by interface association descriptors
+    .bDeviceClass = 0xEF,
+    .bDeviceSubClass = 0x02,
+    .bDeviceProtocol = 0x01,
+    .bMaxPacketSize0 = 0x40,
+    .idVendor = 0x1209,// pid.codes open source
+    .idProduct = 0x0001,// pid.codes test PID
+    .bcdDevice = 0x01'00,
+    .iManufacturer = std::to_underlying(StringIndex::Manufacturer),
+    .iProduct = std::to_underlying(StringIndex::Product),
+    .bNumConfigurations = 1,
+  };
+  return ConstDescriptor;
+}
+
+#pragma pack(push, 1)
+struct FredEmmott_USBIP_VirtPP_UAC2Device::ConfigurationDescriptor {
+  FredEmmott_USBSpec_ConfigurationDescriptor mConfigurationDescriptor {
+    .bLength = FredEmmott_USBSpec_ConfigurationDescriptor_Size,
+    .bDescriptorType = 0x02,
+    .wTotalLength = sizeof(ConfigurationDescriptor),
+    .bNumInterfaces = 3,
+    .bConfigurationValue = 1,
+    .bmAttributes = 0x80,// bus-powered
+    .MaxPower = 0x32,// 100mA
+  };
+  InterfaceAssociationDescriptor mAssociation {
+    .bFirstInterface = std::to_underlying(Interface::AudioControl),
+    .bInterfaceCount = 3,
+  };
+  FredEmmott_USBSpec_InterfaceDescriptor mAudioControlInterface {
+    .bLength = FredEmmott_USBSpec_InterfaceDescriptor_Size,
+    .bDescriptorType = 0x04,// INTERFACE
+    .bInterfaceNumber = std::to_underlying(Interface::AudioControl),
+    .bAlternateSetting = 0,
+    .bNumEndpoints = 0,
+    .bInterfaceClass = 0x01,// AUDIO
+    .bInterfaceSubClass = 0x01,// AUDIOCONTROL
+    .bInterfaceProtocol = 0x20,// IP_VERSION_02_00
+  };
+  struct AudioControlTopology {
+    AudioControlHeaderDescriptor mHeader {
+      .wTotalLength = sizeof(AudioControlTopology),
+    };
+    ClockSourceDescriptor mClock {};
+    // Playback: USB streaming -> speaker
+    InputTerminalDescriptor mPlaybackStream {
+      .bTerminalID = std::to_underlying(Entity::PlaybackStream),
+      .wTerminalType = 0x0101,// USB streaming
+    };
+    OutputTerminalDescriptor mSpeaker {
+      .bTerminalID = std::to_underlying(Entity::Speaker),
+      .wTerminalType = 0x0301,// speaker
+      .bSourceID = std::to_underlying(Entity::PlaybackStream),
+    };
+    // Capture: microphone -> USB streaming
+    InputTerminalDescriptor mMicrophone {
+      .bTerminalID = std::to_underlying(Entity::Microphone),
+      .wTerminalType = 0x0201,// microphone
+    };
+    OutputTerminalDescriptor mCaptureStream {
+      .bTerminalID = std::to_underlying(Entity::CaptureStream),
+      .wTerminalType = 0x0101,// USB streaming
+      .bSourceID = std::to_underlying(Entity::Microphone),
+    };
+  } mAudioControlTopology;
+  AudioStreamingInterface mPlaybackInterface = MakeAudioStreamingInterface(
+    Interface::Playback,
+    Entity::PlaybackStream,
+    std::to_underlying(Endpoint::Playback),// OUT
+    0x09);// isochronous, adaptive
+  AudioStreamingInterface mCaptureInterface = MakeAudioStreamingInterface(
+    Interface::Capture,
+    Entity::CaptureStream,
+    0x80 | std::to_underlying(Endpoint::Capture),// IN
+    0x05);// isochronous, asynchronous
+};
+#pragma pack(pop)
+
+const FredEmmott_USBIP_VirtPP_UAC2Device::ConfigurationDescriptor&
+FredEmmott_USBIP_VirtPP_UAC2Device::GetConfigurationDescriptor() {
+  static constexpr ConfigurationDescriptor ConstDescriptor {};
+  return ConstDescriptor;
+}
+
+FredEmmott_USBIP_VirtPP_UAC2DeviceHandle
+FredEmmott_USBIP_VirtPP_UAC2Device_Create(
+  const FredEmmott_USBIP_VirtPP_InstanceHandle instance,
+  const FredEmmott_USBIP_VirtPP_UAC2Device_InitData* initData) {
+  if (!instance) {
+    return nullptr;
+  }
+  if (!initData) {
+    instance->LogError("UAC2Device_InitData is required");
+    return nullptr;
+  }
+  auto ret = std::make_unique<FredEmmott_USBIP_VirtPP_UAC2Device>(
+    instance, *initData);
+  if (ret->mUSBDevice) {
+    return ret.release();
+  }
+  return nullptr;
+}
+
+void FredEmmott_USBIP_VirtPP_UAC2Device_Destroy(
+  const FredEmmott_USBIP_VirtPP_UAC2DeviceHandle handle) {
+  delete handle;
+}
+
+void* FredEmmott_USBIP_VirtPP_UAC2Device_GetUserData(
+  const FredEmmott_USBIP_VirtPP_UAC2DeviceHandle handle) {
+  return handle->mUserData;
+}
+
+size_t FredEmmott_USBIP_VirtPP_UAC2Device_ReadPlayback(
+  const FredEmmott_USBIP_VirtPP_UAC2DeviceHandle handle,
+  int16_t* const samples,
+  const size_t frameCount) {
+  return handle->ReadPlayback({samples, frameCount * ChannelCount})
+    / ChannelCount;
+}
+
+size_t FredEmmott_USBIP_VirtPP_UAC2Device_WriteCapture(
+  const FredEmmott_USBIP_VirtPP_UAC2DeviceHandle handle,
+  const int16_t* const samples,
+  const size_t frameCount) {
+  return handle->WriteCapture({samples, frameCount * ChannelCount})
+    / ChannelCount;
+}
+
+void FredEmmott_USBIP_VirtPP_UAC2Device_GetStats(
+  const FredEmmott_USBIP_VirtPP_UAC2DeviceHandle handle,
+  FredEmmott_USBIP_VirtPP_UAC2Device_Stats* const stats) {
+  *stats = handle->GetStats();
+}
+
+FredEmmott_USBIP_VirtPP_UAC2Device::FredEmmott_USBIP_VirtPP_UAC2Device(
+  FredEmmott_USBIP_VirtPP_InstanceHandle instance,
+  const FredEmmott_USBIP_VirtPP_UAC2Device_InitData& initData)
+  : mUserData(initData.mUserData),
+    mInstance(instance),
+    // Every read and write is whole frames, and the capacities are powers of
+    // two, so the rings never split a frame
+    mPlaybackRing(
+      std::size_t {initData.mRingFrames ? initData.mRingFrames
+                                        : DefaultRingFrames}
+      * ChannelCount),
+    mCaptureRing(mPlaybackRing.GetCapacity()) {
+  const auto& configuration = GetConfigurationDescriptor();
+  const FredEmmott_USBSpec_InterfaceDescriptor interfaces[] {
+    configuration.mAudioControlInterface,
+    configuration.mPlaybackInterface.mIdle,
+    configuration.mCaptureInterface.mIdle,
+  };
+  const FredEmmott_USBIP_VirtPP_Device_InitData usbDeviceInit {
+    .mUserData = this,
+    .mCallbacks = {&OnUSBInputRequestCallback, &OnUSBOutputRequestCallback},
+    .mAutoAttach = static_cast<bool>(initData.mAutoAttach),
+    .mDeviceDescriptor = &GetDeviceDescriptor(),
+    .mNumInterfaces = static_cast<uint8_t>(std::size(interfaces)),
+    .mInterfaceDescriptors = interfaces,
+  };
+  mUSBDevice = FredEmmott_USBIP_VirtPP_Device_Create(instance, &usbDeviceInit);
+}
+
+FredEmmott_USBIP_VirtPP_UAC2Device::~FredEmmott_USBIP_VirtPP_UAC2Device() {
+  FredEmmott_USBIP_VirtPP_Device_Destroy(mUSBDevice);
+}
+
+std::size_t FredEmmott_USBIP_VirtPP_UAC2Device::ReadPlayback(
+  const std::span<int16_t> samples) {
+  return mPlaybackRing.Read(
+    samples.first(samples.size() - (samples.size() % ChannelCount)));
+}
+
+std::size_t FredEmmott_USBIP_VirtPP_UAC2Device::WriteCapture(
+  const std::span<const int16_t> samples) {
+  return mCaptureRing.Write(
+    samples.first(samples.size() - (samples.size() % ChannelCount)));
+}
+
+FredEmmott_USBIP_VirtPP_UAC2Device_Stats
+FredEmmott_USBIP_VirtPP_UAC2Device::GetStats() const {
+  constexpr auto relaxed = std::memory_order_relaxed;
+  return {
+    .mPlaybackFrames = mPlayback.mFrames.load(relaxed),
+    .mPlaybackOverrunFrames = mPlayback.mXRunFrames.load(relaxed),
+    .mPlaybackMaxJitterMicroseconds
+    = mPlayback.mMaxJitterMicroseconds.load(relaxed),
+    .mCaptureFrames = mCapture.mFrames.load(relaxed),
+    .mCaptureUnderrunFrames = mCapture.mXRunFrames.load(relaxed),
+    .mCaptureMaxJitterMicroseconds
+    = mCapture.mMaxJitterMicroseconds.load(relaxed),
+  };
+}
+
+void FredEmmott_USBIP_VirtPP_UAC2Device::Stream::OnTransfer(
+  const uint32_t usbFrames) {
+  const auto now = Clock::now();
+  if (mTransferCount >= JitterWarmUpTransfers) {
+    const auto gap = now - mLastTransferAt;
+    const auto jitter = std::chrono::duration_cast<std::chrono::microseconds>(
+      (gap > mLastTransferLength) ? (gap - mLastTransferLength)
+                                  : (mLastTransferLength - gap));
+    // We're the only writer
+    const auto jitterMicroseconds = static_cast<uint64_t>(jitter.count());
+    if (
+      jitterMicroseconds
+      > mMaxJitterMicroseconds.load(std::memory_order_relaxed)) {
+      mMaxJitterMicroseconds.store(
+        jitterMicroseconds, std::memory_order_relaxed);
+    }
+  } else {
+    ++mTransferCount;
+  }
+  mLastTransferAt = now;
+  mLastTransferLength
+    = usbFrames * FredEmmott::USBVirtPP::IsoScheduler::FrameDuration;
+}
+
+void FredEmmott_USBIP_VirtPP_UAC2Device::Stream::Reset(
+  const uint8_t alternateSetting) {
+  mAlternateSetting = alternateSetting;
+  mTransferCount = 0;
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_UAC2Device::OnControlInputRequest(
+  FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint8_t rawRequestType,
+  uint8_t requestCode,
+  uint16_t value,
+  uint16_t index,
+  uint16_t length) {
+  const auto [direction, requestType, recipient]
+    = RequestType::Parse(rawRequestType);
+  using enum RequestType::Type;
+
+  if (requestType == Class && recipient == RequestType::Recipient::Interface) {
+    return OnClassInputRequest(request, requestCode, value, index);
+  }
+  if (requestType != Standard) {
+    return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+
+  switch (requestCode) {
+    case 0x00:// GET_STATUS
+      return FredEmmott_USBIP_VirtPP_Request_SendReply(request, uint16_t {});
+    case 0x06: /* GET_DESCRIPTOR */ {
+      const auto descriptorType = static_cast<uint8_t>(value >> 8);
+      const auto descriptorIndex = static_cast<uint8_t>(value & 0xff);
+      switch (descriptorType) {
+        case 0x01:// DEVICE
+          return FredEmmott_USBIP_VirtPP_Request_SendReply(
+            request, GetDeviceDescriptor());
+        case 0x02:// CONFIGURATION
+          return FredEmmott_USBIP_VirtPP_Request_SendReply(
+            request, GetConfigurationDescriptor());
+        case 0x03:// STRING
+          switch (static_cast<StringIndex>(descriptorIndex)) {
+            case StringIndex::LangID:
+              return FredEmmott_USBIP_VirtPP_Request_SendStringReply(
+                request, L"\x0409");// en_US
+            case StringIndex::Manufacturer:
+              return FredEmmott_USBIP_VirtPP_Request_SendStringReply(
+                request, L"Fred Emmott");
+            case StringIndex::Product:
+              return FredEmmott_USBIP_VirtPP_Request_SendStringReply(
+                request, L"USBIP-VirtPP Audio");
+          }
+          // e.g. MS OS descriptors
+          return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
+            request, -EPIPE);
+        default:
+          // DEVICE_QUALIFIER, BOS, etc
+          return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
+            request, -EPIPE);
+      }
+    }
+    case 0x0A: /* GET_INTERFACE */ {
+      switch (static_cast<Interface>(index & 0xff)) {
+        case Interface::AudioControl:
+          return FredEmmott_USBIP_VirtPP_Request_SendReply(request, uint8_t {});
+        case Interface::Playback:
+          return FredEmmott_USBIP_VirtPP_Request_SendReply(
+            request, mPlayback.mAlternateSetting);
+        case Interface::Capture:
+          return FredEmmott_USBIP_VirtPP_Request_SendReply(
+            request, mCapture.mAlternateSetting);
+      }
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+    }
+    default:
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_UAC2Device::OnClassInputRequest(
+  FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint8_t requestCode,
+  uint16_t value,
+  uint16_t index) {
+  const auto entity = static_cast<Entity>(index >> 8);
+  const auto controlSelector = static_cast<uint8_t>(value >> 8);
+  if (entity != Entity::Clock) {
+    // None of the terminals have any controls
+    return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+
+  if (controlSelector == SamplingFrequencyControl) {
+    if (requestCode == CUR) {
+      return FredEmmott_USBIP_VirtPP_Request_SendReply(request, SampleRate);
+    }
+    if (requestCode == RANGE) {
+      return FredEmmott_USBIP_VirtPP_Request_SendReply(
+        request, SamplingFrequencyRange {});
+    }
+  }
+  if (controlSelector == ClockValidControl && requestCode == CUR) {
+    return FredEmmott_USBIP_VirtPP_Request_SendReply(request, uint8_t {1});
+  }
+  return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_UAC2Device::OnControlOutputRequest(
+  FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint8_t rawRequestType,
+  uint8_t requestCode,
+  uint16_t value,
+  uint16_t index) {
+  const auto [direction, requestType, recipient]
+    = RequestType::Parse(rawRequestType);
+  using enum RequestType::Type;
+
+  if (requestType == Class) {
+    // We only have one sampling frequency, so setting it is a no-op
+    if (
+      static_cast<Entity>(index >> 8) == Entity::Clock && requestCode == CUR
+      && (value >> 8) == SamplingFrequencyControl) {
+      // Not actually an error with code 0
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, 0);
+    }
+    return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+  if (requestType != Standard) {
+    return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+
+  switch (requestCode) {
+    case 0x01:// CLEAR_FEATURE: no-op
+    case 0x09:// SET_CONFIGURATION no-op, we only support 1 configuration
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, 0);
+    case 0x0B: /* SET_INTERFACE */ {
+      if (value > 1) {
+        return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+      }
+      const auto alternateSetting = static_cast<uint8_t>(value);
+      switch (static_cast<Interface>(index & 0xff)) {
+        case Interface::AudioControl:
+          break;
+        case Interface::Playback:
+          mPlayback.Reset(alternateSetting);
+          mInstance->Log(
+            "[UAC2Device] Playback {}",
+            alternateSetting ? "started" : "stopped");
+          break;
+        case Interface::Capture:
+          mCapture.Reset(alternateSetting);
+          mInstance->Log(
+            "[UAC2Device] Capture {}",
+            alternateSetting ? "started" : "stopped");
+          break;
+        default:
+          return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
+            request, -EPIPE);
+      }
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, 0);
+    }
+    default:
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_UAC2Device::OnPlaybackRequest(
+  FredEmmott_USBIP_VirtPP_RequestHandle request,
+  const void* data,
+  uint32_t dataLength) {
+  const auto packetCount
+    = FredEmmott_USBIP_VirtPP_Request_GetIsoPacketCount(request);
+  if (packetCount == 0) [[unlikely]] {
+    return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+  // Kept to reuse the allocation
+  thread_local std::vector<FredEmmott_USBIP_VirtPP_IsoPacket> packets;
+  packets.resize(packetCount);
+  FredEmmott_USBIP_VirtPP_Request_GetIsoPackets(
+    request, packets.data(), packets.size());
+
+  const auto bytes = static_cast<const std::byte*>(data);
+  uint64_t frames {};
+  uint64_t overrunFrames {};
+  for (auto&& packet: packets) {
+    if (
+      packet.mLength > MaxPacketSize || packet.mOffset > dataLength
+      || packet.mLength > dataLength - packet.mOffset) [[unlikely]] {
+      packet.mActualLength = 0;
+      packet.mStatus = -LinuxEOVERFLOW;
+      continue;
+    }
+    // `data` may not be aligned
+    std::array<int16_t, MaxPacketSize / sizeof(int16_t)> samples;
+    const auto packetFrames = packet.mLength / BytesPerFrame;
+    std::memcpy(
+      samples.data(), bytes + packet.mOffset, packetFrames * BytesPerFrame);
+    const auto written = mPlaybackRing.Write(
+      std::span {samples}.first(packetFrames * ChannelCount));
+
+    frames += packetFrames;
+    overrunFrames += packetFrames - (written / ChannelCount);
+    packet.mActualLength = packet.mLength;
+    packet.mStatus = 0;
+  }
+  mPlayback.mFrames.fetch_add(frames, std::memory_order_relaxed);
+  mPlayback.mXRunFrames.fetch_add(overrunFrames, std::memory_order_relaxed);
+  mPlayback.OnTransfer(packetCount);
+
+  return FredEmmott_USBIP_VirtPP_Request_SendIsoReply(
+    request, data, packets.data(), packets.size());
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_UAC2Device::OnCaptureRequest(
+  FredEmmott_USBIP_VirtPP_RequestHandle request) {
+  const auto packetCount
+    = FredEmmott_USBIP_VirtPP_Request_GetIsoPacketCount(request);
+  if (packetCount == 0) [[unlikely]] {
+    return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+  // Kept to reuse the allocations
+  thread_local std::vector<FredEmmott_USBIP_VirtPP_IsoPacket> packets;
+  thread_local std::vector<std::byte> buffer;
+  packets.resize(packetCount);
+  FredEmmott_USBIP_VirtPP_Request_GetIsoPackets(
+    request, packets.data(), packets.size());
+  const auto length
+    = FredEmmott_USBIP_VirtPP_Request_GetTransferBufferLength(request);
+  buffer.resize(length);
+
+  uint64_t frames {};
+  uint64_t underrunFrames {};
+  for (auto&& packet: packets) {
+    if (packet.mOffset > length || packet.mLength > length - packet.mOffset)
+      [[unlikely]] {
+      packet.mActualLength = 0;
+      packet.mStatus = -LinuxEOVERFLOW;
+      continue;
+    }
+    // One USB frame's worth; silence if the ring runs dry
+    std::array<int16_t, MaxPacketSize / sizeof(int16_t)> samples {};
+    const auto packetFrames
+      = std::min<uint32_t>(packet.mLength / BytesPerFrame, FramesPerPacket);
+    const auto read = mCaptureRing.Read(
+      std::span {samples}.first(packetFrames * ChannelCount));
+    std::memcpy(
+      buffer.data() + packet.mOffset,
+      samples.data(),
+      packetFrames * BytesPerFrame);
+
+    frames += packetFrames;
+    underrunFrames += packetFrames - (read / ChannelCount);
+    packet.mActualLength = packetFrames * BytesPerFrame;
+    packet.mStatus = 0;
+  }
+  mCapture.mFrames.fetch_add(frames, std::memory_order_relaxed);
+  mCapture.mXRunFrames.fetch_add(underrunFrames, std::memory_order_relaxed);
+  mCapture.OnTransfer(packetCount);
+
+  return FredEmmott_USBIP_VirtPP_Request_SendIsoReply(
+    request, buffer.data(), packets.data(), packets.size());
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_UAC2Device::OnUSBInputRequestCallback(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  const uint32_t endpoint,
+  const uint8_t requestType,
+  const uint8_t requestCode,
+  const uint16_t value,
+  const uint16_t index,
+  const uint16_t length) {
+  auto& self = *static_cast<FredEmmott_USBIP_VirtPP_UAC2Device*>(
+    FredEmmott_USBIP_VirtPP_Request_GetDeviceUserData(request));
+  switch (static_cast<Endpoint>(endpoint)) {
+    case Endpoint::Control:
+      return self.OnControlInputRequest(
+        request, requestType, requestCode, value, index, length);
+    case Endpoint::Capture:
+      return self.OnCaptureRequest(request);
+    default:
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+}
+
+FredEmmott_USBIP_VirtPP_Result
+FredEmmott_USBIP_VirtPP_UAC2Device::OnUSBOutputRequestCallback(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  const uint32_t endpoint,
+  const uint8_t requestType,
+  const uint8_t requestCode,
+  const uint16_t value,
+  const uint16_t index,
+  const uint16_t length,
+  const void* data,
+  const uint32_t dataLength) {
+  auto& self = *static_cast<FredEmmott_USBIP_VirtPP_UAC2Device*>(
+    FredEmmott_USBIP_VirtPP_Request_GetDeviceUserData(request));
+  switch (static_cast<Endpoint>(endpoint)) {
+    case Endpoint::Control:
+      return self.OnControlOutputRequest(
+        request, requestType, requestCode, value, index);
+    case Endpoint::Playback:
+      return self.OnPlaybackRequest(request, data, dataLength);
+    default:
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+}
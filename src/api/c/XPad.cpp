@@ -7,6 +7,8 @@
 
 #include <FredEmmott/USBIP-VirtPP/XPad.h>
 
+#include <cstring>
+
 namespace {
 enum class Interface : uint8_t {
   Gamepad = 0,
@@ -34,15 +36,23 @@ FredEmmott_USBIP_VirtPP_Result FredEmmott_USBIP_VirtPP_XPad::UpdateInPlace(
     FredEmmott_USBIP_VirtPP_XPad_State*)) {
   callback(this, userData, &mXUSBReport.mGamepadInputReport.mState);
 
-  auto queue = mGamepadInputQueue.lock();
-  if (queue->empty()) {
+  const auto request = PopPendingGamepadInputRequest();
+  if (!request) {
     return FredEmmott_USBIP_VirtPP_SUCCESS;
   }
-  const auto request = std::move(queue->front());
-  queue->pop();
-  queue.unlock();
 
-  return FredEmmott_USBIP_VirtPP_Request_SendReply(request.get(), mXUSBReport);
+  return FredEmmott_USBIP_VirtPP_Request_SendReply(
+    request->get(), mXUSBReport);
+}
+
+std::optional<FredEmmott::USBVirtPP::unique_request>
+FredEmmott_USBIP_VirtPP_XPad::PopPendingGamepadInputRequest() {
+  auto request = mGamepadInputQueue.TryPop();
+  while (request
+         && !FredEmmott_USBIP_VirtPP_Request_IsPending(request->get())) {
+    request = mGamepadInputQueue.TryPop();
+  }
+  return request;
 }
 
 const FredEmmott_USBSpec_DeviceDescriptor&
@@ -176,6 +186,8 @@ FredEmmott_USBIP_VirtPP_XPad::FredEmmott_USBIP_VirtPP_XPad(
     .mDeviceDescriptor = &GetDeviceDescriptor(),
     .mNumInterfaces = 1,
     .mInterfaceDescriptors = &GetConfigurationDescriptor().mGamepadInterface,
+    // Each report is the full gamepad state
+    .mSupersededInputEndpoints = 1 << 1,
   };
   mUSBDevice = FredEmmott_USBIP_VirtPP_Device_Create(instance, &usbDeviceInit);
   if (!mUSBDevice) {
@@ -346,8 +358,26 @@ FredEmmott_USBIP_VirtPP_XPad::OnGamepadInputRequest(
   using enum RequestType::Type;
   using enum RequestType::Recipient;
   if (rawRequestType == 0 && requestCode == 0) {
-    mGamepadInputQueue.lock()->emplace(
-      FredEmmott_USBIP_VirtPP_Request_Clone(request));
+    FredEmmott::USBVirtPP::unique_request pending {
+      FredEmmott_USBIP_VirtPP_Request_Clone(request)};
+    if (mGamepadInputQueue.TryPush(std::move(pending))) [[likely]] {
+      return FredEmmott_USBIP_VirtPP_SUCCESS;
+    }
+    // Hosts that cancel and resubmit, e.g. on suspend, leave unlinked
+    // requests behind until the next report; they're the oldest, so this
+    // drops them. If the oldest is still wanted, the host has more in flight
+    // than we allow for, so fail that one instead of this one.
+    if (const auto oldest = PopPendingGamepadInputRequest()) {
+      mInstance->LogError("[XPad] Too many pending gamepad input requests");
+      std::ignore
+        = FredEmmott_USBIP_VirtPP_Request_SendErrorReply(oldest->get(), -EPIPE);
+    }
+    // This can still fail: a feeder thread's pop may have claimed a slot
+    // without releasing it yet. The host resubmits failed requests.
+    if (!mGamepadInputQueue.TryPush(std::move(pending))) [[unlikely]] {
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
+        pending.get(), -EPIPE);
+    }
     return FredEmmott_USBIP_VirtPP_SUCCESS;
   }
   return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
@@ -431,14 +461,14 @@ FredEmmott_USBIP_VirtPP_XPad::OnUSBOutputRequestCallback(
   const uint16_t length,
   const void* data,
   const uint32_t dataLength) {
-  std::println(
+  auto& self
+    = *static_cast<FredEmmott_USBIP_VirtPP_XPad*>(request->mDevice->mUserData);
+  self.mInstance->LogDebug(
     "XPad received OUTPUT request for EP {}: {:#04x}/{:#04x} - {} bytes",
     endpoint,
     requestType,
     requestCode,
     dataLength);
-  auto& self
-    = *static_cast<FredEmmott_USBIP_VirtPP_XPad*>(request->mDevice->mUserData);
   switch (static_cast<Endpoint>(endpoint)) {
     case Endpoint::Control:
       return self.OnControlOutputRequest(
@@ -0,0 +1,60 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "attach-backend.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+// Each attach is mostly waiting, so this can be well above the core count
+constexpr std::size_t MaxConcurrentAttaches = 64;
+#ifdef __linux__
+constexpr auto DefaultVHCISysfsPath = "/sys/devices/platform/vhci_hcd.0";
+#endif
+}// namespace
+
+std::vector<std::expected<uint16_t, HRESULT>> AttachBackend::AttachAll(
+  const uint16_t tcpPortNumber,
+  const std::span<const std::string> busIDs) {
+  std::vector<std::expected<uint16_t, HRESULT>> ret(busIDs.size());
+  if (busIDs.size() == 1) {
+    ret.front() = Attach(tcpPortNumber, busIDs.front());
+    return ret;
+  }
+
+  std::atomic<std::size_t> next {0};
+  const auto worker = [&] {
+    for (auto i = next.fetch_add(1, std::memory_order_relaxed);
+         i < busIDs.size();
+         i = next.fetch_add(1, std::memory_order_relaxed)) {
+      ret[i] = Attach(tcpPortNumber, busIDs[i]);
+    }
+  };
+
+  std::vector<std::jthread> workers;
+  const auto workerCount = std::min(busIDs.size(), MaxConcurrentAttaches);
+  workers.reserve(workerCount);
+  for (std::size_t i = 0; i < workerCount; ++i) {
+    workers.emplace_back(worker);
+  }
+  // Join them before `ret` is returned
+  workers.clear();
+  return ret;
+}
+
+std::unique_ptr<AttachBackend> CreateAttachBackend(
+  [[maybe_unused]] const char* vhciSysfsPath) {
+#if defined(_WIN32)
+  return CreateWin2AttachBackend();
+#elif defined(__linux__)
+  return CreateVHCIAttachBackend(
+    vhciSysfsPath ? vhciSysfsPath : DefaultVHCISysfsPath);
+#else
+#error "No AttachBackend for this platform"
+#endif
+}
+
+}// namespace FredEmmott::USBVirtPP
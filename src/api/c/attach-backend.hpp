@@ -0,0 +1,76 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include "posix-compat.hpp"
+#endif
+
+namespace FredEmmott::USBVirtPP {
+
+/* Attaches our devices to the local USB/IP client (driver), so they show up
+ * as local USB devices.
+ *
+ * Implementations:
+ * - win32-attach.cpp: usbip-win2's `PLUGIN_HARDWARE` IOCTL; the driver
+ *   connects to us, and imports the device itself
+ * - vhci-attach.cpp: Linux `vhci_hcd`; we connect and import the device, then
+ *   hand the socket to the kernel by writing to the sysfs `attach` file
+ *
+ * Either way, the import is handled by `Instance::Run()`, so it must be
+ * running, on another thread.
+ */
+class AttachBackend {
+ public:
+  virtual ~AttachBackend() = default;
+
+  /* Attach one device; thread-safe.
+   *
+   * Returns the *USB* port number.
+   */
+  [[nodiscard]]
+  virtual std::expected<uint16_t, HRESULT> Attach(
+    uint16_t tcpPortNumber,
+    std::string_view busID)
+    = 0;
+
+  /* Attach every device in `busIDs` concurrently.
+   *
+   * Most of the time for each attach is spent waiting for the driver or the
+   * server, so many devices take about as long as one.
+   *
+   * The results are in the same order as `busIDs`.
+   */
+  [[nodiscard]]
+  std::vector<std::expected<uint16_t, HRESULT>> AttachAll(
+    uint16_t tcpPortNumber,
+    std::span<const std::string> busIDs);
+};
+
+[[nodiscard]]
+std::unique_ptr<AttachBackend> CreateAttachBackend(
+  const char* vhciSysfsPath);
+
+#ifdef _WIN32
+[[nodiscard]]
+std::unique_ptr<AttachBackend> CreateWin2AttachBackend();
+#endif
+#ifdef __linux__
+/* `sysfsPath` is the first `vhci_hcd` platform device; for example,
+ * `/sys/devices/platform/vhci_hcd.0`.
+ */
+[[nodiscard]]
+std::unique_ptr<AttachBackend> CreateVHCIAttachBackend(std::string sysfsPath);
+#endif
+
+}// namespace FredEmmott::USBVirtPP
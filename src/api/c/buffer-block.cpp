@@ -0,0 +1,66 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "buffer-block.hpp"
+
+#include "guarded_data.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <new>
+#include <vector>
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+constexpr std::size_t SizeClassCount
+  = std::countr_zero(BufferBlock::MaxCapacity / BufferBlock::MinCapacity) + 1;
+// Per size class; anything beyond this is freed
+constexpr std::size_t MaxFreeBlocks = 8;
+
+using FreeList = guarded_data<std::vector<BufferBlock*>>;
+
+std::array<FreeList, SizeClassCount>& GetFreeLists() {
+  // Intentionally leaked, so that blocks can be released during static
+  // destruction
+  static auto ret = new std::array<FreeList, SizeClassCount>();
+  return *ret;
+}
+
+std::size_t GetSizeClass(const std::size_t capacity) {
+  return std::countr_zero(capacity / BufferBlock::MinCapacity);
+}
+}// namespace
+
+BufferBlock* BufferBlock::Create(const std::size_t minCapacity) {
+  const auto capacity
+    = std::bit_ceil(std::max(minCapacity, BufferBlock::MinCapacity));
+  {
+    auto freeList = GetFreeLists().at(GetSizeClass(capacity)).lock();
+    if (!freeList->empty()) {
+      const auto ret = freeList->back();
+      freeList->pop_back();
+      ret->mRefCount.store(1, std::memory_order_relaxed);
+      return ret;
+    }
+  }
+  return new (::operator new(sizeof(BufferBlock) + capacity))
+    BufferBlock(capacity);
+}
+
+void BufferBlock::Release() noexcept {
+  if (mRefCount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  {
+    auto freeList = GetFreeLists().at(GetSizeClass(mCapacity)).lock();
+    if (freeList->size() < MaxFreeBlocks) {
+      freeList->push_back(this);
+      return;
+    }
+  }
+  this->~BufferBlock();
+  ::operator delete(this);
+}
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,66 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace FredEmmott::USBVirtPP {
+
+/* A reference-counted, pooled byte buffer.
+ *
+ * Capacities are powers of two, from `MinCapacity` to `MaxCapacity`; released
+ * blocks go back to a process-wide free list for their size, so that they can
+ * be released from any thread, even after the `Instance` that created them
+ * has been destroyed.
+ *
+ * The bytes immediately follow the struct, so each block is a single
+ * allocation.
+ */
+class BufferBlock final {
+ public:
+  static constexpr std::size_t MinCapacity = 64 * 1024;
+  static constexpr std::size_t MaxCapacity = 16 * 1024 * 1024;
+
+  BufferBlock() = delete;
+  BufferBlock(const BufferBlock&) = delete;
+  BufferBlock& operator=(const BufferBlock&) = delete;
+
+  // Returns a block with a reference count of 1; `minCapacity` must not be
+  // larger than `MaxCapacity`
+  [[nodiscard]]
+  static BufferBlock* Create(std::size_t minCapacity);
+
+  // Thread-safe
+  void AddRef() noexcept {
+    mRefCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  // Thread-safe
+  void Release() noexcept;
+
+  // Whether anything other than the creator still holds a reference
+  [[nodiscard]]
+  bool IsShared() const noexcept {
+    return mRefCount.load(std::memory_order_acquire) > 1;
+  }
+
+  [[nodiscard]]
+  std::size_t GetCapacity() const noexcept {
+    return mCapacity;
+  }
+
+  [[nodiscard]]
+  std::byte* GetData() noexcept {
+    return reinterpret_cast<std::byte*>(this + 1);
+  }
+
+ private:
+  explicit BufferBlock(const std::size_t capacity) : mCapacity(capacity) {
+  }
+
+  std::atomic<uint32_t> mRefCount {1};
+  const std::size_t mCapacity {};
+};
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,256 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "capture.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <utility>
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+// `URB_ISOCHRONOUS` etc, as used by usbmon
+constexpr uint8_t TransferTypeIsochronous = 0;
+constexpr uint8_t TransferTypeInterrupt = 1;
+constexpr uint8_t TransferTypeControl = 2;
+
+struct PcapFileHeader {
+  uint32_t mMagic {0xa1b2c3d4};
+  uint16_t mVersionMajor {2};
+  uint16_t mVersionMinor {4};
+  int32_t mTimeZone {};
+  uint32_t mTimestampAccuracy {};
+  uint32_t mSnapLength {};
+  uint32_t mLinkType {};
+};
+static_assert(sizeof(PcapFileHeader) == 24);
+
+struct PcapRecordHeader {
+  uint32_t mSeconds {};
+  uint32_t mMicroseconds {};
+  uint32_t mCapturedLength {};
+  uint32_t mOriginalLength {};
+};
+static_assert(sizeof(PcapRecordHeader) == 16);
+
+template <class T>
+void WriteStruct(std::ofstream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+}// namespace
+
+std::unique_ptr<Capture> Capture::Create(
+  AsyncLogger& logger,
+  const char* const path) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    LogError(logger, "Failed to create capture file `{}`", path);
+    return nullptr;
+  }
+  WriteStruct(
+    file,
+    PcapFileHeader {
+      .mSnapLength = sizeof(UsbmonHeader) + SnapLength,
+      .mLinkType = LinkType,
+    });
+  file.flush();
+  return std::unique_ptr<Capture>(new Capture(logger, std::move(file)));
+}
+
+Capture::Capture(AsyncLogger& logger, std::ofstream file)
+  : mLogger(logger),
+    mFile(std::move(file)),
+    mThread(std::bind_front(&Capture::Run, this)) {
+}
+
+Capture::~Capture() {
+  mThread.request_stop();
+  mWake.store(true);
+  mWake.notify_one();
+  mThread.join();
+}
+
+void Capture::OnSubmit(
+  const URB& urb,
+  const USBIP::USBIP_CMD_SUBMIT& submit,
+  const std::span<const std::byte> data,
+  const std::span<const std::byte> isoPackets) {
+  Record record;
+  InitRecord(record, 'S', urb);
+  auto& header = record.mHeader;
+  header.mURBLength = submit.mTransferBufferLength;
+  header.mInterval = static_cast<int32_t>(submit.mInterval.NativeValue());
+  header.mStartFrame = static_cast<int32_t>(submit.mStartFrame.NativeValue());
+  header.mTransferFlags = submit.mTransferFlags;
+  if (header.mTransferType == TransferTypeControl) {
+    header.mSetupFlag = 0;
+    std::memcpy(header.mSetup, &submit.mSetup, sizeof(header.mSetup));
+  } else if (urb.mIsochronous) {
+    header.mIso = {
+      .mErrorCount = 0,
+      .mDescriptorCount = static_cast<int32_t>(
+        isoPackets.size() / sizeof(USBIP::USBIP_ISO_PACKET_DESCRIPTOR)),
+    };
+  }
+  AppendIsoPackets(record, isoPackets, false);
+  AppendData(record, data);
+  Push(std::move(record));
+}
+
+void Capture::OnComplete(
+  const URB& urb,
+  const USBIP::USBIP_RET_SUBMIT& response,
+  const std::span<const std::span<const std::byte>> data,
+  const std::span<const std::byte> isoPackets) {
+  Record record;
+  InitRecord(record, 'C', urb);
+  auto& header = record.mHeader;
+  header.mStatus = response.mStatus.NativeValue();
+  header.mURBLength = response.mActualLength;
+  header.mStartFrame = static_cast<int32_t>(response.mStartFrame.NativeValue());
+  if (urb.mIsochronous) {
+    header.mIso = {
+      .mErrorCount = static_cast<int32_t>(response.mErrorCount.NativeValue()),
+      .mDescriptorCount = static_cast<int32_t>(
+        isoPackets.size() / sizeof(USBIP::USBIP_ISO_PACKET_DESCRIPTOR)),
+    };
+  }
+  AppendIsoPackets(record, isoPackets, true);
+  for (auto&& buffer: data) {
+    AppendData(record, buffer);
+  }
+  Push(std::move(record));
+}
+
+void Capture::InitRecord(Record& record, const char eventType, const URB& urb) {
+  const auto now = std::chrono::system_clock::now().time_since_epoch();
+  const auto seconds = std::chrono::floor<std::chrono::seconds>(now);
+  const auto endpointNumber = urb.mEndpointAddress & 0x7f;
+  const bool isInput = urb.mEndpointAddress & 0x80;
+
+  auto& header = record.mHeader;
+  header = {};
+  header.mID = urb.mID;
+  header.mEventType = eventType;
+  header.mTransferType = urb.mIsochronous ? TransferTypeIsochronous
+    : (endpointNumber == 0)               ? TransferTypeControl
+                                          : TransferTypeInterrupt;
+  header.mEndpointAddress = urb.mEndpointAddress;
+  header.mDeviceAddress = static_cast<uint8_t>(urb.mDeviceID & 0xff);
+  header.mBusNumber = static_cast<uint16_t>(urb.mDeviceID >> 16);
+  header.mSetupFlag = '-';
+  // Like usbmon: '<' for a submitted IN URB, '>' for a completed OUT URB
+  header.mDataFlag = (isInput == (eventType == 'S')) ? '<' : '>';
+  header.mSeconds = seconds.count();
+  header.mMicroseconds = static_cast<int32_t>(
+    std::chrono::duration_cast<std::chrono::microseconds>(now - seconds)
+      .count());
+  record.mOriginalLength = 0;
+  record.mBodyLength = 0;
+}
+
+void Capture::AppendIsoPackets(
+  Record& record,
+  const std::span<const std::byte> isoPackets,
+  const bool isComplete) {
+  const auto count
+    = isoPackets.size() / sizeof(USBIP::USBIP_ISO_PACKET_DESCRIPTOR);
+  // Always complete, even if that leaves no room for the data
+  const auto fit = std::min(
+    count, (SnapLength - record.mBodyLength) / sizeof(UsbmonIsoDescriptor));
+  for (std::size_t i = 0; i < fit; ++i) {
+    // The wire structs are packed, and big-endian
+    const auto& packet = *reinterpret_cast<
+      const USBIP::USBIP_ISO_PACKET_DESCRIPTOR*>(
+      isoPackets.data() + (i * sizeof(USBIP::USBIP_ISO_PACKET_DESCRIPTOR)));
+    const UsbmonIsoDescriptor descriptor {
+      .mStatus = packet.mStatus.NativeValue(),
+      .mOffset = packet.mOffset,
+      .mLength = isComplete ? packet.mActualLength : packet.mLength,
+    };
+    std::memcpy(
+      record.mBody.data() + record.mBodyLength,
+      &descriptor,
+      sizeof(descriptor));
+    record.mBodyLength += sizeof(descriptor);
+  }
+  record.mHeader.mDescriptorCount = static_cast<uint32_t>(fit);
+  record.mOriginalLength
+    += static_cast<uint32_t>(fit * sizeof(UsbmonIsoDescriptor));
+}
+
+void Capture::AppendData(
+  Record& record,
+  const std::span<const std::byte> data) {
+  if (data.empty()) {
+    return;
+  }
+  const auto captured
+    = std::min(data.size(), SnapLength - record.mBodyLength);
+  std::ranges::copy(
+    data.first(captured), record.mBody.begin() + record.mBodyLength);
+  record.mBodyLength += static_cast<uint32_t>(captured);
+  record.mOriginalLength += static_cast<uint32_t>(data.size());
+  record.mHeader.mCapturedLength += static_cast<uint32_t>(captured);
+  record.mHeader.mDataFlag = 0;
+}
+
+void Capture::Push(Record&& record) {
+  if (!mRecords.TryPush(std::move(record))) [[unlikely]] {
+    mDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // Pairs with the fence in `Run()`; see `AsyncLogger::Push()`
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!mWake.exchange(true)) {
+    mWake.notify_one();
+  }
+}
+
+void Capture::Run(const std::stop_token stopToken) {
+  while (!stopToken.stop_requested()) {
+    mWake.wait(false);
+    mWake.store(false);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Drain();
+  }
+  // Anything captured while we were stopping
+  Drain();
+}
+
+void Capture::Drain() {
+  bool wrote = false;
+  while (const auto record = mRecords.TryPop()) {
+    const auto& header = record->mHeader;
+    WriteStruct(
+      mFile,
+      PcapRecordHeader {
+        .mSeconds = static_cast<uint32_t>(header.mSeconds),
+        .mMicroseconds = static_cast<uint32_t>(header.mMicroseconds),
+        .mCapturedLength
+        = static_cast<uint32_t>(sizeof(header) + record->mBodyLength),
+        .mOriginalLength
+        = static_cast<uint32_t>(sizeof(header) + record->mOriginalLength),
+      });
+    WriteStruct(mFile, header);
+    mFile.write(
+      reinterpret_cast<const char*>(record->mBody.data()),
+      record->mBodyLength);
+    wrote = true;
+  }
+  if (!wrote) {
+    return;
+  }
+  // Keep the file usable if we crash
+  if (!mFile.flush()) [[unlikely]] {
+    LogError(mLogger, "Failed to write to the capture file");
+    mFile.clear();
+  }
+  if (const auto dropped = mDropped.exchange(0, std::memory_order_relaxed)) {
+    LogError(mLogger, "{} capture records dropped; the ring was full", dropped);
+  }
+}
+
+}// namespace FredEmmott::USBVirtPP
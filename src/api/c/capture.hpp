@@ -0,0 +1,159 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <FredEmmott/USBIP.hpp>
+#include "logging.hpp"
+#include "mpmc-ring.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <stop_token>
+#include <thread>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Writes URBs to a pcap file, with the Linux usbmon link type, so that a
+ * session can be opened in Wireshark; see `InitData::mCapturePath`.
+ *
+ * Each CMD_SUBMIT is a usbmon 'S' event, and each RET_SUBMIT - or the unlink
+ * or unplug that replaced it - is a 'C' event, with the same ID.
+ *
+ * Records are built by the thread that submits or replies, in a fixed-size
+ * slot of a preallocated lock-free ring, and written by a background thread;
+ * capturing never waits for disk I/O. Data beyond `SnapLength` bytes is
+ * truncated, as in a real capture. If the ring is full, records are dropped,
+ * and the drops are logged.
+ */
+class Capture final {
+ public:
+  // Everything we know about a URB that isn't on the wire in the RET_SUBMIT
+  struct URB {
+    // e.g. `Tracer::GetURBID()`; matches the 'C' event to the 'S' event
+    uint64_t mID {};
+    // `busnum << 16 | devnum`
+    uint32_t mDeviceID {};
+    // 0x80 for IN
+    uint8_t mEndpointAddress {};
+    bool mIsochronous {};
+  };
+
+  Capture() = delete;
+  Capture(const Capture&) = delete;
+  Capture& operator=(const Capture&) = delete;
+  // Writes everything that's been queued before returning
+  ~Capture();
+
+  // Returns null, and logs an error, if the file can't be created
+  [[nodiscard]]
+  static std::unique_ptr<Capture> Create(AsyncLogger&, const char* path);
+
+  /* Thread-safe.
+   *
+   * `data` is the OUT data, if any; `isoPackets` is the raw
+   * `USBIP_ISO_PACKET_DESCRIPTOR`s.
+   */
+  void OnSubmit(
+    const URB&,
+    const USBIP::USBIP_CMD_SUBMIT&,
+    std::span<const std::byte> data,
+    std::span<const std::byte> isoPackets);
+
+  // Thread-safe. As above, but `data` is the IN data, in pieces
+  void OnComplete(
+    const URB&,
+    const USBIP::USBIP_RET_SUBMIT&,
+    std::span<const std::span<const std::byte>> data,
+    std::span<const std::byte> isoPackets);
+
+ private:
+  // Data per record; enough for control transfers and HID reports
+  static constexpr std::size_t SnapLength = 1024;
+  static constexpr std::size_t Capacity = 1024;
+  // `LINKTYPE_USB_LINUX_MMAPPED`
+  static constexpr uint32_t LinkType = 220;
+
+  // For isochronous 'S' and 'C' events, instead of the setup packet
+  struct UsbmonIsoInfo {
+    int32_t mErrorCount;
+    int32_t mDescriptorCount;
+  };
+
+  /* `struct mon_bin_hdr` from Linux's `drivers/usb/mon/mon_bin.c`, which is
+   * what `LINKTYPE_USB_LINUX_MMAPPED` records start with.
+   *
+   * Host byte order; Wireshark uses the byte order of the pcap header.
+   */
+  struct UsbmonHeader {
+    uint64_t mID {};
+    char mEventType {};// 'S' or 'C'
+    uint8_t mTransferType {};
+    uint8_t mEndpointAddress {};
+    uint8_t mDeviceAddress {};
+    uint16_t mBusNumber {};
+    char mSetupFlag {};// 0 if `mSetup` is valid
+    char mDataFlag {};// 0 if data follows
+    int64_t mSeconds {};
+    int32_t mMicroseconds {};
+    int32_t mStatus {};
+    uint32_t mURBLength {};
+    uint32_t mCapturedLength {};
+    union {
+      uint8_t mSetup[8] {};
+      UsbmonIsoInfo mIso;
+    };
+    int32_t mInterval {};
+    int32_t mStartFrame {};
+    uint32_t mTransferFlags {};
+    uint32_t mDescriptorCount {};
+  };
+  static_assert(sizeof(UsbmonHeader) == 64);
+
+  // `struct mon_bin_isodesc`; between the header and the data
+  struct UsbmonIsoDescriptor {
+    int32_t mStatus {};
+    uint32_t mOffset {};
+    uint32_t mLength {};
+    uint32_t mPadding {};
+  };
+  static_assert(sizeof(UsbmonIsoDescriptor) == 16);
+
+  struct Record {
+    UsbmonHeader mHeader;
+    // Bytes after the header, if we'd captured everything
+    uint32_t mOriginalLength {};
+    // Used bytes of `mBody`: isochronous descriptors, then data
+    uint32_t mBodyLength {};
+    std::array<std::byte, SnapLength> mBody;
+  };
+
+  AsyncLogger& mLogger;
+  std::ofstream mFile;
+  std::atomic<uint64_t> mDropped {};
+  // Set by `Push()` to wake the thread
+  std::atomic<bool> mWake {};
+  MPMCRing<Record, Capacity> mRecords;
+
+  // Last, so that everything else is ready before it starts
+  std::jthread mThread;
+
+  Capture(AsyncLogger&, std::ofstream);
+
+  static void InitRecord(Record&, char eventType, const URB&);
+  static void AppendIsoPackets(
+    Record&,
+    std::span<const std::byte> isoPackets,
+    bool isComplete);
+  static void AppendData(Record&, std::span<const std::byte>);
+
+  void Push(Record&&);
+  void Run(std::stop_token);
+  void Drain();
+};
+
+}// namespace FredEmmott::USBVirtPP
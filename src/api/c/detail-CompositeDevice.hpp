@@ -0,0 +1,93 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <FredEmmott/USBIP-VirtPP/CompositeDevice.h>
+#include <FredEmmott/USBSpec.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+struct FredEmmott_USBIP_VirtPP_CompositeDevice final {
+  FredEmmott_USBIP_VirtPP_CompositeDevice() = delete;
+  FredEmmott_USBIP_VirtPP_CompositeDevice(
+    FredEmmott_USBIP_VirtPP_InstanceHandle,
+    const FredEmmott_USBIP_VirtPP_CompositeDevice_InitData&);
+  ~FredEmmott_USBIP_VirtPP_CompositeDevice();
+  void* mUserData {};
+  FredEmmott_USBIP_VirtPP_DeviceHandle mUSBDevice {};
+
+ private:
+  struct Function {
+    void* mUserData {};
+    FredEmmott_USBIP_VirtPP_Device_Callbacks mCallbacks {};
+    uint8_t mFirstInterface {};
+    // Indexed by the function's endpoint number; 0 if unused
+    std::array<uint8_t, 16> mEndpoints {};
+  };
+  // An endpoint number of the composite device
+  struct EndpointRoute {
+    uint8_t mFunction {};
+    uint8_t mFunctionEndpoint {};
+  };
+
+  FredEmmott_USBIP_VirtPP_InstanceHandle mInstance {};
+  FredEmmott_USBSpec_DeviceDescriptor mDeviceDescriptor {};
+  // The configuration descriptor, followed by every function's descriptors
+  std::vector<std::byte> mConfigurationDescriptor;
+  // Every interface's default alternate setting, for `Device_InitData`
+  std::vector<FredEmmott_USBSpec_InterfaceDescriptor> mInterfaces;
+
+  std::vector<Function> mFunctions;
+  // Indexed by interface number
+  std::vector<uint8_t> mInterfaceFunctions;
+  // Indexed by endpoint number
+  std::array<std::optional<EndpointRoute>, 16> mEndpointRoutes {};
+
+  // Renumber and append a function's descriptors; returns false if invalid
+  bool AddFunction(const FredEmmott_USBIP_VirtPP_CompositeDevice_Function&);
+
+  FredEmmott_USBIP_VirtPP_Result OnDeviceInputRequest(
+    FredEmmott_USBIP_VirtPP_RequestHandle request,
+    uint8_t rawRequestType,
+    uint8_t requestCode,
+    uint16_t value);
+  FredEmmott_USBIP_VirtPP_Result OnDeviceOutputRequest(
+    FredEmmott_USBIP_VirtPP_RequestHandle request,
+    uint8_t rawRequestType,
+    uint8_t requestCode);
+
+  /* Find the function that a request is for, and translate the endpoint and
+   * `index` to the function's numbering.
+   *
+   * Returns null for requests to the device itself, or if there's no such
+   * interface or endpoint.
+   */
+  const Function* Route(
+    uint32_t& endpoint,
+    uint8_t rawRequestType,
+    uint16_t& index) const;
+
+  static FredEmmott_USBIP_VirtPP_Result OnUSBInputRequestCallback(
+    FredEmmott_USBIP_VirtPP_RequestHandle request,
+    uint32_t endpoint,
+    uint8_t requestType,
+    uint8_t requestCode,
+    uint16_t value,
+    uint16_t index,
+    uint16_t length);
+  static FredEmmott_USBIP_VirtPP_Result OnUSBOutputRequestCallback(
+    FredEmmott_USBIP_VirtPP_RequestHandle,
+    uint32_t endpoint,
+    uint8_t requestType,
+    uint8_t request,
+    uint16_t value,
+    uint16_t index,
+    uint16_t length,
+    const void* data,
+    uint32_t dataLength);
+};
@@ -0,0 +1,231 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "unique-socket.hpp"
+
+#include <FredEmmott/USBIP-VirtPP/Request.h>
+#include "guarded_data.hpp"
+#include "mpsc-queue.hpp"
+#include "pdu-parser.hpp"
+#include "receive-buffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace FredEmmott::USBVirtPP {
+
+// An isochronous stream: a device ID, and an endpoint address (0x80 for IN)
+using IsoStreamKey = std::pair<uint32_t, uint32_t>;
+
+/* A reply, waiting to be written.
+ *
+ * The wire bytes immediately follow the struct, so each reply is a single
+ * allocation.
+ *
+ * Streaming replies are followed by `mStreamRemaining` more bytes, which are
+ * pulled from `mProducer` by `Instance::WriteReplies()` as the connection can
+ * take them.
+ */
+struct Reply final {
+  Reply* mNext {};
+  const std::size_t mSize {};
+
+  FredEmmott_USBIP_VirtPP_StreamProducer mProducer {};
+  std::size_t mStreamRemaining {};
+  // Set once `GetData()` has been handed to the EventLoop; only accessed from
+  // the `Instance::Run()` thread
+  bool mStarted {false};
+
+  ~Reply() {
+    if (mProducer.OnComplete) {
+      mProducer.OnComplete(mProducer.mUserData);
+    }
+  }
+
+  [[nodiscard]]
+  static Reply* Create(
+    const std::span<const std::span<const std::byte>> buffers) {
+    std::size_t size {};
+    for (auto&& buffer: buffers) {
+      size += buffer.size();
+    }
+    auto ret = new (::operator new(sizeof(Reply) + size)) Reply {.mSize = size};
+    auto out = ret->GetData().data();
+    for (auto&& buffer: buffers) {
+      out = std::ranges::copy(buffer, out).out;
+    }
+    return ret;
+  }
+
+  // `buffers` is the start of the reply, e.g. the header
+  [[nodiscard]]
+  static Reply* CreateStreaming(
+    const std::span<const std::span<const std::byte>> buffers,
+    const std::size_t streamLength,
+    const FredEmmott_USBIP_VirtPP_StreamProducer& producer) {
+    auto ret = Create(buffers);
+    ret->mProducer = producer;
+    ret->mStreamRemaining = streamLength;
+    return ret;
+  }
+
+  // Destroy `reply`, and every reply linked from it
+  static void DestroyAll(Reply* reply) noexcept {
+    while (reply) {
+      const auto next = reply->mNext;
+      reply->~Reply();
+      ::operator delete(reply);
+      reply = next;
+    }
+  }
+
+  [[nodiscard]]
+  std::span<std::byte> GetData() noexcept {
+    return {reinterpret_cast<std::byte*>(this + 1), mSize};
+  }
+};
+
+// FIFO of replies that have been taken from `Connection::mReplies`
+class ReplyList final {
+ public:
+  ReplyList() = default;
+  ReplyList(const ReplyList&) = delete;
+  ReplyList& operator=(const ReplyList&) = delete;
+  ~ReplyList() {
+    Reply::DestroyAll(mHead);
+  }
+
+  [[nodiscard]]
+  Reply* Front() const noexcept {
+    return mHead;
+  }
+
+  // Append `replies`, and every reply linked from it
+  void Append(Reply* replies) noexcept {
+    if (!replies) {
+      return;
+    }
+    if (mTail) {
+      mTail->mNext = replies;
+    } else {
+      mHead = replies;
+    }
+    mTail = replies;
+    while (mTail->mNext) {
+      mTail = mTail->mNext;
+    }
+  }
+
+  [[nodiscard]]
+  Reply* PopFront() noexcept {
+    const auto ret = mHead;
+    mHead = std::exchange(ret->mNext, nullptr);
+    if (!mHead) {
+      mTail = nullptr;
+    }
+    return ret;
+  }
+
+ private:
+  Reply* mHead {};
+  Reply* mTail {};
+};
+
+// An entry in `Connection::mPendingURBs`
+struct PendingURB {
+  uint32_t mDeviceID {};
+  // Only needed for `Capture`; 0x80 for IN
+  uint8_t mEndpointAddress {};
+  bool mIsochronous {};
+};
+
+/* A USB/IP client connection, and the session state that goes with it.
+ *
+ * Owned by `Instance::mConnections`; `Request`s hold a `weak_ptr`, so replies
+ * go back to the connection that sent the URB, and replies for URBs from a
+ * connection that has since closed fail instead of going somewhere else.
+ */
+struct Connection final : std::enable_shared_from_this<Connection> {
+  Connection() = delete;
+  Connection(unique_socket socket, const uint64_t id)
+    : mSocket(std::move(socket)), mID(id) {
+  }
+  ~Connection() {
+    Reply::DestroyAll(mReplies.TakeAll());
+  }
+
+  unique_socket mSocket;
+  // Unique within the instance
+  const uint64_t mID {};
+
+  // Set by `Instance::CloseConnection()`; no more replies are accepted
+  std::atomic<bool> mClosed {false};
+
+  // Pushed to by any thread; drained by `Instance::FlushReplies()`
+  MPSCQueue<Reply, &Reply::mNext> mReplies;
+
+  // Bytes in `mReplies`, `mUnwritten`, and `mUnsent`, not counting streamed
+  // data that hasn't been produced yet; with the `Block` policy, producers
+  // `wait()` on this
+  std::atomic<std::size_t> mQueuedBytes {};
+  // Largest value `mQueuedBytes` has reached
+  std::atomic<std::size_t> mQueuedBytesHighWater {};
+  // Replies completed without data by `DropSupersededInputReports`
+  std::atomic<uint64_t> mDroppedReplies {};
+  // Replies queued for this connection; counted by any thread
+  std::atomic<uint64_t> mRepliesSent {};
+
+  // Only written by the `Instance::Run()` thread, but read by
+  // `Instance_GetConnectionStats()`
+  std::atomic<uint64_t> mURBs {};
+  std::atomic<uint64_t> mUnlinks {};
+  std::atomic<uint64_t> mBytesReceived {};
+  std::atomic<uint64_t> mBytesSent {};
+  std::atomic<uint64_t> mPendingURBsHighWater {};
+
+  // When `mReplies` goes from empty to non-empty, the producer puts the
+  // connection in `Instance::mScheduledConnections`, which then owns these
+  Connection* mNextScheduled {};
+  std::shared_ptr<Connection> mScheduledRef;
+
+  // Only accessed from the `Instance::Run()` thread
+  ReceiveBuffer mReceiveBuffer;
+  PDUParser mParser;
+  bool mInBacklog {false};
+  // Set while `mQueuedBytes` is over the limit; we stop reading requests
+  bool mReceivePaused {false};
+  // Taken from `mReplies`, but not yet handed to the EventLoop; only
+  // non-empty if a streaming reply is in progress
+  ReplyList mUnwritten;
+  // Handed to the EventLoop, but not accepted
+  std::vector<std::byte> mUnsent;
+  bool mInWriteBacklog {false};
+
+  /* Sequence numbers of submitted URBs that haven't been answered or
+   * unlinked yet, and where they were sent.
+   *
+   * Whichever of the reply, CMD_UNLINK, and unplugging the device removes the
+   * entry first wins; the others are discarded.
+   */
+  guarded_data<std::unordered_map<uint32_t, PendingURB>> mPendingURBs;
+
+  // The next free frame for each isochronous stream; see `IsoScheduler`
+  guarded_data<std::map<IsoStreamKey, uint64_t>> mIsoStreams;
+
+  // IDs of devices that this client has attached with OP_REQ_IMPORT; only
+  // accessed from the `Instance::Run()` thread
+  std::unordered_set<uint32_t> mImportedDevices;
+};
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,112 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "spsc-ring.hpp"
+
+#include <FredEmmott/USBIP-VirtPP/UAC2Device.h>
+#include <FredEmmott/USBSpec.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+struct FredEmmott_USBIP_VirtPP_UAC2Device final {
+  FredEmmott_USBIP_VirtPP_UAC2Device() = delete;
+  FredEmmott_USBIP_VirtPP_UAC2Device(
+    FredEmmott_USBIP_VirtPP_InstanceHandle,
+    const FredEmmott_USBIP_VirtPP_UAC2Device_InitData&);
+  ~FredEmmott_USBIP_VirtPP_UAC2Device();
+  void* mUserData {};
+  FredEmmott_USBIP_VirtPP_DeviceHandle mUSBDevice {};
+
+  // Interleaved samples; the sizes are in samples, not frames
+  std::size_t ReadPlayback(std::span<int16_t>);
+  std::size_t WriteCapture(std::span<const int16_t>);
+
+  FredEmmott_USBIP_VirtPP_UAC2Device_Stats GetStats() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct ConfigurationDescriptor;
+  static const FredEmmott_USBSpec_DeviceDescriptor& GetDeviceDescriptor();
+  static const ConfigurationDescriptor& GetConfigurationDescriptor();
+
+  // One direction of audio
+  struct Stream {
+    std::atomic<uint64_t> mFrames {};
+    // Overruns for playback, underruns for capture
+    std::atomic<uint64_t> mXRunFrames {};
+    std::atomic<uint64_t> mMaxJitterMicroseconds {};
+
+    // The rest is only accessed from the `Instance::Run()` thread
+    uint8_t mAlternateSetting {};
+    // Transfers since the host selected `mAlternateSetting`
+    uint32_t mTransferCount {};
+    Clock::time_point mLastTransferAt {};
+    Clock::duration mLastTransferLength {};
+
+    // Call for each transfer the host sends, with its length in USB frames
+    void OnTransfer(uint32_t usbFrames);
+    void Reset(uint8_t alternateSetting);
+  };
+
+  FredEmmott_USBIP_VirtPP_InstanceHandle mInstance {};
+
+  // Host to device
+  FredEmmott::USBVirtPP::SPSCRing<int16_t> mPlaybackRing;
+  Stream mPlayback;
+  // Device to host
+  FredEmmott::USBVirtPP::SPSCRing<int16_t> mCaptureRing;
+  Stream mCapture;
+
+  FredEmmott_USBIP_VirtPP_Result OnControlInputRequest(
+    FredEmmott_USBIP_VirtPP_RequestHandle request,
+    uint8_t rawRequestType,
+    uint8_t requestCode,
+    uint16_t value,
+    uint16_t index,
+    uint16_t length);
+  FredEmmott_USBIP_VirtPP_Result OnControlOutputRequest(
+    FredEmmott_USBIP_VirtPP_RequestHandle request,
+    uint8_t rawRequestType,
+    uint8_t requestCode,
+    uint16_t value,
+    uint16_t index);
+  FredEmmott_USBIP_VirtPP_Result OnClassInputRequest(
+    FredEmmott_USBIP_VirtPP_RequestHandle request,
+    uint8_t requestCode,
+    uint16_t value,
+    uint16_t index);
+
+  FredEmmott_USBIP_VirtPP_Result OnPlaybackRequest(
+    FredEmmott_USBIP_VirtPP_RequestHandle request,
+    const void* data,
+    uint32_t dataLength);
+  FredEmmott_USBIP_VirtPP_Result OnCaptureRequest(
+    FredEmmott_USBIP_VirtPP_RequestHandle request);
+
+  static FredEmmott_USBIP_VirtPP_Result OnUSBInputRequestCallback(
+    FredEmmott_USBIP_VirtPP_RequestHandle request,
+    uint32_t endpoint,
+    uint8_t requestType,
+    uint8_t requestCode,
+    uint16_t value,
+    uint16_t index,
+    uint16_t length);
+  static FredEmmott_USBIP_VirtPP_Result OnUSBOutputRequestCallback(
+    FredEmmott_USBIP_VirtPP_RequestHandle,
+    uint32_t endpoint,
+    uint8_t requestType,
+    uint8_t request,
+    uint16_t value,
+    uint16_t index,
+    uint16_t length,
+    const void* data,
+    uint32_t dataLength);
+};
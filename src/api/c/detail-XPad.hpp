@@ -2,14 +2,14 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
-#include "guarded_data.hpp"
 #include "handles.hpp"
+#include "mpmc-ring.hpp"
 
 #include <FredEmmott/USBIP-VirtPP/XPad.h>
 #include <FredEmmott/USBSpec.h>
 
-#include <mutex>
-#include <queue>
+#include <cstddef>
+#include <optional>
 #include <string_view>
 
 struct FredEmmott_USBIP_VirtPP_XPad final {
@@ -77,9 +77,21 @@ struct FredEmmott_USBIP_VirtPP_XPad final {
   XUSBInputReport mXUSBReport {};
   FredEmmott_USBIP_VirtPP_XPad_Callbacks mCallbacks{};
 
-  guarded_data<std::queue<FredEmmott::USBVirtPP::unique_request>>
+  // Hosts only have a few interrupt IN URBs in flight per endpoint
+  static constexpr std::size_t MaxPendingGamepadInputRequests = 32;
+  FredEmmott::USBVirtPP::MPMCRing<
+    FredEmmott::USBVirtPP::unique_request,
+    MaxPendingGamepadInputRequests>
     mGamepadInputQueue;
 
+  /* Pops the oldest request the host is still waiting for.
+   *
+   * Requests the host has unlinked are dropped here, rather than when they're
+   * unlinked, so the rest stay in order.
+   */
+  std::optional<FredEmmott::USBVirtPP::unique_request>
+  PopPendingGamepadInputRequest();
+
   FredEmmott_USBIP_VirtPP_Result OnControlInputRequest(
     FredEmmott_USBIP_VirtPP_RequestHandle request,
     uint8_t rawRequestType,
@@ -2,13 +2,13 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
-#include "guarded_data.hpp"
 #include "handles.hpp"
+#include "mpmc-ring.hpp"
 
 #include <FredEmmott/USBIP-VirtPP/HIDDevice.h>
 
 #include <cstddef>
-#include <queue>
+#include <optional>
 #include <tuple>
 #include <vector>
 
@@ -46,7 +46,17 @@ struct FredEmmott_USBIP_VirtPP_HIDDevice final {
     uint16_t mLength {};
   };
 
-  guarded_data<std::queue<PendingInputRequest>> mInputQueue;
+  // Hosts only have a few interrupt IN URBs in flight per endpoint
+  static constexpr std::size_t MaxPendingInputRequests = 32;
+  FredEmmott::USBVirtPP::MPMCRing<PendingInputRequest, MaxPendingInputRequests>
+    mInputQueue;
+
+  /* Pops the oldest request the host is still waiting for.
+   *
+   * Requests the host has unlinked are dropped here, rather than when they're
+   * unlinked, so the rest stay in order.
+   */
+  std::optional<PendingInputRequest> PopPendingInputRequest();
 
   void InitializeDescriptors();
   void InitializeDeviceDescriptor();
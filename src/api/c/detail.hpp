@@ -5,21 +5,34 @@
 #include <FredEmmott/USBIP-VirtPP/Core.h>
 #include <FredEmmott/USBIP-VirtPP/Device.h>
 #include <FredEmmott/USBIP.hpp>
+#include "attach-backend.hpp"
+#include "capture.hpp"
+#include "detail-Connection.hpp"
+#include "device-stats.hpp"
+#include "device-table.hpp"
+#include "event-loop.hpp"
+#include "handle-pool.hpp"
+#include "iso-scheduler.hpp"
 #include "logging.hpp"
+#include "session-recorder.hpp"
+#include "tracer.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <concepts>
 #include <format>
+#include <memory>
 #include <optional>
+#include <span>
 #include <stop_token>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <mutex>
 
-// clang-format off
-#include <winsock2.h>
-#include <wil/resource.h>
-// clang-format on
-
 struct FredEmmott_USBIP_VirtPP_Device final {
   bool mAutoAttach {};
 
@@ -28,8 +41,18 @@ struct FredEmmott_USBIP_VirtPP_Device final {
   FredEmmott_USBIP_VirtPP_Device_Callbacks mCallbacks {};
   FredEmmott_USBSpec_DeviceDescriptor mDescriptor {};
   std::vector<FredEmmott_USBSpec_InterfaceDescriptor> mInterfaces {};
+  // See `Device_InitData::mSupersededInputEndpoints`
+  uint16_t mSupersededInputEndpoints {};
+  // The USB/IP `busnum << 16 | devnum`; see `DeviceTable`
+  uint32_t mDeviceID {};
+
+  // The connection that has imported this device, if any; only accessed from
+  // the `Instance::Run()` thread
+  FredEmmott::USBVirtPP::Connection* mImportedBy {};
 
-  std::mutex mReplyMutex;
+  // Shared with request clones; see `DeviceStats`
+  std::shared_ptr<FredEmmott::USBVirtPP::DeviceStats> mStats {
+    std::make_shared<FredEmmott::USBVirtPP::DeviceStats>()};
 
   void* mUserData {};
 
@@ -37,26 +60,98 @@ struct FredEmmott_USBIP_VirtPP_Device final {
   explicit FredEmmott_USBIP_VirtPP_Device(
     FredEmmott_USBIP_VirtPP_InstanceHandle,
     const FredEmmott_USBIP_VirtPP_Device_InitData*);
-  ~FredEmmott_USBIP_VirtPP_Device() = default;
+  // Unplugs the device; safe while `Instance::Run()` is active
+  ~FredEmmott_USBIP_VirtPP_Device();
 
   [[nodiscard]]
-  FredEmmott_USBIP_VirtPP_Result Attach(std::string_view busID = {}) const;
+  FredEmmott_USBIP_VirtPP_Result Attach() const;
+};
 
- private:
-  std::optional<std::string> GetBusID() const;
+struct FredEmmott_USBIP_VirtPP_Request {
+  // Clones can outlive `mDevice`, but not the instance
+  FredEmmott_USBIP_VirtPP_InstanceHandle mInstance {};
+  FredEmmott_USBIP_VirtPP_DeviceHandle mDevice {};
+  uint32_t mDeviceID {};
+  // `mDevice->mUserData`, unless a composite device has routed the request
+  // to one of its functions
+  void* mDeviceUserData {};
+  std::weak_ptr<FredEmmott::USBVirtPP::Connection> mConnection;
+  // `mDevice->mStats`; clones own a reference, as they can outlive `mDevice`
+  FredEmmott::USBVirtPP::DeviceStats* mDeviceStats {};
+  std::shared_ptr<FredEmmott::USBVirtPP::DeviceStats> mDeviceStatsOwner;
+  uint32_t mSequenceNumber {};
+  // See `Tracer::GetURBID()`
+  uint64_t mTraceID {};
+  uint32_t mTransferBufferLength {};
+  uint32_t mTransferFlags {};
+  uint32_t mEndpoint {};
+  FredEmmott::USBIP::Direction mDirection {};
+  // Isochronous requests only; `mInterval` is in frames
+  uint32_t mIsoPacketCount {};
+  uint32_t mInterval {};
+  // An IN request on one of `mDevice->mSupersededInputEndpoints`; copied, as
+  // clones can outlive `mDevice`
+  bool mIsSupersededInput {};
+
+  // OUT payload, in `mPayloadBlock`; only set for the duration of the
+  // `OnOutputRequest` callback, not in clones
+  std::span<const std::byte> mPayload;
+  FredEmmott::USBVirtPP::BufferBlock* mPayloadBlock {};
+  // Also in `mPayloadBlock`, with the same lifetime as `mPayload`
+  std::span<const FredEmmott::USBIP::USBIP_ISO_PACKET_DESCRIPTOR> mIsoPackets;
 };
 
-struct FredEmmott_USBIP_VirtPP_Instance final {
-  using Bus = std::vector<FredEmmott_USBIP_VirtPP_DeviceHandle>;
+// Created by `Request_RetainPayload()`
+struct FredEmmott_USBIP_VirtPP_Payload {
+  FredEmmott_USBIP_VirtPP_InstanceHandle mInstance {};
+  FredEmmott::USBVirtPP::BufferBlock* mBlock {};
+  std::span<const std::byte> mData;
+};
 
+struct FredEmmott_USBIP_VirtPP_Instance final {
   FredEmmott_USBIP_VirtPP_Instance_InitData mInitData {};
+  // Before everything else, so it's destroyed last
+  mutable FredEmmott::USBVirtPP::AsyncLogger mLogger;
+  // Opt-in; see `InitData::mEnableTracing`
+  FredEmmott::USBVirtPP::Tracer mTracer;
+  // Null unless `InitData::mCapturePath` is set
+  std::unique_ptr<FredEmmott::USBVirtPP::Capture> mCapture;
+  // Null unless `InitData::mRecordPath` is set; only used by `Run()`
+  std::unique_ptr<FredEmmott::USBVirtPP::SessionRecorder> mRecorder;
 
   std::stop_source mStopSource;
 
-  wil::unique_socket mListeningSocket {};
-  SOCKET mClientSocket {INVALID_SOCKET};
+  FredEmmott::USBVirtPP::unique_socket mListeningSocket {};
+
+  std::unique_ptr<FredEmmott::USBVirtPP::EventLoop> mEventLoop;
+  // Keyed by the raw pointer, which is also the EventLoop key
+  std::unordered_map<
+    FredEmmott::USBVirtPP::Connection*,
+    std::shared_ptr<FredEmmott::USBVirtPP::Connection>>
+    mConnections;
+  // Closed during this `Run()` iteration; freed at the end of it
+  std::vector<std::shared_ptr<FredEmmott::USBVirtPP::Connection>>
+    mClosedConnections;
+  // Also every open connection, for `Instance_GetConnectionStats()` from
+  // other threads
+  guarded_data<std::vector<std::shared_ptr<FredEmmott::USBVirtPP::Connection>>>
+    mOpenConnections;
+  // Only accessed from the `Run()` thread
+  uint64_t mNextConnectionID {1};
+
+  // Thread-safe; see `DeviceTable` for lifetimes
+  FredEmmott::USBVirtPP::DeviceTable mDevices;
 
-  std::vector<Bus> mBusses {};
+  // Backs `Request_Clone()`; see `GetRequest()`
+  FredEmmott::USBVirtPP::HandlePool<FredEmmott_USBIP_VirtPP_Request>
+    mRequestPool;
+  // Backs `Request_RetainPayload()`
+  FredEmmott::USBVirtPP::HandlePool<FredEmmott_USBIP_VirtPP_Payload>
+    mPayloadPool;
+
+  FredEmmott::USBVirtPP::IsoScheduler mIsoScheduler;
+
+  std::unique_ptr<FredEmmott::USBVirtPP::AttachBackend> mAttachBackend;
 
   FredEmmott_USBIP_VirtPP_Instance() = delete;
   explicit FredEmmott_USBIP_VirtPP_Instance(
@@ -66,6 +161,80 @@ struct FredEmmott_USBIP_VirtPP_Instance final {
 
   void Run();
 
+  /* Attach the devices concurrently; thread-safe, but `Run()` must be active
+   * on another thread.
+   *
+   * `results` must be the same size as `deviceIDs`.
+   */
+  void Attach(
+    std::span<const uint32_t> deviceIDs,
+    std::span<FredEmmott_USBIP_VirtPP_Result> results);
+
+  /* Queue a reply, as a single message.
+   *
+   * Replies are corked until the end of the current `Run()` iteration; all
+   * replies to a connection from an iteration are then written together, by
+   * the `Run()` thread.
+   *
+   * Thread-safe and lock-free: the caller never waits for network I/O, or for
+   * other threads sending replies. Replies from other threads wake up the
+   * loop.
+   *
+   * The exception is the `Block` backpressure policy: if the connection's
+   * queue is full, threads other than the `Run()` thread wait for it to
+   * drain.
+   */
+  [[nodiscard]] HRESULT Send(
+    FredEmmott::USBVirtPP::Connection&,
+    std::span<const std::span<const std::byte>>);
+  // As above, but takes ownership of a `Reply`, e.g. a streaming reply
+  [[nodiscard]] HRESULT Send(
+    FredEmmott::USBVirtPP::Connection&,
+    FredEmmott::USBVirtPP::Reply*);
+
+  // A single PDU; arrays of buffers go to the overload above instead
+  template <class T>
+    requires(!std::convertible_to<
+             const T&,
+             std::span<const std::span<const std::byte>>>)
+  [[nodiscard]] HRESULT Send(
+    FredEmmott::USBVirtPP::Connection& connection,
+    const T& what) {
+    const std::span<const std::byte> buffers[] {
+      std::as_bytes(std::span {&what, 1}),
+    };
+    return Send(connection, buffers);
+  }
+
+  /* Like `Send()`, but held back until `due`; see `IsoScheduler`.
+   *
+   * If the URB is unlinked in the meantime, the reply is discarded.
+   */
+  [[nodiscard]] HRESULT SendWhenDue(
+    std::shared_ptr<FredEmmott::USBVirtPP::Connection>,
+    uint32_t sequenceNumber,
+    FredEmmott::USBVirtPP::IsoScheduler::Clock::time_point due,
+    FredEmmott::USBVirtPP::Reply*);
+
+  /* Called by `~Device()` once the device has been removed from `mDevices`.
+   *
+   * Thread-safe; the `Run()` thread then fails the device's pending URBs,
+   * counting them in `stats`, and releases the device ID for reuse.
+   */
+  void OnDeviceRemoved(
+    uint32_t deviceID,
+    std::shared_ptr<FredEmmott::USBVirtPP::DeviceStats> stats);
+
+  /* With the `DropSupersededInputReports` policy, whether an IN report of
+   * `size` bytes, on one of the device's `mSupersededInputEndpoints`, should
+   * be replaced with an empty completion.
+   *
+   * If so, the drop is counted.
+   */
+  [[nodiscard]] bool ShouldDropInputReport(
+    FredEmmott::USBVirtPP::Connection&,
+    std::size_t size);
+
   template<class... Args>
   void LogError(std::format_string<Args...> fmt, Args&&... args) const {
     return FredEmmott::USBVirtPP::LogError(this, fmt, std::forward<Args>(args)...);
@@ -76,12 +245,106 @@ struct FredEmmott_USBIP_VirtPP_Instance final {
     return FredEmmott::USBVirtPP::Log(this, fmt, std::forward<Args>(args)...);
   }
 
+  template<class... Args>
+  void LogDebug(std::format_string<Args...> fmt, Args&&... args) const {
+    return FredEmmott::USBVirtPP::LogDebug(
+      this, fmt, std::forward<Args>(args)...);
+  }
+
  private:
+#ifdef _WIN32
   bool mNeedWSACleanup {false};
+#endif
+
+  // From `mInitData`, with the default applied
+  std::size_t mMaxQueuedBytesPerConnection {};
+
+  // Set by `Run()`; replies from any other thread need to wake the loop
+  std::atomic<std::thread::id> mLoopThread;
+
+#ifdef _WIN32
+  // Set by the first `SendWhenDue()`; we need 1ms timers from then on
+  std::atomic<bool> mRaisedTimerResolution {false};
+#endif
+  // Only used by `SendDueReplies()`; kept to reuse the allocation
+  std::vector<FredEmmott::USBVirtPP::IsoScheduler::DeferredReply> mDueReplies;
+
+  // From `OnDeviceRemoved()`, for `ServiceRemovedDevices()`
+  using RemovedDevice
+    = std::pair<uint32_t, std::shared_ptr<FredEmmott::USBVirtPP::DeviceStats>>;
+  guarded_data<std::vector<RemovedDevice>> mRemovedDevices;
+  // Only used by `ServiceRemovedDevices()`; kept to reuse the allocations
+  std::vector<RemovedDevice> mServicingRemovedDevices;
+  std::vector<std::pair<uint32_t, FredEmmott::USBVirtPP::PendingURB>>
+    mFailedURBs;
 
-  [[nodiscard]] HRESULT OnClientSocketActive(SOCKET);
-  [[nodiscard]] FredEmmott_USBIP_VirtPP_Result OnDevListOp();
+  // Connections with unsent replies; see `FlushReplies()`
+  FredEmmott::USBVirtPP::MPSCQueue<
+    FredEmmott::USBVirtPP::Connection,
+    &FredEmmott::USBVirtPP::Connection::mNextScheduled>
+    mScheduledConnections;
+  // Only used by `WriteReplies()`; kept to reuse the allocations
+  std::vector<std::span<const std::byte>> mFlushBuffers;
+  std::vector<std::byte> mStreamChunk;
+
+  // Connections with a streaming reply that used up its budget
+  std::vector<FredEmmott::USBVirtPP::Connection*> mWriteBacklog;
+  // The previous `mWriteBacklog`, while it's being serviced
+  std::vector<FredEmmott::USBVirtPP::Connection*> mWriting;
+
+  // Connections that might have unhandled data; see `ServiceConnections()`
+  std::vector<FredEmmott::USBVirtPP::Connection*> mBacklog;
+  // The previous `mBacklog`, while it's being serviced
+  std::vector<FredEmmott::USBVirtPP::Connection*> mServicing;
+
+  [[nodiscard]] std::optional<std::chrono::milliseconds> GetWaitTimeout();
+  void AcceptConnections();
+  void ServiceConnections();
+  // Hand every reply since the last call to the EventLoop, and flush it
+  void FlushReplies();
+  /* Hand `replies` to the EventLoop, after anything it didn't accept or we
+   * didn't write last time; keeps whatever it doesn't accept this time.
+   *
+   * Streaming replies are written a chunk at a time, until the EventLoop
+   * stops accepting data, or the stream uses up its budget for this round.
+   *
+   * Takes ownership of `replies`, which may be null.
+   */
+  void WriteReplies(
+    FredEmmott::USBVirtPP::Connection&,
+    FredEmmott::USBVirtPP::Reply* replies);
+  /* A single gather-write of up to `MaxBuffersPerSend` buffers, with at most
+   * one chunk of a streaming reply; closes the connection if it fails.
+   *
+   * Returns true if everything was accepted, and there's more to write.
+   */
+  [[nodiscard]] bool WriteSomeReplies(FredEmmott::USBVirtPP::Connection&);
+  [[nodiscard]] bool IsOverQueueLimit(
+    const FredEmmott::USBVirtPP::Connection&) const;
+  // Does nothing if it's already closed; it's freed at the end of this
+  // `Run()` iteration
+  void CloseConnection(FredEmmott::USBVirtPP::Connection&);
+  // Fail pending URBs for devices that have been unplugged
+  void ServiceRemovedDevices();
+  // Continue streaming replies that used up their budget last round
+  void ServiceWriteBacklog();
+  // Send the replies from `SendWhenDue()` that are due
+  void SendDueReplies();
+
+  /* Receive everything available, and handle every complete PDU.
+   *
+   * Returns `S_FALSE` if `budget` PDUs were handled, but there may be more.
+   */
+  [[nodiscard]] HRESULT OnClientDataAvailable(
+    FredEmmott::USBVirtPP::Connection&,
+    std::size_t budget);
+  [[nodiscard]] HRESULT OnClientPDU(
+    FredEmmott::USBVirtPP::Connection&,
+    std::span<const std::byte> pdu);
+  [[nodiscard]] FredEmmott_USBIP_VirtPP_Result OnDevListOp(
+    FredEmmott::USBVirtPP::Connection&);
   [[nodiscard]] FredEmmott_USBIP_VirtPP_Result OnImportOp(
+    FredEmmott::USBVirtPP::Connection&,
     const FredEmmott::USBIP::OP_REQ_IMPORT&);
 
   [[nodiscard]]
@@ -93,20 +356,39 @@ struct FredEmmott_USBIP_VirtPP_Instance final {
   FredEmmott_USBIP_VirtPP_Result OnOutputRequest(
     FredEmmott_USBIP_VirtPP_Device& device,
     const FredEmmott::USBIP::USBIP_CMD_SUBMIT& request,
+    std::span<const std::byte> payload,
     FredEmmott_USBIP_VirtPP_Request& apiRequest);
 
   [[nodiscard]]
   FredEmmott_USBIP_VirtPP_Result OnSubmitRequest(
-    const FredEmmott::USBIP::USBIP_CMD_SUBMIT&);
+    FredEmmott::USBVirtPP::Connection&,
+    const FredEmmott::USBIP::USBIP_CMD_SUBMIT&,
+    std::span<const std::byte> payload);
   [[nodiscard]] FredEmmott_USBIP_VirtPP_Result OnUnlinkRequest(
+    FredEmmott::USBVirtPP::Connection&,
     const FredEmmott::USBIP::USBIP_CMD_UNLINK&);
 
   void AutoAttach();
 };
 
-struct FredEmmott_USBIP_VirtPP_Request {
-  FredEmmott_USBIP_VirtPP_DeviceHandle mDevice {};
-  SOCKET mSocket { INVALID_SOCKET };
-  uint32_t mSequenceNumber {};
-  uint32_t mTransferBufferLength {};
-};
\ No newline at end of file
+inline FredEmmott::USBVirtPP::AsyncLogger& GetLogger(
+  const FredEmmott_USBIP_VirtPP_Instance* instance) {
+  return instance->mLogger;
+}
+
+namespace FredEmmott::USBVirtPP {
+/* Resolve a handle that was either passed to a device callback, or created by
+ * `Request_Clone()`.
+ *
+ * Returns null if the handle is stale.
+ */
+[[nodiscard]]
+inline FredEmmott_USBIP_VirtPP_Request* GetRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle handle) noexcept {
+  using Pool = HandlePool<FredEmmott_USBIP_VirtPP_Request>;
+  if (!Pool::IsPooled(handle)) {
+    return handle;
+  }
+  return Pool::Get(handle);
+}
+}// namespace FredEmmott::USBVirtPP
\ No newline at end of file
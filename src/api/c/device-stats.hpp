@@ -0,0 +1,123 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <FredEmmott/USBIP-VirtPP/Device.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Counters for `Device_GetStats()`.
+ *
+ * Everything is relaxed: each counter is exact, but a snapshot may be taken
+ * between two related updates.
+ *
+ * Owned by a `shared_ptr`, as cloned requests can outlive the device.
+ */
+class DeviceStats final {
+ public:
+  static constexpr std::size_t EndpointCount
+    = FredEmmott_USBIP_VirtPP_Device_Stats_EndpointCount;
+
+  // `Instance::Run()` thread only
+  void OnSubmit(
+    const uint32_t endpoint,
+    const bool isInput,
+    const std::size_t outBytes) noexcept {
+    auto& urbs = isInput ? mSubmit.mInURBs : mSubmit.mOutURBs;
+    Increment(urbs[endpoint % EndpointCount]);
+    Increment(mSubmit.mBytesOut, outBytes);
+    Increment(mSubmit.mSubmittedURBs);
+    // We're the only writer of these two, so this doesn't need a CAS
+    auto& highWater = mSubmit.mPendingURBsHighWater;
+    const auto pending = GetPendingURBs();
+    if (pending > highWater.load(std::memory_order_relaxed)) {
+      highWater.store(pending, std::memory_order_relaxed);
+    }
+  }
+
+  // Any thread; call once per submitted URB
+  void OnReply(const int32_t status, const std::size_t inBytes) noexcept {
+    Increment(mReply.mReplies);
+    if (status != 0) {
+      Increment(mReply.mErrorReplies);
+    }
+    if (status == -LinuxEPIPE) {
+      Increment(mReply.mStallReplies);
+    }
+    Increment(mReply.mBytesIn, inBytes);
+    Increment(mReply.mCompletedURBs);
+  }
+
+  // `Instance::Run()` thread only; instead of `OnReply()`
+  void OnUnlink() noexcept {
+    Increment(mSubmit.mUnlinks);
+    Increment(mReply.mCompletedURBs);
+  }
+
+  void Get(FredEmmott_USBIP_VirtPP_Device_Stats&) const noexcept;
+
+ private:
+  // Linux's value; `<errno.h>` on Windows has a different one
+  static constexpr int32_t LinuxEPIPE = 32;
+  // Typical cache line size
+  static constexpr std::size_t CacheLineSize = 64;
+
+  [[nodiscard]] uint64_t GetPendingURBs() const noexcept {
+    // Completions first, so that a reply racing with us can't make this
+    // negative
+    const auto completed
+      = mReply.mCompletedURBs.load(std::memory_order_relaxed);
+    const auto submitted
+      = mSubmit.mSubmittedURBs.load(std::memory_order_relaxed);
+    return submitted > completed ? submitted - completed : 0;
+  }
+
+  static void Increment(
+    std::atomic<uint64_t>& counter,
+    const uint64_t by = 1) noexcept {
+    counter.fetch_add(by, std::memory_order_relaxed);
+  }
+
+  // Written by the `Instance::Run()` thread...
+  struct alignas(CacheLineSize) {
+    std::array<std::atomic<uint64_t>, EndpointCount> mInURBs {};
+    std::array<std::atomic<uint64_t>, EndpointCount> mOutURBs {};
+    std::atomic<uint64_t> mUnlinks {};
+    std::atomic<uint64_t> mBytesOut {};
+    std::atomic<uint64_t> mSubmittedURBs {};
+    std::atomic<uint64_t> mPendingURBsHighWater {};
+  } mSubmit;
+
+  // ... and these by whichever thread replies, so keep them apart
+  struct alignas(CacheLineSize) {
+    std::atomic<uint64_t> mReplies {};
+    std::atomic<uint64_t> mErrorReplies {};
+    std::atomic<uint64_t> mStallReplies {};
+    std::atomic<uint64_t> mBytesIn {};
+    std::atomic<uint64_t> mCompletedURBs {};
+  } mReply;
+};
+
+inline void DeviceStats::Get(
+  FredEmmott_USBIP_VirtPP_Device_Stats& ret) const noexcept {
+  constexpr auto Relaxed = std::memory_order_relaxed;
+  for (std::size_t i = 0; i < EndpointCount; ++i) {
+    ret.mInURBs[i] = mSubmit.mInURBs[i].load(Relaxed);
+    ret.mOutURBs[i] = mSubmit.mOutURBs[i].load(Relaxed);
+  }
+  ret.mReplies = mReply.mReplies.load(Relaxed);
+  ret.mErrorReplies = mReply.mErrorReplies.load(Relaxed);
+  ret.mStallReplies = mReply.mStallReplies.load(Relaxed);
+  ret.mUnlinks = mSubmit.mUnlinks.load(Relaxed);
+  ret.mBytesOut = mSubmit.mBytesOut.load(Relaxed);
+  ret.mBytesIn = mReply.mBytesIn.load(Relaxed);
+  ret.mPendingURBs = GetPendingURBs();
+  ret.mPendingURBsHighWater = mSubmit.mPendingURBsHighWater.load(Relaxed);
+}
+
+}// namespace FredEmmott::USBVirtPP
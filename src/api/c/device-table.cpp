@@ -0,0 +1,212 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+#include "device-table.hpp"
+
+#include "detail.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <functional>
+#include <span>
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+USBIP::Device MakeUSBIPDevice(
+  const uint32_t busId,
+  const uint32_t deviceId,
+  const FredEmmott_USBSpec_DeviceDescriptor& deviceDescriptor,
+  const uint8_t numInterfaces) {
+  USBIP::Device ret {
+    .mBusNum = busId,
+    .mDevNum = deviceId,
+    .mSpeed = USBIP::Speed::Full,
+    .mVendorID = deviceDescriptor.idVendor,
+    .mProductID = deviceDescriptor.idProduct,
+    .mDeviceVersion = deviceDescriptor.bcdDevice,
+    .mDeviceClass = deviceDescriptor.bDeviceClass,
+    .mDeviceSubClass = deviceDescriptor.bDeviceSubClass,
+    .mDeviceProtocol = deviceDescriptor.bDeviceProtocol,
+    .mNumConfigurations = deviceDescriptor.bNumConfigurations,
+    .mNumInterfaces = numInterfaces};
+  std::format_to(
+    ret.mPath, "/github.com/fredemmott/USBIP-VirtPP/{}/{}", busId, deviceId);
+  std::format_to(ret.mBusID, "{}-{}", busId, deviceId);
+  return ret;
+}
+
+constexpr std::size_t InvalidSlot = ~std::size_t {};
+
+std::size_t GetSlot(const uint32_t busNum, const uint32_t devNum) {
+  if (
+    busNum == 0 || devNum == 0 || devNum > DeviceTable::MaxDevicesPerBus)
+    [[unlikely]] {
+    return InvalidSlot;
+  }
+  return (std::size_t {busNum} - 1) * DeviceTable::MaxDevicesPerBus
+    + (devNum - 1);
+}
+}// namespace
+
+DeviceTable::~DeviceTable() {
+  for (auto&& chunkSlot: mChunks) {
+    const auto chunk = chunkSlot.load(std::memory_order_relaxed);
+    if (!chunk) {
+      continue;
+    }
+    for (auto&& entry: chunk->mEntries) {
+      delete entry.load(std::memory_order_relaxed);
+    }
+    delete chunk;
+  }
+}
+
+uint32_t DeviceTable::Add(const FredEmmott_USBIP_VirtPP_DeviceHandle device) {
+  std::unique_lock lock(mMutex);
+  std::size_t slot {};
+  if (mFreeSlots.empty()) {
+    slot = mSlotCount.load(std::memory_order_relaxed);
+    if (slot == ChunkSize * ChunkCount) [[unlikely]] {
+      return 0;
+    }
+  } else {
+    std::ranges::pop_heap(mFreeSlots, std::greater {});
+    slot = mFreeSlots.back();
+    mFreeSlots.pop_back();
+  }
+
+  auto& chunkSlot = mChunks[slot / ChunkSize];
+  auto chunk = chunkSlot.load(std::memory_order_relaxed);
+  if (!chunk) {
+    chunk = new Chunk();
+    chunkSlot.store(chunk, std::memory_order_release);
+  }
+
+  const auto busNum = static_cast<uint32_t>(slot / MaxDevicesPerBus) + 1;
+  const auto devNum = static_cast<uint32_t>(slot % MaxDevicesPerBus) + 1;
+  const auto entry = new Entry {
+    .mDevice = device,
+    .mDeviceID = (busNum << 16) | devNum,
+    .mBusID = std::format("{}-{}", busNum, devNum),
+    .mUSBIPDevice = MakeUSBIPDevice(
+      busNum,
+      devNum,
+      device->mDescriptor,
+      static_cast<uint8_t>(device->mInterfaces.size())),
+  };
+  chunk->mEntries[slot % ChunkSize].store(entry, std::memory_order_release);
+  if (slot == mSlotCount.load(std::memory_order_relaxed)) {
+    mSlotCount.store(slot + 1, std::memory_order_release);
+  }
+  mDevListReply = {};
+  return entry->mDeviceID;
+}
+
+void DeviceTable::Remove(const uint32_t deviceID) {
+  const auto slot = GetSlot(deviceID >> 16, deviceID & 0xffff);
+  if (slot >= mSlotCount.load(std::memory_order_acquire)) [[unlikely]] {
+    return;
+  }
+  std::unique_ptr<Entry> entry;
+  {
+    std::unique_lock lock(mMutex);
+    entry.reset(mChunks[slot / ChunkSize]
+                  .load(std::memory_order_relaxed)
+                  ->mEntries[slot % ChunkSize]
+                  .exchange(nullptr, std::memory_order_acq_rel));
+    if (!entry) [[unlikely]] {
+      return;
+    }
+    mDevListReply = {};
+  }
+
+  mEpochs.Synchronize();
+}
+
+void DeviceTable::Release(const uint32_t deviceID) {
+  const auto slot = GetSlot(deviceID >> 16, deviceID & 0xffff);
+  if (slot >= mSlotCount.load(std::memory_order_acquire)) [[unlikely]] {
+    return;
+  }
+  std::unique_lock lock(mMutex);
+  mFreeSlots.push_back(slot);
+  std::ranges::push_heap(mFreeSlots, std::greater {});
+}
+
+const DeviceTable::Entry* DeviceTable::GetEntry(
+  const std::size_t slot) const noexcept {
+  if (slot >= mSlotCount.load(std::memory_order_acquire)) [[unlikely]] {
+    return nullptr;
+  }
+  const auto chunk
+    = mChunks[slot / ChunkSize].load(std::memory_order_acquire);
+  return chunk->mEntries[slot % ChunkSize].load(std::memory_order_acquire);
+}
+
+std::shared_ptr<const std::vector<std::byte>> DeviceTable::GetDevListReply() {
+  std::unique_lock lock(mMutex);
+  if (mDevListReply) [[likely]] {
+    return mDevListReply;
+  }
+
+  // Entries can only be removed while we don't hold the lock, so we don't
+  // need to be pinned
+  std::vector<const Entry*> entries;
+  std::size_t size = sizeof(USBIP::OP_REP_DEVLIST);
+  ForEach([&](const Entry& entry) {
+    entries.push_back(&entry);
+    size += sizeof(USBIP::Device)
+      + (entry.mDevice->mInterfaces.size() * sizeof(USBIP::Interface));
+  });
+
+  auto reply = std::make_shared<std::vector<std::byte>>();
+  reply->reserve(size);
+  const auto append = [&reply](const auto& what) {
+    const auto bytes = std::as_bytes(std::span {&what, 1});
+    reply->insert(reply->end(), bytes.begin(), bytes.end());
+  };
+
+  append(USBIP::OP_REP_DEVLIST {
+    .mNumDevices = static_cast<uint32_t>(entries.size()),
+  });
+  for (auto&& entry: entries) {
+    append(entry->mUSBIPDevice);
+    for (auto&& iface: entry->mDevice->mInterfaces) {
+      append(USBIP::Interface {
+        .mClass = iface.bInterfaceClass,
+        .mSubClass = iface.bInterfaceSubClass,
+        .mProtocol = iface.bInterfaceProtocol,
+      });
+    }
+  }
+  mDevListReply = std::move(reply);
+  return mDevListReply;
+}
+
+const DeviceTable::Entry* DeviceTable::Find(
+  const uint32_t deviceID) const noexcept {
+  return GetEntry(GetSlot(deviceID >> 16, deviceID & 0xffff));
+}
+
+const DeviceTable::Entry* DeviceTable::Find(
+  const std::string_view busID) const noexcept {
+  const auto first = busID.data();
+  const auto last = first + busID.size();
+
+  uint32_t busNum {};
+  const auto [dash, busError] = std::from_chars(first, last, busNum);
+  if (busError != std::errc {} || dash == last || *dash != '-') {
+    return nullptr;
+  }
+  uint32_t devNum {};
+  const auto [end, devError] = std::from_chars(dash + 1, last, devNum);
+  if (devError != std::errc {} || end != last) {
+    return nullptr;
+  }
+
+  return GetEntry(GetSlot(busNum, devNum));
+}
+
+}// namespace FredEmmott::USBVirtPP
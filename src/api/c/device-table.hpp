@@ -0,0 +1,128 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "epoch.hpp"
+
+#include <FredEmmott/USBIP-VirtPP/Device.h>
+#include <FredEmmott/USBIP.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Maps USB/IP device IDs and bus IDs to devices in constant time.
+ *
+ * Slot `i` is device `(i % MaxDevicesPerBus) + 1` on bus
+ * `(i / MaxDevicesPerBus) + 1`, so the wire device ID - `busnum << 16 |
+ * devnum` - and the `"busnum-devnum"` bus ID are both arithmetic on the slot
+ * index. The bus ID string and the `USBIP::Device` record are built once,
+ * when the device is added, rather than for every request.
+ *
+ * Devices can be added and removed from any thread while others look them
+ * up: slots are atomic pointers in fixed-size chunks that never move, and
+ * removed entries are reclaimed with `EpochDomain`. Lookups must be made
+ * while holding a guard from `Pin()`; the entry, and the device it points
+ * to, stay valid until the guard is released.
+ *
+ * The complete `OP_REP_DEVLIST` reply is also cached, and rebuilt on the
+ * next request after the set of devices changes.
+ */
+class DeviceTable final {
+ public:
+  // Device numbers are 16 bits on the wire, and 0 is not a valid device
+  static constexpr std::size_t MaxDevicesPerBus = 0xffff;
+
+  struct Entry {
+    FredEmmott_USBIP_VirtPP_DeviceHandle mDevice {};
+    uint32_t mDeviceID {};
+    std::string mBusID;
+    USBIP::Device mUSBIPDevice {};
+  };
+
+  DeviceTable() = default;
+  DeviceTable(const DeviceTable&) = delete;
+  DeviceTable& operator=(const DeviceTable&) = delete;
+  ~DeviceTable();
+
+  /* Thread-safe.
+   *
+   * The device's descriptors must already be populated. Returns the device
+   * ID, or 0 if the table is full. Slots are reused, lowest first.
+   */
+  [[nodiscard]]
+  uint32_t Add(FredEmmott_USBIP_VirtPP_DeviceHandle);
+
+  /* Thread-safe.
+   *
+   * Waits until no other thread can still be using the device through the
+   * table, so the caller can free it when this returns.
+   *
+   * The device ID isn't reused until `Release()`, so state keyed on it can
+   * be cleaned up first.
+   */
+  void Remove(uint32_t deviceID);
+
+  // Thread-safe; makes a `Remove()`d device ID available to `Add()` again
+  void Release(uint32_t deviceID);
+
+  [[nodiscard]]
+  EpochDomain::Guard Pin() {
+    return mEpochs.Enter();
+  }
+
+  // Pinned threads only
+  [[nodiscard]]
+  const Entry* Find(uint32_t deviceID) const noexcept;
+  [[nodiscard]]
+  const Entry* Find(std::string_view busID) const noexcept;
+
+  // Pinned threads only
+  template <class F>
+  void ForEach(F&& f) const {
+    const auto count = mSlotCount.load(std::memory_order_acquire);
+    for (std::size_t slot = 0; slot < count; ++slot) {
+      if (const auto entry = GetEntry(slot)) {
+        f(*entry);
+      }
+    }
+  }
+
+  // `OP_REP_DEVLIST`, followed by each device and its interfaces
+  [[nodiscard]]
+  std::shared_ptr<const std::vector<std::byte>> GetDevListReply();
+
+ private:
+  static constexpr std::size_t ChunkSize = 256;
+  // Enough for 4 full busses
+  static constexpr std::size_t ChunkCount = 1024;
+
+  struct Chunk {
+    std::array<std::atomic<Entry*>, ChunkSize> mEntries {};
+  };
+
+  std::array<std::atomic<Chunk*>, ChunkCount> mChunks {};
+  // Slots that have ever been used
+  std::atomic<std::size_t> mSlotCount {};
+  EpochDomain mEpochs;
+
+  // Writers only
+  std::mutex mMutex;
+  // Min-heap
+  std::vector<std::size_t> mFreeSlots;
+  // Null if invalidated
+  std::shared_ptr<const std::vector<std::byte>> mDevListReply;
+
+  [[nodiscard]]
+  const Entry* GetEntry(std::size_t slot) const noexcept;
+};
+
+}// namespace FredEmmott::USBVirtPP
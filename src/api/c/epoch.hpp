@@ -0,0 +1,111 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Epoch-based reclamation, for shared data that's read far more often than
+ * it's removed.
+ *
+ * Readers hold a `Guard` while they use pointers loaded from the shared data;
+ * entering stamps one of a fixed set of reader slots with the current epoch.
+ * A writer unpublishes a pointer, then calls `Synchronize()`: this advances
+ * the epoch, and waits for every reader that entered before that to leave.
+ * No reader can then still see the old pointer, so the writer can free it.
+ *
+ * Readers never wait for writers, and never take a lock. Guards are meant to
+ * be short-lived - e.g. one event loop iteration - as `Synchronize()` waits
+ * for them.
+ */
+class EpochDomain final {
+  struct alignas(64) ReaderSlot {
+    // 0 if free
+    std::atomic<uint64_t> mEpoch {};
+    std::atomic<std::thread::id> mOwner {};
+  };
+
+ public:
+  // Concurrent readers; any more wait for a slot
+  static constexpr std::size_t MaxReaders = 16;
+
+  class Guard final {
+   public:
+    Guard() = delete;
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+    Guard(Guard&& other) noexcept
+      : mSlot(std::exchange(other.mSlot, nullptr)) {
+    }
+    Guard& operator=(Guard&&) = delete;
+
+    ~Guard() {
+      if (mSlot) {
+        mSlot->mOwner.store({}, std::memory_order_relaxed);
+        mSlot->mEpoch.store(0, std::memory_order_release);
+      }
+    }
+
+   private:
+    friend class EpochDomain;
+    explicit Guard(ReaderSlot* slot) : mSlot(slot) {
+    }
+    ReaderSlot* mSlot {};
+  };
+
+  EpochDomain() = default;
+  EpochDomain(const EpochDomain&) = delete;
+  EpochDomain& operator=(const EpochDomain&) = delete;
+
+  // Thread-safe; re-entrant
+  [[nodiscard]]
+  Guard Enter() {
+    while (true) {
+      for (auto&& slot: mReaders) {
+        uint64_t expected {};
+        if (slot.mEpoch.compare_exchange_strong(
+              expected, mEpoch.load(std::memory_order_seq_cst))) {
+          slot.mOwner.store(
+            std::this_thread::get_id(), std::memory_order_relaxed);
+          return Guard {&slot};
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  /* Thread-safe.
+   *
+   * Guards held by the calling thread are ignored, so this can be called
+   * from within a reader; the caller must not use anything it's removed
+   * after that reader returns.
+   */
+  void Synchronize() {
+    const auto epoch = mEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    const auto thisThread = std::this_thread::get_id();
+    for (auto&& slot: mReaders) {
+      while (true) {
+        const auto entered = slot.mEpoch.load(std::memory_order_seq_cst);
+        if (entered == 0 || entered >= epoch) {
+          break;
+        }
+        if (slot.mOwner.load(std::memory_order_relaxed) == thisThread) {
+          break;
+        }
+        std::this_thread::yield();
+      }
+    }
+  }
+
+ private:
+  std::atomic<uint64_t> mEpoch {1};
+  std::array<ReaderSlot, MaxReaders> mReaders {};
+};
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,128 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "event-loop.hpp"
+#include "unique-fd.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+
+class EPollEventLoop final : public EventLoop {
+ public:
+  EPollEventLoop(unique_fd epoll, unique_fd wakeFD)
+    : mEPoll(std::move(epoll)), mWakeFD(std::move(wakeFD)) {
+  }
+
+  HRESULT Add(const SOCKET socket, void* const key) override {
+    u_long nonBlocking {1};
+    if (ioctlsocket(socket, FIONBIO, &nonBlocking) == SOCKET_ERROR) {
+      return HRESULT_FROM_ERRNO(errno);
+    }
+    epoll_event event {
+      .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+      .data = {.ptr = key},
+    };
+    if (epoll_ctl(mEPoll.get(), EPOLL_CTL_ADD, socket, &event) != 0) {
+      return HRESULT_FROM_ERRNO(errno);
+    }
+    return S_OK;
+  }
+
+  void Remove(const SOCKET socket, void*) override {
+    epoll_ctl(mEPoll.get(), EPOLL_CTL_DEL, socket, nullptr);
+  }
+
+  std::expected<std::size_t, HRESULT> Wait(
+    const std::span<Event> events,
+    const std::optional<std::chrono::milliseconds> timeout) override {
+    if (events.empty()) [[unlikely]] {
+      return std::unexpected {HRESULT_FROM_ERRNO(EINVAL)};
+    }
+    mBuffer.resize(events.size());
+
+    const auto count = epoll_wait(
+      mEPoll.get(),
+      mBuffer.data(),
+      static_cast<int>(mBuffer.size()),
+      timeout ? static_cast<int>(timeout->count()) : -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        return 0;
+      }
+      return std::unexpected {HRESULT_FROM_ERRNO(errno)};
+    }
+
+    std::size_t ret = 0;
+    for (auto&& it: std::span {mBuffer}.first(count)) {
+      if (it.data.ptr == this) {
+        uint64_t ignored {};
+        std::ignore = read(mWakeFD.get(), &ignored, sizeof(ignored));
+        continue;
+      }
+      // The client may have sent more before shutting down, so a half-close
+      // is only readable; `Recv()` reports it once the data's been drained
+      events[ret++] = {
+        .mKey = it.data.ptr,
+        .mReadable = (it.events & (EPOLLIN | EPOLLRDHUP)) != 0,
+        .mWritable = (it.events & EPOLLOUT) != 0,
+        .mClosed = (it.events & (EPOLLHUP | EPOLLERR)) != 0,
+      };
+    }
+    return ret;
+  }
+
+  void Wake() override {
+    constexpr uint64_t one {1};
+    std::ignore = write(mWakeFD.get(), &one, sizeof(one));
+  }
+
+  // Second phase of construction, as the wake registration needs `this`
+  [[nodiscard]]
+  HRESULT RegisterWakeFD() {
+    epoll_event event {
+      .events = EPOLLIN,
+      .data = {.ptr = this},
+    };
+    if (epoll_ctl(mEPoll.get(), EPOLL_CTL_ADD, mWakeFD.get(), &event) != 0) {
+      return HRESULT_FROM_ERRNO(errno);
+    }
+    return S_OK;
+  }
+
+ private:
+  unique_fd mEPoll;
+  unique_fd mWakeFD;
+
+  std::vector<epoll_event> mBuffer;
+};
+
+}// namespace
+
+std::expected<std::unique_ptr<EventLoop>, HRESULT> CreateEPollEventLoop() {
+  unique_fd epoll {epoll_create1(EPOLL_CLOEXEC)};
+  if (!epoll) {
+    return std::unexpected {HRESULT_FROM_ERRNO(errno)};
+  }
+  unique_fd wakeFD {eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)};
+  if (!wakeFD) {
+    return std::unexpected {HRESULT_FROM_ERRNO(errno)};
+  }
+
+  auto ret
+    = std::make_unique<EPollEventLoop>(std::move(epoll), std::move(wakeFD));
+  if (const auto hr = ret->RegisterWakeFD(); FAILED(hr)) {
+    return std::unexpected {hr};
+  }
+  return ret;
+}
+
+}// namespace FredEmmott::USBVirtPP
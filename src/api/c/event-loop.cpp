@@ -0,0 +1,40 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "event-loop.hpp"
+
+#include "send-recv.hpp"
+
+namespace FredEmmott::USBVirtPP {
+
+std::expected<std::size_t, HRESULT>
+EventLoop::Recv(const SOCKET socket, void*, const std::span<std::byte> buffer) {
+  return RecvSome(socket, buffer.data(), buffer.size());
+}
+
+std::expected<std::size_t, HRESULT> EventLoop::Send(
+  const SOCKET socket,
+  void*,
+  const std::span<const std::span<const std::byte>> buffers) {
+  return SendSome(socket, buffers);
+}
+
+void EventLoop::Flush() {
+}
+
+std::expected<std::unique_ptr<EventLoop>, HRESULT> CreateEventLoop() {
+#if defined(_WIN32)
+  return CreateWin32EventLoop();
+#elif defined(__linux__)
+#ifdef USBIP_VIRTPP_HAVE_IO_URING
+  // Fails if io_uring is disabled by sysctl, or seccomp in a container
+  if (auto ret = CreateIOUringEventLoop()) {
+    return ret;
+  }
+#endif
+  return CreateEPollEventLoop();
+#else
+#error "No EventLoop backend for this platform"
+#endif
+}
+
+}// namespace FredEmmott::USBVirtPP
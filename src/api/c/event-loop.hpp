@@ -0,0 +1,136 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include "posix-compat.hpp"
+#endif
+
+namespace FredEmmott::USBVirtPP {
+
+/* Socket readiness backend for `Instance::Run()`.
+ *
+ * Sockets are registered with an opaque key - usually a `Connection*` - which
+ * is handed back as-is in `Event::mKey`; dispatching an event never needs a
+ * lookup, no matter how many sockets are registered.
+ *
+ * Notifications are edge-triggered: after a `mReadable` event, the caller must
+ * keep calling `Recv()` until it returns 0, or it may not be notified again.
+ * `Add()` puts the socket into non-blocking mode - as `WSAEventSelect()`
+ * does - so this never blocks.
+ *
+ * A single `Wait()` reports at most one event per key, so once the caller
+ * has removed a socket, the rest of the events are still safe to handle.
+ *
+ * Implementations:
+ * - win32-event-loop.cpp: `WSAEventSelect()` + `WaitForMultipleObjects()`;
+ *   past `MAXIMUM_WAIT_OBJECTS - 1` sockets, they share events
+ * - epoll-event-loop.cpp: Linux `epoll`; no fixed limit
+ * - io_uring-event-loop.cpp: Linux `io_uring`, if built with
+ *   `USBIP_VIRTPP_IO_URING`; falls back to `epoll` if the kernel refuses
+ *   to create a ring, or is older than 6.0. Sends are deferred until
+ *   `Flush()`, and submitted along with the next `Wait()` in a single
+ *   `io_uring_enter()`; data is received by the kernel before `Recv()`
+ */
+class EventLoop {
+ public:
+  struct Event {
+    void* mKey {};
+    bool mReadable {};
+    // A previous `Send()` didn't accept everything, but now there's space
+    bool mWritable {};
+    // Reset, or failed; a graceful close by the client is `mReadable`, and
+    // `Recv()` fails once everything sent before it has been received
+    bool mClosed {};
+  };
+
+  virtual ~EventLoop() = default;
+
+  [[nodiscard]]
+  virtual HRESULT Add(SOCKET, void* key) = 0;
+  virtual void Remove(SOCKET, void* key) = 0;
+
+  /* Block until at least one registered socket is ready, until `Wake()` is
+   * called, or until `timeout` has passed; `std::nullopt` waits
+   * indefinitely, and zero just polls.
+   *
+   * Returns the number of events written to the span; 0 if we were woken up
+   * without any socket activity.
+   *
+   * If more sockets are ready than there is space for, the ones that are left
+   * out must be reported by the next call.
+   */
+  [[nodiscard]]
+  virtual std::expected<std::size_t, HRESULT> Wait(
+    std::span<Event>,
+    std::optional<std::chrono::milliseconds> timeout)
+    = 0;
+
+  // Thread-safe
+  virtual void Wake() = 0;
+
+  /* Receive whatever is available, up to `buffer.size()` bytes, without
+   * blocking.
+   *
+   * Returns 0 if no data is available; if the peer has closed the
+   * connection, fails with `WSAECONNRESET`.
+   *
+   * By default, this is a non-blocking `recv()`; backends may have received
+   * the data already, and copy it from there.
+   *
+   * Loop thread only.
+   */
+  [[nodiscard]]
+  virtual std::expected<std::size_t, HRESULT>
+  Recv(SOCKET, void* key, std::span<std::byte> buffer);
+
+  /* Send as much of `buffers` as possible, in order, without blocking.
+   *
+   * Returns how many bytes were accepted; if that's less than the total, an
+   * `mWritable` event is reported when more can be sent, and the caller is
+   * responsible for retrying with the remainder.
+   *
+   * Backends may copy the data and defer the write until `Flush()`; by
+   * default, this is a single non-blocking gather-write.
+   *
+   * Loop thread only.
+   */
+  [[nodiscard]]
+  virtual std::expected<std::size_t, HRESULT> Send(
+    SOCKET,
+    void* key,
+    std::span<const std::span<const std::byte>>);
+
+  /* Start any writes deferred by `Send()`.
+   *
+   * Called by `Instance::Run()` once per loop iteration, on the loop thread.
+   */
+  virtual void Flush();
+};
+
+[[nodiscard]]
+std::expected<std::unique_ptr<EventLoop>, HRESULT> CreateEventLoop();
+
+#ifdef _WIN32
+[[nodiscard]]
+std::expected<std::unique_ptr<EventLoop>, HRESULT> CreateWin32EventLoop();
+#endif
+#ifdef __linux__
+[[nodiscard]]
+std::expected<std::unique_ptr<EventLoop>, HRESULT> CreateEPollEventLoop();
+#endif
+#ifdef USBIP_VIRTPP_HAVE_IO_URING
+[[nodiscard]]
+std::expected<std::unique_ptr<EventLoop>, HRESULT> CreateIOUringEventLoop();
+#endif
+
+}// namespace FredEmmott::USBVirtPP
@@ -19,6 +19,10 @@ struct guarded_data {
       return mData;
     }
 
+    T& operator*() const {
+      return *mData;
+    }
+
     void unlock() {
       mData = nullptr;
       mLock.unlock();
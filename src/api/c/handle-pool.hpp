@@ -0,0 +1,139 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Pool of `T`s, addressed by generation-checked handles.
+ *
+ * Handles are tagged pointers: the address of a slot, with the slot's
+ * generation in the otherwise-unused top 16 bits. Destroying a handle bumps
+ * the generation, so stale handles - including double-destroys - are detected
+ * instead of dereferenced, until the generation wraps around.
+ *
+ * Slots are allocated in chunks, and are never freed until the pool is; once
+ * the pool has grown to its working size, creating and destroying handles
+ * doesn't allocate.
+ *
+ * Handles are `T*` so that they can be used as opaque C API handles, but must
+ * not be dereferenced; use `Get()`. A handle without a tag isn't from a pool,
+ * and is left to the caller.
+ */
+template <class T>
+class HandlePool final {
+  static_assert(
+    sizeof(void*) == 8, "Tagged handles need 64-bit user-mode addresses");
+
+ public:
+  HandlePool() = default;
+  HandlePool(const HandlePool&) = delete;
+  HandlePool& operator=(const HandlePool&) = delete;
+
+  // Thread-safe
+  [[nodiscard]]
+  T* Create(const T& value) {
+    Slot* slot {};
+    {
+      std::unique_lock lock(mMutex);
+      if (!mFreeList) [[unlikely]] {
+        Grow();
+      }
+      slot = std::exchange(mFreeList, mFreeList->mNextFree);
+    }
+    slot->mValue = value;
+    const uintptr_t generation
+      = slot->mGeneration.load(std::memory_order_relaxed);
+    return reinterpret_cast<T*>(
+      reinterpret_cast<uintptr_t>(slot) | (generation << TagShift));
+  }
+
+  /* Thread-safe.
+   *
+   * Returns false if `handle` is stale, or isn't from a pool.
+   */
+  bool Destroy(T* const handle) {
+    const auto slot = GetSlot(handle);
+    if (!slot) {
+      return false;
+    }
+    // If there's a concurrent `Destroy()` for the same handle, only one wins
+    auto generation = GetTag(handle);
+    const auto next = static_cast<uint16_t>(generation + 1);
+    if (!slot->mGeneration.compare_exchange_strong(
+          generation, next ? next : 1, std::memory_order_acq_rel)) {
+      return false;
+    }
+    slot->mValue = {};
+
+    std::unique_lock lock(mMutex);
+    slot->mNextFree = std::exchange(mFreeList, slot);
+    return true;
+  }
+
+  [[nodiscard]]
+  static bool IsPooled(const T* const handle) noexcept {
+    return GetTag(handle) != 0;
+  }
+
+  // Returns null if `handle` is stale, or isn't from a pool
+  [[nodiscard]]
+  static T* Get(T* const handle) noexcept {
+    const auto slot = GetSlot(handle);
+    return slot ? &slot->mValue : nullptr;
+  }
+
+ private:
+  static constexpr std::size_t TagShift = 48;
+  static constexpr uintptr_t AddressMask = (uintptr_t {1} << TagShift) - 1;
+  static constexpr std::size_t SlotsPerChunk = 256;
+
+  struct Slot {
+    T mValue {};
+    Slot* mNextFree {};
+    // Never 0, so that tagged handles are distinguishable from pointers
+    std::atomic<uint16_t> mGeneration {1};
+  };
+
+  std::mutex mMutex;
+  Slot* mFreeList {};
+  std::vector<std::unique_ptr<Slot[]>> mChunks;
+
+  [[nodiscard]]
+  static uint16_t GetTag(const T* const handle) noexcept {
+    return static_cast<uint16_t>(
+      reinterpret_cast<uintptr_t>(handle) >> TagShift);
+  }
+
+  [[nodiscard]]
+  static Slot* GetSlot(T* const handle) noexcept {
+    const auto tag = GetTag(handle);
+    if (tag == 0) {
+      return nullptr;
+    }
+    const auto slot = reinterpret_cast<Slot*>(
+      reinterpret_cast<uintptr_t>(handle) & AddressMask);
+    if (slot->mGeneration.load(std::memory_order_acquire) != tag) {
+      return nullptr;
+    }
+    return slot;
+  }
+
+  // Caller must hold `mMutex`
+  void Grow() {
+    auto chunk = std::make_unique<Slot[]>(SlotsPerChunk);
+    for (std::size_t i = 0; i < SlotsPerChunk; ++i) {
+      chunk[i].mNextFree = std::exchange(mFreeList, &chunk[i]);
+    }
+    mChunks.push_back(std::move(chunk));
+  }
+};
+
+}// namespace FredEmmott::USBVirtPP
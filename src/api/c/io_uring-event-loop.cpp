@@ -0,0 +1,707 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "event-loop.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <liburing.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+
+constexpr unsigned int RingEntries = 1024;
+// Per socket, between `Send()` and the kernel; once this is reached, callers
+// keep anything else until we report `mWritable`
+constexpr std::size_t MaxBufferedBytes = 256 * 1024;
+
+// Shared by every connection's multishot receive; the kernel picks a free
+// one for each completion, and `Recv()` gives it back once it's been copied
+// into the connection's `ReceiveBuffer`.
+constexpr unsigned int RecvBufferCount = 256;
+constexpr std::size_t RecvBufferSize = 16 * 1024;
+constexpr int RecvBufferGroup = 0;
+// A connection that isn't being read from - paused, or flooding us faster
+// than its budget - holds on to its buffers. Once it holds this many, its
+// receive is cancelled, leaving anything else in the socket, so it can't
+// starve the others; it's restarted once `Recv()` has taken half of them.
+constexpr std::size_t MaxRecvBuffersPerSocket = RecvBufferCount / 16;
+constexpr std::size_t ResumeRecvBuffersPerSocket = MaxRecvBuffersPerSocket / 2;
+
+/* Every SQE's user_data is a registration's generation, and one of these.
+ *
+ * Generations are never reused, so a completion for a removed registration
+ * can't be mistaken for one for a new registration that happens to have the
+ * same socket, or the same key.
+ */
+enum class OperationKind : uint8_t {
+  // Cancellations; nothing to do when they complete
+  Ignore,
+  Wake,
+  // Only used for listening sockets
+  Poll,
+  Recv,
+  Send,
+};
+constexpr unsigned int OperationKindBits = 3;
+constexpr uint64_t OperationKindMask = (1 << OperationKindBits) - 1;
+
+[[nodiscard]]
+constexpr uint64_t MakeUserData(
+  const uint64_t generation,
+  const OperationKind kind) {
+  return (generation << OperationKindBits) | std::to_underlying(kind);
+}
+
+struct SendOperation {
+  // Appended to by `Send()`
+  std::vector<std::byte> mPending;
+  // Owned by the kernel while `mInFlight`
+  std::vector<std::byte> mSending;
+  std::size_t mSent {};
+  bool mInFlight {false};
+  bool mDirty {false};
+  // `Send()` didn't accept everything
+  bool mWantWritable {false};
+  HRESULT mError {S_OK};
+};
+
+// Part of a provided buffer that `Recv()` hasn't taken yet
+struct ReceivedData {
+  uint16_t mBufferID {};
+  uint32_t mOffset {};
+  uint32_t mSize {};
+};
+
+struct Registration {
+  Registration(
+    const SOCKET socket,
+    void* const key,
+    const uint64_t generation,
+    const bool listening)
+    : mSocket(socket),
+      mKey(key),
+      mGeneration(generation),
+      mListening(listening) {
+  }
+
+  const SOCKET mSocket;
+  void* const mKey;
+  const uint64_t mGeneration;
+  // Polled for `accept()`, instead of received from
+  const bool mListening;
+
+  SendOperation mSend;
+
+  // Loop thread only
+  std::deque<ReceivedData> mReceived;
+  bool mRecvArmed {false};
+  // We've asked the kernel to stop the receive, as `mReceived` is full
+  bool mRecvCancelling {false};
+  bool mEndOfStream {false};
+  HRESULT mRecvError {S_OK};
+
+  // Can't be freed until the kernel's finished with every operation
+  uint8_t mOperationsInFlight {};
+  bool mRemoved {false};
+
+  // Loop thread only; a `Wait()` reports at most one event per
+  // registration, so later completions are merged into that one
+  uint64_t mLastWait {};
+  std::size_t mEventIndex {};
+};
+
+class IOUringEventLoop final : public EventLoop {
+ public:
+  IOUringEventLoop() = default;
+  ~IOUringEventLoop() override {
+    if (mBufferRing) {
+      io_uring_free_buf_ring(
+        &mRing, mBufferRing, RecvBufferCount, RecvBufferGroup);
+    }
+    if (mHaveRing) {
+      io_uring_queue_exit(&mRing);
+    }
+    if (mWakeFD >= 0) {
+      close(mWakeFD);
+    }
+  }
+
+  [[nodiscard]]
+  HRESULT Init() {
+    if (const auto ret = io_uring_queue_init(RingEntries, &mRing, 0);
+        ret < 0) {
+      return HRESULT_FROM_ERRNO(-ret);
+    }
+    mHaveRing = true;
+
+    // Multishot receives need Linux 6.0, as does `IORING_OP_SEND_ZC`, which
+    // we can probe for
+    const auto probe = io_uring_get_probe_ring(&mRing);
+    const auto haveMultishotRecv
+      = probe && io_uring_opcode_supported(probe, IORING_OP_SEND_ZC);
+    io_uring_free_probe(probe);
+    if (!haveMultishotRecv) {
+      return HRESULT_FROM_ERRNO(ENOSYS);
+    }
+
+    int ret {};
+    mBufferRing = io_uring_setup_buf_ring(
+      &mRing, RecvBufferCount, RecvBufferGroup, 0, &ret);
+    if (!mBufferRing) {
+      return HRESULT_FROM_ERRNO(-ret);
+    }
+    mRecvBuffers.resize(RecvBufferCount * RecvBufferSize);
+    for (unsigned int i = 0; i < RecvBufferCount; ++i) {
+      io_uring_buf_ring_add(
+        mBufferRing,
+        GetRecvBuffer(i),
+        RecvBufferSize,
+        static_cast<uint16_t>(i),
+        io_uring_buf_ring_mask(RecvBufferCount),
+        static_cast<int>(i));
+    }
+    io_uring_buf_ring_advance(mBufferRing, RecvBufferCount);
+
+    mWakeFD = eventfd(0, EFD_CLOEXEC);
+    if (mWakeFD < 0) {
+      return HRESULT_FROM_ERRNO(errno);
+    }
+    ArmWakeRead();
+    return S_OK;
+  }
+
+  HRESULT Add(const SOCKET socket, void* const key) override {
+    u_long nonBlocking {1};
+    if (ioctlsocket(socket, FIONBIO, &nonBlocking) == SOCKET_ERROR) {
+      return HRESULT_FROM_ERRNO(errno);
+    }
+    int listening {};
+    socklen_t size = sizeof(listening);
+    if (
+      getsockopt(socket, SOL_SOCKET, SO_ACCEPTCONN, &listening, &size) != 0) {
+      return HRESULT_FROM_ERRNO(errno);
+    }
+
+    const auto generation = mNextGeneration++;
+    auto owned = std::make_unique<Registration>(
+      socket, key, generation, listening != 0);
+    auto& registration = *owned;
+    mRegistrations.emplace(generation, std::move(owned));
+    {
+      const std::unique_lock lock(mMutex);
+      mByKey.insert_or_assign(key, &registration);
+    }
+
+    if (registration.mListening) {
+      ArmPoll(registration);
+    } else {
+      ArmRecv(registration);
+    }
+    return S_OK;
+  }
+
+  void Remove(const SOCKET, void* const key) override {
+    Registration* registration {};
+    {
+      const std::unique_lock lock(mMutex);
+      const auto it = mByKey.find(key);
+      if (it == mByKey.end()) [[unlikely]] {
+        return;
+      }
+      registration = it->second;
+      mByKey.erase(it);
+      registration->mRemoved = true;
+    }
+
+    std::erase(mStarved, registration);
+    for (auto&& received: registration->mReceived) {
+      RecycleBuffer(received.mBufferID);
+    }
+    registration->mReceived.clear();
+
+    if (registration->mListening) {
+      const auto sqe = GetSQE();
+      io_uring_prep_poll_remove(
+        sqe, MakeUserData(registration->mGeneration, OperationKind::Poll));
+      io_uring_sqe_set_data64(sqe, MakeUserData(0, OperationKind::Ignore));
+    } else if (registration->mRecvArmed) {
+      const auto sqe = GetSQE();
+      io_uring_prep_cancel64(
+        sqe, MakeUserData(registration->mGeneration, OperationKind::Recv), 0);
+      io_uring_sqe_set_data64(sqe, MakeUserData(0, OperationKind::Ignore));
+    }
+
+    // Any in-flight send still references the buffers
+    const std::unique_lock lock(mMutex);
+    MaybeFree(*registration);
+  }
+
+  std::expected<std::size_t, HRESULT> Wait(
+    const std::span<Event> events,
+    const std::optional<std::chrono::milliseconds> timeout) override {
+    if (events.empty()) [[unlikely]] {
+      return std::unexpected {HRESULT_FROM_ERRNO(EINVAL)};
+    }
+
+    // Submits everything queued by `Flush()`, `Add()` and `Remove()` in the
+    // same syscall as the wait
+    if (timeout) {
+      __kernel_timespec ts {
+        .tv_sec = timeout->count() / 1000,
+        .tv_nsec = (timeout->count() % 1000) * 1'000'000,
+      };
+      io_uring_cqe* cqe {};
+      if (const auto ret
+          = io_uring_submit_and_wait_timeout(&mRing, &cqe, 1, &ts, nullptr);
+          ret < 0 && ret != -EINTR && ret != -ETIME) [[unlikely]] {
+        return std::unexpected {HRESULT_FROM_ERRNO(-ret)};
+      }
+    } else if (const auto ret = io_uring_submit_and_wait(&mRing, 1);
+               ret < 0 && ret != -EINTR) [[unlikely]] {
+      return std::unexpected {HRESULT_FROM_ERRNO(-ret)};
+    }
+
+    ++mWaitCount;
+    std::size_t count = 0;
+    unsigned int seen = 0;
+    unsigned int head {};
+    io_uring_cqe* cqe {};
+    io_uring_for_each_cqe(&mRing, head, cqe) {
+      const auto userData = io_uring_cqe_get_data64(cqe);
+      const auto kind
+        = static_cast<OperationKind>(userData & OperationKindMask);
+      if (
+        kind != OperationKind::Ignore && kind != OperationKind::Wake
+        && count == events.size()) {
+        // Leave it in the completion queue for the next call
+        break;
+      }
+      ++seen;
+      if (kind == OperationKind::Ignore) {
+        continue;
+      }
+      if (kind == OperationKind::Wake) {
+        ArmWakeRead();
+        continue;
+      }
+
+      const auto it = mRegistrations.find(userData >> OperationKindBits);
+      if (it == mRegistrations.end()) [[unlikely]] {
+        // Registrations outlive their operations, so this shouldn't happen
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+          RecycleBuffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        continue;
+      }
+      auto& registration = *it->second;
+      std::optional<Event> event;
+      switch (kind) {
+        case OperationKind::Poll:
+          event = OnPollCompletion(registration, *cqe);
+          break;
+        case OperationKind::Recv:
+          event = OnRecvCompletion(registration, *cqe);
+          break;
+        case OperationKind::Send:
+          event = OnSendCompletion(registration, cqe->res);
+          break;
+        default:
+          break;
+      }
+      if (!event) {
+        continue;
+      }
+      if (registration.mLastWait == mWaitCount) {
+        auto& merged = events[registration.mEventIndex];
+        merged.mReadable |= event->mReadable;
+        merged.mWritable |= event->mWritable;
+        merged.mClosed |= event->mClosed;
+        continue;
+      }
+      registration.mLastWait = mWaitCount;
+      registration.mEventIndex = count;
+      events[count++] = *event;
+    }
+    io_uring_cq_advance(&mRing, seen);
+    return count;
+  }
+
+  void Wake() override {
+    constexpr uint64_t one {1};
+    std::ignore = write(mWakeFD, &one, sizeof(one));
+  }
+
+  std::expected<std::size_t, HRESULT>
+  Recv(const SOCKET, void* const key, const std::span<std::byte> buffer)
+    override {
+    Registration* registration {};
+    {
+      const std::unique_lock lock(mMutex);
+      const auto it = mByKey.find(key);
+      if (it == mByKey.end()) [[unlikely]] {
+        return std::unexpected {HRESULT_FROM_ERRNO(EBADF)};
+      }
+      registration = it->second;
+    }
+
+    auto& received = registration->mReceived;
+    std::size_t copied {};
+    while (copied < buffer.size() && !received.empty()) {
+      auto& front = received.front();
+      const auto chunk = std::min<std::size_t>(
+        front.mSize, buffer.size() - copied);
+      std::memcpy(
+        buffer.data() + copied,
+        GetRecvBuffer(front.mBufferID) + front.mOffset,
+        chunk);
+      copied += chunk;
+      front.mOffset += chunk;
+      front.mSize -= chunk;
+      if (front.mSize == 0) {
+        RecycleBuffer(front.mBufferID);
+        received.pop_front();
+      }
+    }
+    MaybeArmRecv(*registration);
+    if (copied) {
+      return copied;
+    }
+    if (FAILED(registration->mRecvError)) {
+      return std::unexpected {registration->mRecvError};
+    }
+    if (registration->mEndOfStream) {
+      return std::unexpected {HRESULT_FROM_ERRNO(ECONNRESET)};
+    }
+    return 0;
+  }
+
+  std::expected<std::size_t, HRESULT> Send(
+    const SOCKET,
+    void* const key,
+    const std::span<const std::span<const std::byte>> buffers) override {
+    const std::unique_lock lock(mMutex);
+    const auto it = mByKey.find(key);
+    if (it == mByKey.end()) [[unlikely]] {
+      return std::unexpected {HRESULT_FROM_ERRNO(EBADF)};
+    }
+    auto& send = it->second->mSend;
+    if (FAILED(send.mError)) [[unlikely]] {
+      return std::unexpected {send.mError};
+    }
+
+    const auto buffered = send.mPending.size() + send.mSending.size();
+    auto space = MaxBufferedBytes - std::min(buffered, MaxBufferedBytes);
+    std::size_t accepted {};
+    for (auto&& buffer: buffers) {
+      const auto chunk = buffer.first(std::min(space, buffer.size()));
+      send.mPending.insert(send.mPending.end(), chunk.begin(), chunk.end());
+      accepted += chunk.size();
+      space -= chunk.size();
+    }
+    if (space == 0) {
+      send.mWantWritable = true;
+    }
+    if (accepted && !send.mDirty) {
+      send.mDirty = true;
+      mDirty.push_back(it->second);
+    }
+    return accepted;
+  }
+
+  void Flush() override {
+    const std::unique_lock lock(mMutex);
+    for (auto&& registration: mDirty) {
+      auto& send = registration->mSend;
+      send.mDirty = false;
+      if (registration->mRemoved) {
+        MaybeFree(*registration);
+        continue;
+      }
+      if (send.mInFlight || send.mPending.empty()) {
+        // We'll be marked dirty again when the in-flight send completes
+        continue;
+      }
+      std::swap(send.mPending, send.mSending);
+      send.mSent = 0;
+      SubmitSend(*registration);
+    }
+    mDirty.clear();
+  }
+
+ private:
+  io_uring mRing {};
+  bool mHaveRing {false};
+  int mWakeFD {-1};
+  uint64_t mWakeBuffer {};
+
+  io_uring_buf_ring* mBufferRing {};
+  std::vector<std::byte> mRecvBuffers;
+
+  // Loop thread only; every registration, including removed ones that
+  // the kernel might still be using
+  std::unordered_map<uint64_t, std::unique_ptr<Registration>> mRegistrations;
+  // Generation 0 is for operations that aren't for a registration
+  uint64_t mNextGeneration {1};
+  uint64_t mWaitCount {};
+  // Loop thread only; their multishot receive ran out of buffers, so needs
+  // to be restarted once some are available
+  std::vector<Registration*> mStarved;
+
+  // Guards `mByKey`, `mDirty`, and every `SendOperation`
+  std::mutex mMutex;
+  // Registrations that haven't been removed
+  std::unordered_map<void*, Registration*> mByKey;
+  std::vector<Registration*> mDirty;
+
+  [[nodiscard]]
+  std::byte* GetRecvBuffer(const std::size_t id) {
+    return mRecvBuffers.data() + (id * RecvBufferSize);
+  }
+
+  io_uring_sqe* GetSQE() {
+    while (true) {
+      if (const auto sqe = io_uring_get_sqe(&mRing)) {
+        return sqe;
+      }
+      // Submission queue is full; make some space
+      io_uring_submit(&mRing);
+    }
+  }
+
+  void ArmWakeRead() {
+    const auto sqe = GetSQE();
+    io_uring_prep_read(sqe, mWakeFD, &mWakeBuffer, sizeof(mWakeBuffer), 0);
+    io_uring_sqe_set_data64(sqe, MakeUserData(0, OperationKind::Wake));
+  }
+
+  void ArmPoll(Registration& registration) {
+    const auto sqe = GetSQE();
+    io_uring_prep_poll_multishot(sqe, registration.mSocket, POLLIN);
+    io_uring_sqe_set_data64(
+      sqe, MakeUserData(registration.mGeneration, OperationKind::Poll));
+    ++registration.mOperationsInFlight;
+  }
+
+  void ArmRecv(Registration& registration) {
+    const auto sqe = GetSQE();
+    io_uring_prep_recv_multishot(sqe, registration.mSocket, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RecvBufferGroup;
+    io_uring_sqe_set_data64(
+      sqe, MakeUserData(registration.mGeneration, OperationKind::Recv));
+    registration.mRecvArmed = true;
+    ++registration.mOperationsInFlight;
+  }
+
+  // Restarts the receive if it's stopped, and there's room for more
+  void MaybeArmRecv(Registration& registration) {
+    if (
+      registration.mRecvArmed || registration.mRemoved
+      || registration.mEndOfStream || FAILED(registration.mRecvError)
+      || registration.mReceived.size() > ResumeRecvBuffersPerSocket) {
+      return;
+    }
+    ArmRecv(registration);
+  }
+
+  void CancelRecv(Registration& registration) {
+    if (registration.mRecvCancelling || !registration.mRecvArmed) {
+      return;
+    }
+    const auto sqe = GetSQE();
+    io_uring_prep_cancel64(
+      sqe, MakeUserData(registration.mGeneration, OperationKind::Recv), 0);
+    io_uring_sqe_set_data64(sqe, MakeUserData(0, OperationKind::Ignore));
+    registration.mRecvCancelling = true;
+  }
+
+  void RecycleBuffer(const unsigned int id) {
+    io_uring_buf_ring_add(
+      mBufferRing,
+      GetRecvBuffer(id),
+      RecvBufferSize,
+      static_cast<uint16_t>(id),
+      io_uring_buf_ring_mask(RecvBufferCount),
+      0);
+    io_uring_buf_ring_advance(mBufferRing, 1);
+
+    for (auto&& registration: std::exchange(mStarved, {})) {
+      MaybeArmRecv(*registration);
+    }
+  }
+
+  // Call with mMutex held
+  void SubmitSend(Registration& registration) {
+    auto& send = registration.mSend;
+    const auto sqe = GetSQE();
+    io_uring_prep_send(
+      sqe,
+      registration.mSocket,
+      send.mSending.data() + send.mSent,
+      send.mSending.size() - send.mSent,
+      MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(
+      sqe, MakeUserData(registration.mGeneration, OperationKind::Send));
+    send.mInFlight = true;
+    ++registration.mOperationsInFlight;
+  }
+
+  std::optional<Event> OnPollCompletion(
+    Registration& registration,
+    const io_uring_cqe& cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      // Multishot poll has terminated; either removed, or the kernel gave up
+      --registration.mOperationsInFlight;
+      if (registration.mRemoved) {
+        const std::unique_lock lock(mMutex);
+        MaybeFree(registration);
+        return std::nullopt;
+      }
+      ArmPoll(registration);
+    }
+    if (registration.mRemoved || cqe.res == -ECANCELED) {
+      return std::nullopt;
+    }
+
+    if (cqe.res < 0) {
+      return Event {.mKey = registration.mKey, .mClosed = true};
+    }
+    return Event {
+      .mKey = registration.mKey,
+      .mReadable = (static_cast<unsigned int>(cqe.res) & POLLIN) != 0,
+    };
+  }
+
+  std::optional<Event> OnRecvCompletion(
+    Registration& registration,
+    const io_uring_cqe& cqe) {
+    const auto more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+    if (!more) {
+      --registration.mOperationsInFlight;
+      registration.mRecvArmed = false;
+      registration.mRecvCancelling = false;
+    }
+    const auto hasBuffer = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+    const auto bufferID = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+    if (registration.mRemoved) {
+      if (hasBuffer) {
+        RecycleBuffer(bufferID);
+      }
+      if (!more) {
+        const std::unique_lock lock(mMutex);
+        MaybeFree(registration);
+      }
+      return std::nullopt;
+    }
+
+    if (cqe.res > 0 && hasBuffer) {
+      registration.mReceived.push_back({
+        .mBufferID = static_cast<uint16_t>(bufferID),
+        .mSize = static_cast<uint32_t>(cqe.res),
+      });
+      if (registration.mReceived.size() >= MaxRecvBuffersPerSocket) {
+        CancelRecv(registration);
+      } else if (!more) {
+        MaybeArmRecv(registration);
+      }
+      return Event {.mKey = registration.mKey, .mReadable = true};
+    }
+
+    switch (cqe.res) {
+      case -ENOBUFS:
+        // Every buffer is waiting for a `Recv()`; the data is still in the
+        // socket, so carry on once one is recycled
+        mStarved.push_back(&registration);
+        return std::nullopt;
+      case -ECANCELED:
+        // By `CancelRecv()`; `Recv()` may have made room since
+        MaybeArmRecv(registration);
+        return std::nullopt;
+      case 0:
+        registration.mEndOfStream = true;
+        break;
+      default:
+        registration.mRecvError = HRESULT_FROM_ERRNO(-cqe.res);
+        break;
+    }
+    // Let the caller handle what we've already received first; `Recv()`
+    // reports the disconnect once that's done
+    if (registration.mReceived.empty()) {
+      return Event {.mKey = registration.mKey, .mClosed = true};
+    }
+    return Event {.mKey = registration.mKey, .mReadable = true};
+  }
+
+  std::optional<Event> OnSendCompletion(
+    Registration& registration,
+    const int result) {
+    auto& send = registration.mSend;
+    const std::unique_lock lock(mMutex);
+    --registration.mOperationsInFlight;
+    send.mInFlight = false;
+
+    if (registration.mRemoved) {
+      MaybeFree(registration);
+      return std::nullopt;
+    }
+
+    if (result < 0) {
+      // The receive will report the disconnect
+      send.mError = HRESULT_FROM_ERRNO(-result);
+      send.mSending.clear();
+      send.mPending.clear();
+      return std::nullopt;
+    }
+
+    send.mSent += result;
+    if (send.mSent < send.mSending.size()) {
+      SubmitSend(registration);
+      return std::nullopt;
+    }
+    send.mSending.clear();
+    if ((!send.mPending.empty()) && !send.mDirty) {
+      send.mDirty = true;
+      mDirty.push_back(&registration);
+    }
+    if (!send.mWantWritable) {
+      return std::nullopt;
+    }
+    send.mWantWritable = false;
+    return Event {.mKey = registration.mKey, .mWritable = true};
+  }
+
+  // Call with mMutex held
+  void MaybeFree(Registration& registration) {
+    // If it's dirty, it's still referenced by `mDirty`
+    if (registration.mOperationsInFlight == 0 && !registration.mSend.mDirty) {
+      mRegistrations.erase(registration.mGeneration);
+    }
+  }
+};
+
+}// namespace
+
+std::expected<std::unique_ptr<EventLoop>, HRESULT> CreateIOUringEventLoop() {
+  auto ret = std::make_unique<IOUringEventLoop>();
+  if (const auto hr = ret->Init(); FAILED(hr)) {
+    return std::unexpected {hr};
+  }
+  return ret;
+}
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,128 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "detail-Connection.hpp"
+#include "guarded_data.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Paces isochronous replies to the USB frame clock.
+ *
+ * A real device completes an isochronous URB once the frame of its last
+ * packet has passed, and hosts rely on that to stream in real time with only
+ * a few URBs in flight. Devices here reply as soon as they have the data, so
+ * replies are held back until they're due.
+ *
+ * Each stream is scheduled back-to-back: a transfer starts when the previous
+ * one on the same stream ends, or in the current frame if the host has fallen
+ * behind. The host's `start_frame` is in its own frame numbering, so it's
+ * ignored; every transfer is treated as `URB_ISO_ASAP`.
+ *
+ * We present full-speed devices, so a frame is 1ms.
+ */
+class IsoScheduler final {
+ public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr std::chrono::milliseconds FrameDuration {1};
+  // Frame numbers on the wire are 11 bits
+  static constexpr uint32_t FrameNumberMask = 0x7ff;
+
+  struct Transfer {
+    // Frames since the scheduler was created
+    uint64_t mStartFrame {};
+    // The end of the last frame
+    Clock::time_point mDue {};
+  };
+
+  struct DeferredReply {
+    Clock::time_point mDue {};
+    std::shared_ptr<Connection> mConnection;
+    uint32_t mSequenceNumber {};
+    Reply* mReply {};
+  };
+
+  IsoScheduler() = default;
+  IsoScheduler(const IsoScheduler&) = delete;
+  IsoScheduler& operator=(const IsoScheduler&) = delete;
+  ~IsoScheduler() {
+    Clear();
+  }
+
+  [[nodiscard]]
+  uint64_t GetCurrentFrame() const noexcept {
+    return (Clock::now() - mEpoch) / FrameDuration;
+  }
+
+  // Thread-safe. Reserve the next `frameCount` frames of `stream`.
+  [[nodiscard]]
+  Transfer Reserve(
+    Connection& connection,
+    const IsoStreamKey& stream,
+    const uint64_t frameCount) {
+    const auto now = GetCurrentFrame();
+    auto streams = connection.mIsoStreams.lock();
+    auto& next = streams->try_emplace(stream, now).first->second;
+    const auto start = std::max(next, now);
+    next = start + frameCount;
+    return {start, mEpoch + (next * FrameDuration)};
+  }
+
+  /* Thread-safe. Hold `reply` until it's due.
+   *
+   * Returns true if it's now the first reply that's due, so the loop's
+   * timeout needs recalculating.
+   */
+  [[nodiscard]]
+  bool Defer(DeferredReply reply) {
+    auto replies = mReplies.lock();
+    const bool first = replies->empty() || reply.mDue < replies->front().mDue;
+    replies->push_back(std::move(reply));
+    std::ranges::push_heap(*replies, std::greater {}, &DeferredReply::mDue);
+    return first;
+  }
+
+  [[nodiscard]]
+  std::optional<Clock::time_point> GetNextDue() {
+    const auto replies = mReplies.lock();
+    if (replies->empty()) {
+      return std::nullopt;
+    }
+    return replies->front().mDue;
+  }
+
+  // Append every reply that's due to `out`, in order
+  void TakeDue(std::vector<DeferredReply>& out) {
+    const auto now = Clock::now();
+    auto replies = mReplies.lock();
+    while (!replies->empty() && replies->front().mDue <= now) {
+      std::ranges::pop_heap(*replies, std::greater {}, &DeferredReply::mDue);
+      out.push_back(std::move(replies->back()));
+      replies->pop_back();
+    }
+  }
+
+  // Discard every reply that's being held
+  void Clear() {
+    auto replies = mReplies.lock();
+    for (auto&& it: *replies) {
+      Reply::DestroyAll(it.mReply);
+    }
+    replies->clear();
+  }
+
+ private:
+  const Clock::time_point mEpoch {Clock::now()};
+  // A min-heap on `mDue`
+  guarded_data<std::vector<DeferredReply>> mReplies;
+};
+
+}// namespace FredEmmott::USBVirtPP
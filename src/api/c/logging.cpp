@@ -0,0 +1,70 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "logging.hpp"
+
+#include <functional>
+#include <print>
+
+namespace FredEmmott::USBVirtPP {
+
+AsyncLogger::AsyncLogger(const Logger callback, const int minSeverity)
+  : mCallback(callback),
+    mMinSeverity(minSeverity),
+    mThread(std::bind_front(&AsyncLogger::Run, this)) {
+}
+
+AsyncLogger::~AsyncLogger() {
+  mThread.request_stop();
+  mWake.store(true);
+  mWake.notify_one();
+  mThread.join();
+}
+
+void AsyncLogger::Push(LogRecord&& record) {
+  if (!mRecords.TryPush(std::move(record))) [[unlikely]] {
+    mDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // Pairs with the fence in `Run()`: either we see that the thread has gone
+  // back to sleep, or it sees this record
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!mWake.exchange(true)) {
+    mWake.notify_one();
+  }
+}
+
+void AsyncLogger::Run(const std::stop_token stopToken) {
+  while (!stopToken.stop_requested()) {
+    mWake.wait(false);
+    mWake.store(false);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Drain();
+  }
+  // Anything logged while we were stopping
+  Drain();
+}
+
+void AsyncLogger::Drain() {
+  while (const auto record = mRecords.TryPop()) {
+    Write(record->GetSeverity(), record->Format());
+  }
+  if (const auto dropped = mDropped.exchange(0, std::memory_order_relaxed)) {
+    Write(
+      FredEmmott_USBIP_VirtPP_LogSeverity_Error,
+      std::format("{} log messages dropped; the queue was full", dropped));
+  }
+}
+
+void AsyncLogger::Write(const int severity, const std::string_view message)
+  const {
+  if (mCallback) {
+    mCallback(severity, message.data(), message.size());
+    return;
+  }
+  std::println(
+    (severity >= FredEmmott_USBIP_VirtPP_LogSeverity_Error) ? stderr : stdout,
+    "{}",
+    message);
+}
+
+}// namespace FredEmmott::USBVirtPP
@@ -3,19 +3,182 @@
 #pragma once
 
 #include <FredEmmott/USBIP-VirtPP/Core.h>
+#include "mpmc-ring.hpp"
 
+#include <atomic>
 #include <concepts>
+#include <cstddef>
+#include <cstdint>
 #include <format>
-#include <print>
+#include <memory>
+#include <new>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 
 namespace FredEmmott::USBVirtPP {
 
 using Logger
   = decltype(FredEmmott_USBIP_VirtPP_Instance_Callbacks::OnLogMessage);
 
+/* A log message with its arguments captured by value, so that formatting can
+ * be deferred to `AsyncLogger`'s thread.
+ *
+ * Strings are copied, as they might not outlive the record. The arguments are
+ * stored inline; if they don't fit, the message is formatted immediately
+ * instead.
+ */
+class LogRecord final {
+ public:
+  LogRecord() = delete;
+
+  template <class... Args>
+  LogRecord(
+    const int severity,
+    std::format_string<Args...> fmt,
+    Args&&... args)
+    : mSeverity(severity) {
+    using TArgs = std::tuple<Captured<Args>...>;
+    if constexpr (
+      sizeof(TArgs) <= InlineSize
+      && alignof(TArgs) <= alignof(std::max_align_t)
+      && std::is_nothrow_move_constructible_v<TArgs>) {
+      mFormatString = fmt.get();
+      std::construct_at(
+        reinterpret_cast<TArgs*>(mArgs), std::forward<Args>(args)...);
+      mOperations = &OperationsFor<TArgs>;
+    } else {
+      using TFormatted = std::tuple<std::string>;
+      mFormatString = "{}";
+      std::construct_at(
+        reinterpret_cast<TFormatted*>(mArgs),
+        std::format(fmt, std::forward<Args>(args)...));
+      mOperations = &OperationsFor<TFormatted>;
+    }
+  }
+
+  LogRecord(LogRecord&& other) noexcept
+    : mSeverity(other.mSeverity),
+      mFormatString(other.mFormatString),
+      mOperations(other.mOperations) {
+    mOperations->mMove(other.mArgs, mArgs);
+  }
+  LogRecord& operator=(LogRecord&&) = delete;
+
+  ~LogRecord() {
+    mOperations->mDestroy(mArgs);
+  }
+
+  [[nodiscard]] int GetSeverity() const noexcept {
+    return mSeverity;
+  }
+
+  [[nodiscard]] std::string Format() const {
+    return mOperations->mFormat(mFormatString, mArgs);
+  }
+
+ private:
+  // Enough for a few strings and numbers
+  static constexpr std::size_t InlineSize = 128;
+
+  template <class T>
+  using Captured = std::conditional_t<
+    std::is_convertible_v<const std::decay_t<T>&, std::string_view>,
+    std::string,
+    std::decay_t<T>>;
+
+  struct Operations {
+    std::string (*mFormat)(std::string_view, const std::byte* args);
+    // Move-construct `to` from `from`, then destroy `from`
+    void (*mMove)(std::byte* from, std::byte* to) noexcept;
+    void (*mDestroy)(std::byte* args) noexcept;
+  };
+
+  template <class T>
+  static T* Get(std::byte* args) noexcept {
+    return std::launder(reinterpret_cast<T*>(args));
+  }
+
+  template <class TArgs>
+  static constexpr Operations OperationsFor {
+    [](const std::string_view fmt, const std::byte* args) {
+      return std::apply(
+        [fmt](const auto&... values) {
+          return std::vformat(fmt, std::make_format_args(values...));
+        },
+        *Get<TArgs>(const_cast<std::byte*>(args)));
+    },
+    [](std::byte* from, std::byte* to) noexcept {
+      const auto source = Get<TArgs>(from);
+      std::construct_at(reinterpret_cast<TArgs*>(to), std::move(*source));
+      std::destroy_at(source);
+    },
+    [](std::byte* args) noexcept { std::destroy_at(Get<TArgs>(args)); },
+  };
+
+  int mSeverity {};
+  std::string_view mFormatString;
+  const Operations* mOperations {};
+  alignas(std::max_align_t) std::byte mArgs[InlineSize];
+};
+
+/* Delivers log messages to the `OnLogMessage` callback - or stdout/stderr if
+ * there isn't one - from a background thread.
+ *
+ * Messages below the minimum severity are discarded before they're formatted;
+ * the rest are queued in a lock-free ring, so logging never waits for the
+ * callback, or for console I/O. If the ring is full, the message is dropped,
+ * and the drops are reported later.
+ */
+class AsyncLogger final {
+ public:
+  AsyncLogger() = delete;
+  AsyncLogger(Logger callback, int minSeverity);
+  AsyncLogger(const AsyncLogger&) = delete;
+  AsyncLogger& operator=(const AsyncLogger&) = delete;
+  // Delivers everything that's been queued before returning
+  ~AsyncLogger();
+
+  [[nodiscard]] bool IsEnabled(const int severity) const noexcept {
+    return severity >= mMinSeverity.load(std::memory_order_relaxed);
+  }
+
+  void SetMinSeverity(const int severity) noexcept {
+    mMinSeverity.store(severity, std::memory_order_relaxed);
+  }
+
+  // Thread-safe
+  void Push(LogRecord&&);
+
+ private:
+  static constexpr std::size_t Capacity = 1024;
+
+  const Logger mCallback {};
+  std::atomic<int> mMinSeverity {};
+  std::atomic<uint64_t> mDropped {};
+  // Set by `Push()` to wake the thread
+  std::atomic<bool> mWake {};
+  MPMCRing<LogRecord, Capacity> mRecords;
+
+  // Last, so that everything else is ready before it starts
+  std::jthread mThread;
+
+  void Run(std::stop_token);
+  void Drain();
+  void Write(int severity, std::string_view message) const;
+};
+
+// For components that don't have an instance, e.g. `Capture`
+inline AsyncLogger& GetLogger(AsyncLogger& logger) {
+  return logger;
+}
+
 template <class T>
 concept logging_target = requires(T v) {
-  { GetLoggerCallback(v) } -> std::convertible_to<Logger>;
+  { GetLogger(v) } -> std::same_as<AsyncLogger&>;
 };
 
 template <logging_target TTarget, class... Args>
@@ -24,16 +187,11 @@ void LogWithSeverity(
   const int severity,
   std::format_string<Args...> fmt,
   Args&&... args) {
-  if (const auto callback = GetLoggerCallback(std::forward<TTarget>(target));
-      callback) {
-    const auto formatted = std::format(fmt, std::forward<Args>(args)...);
-    callback(severity, formatted.c_str(), formatted.size());
-  } else {
-    std::println(
-      (severity >= FredEmmott_USBIP_VirtPP_LogSeverity_Error) ? stderr : stdout,
-      fmt,
-      std::forward<Args>(args)...);
+  auto& logger = GetLogger(std::forward<TTarget>(target));
+  if (!logger.IsEnabled(severity)) {
+    return;
   }
+  logger.Push(LogRecord {severity, fmt, std::forward<Args>(args)...});
 }
 
 template <logging_target TTarget, class... Args>
@@ -56,7 +214,16 @@ void Log(TTarget&& target, std::format_string<Args...> fmt, Args&&... args) {
     fmt,
     std::forward<Args>(args)...);
 }
-}// namespace FredEmmott::USBVirtPP
 
-FredEmmott::USBVirtPP::Logger GetLoggerCallback(
-  FredEmmott_USBIP_VirtPP_Instance const*);
+template <logging_target TTarget, class... Args>
+void LogDebug(
+  TTarget&& target,
+  std::format_string<Args...> fmt,
+  Args&&... args) {
+  LogWithSeverity(
+    std::forward<TTarget>(target),
+    FredEmmott_USBIP_VirtPP_LogSeverity_Debug,
+    fmt,
+    std::forward<Args>(args)...);
+}
+}// namespace FredEmmott::USBVirtPP
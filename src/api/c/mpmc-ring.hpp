@@ -0,0 +1,120 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Bounded, lock-free, multi-producer multi-consumer FIFO.
+ *
+ * Each cell has a sequence number that says whether it's ready to be written
+ * or read for the current lap of the ring; producers and consumers each claim
+ * a position with a single CAS, and never wait for each other, or allocate.
+ *
+ * `Capacity` must be a power of two.
+ */
+template <class T, std::size_t Capacity>
+class MPMCRing final {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0);
+
+ public:
+  MPMCRing() {
+    for (std::size_t i = 0; i < Capacity; ++i) {
+      mCells[i].mSequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  MPMCRing(const MPMCRing&) = delete;
+  MPMCRing& operator=(const MPMCRing&) = delete;
+
+  ~MPMCRing() {
+    while (TryPop()) {
+    }
+  }
+
+  /* Thread-safe. Returns false if the ring is full.
+   *
+   * `value` is only moved from if this succeeds.
+   */
+  [[nodiscard]]
+  bool TryPush(T&& value) {
+    auto pos = mPushPosition.load(std::memory_order_relaxed);
+    Cell* cell {};
+    while (true) {
+      cell = &mCells[pos % Capacity];
+      const auto sequence = cell->mSequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::intptr_t>(sequence)
+        - static_cast<std::intptr_t>(pos);
+      if (diff == 0) {
+        if (mPushPosition.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // Not yet read on the previous lap
+        return false;
+      } else {
+        // Another producer got here first
+        pos = mPushPosition.load(std::memory_order_relaxed);
+      }
+    }
+    std::construct_at(cell->GetValue(), std::move(value));
+    cell->mSequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Thread-safe. Returns `std::nullopt` if the ring is empty.
+  [[nodiscard]]
+  std::optional<T> TryPop() {
+    auto pos = mPopPosition.load(std::memory_order_relaxed);
+    Cell* cell {};
+    while (true) {
+      cell = &mCells[pos % Capacity];
+      const auto sequence = cell->mSequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::intptr_t>(sequence)
+        - static_cast<std::intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (mPopPosition.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // Not yet written on this lap
+        return std::nullopt;
+      } else {
+        // Another consumer got here first
+        pos = mPopPosition.load(std::memory_order_relaxed);
+      }
+    }
+    std::optional<T> ret {std::move(*cell->GetValue())};
+    std::destroy_at(cell->GetValue());
+    cell->mSequence.store(pos + Capacity, std::memory_order_release);
+    return ret;
+  }
+
+ private:
+  // Typical cache line size; keeps producers and consumers from false sharing
+  static constexpr std::size_t CacheLineSize = 64;
+
+  struct Cell {
+    std::atomic<std::size_t> mSequence;
+    alignas(T) std::byte mStorage[sizeof(T)];
+
+    T* GetValue() noexcept {
+      return std::launder(reinterpret_cast<T*>(mStorage));
+    }
+  };
+
+  alignas(CacheLineSize) std::atomic<std::size_t> mPushPosition {};
+  alignas(CacheLineSize) std::atomic<std::size_t> mPopPosition {};
+  alignas(CacheLineSize) std::array<Cell, Capacity> mCells;
+};
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,55 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <atomic>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Intrusive, lock-free, multi-producer single-consumer queue.
+ *
+ * Producers push with a single CAS, and never wait for the consumer; the
+ * consumer takes everything at once with a single exchange.
+ *
+ * `Next` is the link member; it belongs to the queue from `Push()` until the
+ * item is returned by `TakeAll()`.
+ */
+template <class T, T* T::* Next>
+class MPSCQueue final {
+ public:
+  MPSCQueue() = default;
+  MPSCQueue(const MPSCQueue&) = delete;
+  MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+  // Thread-safe. Returns true if the queue was empty.
+  bool Push(T* const item) noexcept {
+    auto head = mHead.load(std::memory_order_relaxed);
+    do {
+      item->*Next = head;
+    } while (!mHead.compare_exchange_weak(
+      head, item, std::memory_order_acq_rel, std::memory_order_relaxed));
+    return head == nullptr;
+  }
+
+  /* Consumer only: remove and return everything pushed so far, as a list
+   * linked by `Next`, oldest first.
+   */
+  [[nodiscard]]
+  T* TakeAll() noexcept {
+    auto head = mHead.exchange(nullptr, std::memory_order_acq_rel);
+    // Pushed newest-first
+    T* ret {};
+    while (head) {
+      const auto next = head->*Next;
+      head->*Next = ret;
+      ret = head;
+      head = next;
+    }
+    return ret;
+  }
+
+ private:
+  std::atomic<T*> mHead {nullptr};
+};
+
+}// namespace FredEmmott::USBVirtPP
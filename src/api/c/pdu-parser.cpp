@@ -0,0 +1,53 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "pdu-parser.hpp"
+
+namespace FredEmmott::USBVirtPP {
+
+std::optional<std::size_t> PDUParser::Parse(
+  const std::span<const std::byte> buffer) {
+  while (buffer.size() >= mNeeded) {
+    switch (mStage) {
+      case Stage::CommandCode:
+        mStage = Stage::Header;
+        switch (GetCommandCode(buffer)) {
+          case USBIP::CommandCode::OP_REQ_DEVLIST:
+            mNeeded = sizeof(USBIP::OP_REQ_DEVLIST);
+            break;
+          case USBIP::CommandCode::OP_REQ_IMPORT:
+            mNeeded = sizeof(USBIP::OP_REQ_IMPORT);
+            break;
+          case USBIP::CommandCode::USBIP_CMD_SUBMIT:
+            mNeeded = sizeof(USBIP::USBIP_CMD_SUBMIT);
+            break;
+          case USBIP::CommandCode::USBIP_CMD_UNLINK:
+            mNeeded = sizeof(USBIP::USBIP_CMD_UNLINK);
+            break;
+          default:
+            // Let the caller report it
+            break;
+        }
+        continue;
+      case Stage::Header:
+        mStage = Stage::Payload;
+        if (GetCommandCode(buffer) == USBIP::CommandCode::USBIP_CMD_SUBMIT) {
+          const auto& submit = PDUAs<USBIP::USBIP_CMD_SUBMIT>(buffer);
+          if (submit.mHeader.mDirection == USBIP::Direction::Out) {
+            mNeeded += submit.mTransferBufferLength.NativeValue();
+          }
+          // In both directions
+          mNeeded += std::size_t {GetIsoPacketCount(submit)}
+            * sizeof(USBIP::USBIP_ISO_PACKET_DESCRIPTOR);
+        }
+        continue;
+      case Stage::Payload: {
+        const auto ret = mNeeded;
+        Reset();
+        return ret;
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+}// namespace FredEmmott::USBVirtPP
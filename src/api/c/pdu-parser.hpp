@@ -0,0 +1,86 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <FredEmmott/USBIP.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Resumable framing for client PDUs.
+ *
+ * A PDU is parsed in stages - command code, then the rest of the fixed-size
+ * header, then any OUT payload and isochronous packet descriptors - and the
+ * current stage and the number of bytes it needs are kept between calls.
+ * Trickled bytes are never re-parsed, and a client that stops half-way
+ * through a PDU doesn't block anything: we just return to the event loop
+ * until more data arrives.
+ */
+class PDUParser final {
+ public:
+  enum class Stage {
+    CommandCode,
+    Header,
+    Payload,
+  };
+
+  /* If `buffer` starts with a complete PDU, return its size, and reset for
+   * the next PDU.
+   *
+   * `buffer` must start at the same PDU as previous calls that returned
+   * `std::nullopt`.
+   *
+   * Unrecognized commands are treated as a bare command code, so that they
+   * can be reported by the caller.
+   */
+  [[nodiscard]]
+  std::optional<std::size_t> Parse(std::span<const std::byte> buffer);
+
+  [[nodiscard]]
+  Stage GetStage() const noexcept {
+    return mStage;
+  }
+
+  // Bytes needed from the start of the PDU to finish the current stage
+  [[nodiscard]]
+  std::size_t GetNeeded() const noexcept {
+    return mNeeded;
+  }
+
+ private:
+  Stage mStage {Stage::CommandCode};
+  std::size_t mNeeded {sizeof(USBIP::CommandCode)};
+
+  void Reset() noexcept {
+    mStage = Stage::CommandCode;
+    mNeeded = sizeof(USBIP::CommandCode);
+  }
+};
+
+inline USBIP::CommandCode GetCommandCode(const std::span<const std::byte> pdu) {
+  USBIP::CommandCode ret {};
+  std::memcpy(&ret, pdu.data(), sizeof(ret));
+  return ret;
+}
+
+// The number of packets in an isochronous CMD_SUBMIT; 0 for other transfers.
+//
+// Clients use either 0 or 0xffffffff for non-isochronous transfers.
+inline uint32_t GetIsoPacketCount(const USBIP::USBIP_CMD_SUBMIT& submit) {
+  const uint32_t count = submit.mNumberOfPackets;
+  return (count == 0xffff'ffff) ? 0 : count;
+}
+
+// PDUs are decoded in place; the wire structs are packed, so there are no
+// alignment requirements
+template <class T>
+const T& PDUAs(const std::span<const std::byte> pdu) {
+  return *reinterpret_cast<const T*>(pdu.data());
+}
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,83 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+/* Just enough of the Winsock/Win32 vocabulary for the socket-level code to
+ * build against POSIX sockets.
+ *
+ * Errors are reported as `HRESULT_FROM_ERRNO(errno)`; like real failure
+ * HRESULTs, these are negative, so `FAILED()`/`SUCCEEDED()` work as usual.
+ */
+
+#ifdef _WIN32
+#error "Use <winsock2.h> instead"
+#endif
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using SOCKET = int;
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr int SOCKET_ERROR = -1;
+
+using HRESULT = int32_t;
+constexpr HRESULT S_OK = 0;
+constexpr HRESULT S_FALSE = 1;
+
+constexpr bool SUCCEEDED(const HRESULT hr) {
+  return hr >= 0;
+}
+
+constexpr bool FAILED(const HRESULT hr) {
+  return hr < 0;
+}
+
+constexpr HRESULT HRESULT_FROM_ERRNO(const int err) {
+  return -err;
+}
+
+// Socket error codes and `ERROR_*` are errno values here, so this is only
+// valid for those
+constexpr HRESULT HRESULT_FROM_WIN32(const int err) {
+  return HRESULT_FROM_ERRNO(err);
+}
+
+constexpr int WSAECONNRESET = ECONNRESET;
+constexpr int WSAEWOULDBLOCK = EWOULDBLOCK;
+constexpr int WSAENOTCONN = ENOTCONN;
+
+// Win32 error codes that we use, as the nearest errno value
+constexpr int ERROR_BAD_COMMAND = EPROTO;
+constexpr int ERROR_INSUFFICIENT_BUFFER = ENOBUFS;
+constexpr int ERROR_INVALID_HANDLE = EBADF;
+constexpr int ERROR_INVALID_PARAMETER = EINVAL;
+constexpr int ERROR_INVALID_STATE = EPERM;
+constexpr int ERROR_NOT_FOUND = ENOENT;
+constexpr int ERROR_OPEN_FAILED = EIO;
+constexpr int ERROR_UNHANDLED_EXCEPTION = ENOTRECOVERABLE;
+constexpr int ERROR_WRITE_FAULT = EIO;
+
+constexpr HRESULT E_INVALIDARG = HRESULT_FROM_ERRNO(EINVAL);
+
+// Like MSVC's intrinsic, this stops in the debugger, or crashes without one
+inline void __debugbreak() {
+  std::raise(SIGTRAP);
+}
+
+inline int WSAGetLastError() {
+  return errno;
+}
+
+inline int closesocket(const SOCKET socket) {
+  return close(socket);
+}
+
+using u_long = unsigned long;
+inline int ioctlsocket(const SOCKET socket, const long cmd, u_long* arg) {
+  return ioctl(socket, cmd, arg);
+}
@@ -0,0 +1,131 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "buffer-block.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <span>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Per-connection receive buffer.
+ *
+ * We `recv()` as much as the socket has into the free space at the end, then
+ * parse PDUs directly from the readable region; PDUs are never copied out
+ * before they're decoded, and OUT payloads are passed to devices in place.
+ *
+ * Unlike a true ring, the readable region never wraps: once the end is
+ * reached, the unconsumed tail - at most one partial PDU - is moved back to
+ * the start. This keeps every PDU contiguous, so structs can be decoded in
+ * place.
+ *
+ * The storage is a `BufferBlock`:
+ * - if a PDU is larger than the block, `Reserve()` moves to a larger one
+ * - if a device keeps a reference to a payload, we move to a new block
+ *   instead of overwriting it
+ */
+class ReceiveBuffer final {
+ public:
+  static constexpr std::size_t DefaultCapacity = BufferBlock::MinCapacity;
+  static constexpr std::size_t MaxCapacity = BufferBlock::MaxCapacity;
+
+  ReceiveBuffer() : mBlock(BufferBlock::Create(DefaultCapacity)) {
+  }
+  ~ReceiveBuffer() {
+    mBlock->Release();
+  }
+
+  ReceiveBuffer(const ReceiveBuffer&) = delete;
+  ReceiveBuffer& operator=(const ReceiveBuffer&) = delete;
+
+  [[nodiscard]]
+  std::size_t GetCapacity() const noexcept {
+    return mBlock->GetCapacity();
+  }
+
+  // The storage for `GetReadable()`; add a reference to keep it alive
+  [[nodiscard]]
+  BufferBlock* GetBlock() const noexcept {
+    return mBlock;
+  }
+
+  // Received, but not yet consumed
+  [[nodiscard]]
+  std::span<const std::byte> GetReadable() const noexcept {
+    return {mBlock->GetData() + mReadOffset, mWriteOffset - mReadOffset};
+  }
+
+  void Consume(const std::size_t count) {
+    mReadOffset += count;
+    if (mReadOffset != mWriteOffset) {
+      return;
+    }
+    mReadOffset = mWriteOffset = 0;
+    // Don't overwrite payloads that are still referenced, and don't hold on
+    // to a large block once the large PDU has been handled
+    if (mBlock->IsShared() || GetCapacity() > DefaultCapacity) {
+      Replace(DefaultCapacity);
+    }
+  }
+
+  /* Make sure a PDU of `size` bytes will fit.
+   *
+   * Returns false if `size` is larger than `MaxCapacity`.
+   */
+  [[nodiscard]]
+  bool Reserve(const std::size_t size) {
+    if (size <= GetCapacity()) {
+      return true;
+    }
+    if (size > MaxCapacity) [[unlikely]] {
+      return false;
+    }
+    Replace(size);
+    return true;
+  }
+
+  /* Space that `recv()` can write to.
+   *
+   * Empty if and only if the buffer is full of unconsumed data.
+   */
+  [[nodiscard]]
+  std::span<std::byte> GetWritable() {
+    if (mWriteOffset == GetCapacity() && mReadOffset > 0) {
+      if (mBlock->IsShared()) {
+        Replace(GetCapacity());
+      } else {
+        const auto remaining = mWriteOffset - mReadOffset;
+        std::memmove(
+          mBlock->GetData(), mBlock->GetData() + mReadOffset, remaining);
+        mReadOffset = 0;
+        mWriteOffset = remaining;
+      }
+    }
+    return {mBlock->GetData() + mWriteOffset, GetCapacity() - mWriteOffset};
+  }
+
+  // Mark `count` bytes from the start of `GetWritable()` as readable
+  void Commit(const std::size_t count) noexcept {
+    mWriteOffset += count;
+  }
+
+ private:
+  BufferBlock* mBlock {};
+  std::size_t mReadOffset {};
+  std::size_t mWriteOffset {};
+
+  // Move the unconsumed data to the start of a new block
+  void Replace(const std::size_t minCapacity) {
+    const auto readable = GetReadable();
+    const auto block = BufferBlock::Create(minCapacity);
+    std::memcpy(block->GetData(), readable.data(), readable.size());
+    mBlock->Release();
+    mBlock = block;
+    mReadOffset = 0;
+    mWriteOffset = readable.size();
+  }
+};
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,38 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <concepts>
+#include <utility>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Calls `fn` when it goes out of scope, unless `release()` is called first.
+ *
+ * Like `wil::scope_exit()`, without needing WIL.
+ */
+template <std::invocable F>
+class [[nodiscard]] scope_exit final {
+ public:
+  explicit scope_exit(F&& fn) : mFn(std::forward<F>(fn)) {
+  }
+  scope_exit(const scope_exit&) = delete;
+  scope_exit& operator=(const scope_exit&) = delete;
+
+  ~scope_exit() {
+    if (mActive) {
+      mFn();
+    }
+  }
+
+  // `const`, like WIL's, so `const auto guard = scope_exit(...)` works
+  void release() const noexcept {
+    mActive = false;
+  }
+
+ private:
+  F mFn;
+  mutable bool mActive {true};
+};
+
+}// namespace FredEmmott::USBVirtPP
@@ -2,42 +2,111 @@
 // SPDX-License-Identifier: MIT
 #include "send-recv.hpp"
 
-#include <print>
+#include <algorithm>
+#include <vector>
+
+#ifndef _WIN32
+#include <climits>
+
+#include <sys/uio.h>
+
+static_assert(FredEmmott::USBVirtPP::MaxBuffersPerSend <= IOV_MAX);
+#endif
 
 namespace FredEmmott::USBVirtPP {
 
-std::expected<void, HRESULT> SendAll(SOCKET sock, const void* buffer, const size_t len) {
-  const char* ptr = (const char*)buffer;
-  int sent = 0;
-  while (sent < len) {
-    const int result = send(sock, ptr + sent, (int)(len - sent), 0);
-    if (result == SOCKET_ERROR) {
-      const auto err = WSAGetLastError();
-      std::println(stderr, "Send failed: {}", err);
-      return std::unexpected { HRESULT_FROM_WIN32(err) };
+namespace {
+// A single gather-write; `buffers` must fit in one
+std::expected<std::size_t, HRESULT> SendBatch(
+  const SOCKET sock,
+  const std::span<const std::span<const std::byte>> buffers) {
+#ifdef _WIN32
+  std::vector<WSABUF> vectors;
+  vectors.reserve(buffers.size());
+  for (auto&& buffer: buffers) {
+    vectors.push_back({
+      .len = static_cast<ULONG>(buffer.size()),
+      .buf = const_cast<CHAR*>(reinterpret_cast<const CHAR*>(buffer.data())),
+    });
+  }
+  DWORD sent {};
+  const auto result = WSASend(
+    sock,
+    vectors.data(),
+    static_cast<DWORD>(vectors.size()),
+    &sent,
+    0,
+    nullptr,
+    nullptr);
+#else
+  std::vector<iovec> vectors;
+  vectors.reserve(buffers.size());
+  for (auto&& buffer: buffers) {
+    vectors.push_back({
+      .iov_base = const_cast<std::byte*>(buffer.data()),
+      .iov_len = buffer.size(),
+    });
+  }
+  msghdr message {};
+  message.msg_iov = vectors.data();
+  message.msg_iovlen = vectors.size();
+  const auto sent = sendmsg(sock, &message, MSG_NOSIGNAL);
+  const auto result = sent < 0 ? SOCKET_ERROR : 0;
+#endif
+  if (result == SOCKET_ERROR) {
+    const auto err = WSAGetLastError();
+    if (err == WSAEWOULDBLOCK) {
+      return 0;
     }
-    sent += result;
+    return std::unexpected {HRESULT_FROM_WIN32(err)};
   }
-  return {};
+  return static_cast<std::size_t>(sent);
 }
+}// namespace
+
+std::expected<std::size_t, HRESULT> SendSome(
+  const SOCKET sock,
+  std::span<const std::span<const std::byte>> buffers) {
+  std::size_t total {};
+  while (!buffers.empty()) {
+    const auto batch
+      = buffers.first(std::min(buffers.size(), MaxBuffersPerSend));
+    const auto sent = SendBatch(sock, batch);
+    if (!sent) {
+      // Report what we did send; the error will come up again next time
+      if (total) {
+        return total;
+      }
+      return sent;
+    }
+    total += *sent;
 
-std::expected<void, HRESULT> RecvAll(SOCKET sock, void* buffer, size_t len) {
-  char* ptr = (char*)buffer;
-  int received = 0;
-  while (received < len) {
-    int result = recv(sock, ptr + received, (int)(len - received), 0);
-    if (result == 0) {
-      std::println(stderr, "Connection closed by peer.");
-      return std::unexpected { HRESULT_FROM_WIN32( WSAECONNRESET) };
+    std::size_t batchSize {};
+    for (auto&& buffer: batch) {
+      batchSize += buffer.size();
     }
-    if (result == SOCKET_ERROR) {
-      const auto err = WSAGetLastError();
-      std::println(stderr, "Recv failed: {}", err);
-      return std::unexpected { HRESULT_FROM_WIN32(err) };
+    if (*sent < batchSize) {
+      return total;
     }
-    received += result;
+    buffers = buffers.subspan(batch.size());
   }
-  return {};
+  return total;
 }
 
-}
\ No newline at end of file
+std::expected<std::size_t, HRESULT>
+RecvSome(const SOCKET sock, void* const buffer, const std::size_t len) {
+  const auto result = recv(sock, static_cast<char*>(buffer), (int)len, 0);
+  if (result == 0) {
+    return std::unexpected {HRESULT_FROM_WIN32(WSAECONNRESET)};
+  }
+  if (result == SOCKET_ERROR) {
+    const auto err = WSAGetLastError();
+    if (err == WSAEWOULDBLOCK) {
+      return 0;
+    }
+    return std::unexpected {HRESULT_FROM_WIN32(err)};
+  }
+  return static_cast<std::size_t>(result);
+}
+
+}
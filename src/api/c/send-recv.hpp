@@ -2,24 +2,35 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
+#include <cstddef>
 #include <expected>
+#include <span>
 
+#ifdef _WIN32
 #include <winsock2.h>
+#else
+#include "posix-compat.hpp"
+#endif
 
 namespace FredEmmott::USBVirtPP {
 
-std::expected<void, HRESULT> SendAll(SOCKET sock, void const* buffer, std::size_t len);
-std::expected<void, HRESULT> RecvAll(SOCKET sock, void* buffer, size_t len);
-
-template <class T>
-auto SendAll(const SOCKET sock, const T& what) {
-  return SendAll(sock, &what, sizeof(T));
-}
-
-template <class T>
-auto RecvAll(const SOCKET sock, T* what) {
-  return RecvAll(sock, what, sizeof(std::decay_t<T>));
-}
+// `IOV_MAX` on Linux; `SendSome()` splits larger gather-writes
+constexpr std::size_t MaxBuffersPerSend = 1024;
+
+/* Send as much of `buffers` as the socket will take without blocking, with a
+ * gather-write (`WSASend()`/`sendmsg()`) per `MaxBuffersPerSend` buffers.
+ *
+ * Returns the number of bytes sent; 0 if the send buffer is full. The socket
+ * must be non-blocking.
+ */
+std::expected<std::size_t, HRESULT> SendSome(SOCKET sock, std::span<const std::span<const std::byte>> buffers);
+
+/* Receive whatever is available, up to `len` bytes, without blocking.
+ *
+ * Returns 0 if no data is available; if the peer has closed the connection,
+ * fails with `WSAECONNRESET`. The socket must be non-blocking.
+ */
+std::expected<std::size_t, HRESULT> RecvSome(SOCKET sock, void* buffer, std::size_t len);
 
 
 }
\ No newline at end of file
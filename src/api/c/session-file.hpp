@@ -0,0 +1,51 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Recordings written by `SessionRecorder`, and read by `usbip_virtpp_replay`.
+ *
+ * A `SessionFileHeader`, then any number of chunks; each chunk is a
+ * `SessionChunkHeader` followed by `mLength` bytes, exactly as they were on
+ * the wire.
+ *
+ * Headers are in host byte order; recordings aren't portable between little-
+ * and big-endian machines.
+ */
+struct SessionFileHeader {
+  static constexpr std::array<char, 8> ExpectedMagic {
+    'U', 'S', 'B', 'I', 'P', 'S', 'E', 'S'};
+  static constexpr uint32_t CurrentVersion = 1;
+
+  std::array<char, 8> mMagic {ExpectedMagic};
+  uint32_t mVersion {CurrentVersion};
+  const uint32_t mReserved {};
+};
+static_assert(sizeof(SessionFileHeader) == 16);
+
+enum class SessionChunkType : uint32_t {
+  // `mLength` is zero
+  Connected = 1,
+  // Bytes we received from the client
+  FromClient = 2,
+  // Bytes the EventLoop accepted for sending to the client
+  ToClient = 3,
+  // `mLength` is zero
+  Closed = 4,
+};
+
+struct SessionChunkHeader {
+  // Since the recording started
+  uint64_t mNanoseconds {};
+  // Unique within the recording; see `Connection::mID`
+  uint64_t mConnectionID {};
+  SessionChunkType mType {};
+  uint32_t mLength {};
+};
+static_assert(sizeof(SessionChunkHeader) == 24);
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,123 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "session-recorder.hpp"
+
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+template <class T>
+void WriteStruct(std::ofstream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void WriteBytes(std::ofstream& out, const std::span<const std::byte> bytes) {
+  out.write(
+    reinterpret_cast<const char*>(bytes.data()),
+    static_cast<std::streamsize>(bytes.size()));
+}
+}// namespace
+
+std::unique_ptr<SessionRecorder> SessionRecorder::Create(
+  AsyncLogger& logger,
+  const char* const path) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    LogError(logger, "Failed to create session recording `{}`", path);
+    return nullptr;
+  }
+  WriteStruct(file, SessionFileHeader {});
+  return std::unique_ptr<SessionRecorder>(
+    new SessionRecorder(logger, std::move(file)));
+}
+
+SessionRecorder::SessionRecorder(AsyncLogger& logger, std::ofstream file)
+  : mLogger(logger),
+    mFile(std::move(file)) {
+}
+
+SessionRecorder::~SessionRecorder() {
+  Flush();
+}
+
+void SessionRecorder::OnConnected(const uint64_t connectionID) {
+  std::ignore
+    = WriteChunkHeader(connectionID, SessionChunkType::Connected, 0);
+}
+
+void SessionRecorder::OnReceived(
+  const uint64_t connectionID,
+  const std::span<const std::byte> data) {
+  if (WriteChunkHeader(
+        connectionID, SessionChunkType::FromClient, data.size())) {
+    WriteBytes(mFile, data);
+  }
+}
+
+void SessionRecorder::OnSent(
+  const uint64_t connectionID,
+  const std::span<const std::span<const std::byte>> buffers,
+  std::size_t count) {
+  if (!WriteChunkHeader(connectionID, SessionChunkType::ToClient, count)) {
+    return;
+  }
+  for (auto&& buffer: buffers) {
+    if (count == 0) {
+      return;
+    }
+    const auto written = std::min(count, buffer.size());
+    WriteBytes(mFile, buffer.first(written));
+    count -= written;
+  }
+}
+
+void SessionRecorder::OnClosed(const uint64_t connectionID) {
+  std::ignore = WriteChunkHeader(connectionID, SessionChunkType::Closed, 0);
+  // A complete connection is usable even if we crash later
+  Flush();
+}
+
+bool SessionRecorder::WriteChunkHeader(
+  const uint64_t connectionID,
+  const SessionChunkType type,
+  const std::size_t length) {
+  if (!IsWritable()) {
+    return false;
+  }
+  WriteStruct(
+    mFile,
+    SessionChunkHeader {
+      .mNanoseconds = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Clock::now() - mStart)
+          .count()),
+      .mConnectionID = connectionID,
+      .mType = type,
+      .mLength = static_cast<uint32_t>(length),
+    });
+  return true;
+}
+
+void SessionRecorder::Flush() {
+  if (IsWritable()) {
+    mFile.flush();
+    std::ignore = IsWritable();
+  }
+}
+
+bool SessionRecorder::IsWritable() {
+  if (mFailed) {
+    return false;
+  }
+  if (mFile) [[likely]] {
+    return true;
+  }
+  mFailed = true;
+  LogError(mLogger, "Failed to write to the session recording; stopping");
+  return false;
+}
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,73 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "logging.hpp"
+#include "session-file.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <span>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Records every byte exchanged with each client, with timestamps; see
+ * `InitData::mRecordPath`, and `session-file.hpp` for the format.
+ *
+ * Recordings of a real host can be replayed against the server with
+ * `usbip_virtpp_replay`, for repeatable throughput and latency runs without
+ * a USB/IP driver.
+ *
+ * Only used by the `Instance::Run()` thread. Chunks are written straight to
+ * a buffered stream, so this is for recording reference sessions, not for
+ * leaving on; `Capture` is the one that's cheap enough for that.
+ */
+class SessionRecorder final {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  SessionRecorder() = delete;
+  SessionRecorder(const SessionRecorder&) = delete;
+  SessionRecorder& operator=(const SessionRecorder&) = delete;
+  ~SessionRecorder();
+
+  // Returns null, and logs an error, if the file can't be created
+  [[nodiscard]]
+  static std::unique_ptr<SessionRecorder> Create(
+    AsyncLogger&,
+    const char* path);
+
+  void OnConnected(uint64_t connectionID);
+  void OnReceived(uint64_t connectionID, std::span<const std::byte>);
+  // Records the first `count` bytes of `buffers`
+  void OnSent(
+    uint64_t connectionID,
+    std::span<const std::span<const std::byte>> buffers,
+    std::size_t count);
+  void OnClosed(uint64_t connectionID);
+
+ private:
+  AsyncLogger& mLogger;
+  std::ofstream mFile;
+  const Clock::time_point mStart {Clock::now()};
+  // Stop after the first error, rather than writing a corrupt file
+  bool mFailed {false};
+
+  SessionRecorder(AsyncLogger&, std::ofstream);
+
+  // Returns false if we've stopped recording
+  [[nodiscard]]
+  bool WriteChunkHeader(
+    uint64_t connectionID,
+    SessionChunkType,
+    std::size_t length);
+  void Flush();
+  // Logs the first error
+  [[nodiscard]]
+  bool IsWritable();
+};
+
+}// namespace FredEmmott::USBVirtPP
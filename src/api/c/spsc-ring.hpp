@@ -0,0 +1,93 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <type_traits>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Bounded, lock-free, single-producer single-consumer FIFO, for bulk copies
+ * of trivially-copyable data, e.g. audio samples.
+ *
+ * Positions only ever increase; the producer owns the write position, and the
+ * consumer owns the read position, so neither side ever waits for the other,
+ * or allocates.
+ *
+ * `Write()` and `Read()` may transfer less than asked. If every call uses a
+ * multiple of some unit - e.g. the channel count - and the capacity is a
+ * multiple of that unit, so is every transfer.
+ */
+template <class T>
+  requires std::is_trivially_copyable_v<T>
+class SPSCRing final {
+ public:
+  // The capacity is rounded up to a power of two
+  explicit SPSCRing(const std::size_t minCapacity)
+    : mCapacity(std::bit_ceil(std::max<std::size_t>(minCapacity, 2))),
+      mData(std::make_unique<T[]>(mCapacity)) {
+  }
+  SPSCRing(const SPSCRing&) = delete;
+  SPSCRing& operator=(const SPSCRing&) = delete;
+
+  [[nodiscard]]
+  std::size_t GetCapacity() const noexcept {
+    return mCapacity;
+  }
+
+  // Approximate, unless called by the producer or consumer
+  [[nodiscard]]
+  std::size_t GetSize() const noexcept {
+    return mWritePosition.load(std::memory_order_acquire)
+      - mReadPosition.load(std::memory_order_acquire);
+  }
+
+  // Producer only. Returns how many elements were written.
+  std::size_t Write(const std::span<const T> data) noexcept {
+    const auto writePosition = mWritePosition.load(std::memory_order_relaxed);
+    const auto readPosition = mReadPosition.load(std::memory_order_acquire);
+    const auto count
+      = std::min(data.size(), mCapacity - (writePosition - readPosition));
+
+    const auto offset = writePosition & (mCapacity - 1);
+    const auto first = std::min(count, mCapacity - offset);
+    std::ranges::copy(data.first(first), mData.get() + offset);
+    std::ranges::copy(data.subspan(first, count - first), mData.get());
+
+    mWritePosition.store(writePosition + count, std::memory_order_release);
+    return count;
+  }
+
+  // Consumer only. Returns how many elements were read.
+  std::size_t Read(const std::span<T> data) noexcept {
+    const auto readPosition = mReadPosition.load(std::memory_order_relaxed);
+    const auto writePosition = mWritePosition.load(std::memory_order_acquire);
+    const auto count = std::min(data.size(), writePosition - readPosition);
+
+    const auto offset = readPosition & (mCapacity - 1);
+    const auto first = std::min(count, mCapacity - offset);
+    std::copy_n(mData.get() + offset, first, data.data());
+    std::copy_n(mData.get(), count - first, data.data() + first);
+
+    mReadPosition.store(readPosition + count, std::memory_order_release);
+    return count;
+  }
+
+ private:
+  // Typical cache line size; keeps the producer and consumer from false
+  // sharing
+  static constexpr std::size_t CacheLineSize = 64;
+
+  const std::size_t mCapacity;
+  const std::unique_ptr<T[]> mData;
+
+  alignas(CacheLineSize) std::atomic<std::size_t> mWritePosition {};
+  alignas(CacheLineSize) std::atomic<std::size_t> mReadPosition {};
+};
+
+}// namespace FredEmmott::USBVirtPP
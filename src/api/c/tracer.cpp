@@ -0,0 +1,205 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "tracer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <iterator>
+#include <utility>
+
+#ifndef _WIN32
+// For `__debugbreak()`
+#include "posix-compat.hpp"
+#endif
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+std::atomic<uint64_t> gNextTracerID {1};
+
+// Chrome wants microseconds; keep the nanoseconds as the fraction
+std::string FormatMicroseconds(const std::chrono::nanoseconds ns) {
+  return std::format("{}.{:03}", ns.count() / 1000, ns.count() % 1000);
+}
+}// namespace
+
+Tracer::Tracer(const bool enabled)
+  : mID(gNextTracerID.fetch_add(1, std::memory_order_relaxed)),
+    mEnabled(enabled) {
+}
+
+Tracer::~Tracer() = default;
+
+const char* Tracer::GetStageName(const Kind kind) {
+  switch (kind) {
+    case Kind::URBDispatched:
+      return "Dispatched";
+    case Kind::URBParked:
+      return "Parked";
+    case Kind::URBScheduled:
+      return "Scheduled";
+    default:
+      __debugbreak();
+      return "Unknown";
+  }
+}
+
+void Tracer::SetThreadName(std::string name) {
+  if (!mEnabled) {
+    return;
+  }
+  auto& ring = GetThreadRing();
+  const std::unique_lock lock(ring.mMutex);
+  ring.mName = std::move(name);
+}
+
+void Tracer::Record(const Event& event) {
+  auto& ring = GetThreadRing();
+  const std::unique_lock lock(ring.mMutex);
+  ring.mEvents[ring.mCount++ % EventsPerThread] = event;
+}
+
+Tracer::ThreadRing& Tracer::GetThreadRing() {
+  // Usually there's only one tracer, so remember the last one
+  thread_local uint64_t cachedTracerID {};
+  thread_local ThreadRing* cachedRing {};
+  if (cachedTracerID == mID) [[likely]] {
+    return *cachedRing;
+  }
+
+  const auto thread = std::this_thread::get_id();
+  const auto rings = mRings.lock();
+  auto it = std::ranges::find_if(
+    *rings, [thread](const auto& ring) { return ring->mThread == thread; });
+  if (it == rings->end()) {
+    auto ring = std::make_unique<ThreadRing>();
+    ring->mThread = thread;
+    ring->mIndex = static_cast<uint32_t>(rings->size() + 1);
+    it = rings->insert(rings->end(), std::move(ring));
+  }
+  cachedTracerID = mID;
+  cachedRing = it->get();
+  return *cachedRing;
+}
+
+void Tracer::Write(std::ostream& out) const {
+  // Copy each ring, so that tracing threads aren't blocked on the output
+  struct ThreadEvents {
+    uint32_t mIndex {};
+    std::string mName;
+    std::vector<Event> mEvents;
+  };
+  std::vector<ThreadEvents> threads;
+  uint64_t overwritten {};
+  {
+    const auto rings = mRings.lock();
+    for (auto&& ring: *rings) {
+      const std::unique_lock lock(ring->mMutex);
+      auto& thread = threads.emplace_back(ring->mIndex, ring->mName);
+      const auto count = std::min<uint64_t>(ring->mCount, EventsPerThread);
+      overwritten += ring->mCount - count;
+      // Oldest first
+      const auto first = (ring->mCount - count) % EventsPerThread;
+      thread.mEvents.reserve(count);
+      for (uint64_t i = 0; i < count; ++i) {
+        thread.mEvents.push_back(
+          ring->mEvents[(first + i) % EventsPerThread]);
+      }
+    }
+  }
+
+  std::string buffer;
+  auto it = std::back_inserter(buffer);
+  std::format_to(
+    it,
+    "{{\"otherData\":{{\"overwrittenEvents\":{}}},\"traceEvents\":[\n",
+    overwritten);
+  bool first = true;
+  const auto separator = [&first] {
+    return std::exchange(first, false) ? "" : ",\n";
+  };
+  for (auto&& [tid, name, events]: threads) {
+    if (!name.empty()) {
+      // Names are only set by us, so don't need escaping
+      std::format_to(
+        it,
+        "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},"
+        "\"args\":{{\"name\":\"{}\"}}}}",
+        separator(),
+        tid,
+        name);
+    }
+    for (auto&& event: events) {
+      const auto ts = FormatMicroseconds(event.mTimestamp - mStart);
+      switch (event.mKind) {
+        case Kind::URBReceived:
+          std::format_to(
+            it,
+            "{}{{\"name\":\"URB\",\"cat\":\"urb\",\"ph\":\"b\","
+            "\"id\":\"0x{:x}\",\"ts\":{},\"pid\":1,\"tid\":{},"
+            "\"args\":{{\"device\":\"{}-{}\",\"endpoint\":\"0x{:02x}\"}}}}",
+            separator(),
+            event.mID,
+            ts,
+            tid,
+            (event.mArg >> 24) & 0xffff,
+            (event.mArg >> 8) & 0xffff,
+            event.mArg & 0xff);
+          break;
+        case Kind::URBDispatched:
+        case Kind::URBParked:
+        case Kind::URBScheduled:
+          std::format_to(
+            it,
+            "{}{{\"name\":\"{}\",\"cat\":\"urb\",\"ph\":\"n\","
+            "\"id\":\"0x{:x}\",\"ts\":{},\"pid\":1,\"tid\":{}}}",
+            separator(),
+            GetStageName(event.mKind),
+            event.mID,
+            ts,
+            tid);
+          break;
+        case Kind::URBAnswered:
+          std::format_to(
+            it,
+            "{}{{\"name\":\"URB\",\"cat\":\"urb\",\"ph\":\"e\","
+            "\"id\":\"0x{:x}\",\"ts\":{},\"pid\":1,\"tid\":{},"
+            "\"args\":{{\"status\":{}}}}}",
+            separator(),
+            event.mID,
+            ts,
+            tid,
+            event.mArg);
+          break;
+        case Kind::URBUnlinked:
+          std::format_to(
+            it,
+            "{}{{\"name\":\"URB\",\"cat\":\"urb\",\"ph\":\"e\","
+            "\"id\":\"0x{:x}\",\"ts\":{},\"pid\":1,\"tid\":{},"
+            "\"args\":{{\"unlinked\":true}}}}",
+            separator(),
+            event.mID,
+            ts,
+            tid);
+          break;
+        case Kind::SocketWrite:
+          std::format_to(
+            it,
+            "{}{{\"name\":\"Socket write\",\"cat\":\"io\",\"ph\":\"X\","
+            "\"ts\":{},\"dur\":{},\"pid\":1,\"tid\":{},"
+            "\"args\":{{\"bytes\":{}}}}}",
+            separator(),
+            ts,
+            FormatMicroseconds(event.mDuration),
+            tid,
+            event.mArg);
+          break;
+      }
+    }
+  }
+  buffer += "\n]}\n";
+  out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+}
+
+}// namespace FredEmmott::USBVirtPP
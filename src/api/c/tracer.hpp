@@ -0,0 +1,158 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "guarded_data.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace FredEmmott::USBVirtPP {
+
+/* Opt-in timeline of each URB, from the CMD_SUBMIT to the RET_SUBMIT, and of
+ * socket writes; see `InitData::mEnableTracing`.
+ *
+ * Each thread records into its own ring, so tracing threads don't contend
+ * with each other; the ring's mutex is only contended while `Write()` is
+ * copying it. Once a ring is full, the oldest events are overwritten.
+ *
+ * When disabled, each trace point is a single branch.
+ */
+class Tracer final {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class URBStage : uint8_t {
+    // The CMD_SUBMIT has been parsed; starts the URB's span
+    Received,
+    // Passed to the device's `OnInputRequest`/`OnOutputRequest` callback
+    Dispatched,
+    // Cloned by the device, to reply later; e.g. an interrupt IN URB waiting
+    // for the device to have a new report
+    Parked,
+    // An isochronous reply, held back until it's due; see `IsoScheduler`
+    Scheduled,
+    // The RET_SUBMIT has been queued; ends the span
+    Answered,
+    // Ends the span instead of `Answered`
+    Unlinked,
+  };
+
+  Tracer() = delete;
+  explicit Tracer(bool enabled);
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+  ~Tracer();
+
+  [[nodiscard]] bool IsEnabled() const noexcept {
+    return mEnabled;
+  }
+
+  // Unique within the instance, as long as connection IDs are
+  [[nodiscard]] static constexpr uint64_t GetURBID(
+    const uint64_t connectionID,
+    const uint32_t sequenceNumber) noexcept {
+    return (connectionID << 32) | sequenceNumber;
+  }
+
+  /* Thread-safe.
+   *
+   * `arg` is `(deviceID << 8) | endpointAddress` for `Received`, and the
+   * status for `Answered`; otherwise, it's ignored.
+   */
+  void OnURB(
+    const URBStage stage,
+    const uint64_t urbID,
+    const int64_t arg = 0) {
+    if (!mEnabled) [[likely]] {
+      return;
+    }
+    Record({
+      .mTimestamp = Clock::now(),
+      .mID = urbID,
+      .mArg = arg,
+      .mKind = static_cast<Kind>(stage),
+    });
+  }
+
+  // Thread-safe; `start` is from `Clock::now()`
+  void OnSocketWrite(const Clock::time_point start, const std::size_t bytes) {
+    if (!mEnabled) [[likely]] {
+      return;
+    }
+    const auto now = Clock::now();
+    Record({
+      .mTimestamp = start,
+      .mDuration = now - start,
+      .mArg = static_cast<int64_t>(bytes),
+      .mKind = Kind::SocketWrite,
+    });
+  }
+
+  // Label the calling thread in the trace
+  void SetThreadName(std::string name);
+
+  /* Write every buffered event as Chrome's trace event format (JSON); view
+   * with `chrome://tracing` or https://ui.perfetto.dev
+   *
+   * Thread-safe; tracing continues while this runs.
+   */
+  void Write(std::ostream&) const;
+
+ private:
+  static constexpr std::size_t EventsPerThread = 16384;
+
+  enum class Kind : uint8_t {
+    URBReceived = static_cast<uint8_t>(URBStage::Received),
+    URBDispatched = static_cast<uint8_t>(URBStage::Dispatched),
+    URBParked = static_cast<uint8_t>(URBStage::Parked),
+    URBScheduled = static_cast<uint8_t>(URBStage::Scheduled),
+    URBAnswered = static_cast<uint8_t>(URBStage::Answered),
+    URBUnlinked = static_cast<uint8_t>(URBStage::Unlinked),
+    SocketWrite,
+  };
+
+  struct Event {
+    Clock::time_point mTimestamp {};
+    Clock::duration mDuration {};
+    uint64_t mID {};
+    int64_t mArg {};
+    Kind mKind {};
+  };
+
+  struct ThreadRing {
+    std::thread::id mThread;
+    // The `tid` in the trace
+    uint32_t mIndex {};
+
+    // Only contended while `Write()` is copying the ring
+    mutable std::mutex mMutex;
+    std::string mName;
+    // Total recorded, including those since overwritten
+    uint64_t mCount {};
+    std::array<Event, EventsPerThread> mEvents {};
+  };
+
+  // Distinguishes us from earlier instances in the thread-local cache
+  const uint64_t mID {};
+  const bool mEnabled {false};
+  const Clock::time_point mStart {Clock::now()};
+
+  mutable guarded_data<std::vector<std::unique_ptr<ThreadRing>>> mRings;
+
+  // Instants within the URB's span
+  static const char* GetStageName(Kind);
+
+  void Record(const Event&);
+  ThreadRing& GetThreadRing();
+};
+
+}// namespace FredEmmott::USBVirtPP
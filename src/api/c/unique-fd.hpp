@@ -0,0 +1,50 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#ifdef _WIN32
+#error "Use wil::unique_handle or wil::unique_socket instead"
+#endif
+
+#include <utility>
+
+#include <unistd.h>
+
+namespace FredEmmott::USBVirtPP {
+
+class unique_fd {
+ public:
+  unique_fd() = default;
+  explicit unique_fd(const int fd) : mFD(fd) {
+  }
+  unique_fd(unique_fd&& other) noexcept
+    : mFD(std::exchange(other.mFD, -1)) {
+  }
+  unique_fd& operator=(unique_fd&& other) noexcept {
+    reset(std::exchange(other.mFD, -1));
+    return *this;
+  }
+  ~unique_fd() {
+    reset();
+  }
+
+  void reset(const int fd = -1) {
+    if (mFD >= 0) {
+      close(mFD);
+    }
+    mFD = fd;
+  }
+
+  [[nodiscard]] int get() const {
+    return mFD;
+  }
+
+  explicit operator bool() const {
+    return mFD >= 0;
+  }
+
+ private:
+  int mFD {-1};
+};
+
+}// namespace FredEmmott::USBVirtPP
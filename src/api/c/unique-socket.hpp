@@ -0,0 +1,22 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <wil/resource.h>
+#else
+#include "posix-compat.hpp"
+#include "unique-fd.hpp"
+#endif
+
+namespace FredEmmott::USBVirtPP {
+
+// An owned socket; closed when it goes out of scope
+#ifdef _WIN32
+using unique_socket = wil::unique_socket;
+#else
+using unique_socket = unique_fd;
+#endif
+
+}// namespace FredEmmott::USBVirtPP
@@ -0,0 +1,290 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "attach-backend.hpp"
+#include "unique-fd.hpp"
+
+#include <FredEmmott/USBIP.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_set>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+// `VDEV_ST_NULL` in the kernel's `usbip_common.h`
+constexpr unsigned int VHCIPortFree = 4;
+// `USB_SPEED_SUPER`; faster devices must use the SuperSpeed hub's ports
+constexpr uint32_t LinuxUSBSpeedSuper = 5;
+// Another process can take a port between us reading `status`, and writing
+// `attach`
+constexpr std::size_t MaxAttachAttempts = 4;
+// Give up on a server that accepts the connection, but doesn't reply
+constexpr timeval ImportTimeout {.tv_sec = 10, .tv_usec = 0};
+
+[[nodiscard]]
+HRESULT LastErrorHR() {
+  return HRESULT_FROM_ERRNO(errno);
+}
+
+[[nodiscard]]
+HRESULT SendAll(const int fd, const void* data, std::size_t length) {
+  auto it = static_cast<const std::byte*>(data);
+  while (length) {
+    const auto sent = send(fd, it, length, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return LastErrorHR();
+    }
+    it += sent;
+    length -= sent;
+  }
+  return S_OK;
+}
+
+[[nodiscard]]
+HRESULT RecvAll(const int fd, void* data, std::size_t length) {
+  auto it = static_cast<std::byte*>(data);
+  while (length) {
+    const auto received = recv(fd, it, length, MSG_WAITALL);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return LastErrorHR();
+    }
+    if (received == 0) {
+      return HRESULT_FROM_ERRNO(ECONNRESET);
+    }
+    it += received;
+    length -= received;
+  }
+  return S_OK;
+}
+
+struct ImportedDevice {
+  unique_fd mSocket;
+  uint32_t mDeviceID {};
+  uint32_t mSpeed {};
+};
+
+// Connect to the server, and import the device, as `usbip attach` does
+std::expected<ImportedDevice, HRESULT> Import(
+  const uint16_t tcpPortNumber,
+  const std::string_view busID) {
+  unique_fd sock {socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)};
+  if (!sock) {
+    return std::unexpected {LastErrorHR()};
+  }
+  for (const auto option: {SO_RCVTIMEO, SO_SNDTIMEO}) {
+    if (
+      setsockopt(
+        sock.get(), SOL_SOCKET, option, &ImportTimeout, sizeof(ImportTimeout))
+      != 0) {
+      return std::unexpected {LastErrorHR()};
+    }
+  }
+
+  const sockaddr_in address {
+    .sin_family = AF_INET,
+    .sin_port = htons(tcpPortNumber),
+    .sin_addr = {htonl(INADDR_LOOPBACK)},
+  };
+  if (
+    connect(
+      sock.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address))
+    != 0) {
+    return std::unexpected {LastErrorHR()};
+  }
+
+  USBIP::OP_REQ_IMPORT request {};
+  std::ranges::copy(busID, request.mBusID);
+  if (const auto hr = SendAll(sock.get(), &request, sizeof(request));
+      FAILED(hr)) {
+    return std::unexpected {hr};
+  }
+
+  // On failure, servers may send just the header
+  USBIP::OP_REP_IMPORT reply {};
+  if (const auto hr
+      = RecvAll(sock.get(), &reply.mHeader, sizeof(reply.mHeader));
+      FAILED(hr)) {
+    return std::unexpected {hr};
+  }
+  if (
+    reply.mHeader.mCommandCode != USBIP::SetupCommandCode::OP_REP_IMPORT
+    || reply.mHeader.mStatus.NativeValue() != 0) {
+    return std::unexpected {HRESULT_FROM_ERRNO(ENODEV)};
+  }
+  if (const auto hr
+      = RecvAll(sock.get(), &reply.mDevice, sizeof(reply.mDevice));
+      FAILED(hr)) {
+    return std::unexpected {hr};
+  }
+
+  // The kernel uses the socket as-is, and would time out idle devices
+  constexpr timeval NoTimeout {};
+  for (const auto option: {SO_RCVTIMEO, SO_SNDTIMEO}) {
+    if (
+      setsockopt(sock.get(), SOL_SOCKET, option, &NoTimeout, sizeof(NoTimeout))
+      != 0) {
+      return std::unexpected {LastErrorHR()};
+    }
+  }
+
+  const auto& device = reply.mDevice;
+  return ImportedDevice {
+    .mSocket = std::move(sock),
+    .mDeviceID = (device.mBusNum << 16) | device.mDevNum,
+    .mSpeed = std::bit_cast<USBIP::beu32_t>(device.mSpeed).NativeValue(),
+  };
+}
+
+class VHCIAttachBackend final : public AttachBackend {
+ public:
+  explicit VHCIAttachBackend(std::string sysfsPath)
+    : mSysfsPath(std::move(sysfsPath)) {
+  }
+
+  std::expected<uint16_t, HRESULT> Attach(
+    const uint16_t tcpPortNumber,
+    const std::string_view busID) override {
+    if (
+      busID.empty() || busID.size() >= sizeof(USBIP::OP_REQ_IMPORT::mBusID)) {
+      return std::unexpected {HRESULT_FROM_ERRNO(EINVAL)};
+    }
+
+    auto imported = Import(tcpPortNumber, busID);
+    if (!imported) {
+      return std::unexpected {imported.error()};
+    }
+    const auto superSpeed = imported->mSpeed >= LinuxUSBSpeedSuper;
+
+    HRESULT hr = HRESULT_FROM_ERRNO(EBUSY);
+    for (std::size_t attempt = 0; attempt < MaxAttachAttempts; ++attempt) {
+      const auto port = ReservePort(superSpeed);
+      if (!port) {
+        return std::unexpected {port.error()};
+      }
+      hr = WriteAttach(*port, *imported);
+      ReleasePort(*port);
+      if (SUCCEEDED(hr)) {
+        // The kernel has its own reference to the socket
+        return static_cast<uint16_t>(*port + 1);
+      }
+      if (hr != HRESULT_FROM_ERRNO(EBUSY)) {
+        break;
+      }
+    }
+    return std::unexpected {hr};
+  }
+
+ private:
+  const std::filesystem::path mSysfsPath;
+
+  std::mutex mMutex;
+  // Ports we're attaching to, but the kernel might not report as used yet
+  std::unordered_set<uint16_t> mReservedPorts;
+
+  /* Find a free port on the right hub, in any `vhci_hcd` controller.
+   *
+   * Every controller's `status` file is on the first one, as `status`,
+   * `status.1`, `status.2`, ... and the port numbers are global, as are the
+   * port numbers for `attach`:
+   *
+   *   hub port sta spd dev      sockfd local_busid
+   *   hs  0000 004 000 00000000 000000 0-0
+   */
+  std::expected<uint16_t, HRESULT> ReservePort(const bool superSpeed) {
+    const std::string_view hub = superSpeed ? "ss" : "hs";
+
+    std::unique_lock lock(mMutex);
+    for (std::size_t i = 0;; ++i) {
+      std::ifstream status(
+        mSysfsPath / (i ? std::format("status.{}", i) : "status"));
+      if (!status) {
+        if (i == 0) {
+          return std::unexpected {HRESULT_FROM_ERRNO(ENOENT)};
+        }
+        return std::unexpected {HRESULT_FROM_ERRNO(EBUSY)};
+      }
+
+      std::string line;
+      std::getline(status, line);// column headers
+      while (std::getline(status, line)) {
+        const auto port = ParseFreePort(line, hub);
+        if (port && !mReservedPorts.contains(*port)) {
+          mReservedPorts.emplace(*port);
+          return *port;
+        }
+      }
+    }
+  }
+
+  void ReleasePort(const uint16_t port) {
+    std::unique_lock lock(mMutex);
+    mReservedPorts.erase(port);
+  }
+
+  // Returns the port number, if the `status` line is a free port on `hub`
+  static std::optional<uint16_t> ParseFreePort(
+    const std::string_view line,
+    const std::string_view hub) {
+    if (!line.starts_with(hub)) {
+      return std::nullopt;
+    }
+    unsigned int port {};
+    unsigned int state {};
+    if (std::sscanf(line.data() + hub.size(), "%u %u", &port, &state) != 2) {
+      return std::nullopt;
+    }
+    if (state != VHCIPortFree || port > UINT16_MAX) {
+      return std::nullopt;
+    }
+    return static_cast<uint16_t>(port);
+  }
+
+  [[nodiscard]]
+  HRESULT WriteAttach(const uint16_t port, const ImportedDevice& device) const {
+    const unique_fd attach {
+      open((mSysfsPath / "attach").c_str(), O_WRONLY | O_CLOEXEC)};
+    if (!attach) {
+      return LastErrorHR();
+    }
+    // sysfs attributes must be written in a single `write()`
+    const auto command = std::format(
+      "{} {} {} {}",
+      port,
+      device.mSocket.get(),
+      device.mDeviceID,
+      device.mSpeed);
+    if (write(attach.get(), command.data(), command.size()) < 0) {
+      return LastErrorHR();
+    }
+    return S_OK;
+  }
+};
+
+}// namespace
+
+std::unique_ptr<AttachBackend> CreateVHCIAttachBackend(std::string sysfsPath) {
+  return std::make_unique<VHCIAttachBackend>(std::move(sysfsPath));
+}
+
+}// namespace FredEmmott::USBVirtPP
@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: MIT
 #include "win32-attach.hpp"
 
+#include "attach-backend.hpp"
+
 #include <wil/resource.h>
 
 #include <expected>
@@ -143,4 +145,28 @@ std::expected<uint16_t, AttachError> Attach(
 
   return static_cast<uint16_t>(ioctlData.mPortOutput);
 }
-}// namespace FredEmmott::USBIP::Win2Client
\ No newline at end of file
+}// namespace FredEmmott::USBIP::Win2Client
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+class Win2AttachBackend final : public AttachBackend {
+ public:
+  std::expected<uint16_t, HRESULT> Attach(
+    const uint16_t tcpPortNumber,
+    const std::string_view busID) override {
+    const auto usbPort
+      = USBIP::Win2Client::Attach(tcpPortNumber, busID.data(), busID.size());
+    if (!usbPort) {
+      return std::unexpected {usbPort.error().hr};
+    }
+    return *usbPort;
+  }
+};
+}// namespace
+
+std::unique_ptr<AttachBackend> CreateWin2AttachBackend() {
+  return std::make_unique<Win2AttachBackend>();
+}
+
+}// namespace FredEmmott::USBVirtPP
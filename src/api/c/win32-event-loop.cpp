@@ -0,0 +1,215 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "event-loop.hpp"
+
+#include <wil/resource.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace FredEmmott::USBVirtPP {
+
+namespace {
+
+class Win32EventLoop final : public EventLoop {
+ public:
+  explicit Win32EventLoop(wil::unique_event wakeEvent)
+    : mWakeEvent(std::move(wakeEvent)) {
+    mHandles.push_back(mWakeEvent.get());
+  }
+
+  HRESULT Add(const SOCKET socket, void* const key) override {
+    constexpr auto NetworkEvents = FD_ACCEPT | FD_READ | FD_WRITE | FD_CLOSE;
+
+    // An event per socket until we run out, then share the least-used ones
+    if (mBuckets.size() < MaxBuckets) {
+      wil::unique_event event {WSACreateEvent()};
+      if (!event) {
+        return HRESULT_FROM_WIN32(WSAGetLastError());
+      }
+      if (
+        WSAEventSelect(socket, event.get(), NetworkEvents) == SOCKET_ERROR) {
+        return HRESULT_FROM_WIN32(WSAGetLastError());
+      }
+      mIndices.emplace(key, Location {mBuckets.size(), 0});
+      mHandles.push_back(event.get());
+      mBuckets.push_back({std::move(event), {{socket, key}}});
+      return S_OK;
+    }
+
+    const auto bucket = std::ranges::min_element(
+      mBuckets, {}, [](const Bucket& it) { return it.mSockets.size(); });
+    if (
+      WSAEventSelect(socket, bucket->mEvent.get(), NetworkEvents)
+      == SOCKET_ERROR) {
+      return HRESULT_FROM_WIN32(WSAGetLastError());
+    }
+    mIndices.emplace(
+      key,
+      Location {
+        static_cast<std::size_t>(bucket - mBuckets.begin()),
+        bucket->mSockets.size(),
+      });
+    bucket->mSockets.push_back({socket, key});
+    return S_OK;
+  }
+
+  void Remove(const SOCKET socket, void* const key) override {
+    const auto it = mIndices.find(key);
+    if (it == mIndices.end()) [[unlikely]] {
+      return;
+    }
+    const auto [bucketIndex, index] = it->second;
+    mIndices.erase(it);
+    WSAEventSelect(socket, nullptr, 0);
+
+    // Swap-and-pop, so removal is O(1) regardless of registration order
+    auto& sockets = mBuckets.at(bucketIndex).mSockets;
+    if (index != sockets.size() - 1) {
+      sockets.at(index) = sockets.back();
+      mIndices.at(sockets.at(index).mKey).mIndex = index;
+    }
+    sockets.pop_back();
+    if (!sockets.empty()) {
+      return;
+    }
+
+    const auto last = mBuckets.size() - 1;
+    if (bucketIndex != last) {
+      mBuckets.at(bucketIndex) = std::move(mBuckets.at(last));
+      mHandles.at(bucketIndex + 1) = mHandles.at(last + 1);
+      for (auto&& moved: mBuckets.at(bucketIndex).mSockets) {
+        mIndices.at(moved.mKey).mBucket = bucketIndex;
+      }
+    }
+    mBuckets.pop_back();
+    mHandles.pop_back();
+  }
+
+  std::expected<std::size_t, HRESULT> Wait(
+    const std::span<Event> events,
+    const std::optional<std::chrono::milliseconds> timeout) override {
+    if (events.empty()) [[unlikely]] {
+      return std::unexpected {HRESULT_FROM_WIN32(ERROR_INVALID_PARAMETER)};
+    }
+
+    const auto wait = WaitForMultipleObjects(
+      static_cast<DWORD>(mHandles.size()),
+      mHandles.data(),
+      FALSE,
+      timeout ? static_cast<DWORD>(timeout->count()) : INFINITE);
+    if (wait == WAIT_FAILED) [[unlikely]] {
+      return std::unexpected {HRESULT_FROM_WIN32(GetLastError())};
+    }
+    if (wait == WAIT_TIMEOUT) {
+      return 0;
+    }
+    const auto index = wait - WAIT_OBJECT_0;
+    if (index >= mHandles.size()) [[unlikely]] {
+      return std::unexpected {HRESULT_FROM_WIN32(ERROR_INVALID_INDEX)};
+    }
+
+    // `WaitForMultipleObjects()` always reports the lowest signalled index,
+    // which would let a busy socket near the start starve the rest; instead,
+    // check every bucket, starting after the last one we reported.
+    //
+    // mWakeEvent is auto-reset, so if it's signalled, we've already consumed
+    // it.
+    const auto bucketCount = mBuckets.size();
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < bucketCount && count < events.size(); ++i) {
+      const auto bucketIndex = (mScanStart + i) % bucketCount;
+      const auto& bucket = mBuckets.at(bucketIndex);
+      const auto event = bucket.mEvent.get();
+      if (WaitForSingleObject(event, 0) != WAIT_OBJECT_0) {
+        continue;
+      }
+      // Before enumerating, so anything that happens from now on signals it
+      // again; we can't let `WSAEnumNetworkEvents()` reset it, as that would
+      // lose events for the other sockets in the bucket.
+      ResetEvent(event);
+
+      for (auto&& registration: bucket.mSockets) {
+        if (count == events.size()) {
+          // Check the rest of this bucket next time
+          SetEvent(event);
+          break;
+        }
+        WSANETWORKEVENTS networkEvents {};
+        if (
+          WSAEnumNetworkEvents(registration.mSocket, nullptr, &networkEvents)
+          != 0) [[unlikely]] {
+          return std::unexpected {HRESULT_FROM_WIN32(WSAGetLastError())};
+        }
+        const auto flags = networkEvents.lNetworkEvents;
+        if (flags == 0) {
+          // Another socket in the bucket, or the kernel race condition: even
+          // though we've just been told there's a read or a close on this
+          // socket, nope, there's not
+          continue;
+        }
+
+        // A graceful close may follow data we haven't read yet, so it's only
+        // readable; `Recv()` reports it once the data's been drained
+        const auto closed = (flags & FD_CLOSE) != 0;
+        const auto reset
+          = closed && networkEvents.iErrorCode[FD_CLOSE_BIT] != 0;
+        events[count++] = {
+          .mKey = registration.mKey,
+          .mReadable
+          = (flags & (FD_ACCEPT | FD_READ)) != 0 || (closed && !reset),
+          .mWritable = (flags & FD_WRITE) != 0,
+          .mClosed = reset,
+        };
+      }
+      mScanStart = bucketIndex + 1;
+    }
+    return count;
+  }
+
+  void Wake() override {
+    SetEvent(mWakeEvent.get());
+  }
+
+ private:
+  // One handle is mWakeEvent
+  static constexpr std::size_t MaxBuckets = MAXIMUM_WAIT_OBJECTS - 1;
+
+  struct Registration {
+    SOCKET mSocket {INVALID_SOCKET};
+    void* mKey {};
+  };
+  // Sockets sharing an event, so we're not limited to `MaxBuckets` sockets
+  struct Bucket {
+    wil::unique_event mEvent;
+    std::vector<Registration> mSockets;
+  };
+  struct Location {
+    std::size_t mBucket {};
+    std::size_t mIndex {};
+  };
+
+  wil::unique_event mWakeEvent;
+
+  // mHandles[0] is mWakeEvent, then mHandles[i + 1] is mBuckets[i].mEvent
+  std::vector<HANDLE> mHandles;
+  std::vector<Bucket> mBuckets;
+
+  std::unordered_map<void*, Location> mIndices;
+
+  // Offset into mBuckets for the next scan
+  std::size_t mScanStart {};
+};
+
+}// namespace
+
+std::expected<std::unique_ptr<EventLoop>, HRESULT> CreateWin32EventLoop() {
+  wil::unique_event wakeEvent {CreateEventW(nullptr, FALSE, FALSE, nullptr)};
+  if (!wakeEvent) {
+    return std::unexpected {HRESULT_FROM_WIN32(GetLastError())};
+  }
+  return std::make_unique<Win32EventLoop>(std::move(wakeEvent));
+}
+
+}// namespace FredEmmott::USBVirtPP
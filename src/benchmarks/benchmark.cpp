@@ -0,0 +1,314 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#include "benchmark.hpp"
+#include "device-table.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace FredEmmott::USBVirtPP::Benchmark {
+
+namespace {
+
+std::string FormatErrno(const std::string_view what) {
+  return std::format("{}: {}", what, std::strerror(errno));
+}
+
+std::expected<void, std::string> ReceiveExactly(
+  const int fd,
+  void* const buffer,
+  const std::size_t size) {
+  auto bytes = static_cast<std::byte*>(buffer);
+  std::size_t received {};
+  while (received < size) {
+    const auto ret = recv(fd, bytes + received, size - received, 0);
+    if (ret == 0) {
+      return std::unexpected {std::string {"server closed the connection"}};
+    }
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return std::unexpected {FormatErrno("recv() failed")};
+    }
+    received += static_cast<std::size_t>(ret);
+  }
+  return {};
+}
+
+std::expected<void, std::string> SendExactly(
+  const int fd,
+  const std::span<const std::span<const std::byte>> buffers) {
+  for (auto&& buffer: buffers) {
+    std::size_t sent {};
+    while (sent < buffer.size()) {
+      const auto ret = send(
+        fd, buffer.data() + sent, buffer.size() - sent, MSG_NOSIGNAL);
+      if (ret < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return std::unexpected {FormatErrno("send() failed")};
+      }
+      sent += static_cast<std::size_t>(ret);
+    }
+  }
+  return {};
+}
+
+template <class T>
+std::span<const std::byte> AsBytes(const T& value) {
+  return std::as_bytes(std::span {&value, 1});
+}
+
+}// namespace
+
+std::unique_ptr<Server> Server::Create() {
+  const FredEmmott_USBIP_VirtPP_Instance_InitData initData {
+    .mMinLogSeverity = FredEmmott_USBIP_VirtPP_LogSeverity_Error,
+  };
+  std::unique_ptr<Server> ret {new Server()};
+  ret->mInstance = FredEmmott_USBIP_VirtPP_Instance_Create(&initData);
+  if (!ret->mInstance) {
+    return nullptr;
+  }
+  ret->mPortNumber = FredEmmott_USBIP_VirtPP_Instance_GetPortNumber(
+    ret->mInstance);
+  ret->mRunner = std::thread {[instance = ret->mInstance] {
+    FredEmmott_USBIP_VirtPP_Instance_Run(instance);
+  }};
+  return ret;
+}
+
+Server::~Server() {
+  if (!mInstance) {
+    return;
+  }
+  if (mRunner.joinable()) {
+    FredEmmott_USBIP_VirtPP_Instance_RequestStop(mInstance);
+    mRunner.join();
+  }
+  FredEmmott_USBIP_VirtPP_Instance_Destroy(mInstance);
+}
+
+unique_device CreateVendorDevice(
+  const FredEmmott_USBIP_VirtPP_InstanceHandle instance,
+  const FredEmmott_USBIP_VirtPP_Device_Callbacks& callbacks,
+  void* const userData) {
+  const FredEmmott_USBSpec_DeviceDescriptor deviceDescriptor {
+    .bLength = FredEmmott_USBSpec_DeviceDescriptor_Size,
+    .bDescriptorType = 0x01,
+    .bcdUSB = 0x0200,
+    .bMaxPacketSize0 = 64,
+    .idVendor = 0x1209,
+    .idProduct = 0x0001,
+    .bNumConfigurations = 1,
+  };
+  const FredEmmott_USBSpec_InterfaceDescriptor interfaceDescriptor {
+    .bLength = FredEmmott_USBSpec_InterfaceDescriptor_Size,
+    .bDescriptorType = 0x04,
+    .bInterfaceClass = 0xff,
+  };
+  const FredEmmott_USBIP_VirtPP_Device_InitData initData {
+    .mUserData = userData,
+    .mCallbacks = callbacks,
+    .mDeviceDescriptor = &deviceDescriptor,
+    .mNumInterfaces = 1,
+    .mInterfaceDescriptors = &interfaceDescriptor,
+  };
+  return unique_device {
+    FredEmmott_USBIP_VirtPP_Device_Create(instance, &initData)};
+}
+
+std::string GetBusID(const std::size_t index) {
+  constexpr auto PerBus = DeviceTable::MaxDevicesPerBus;
+  return std::format("{}-{}", (index / PerBus) + 1, (index % PerBus) + 1);
+}
+
+std::expected<Client, std::string> Client::Import(
+  const uint16_t port,
+  const std::string_view busID) {
+  Client ret;
+  ret.mSocket = unique_fd {socket(AF_INET, SOCK_STREAM, 0)};
+  if (!ret.mSocket) {
+    return std::unexpected {FormatErrno("socket() failed")};
+  }
+  // Requests are small, and we're measuring their latency
+  const int noDelay = 1;
+  setsockopt(
+    ret.mSocket.get(), IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+  sockaddr_in address {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+  };
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (
+    connect(
+      ret.mSocket.get(),
+      reinterpret_cast<const sockaddr*>(&address),
+      sizeof(address))
+    != 0) {
+    return std::unexpected {FormatErrno("connect() failed")};
+  }
+
+  USBIP::OP_REQ_IMPORT request {};
+  busID.copy(request.mBusID, sizeof(request.mBusID) - 1);
+  const std::span<const std::byte> buffers[] {AsBytes(request)};
+  if (const auto sent = SendExactly(ret.mSocket.get(), buffers); !sent) {
+    return std::unexpected {sent.error()};
+  }
+  USBIP::OP_REP_IMPORT reply {};
+  if (const auto received
+      = ReceiveExactly(ret.mSocket.get(), &reply, sizeof(reply));
+      !received) {
+    return std::unexpected {received.error()};
+  }
+  if (reply.mHeader.mStatus.NativeValue() != 0) {
+    return std::unexpected {std::format(
+      "failed to import `{}`: status {}",
+      busID,
+      reply.mHeader.mStatus.NativeValue())};
+  }
+  ret.mDeviceID = (reply.mDevice.mBusNum.NativeValue() << 16)
+    | reply.mDevice.mDevNum.NativeValue();
+  return ret;
+}
+
+Client::PreparedSubmit Client::Prepare(const Submit& submit) {
+  const auto sequenceNumber = mNextSequenceNumber++;
+  PreparedSubmit ret {.mSequenceNumber = sequenceNumber};
+  auto& header = ret.mHeader;
+  header = {
+    .mTransferBufferLength = submit.mTransferBufferLength,
+    .mNumberOfPackets
+    = submit.mIsoPacketCount ? submit.mIsoPacketCount : 0xffff'ffff,
+    .mInterval = submit.mIsoPacketCount ? submit.mInterval : 0,
+    .mSetup = submit.mSetup,
+  };
+  header.mHeader.mSequenceNumber = htonl(sequenceNumber);
+  header.mHeader.mDeviceID = mDeviceID;
+  header.mHeader.mDirection = submit.mDirection;
+  header.mHeader.mEndpoint = submit.mEndpoint;
+  for (uint32_t i = 0; i < submit.mIsoPacketCount; ++i) {
+    const auto length = submit.mTransferBufferLength / submit.mIsoPacketCount;
+    ret.mIsoPackets.push_back({
+      .mOffset = i * length,
+      .mLength = length,
+    });
+  }
+
+  mInFlight.emplace(sequenceNumber, submit.mDirection);
+  return ret;
+}
+
+std::expected<uint32_t, std::string> Client::Send(const Submit& submit) {
+  const auto prepared = Prepare(submit);
+  const std::span<const std::byte> buffers[] {
+    AsBytes(prepared.mHeader),
+    (submit.mDirection == USBIP::Direction::Out)
+      ? submit.mPayload
+      : std::span<const std::byte> {},
+    std::as_bytes(std::span {prepared.mIsoPackets}),
+  };
+  if (const auto sent = SendExactly(mSocket.get(), buffers); !sent) {
+    return std::unexpected {sent.error()};
+  }
+  return prepared.mSequenceNumber;
+}
+
+std::vector<std::byte> Client::Encode(const Submit& submit) {
+  const auto prepared = Prepare(submit);
+  const auto header = AsBytes(prepared.mHeader);
+  const auto packets = std::as_bytes(std::span {prepared.mIsoPackets});
+  std::vector<std::byte> ret {header.begin(), header.end()};
+  if (submit.mDirection == USBIP::Direction::Out) {
+    ret.insert(ret.end(), submit.mPayload.begin(), submit.mPayload.end());
+  }
+  ret.insert(ret.end(), packets.begin(), packets.end());
+  return ret;
+}
+
+std::expected<void, std::string> Client::Receive(ReceivedReply& reply) {
+  USBIP::USBIP_RET_SUBMIT header {};
+  if (const auto received
+      = ReceiveExactly(mSocket.get(), &header, sizeof(header));
+      !received) {
+    return received;
+  }
+  if (header.mHeader.mCommandCode != USBIP::CommandCode::USBIP_RET_SUBMIT) {
+    return std::unexpected {std::format(
+      "expected a RET_SUBMIT, got command 0x{:x}",
+      std::to_underlying(header.mHeader.mCommandCode))};
+  }
+  reply.mSequenceNumber = ntohl(header.mHeader.mSequenceNumber);
+  reply.mStatus = header.mStatus;
+  reply.mActualLength = header.mActualLength;
+
+  const auto it = mInFlight.find(reply.mSequenceNumber);
+  if (it == mInFlight.end()) {
+    return std::unexpected {
+      std::format("RET_SUBMIT for unknown URB #{}", reply.mSequenceNumber)};
+  }
+  const auto direction = it->second;
+  mInFlight.erase(it);
+
+  reply.mData.resize(
+    (direction == USBIP::Direction::In) ? reply.mActualLength : 0);
+  if (const auto received
+      = ReceiveExactly(mSocket.get(), reply.mData.data(), reply.mData.size());
+      !received) {
+    return received;
+  }
+
+  const uint32_t packetCount = header.mNumberOfPackets;
+  reply.mIsoPackets.resize((packetCount == 0xffff'ffff) ? 0 : packetCount);
+  return ReceiveExactly(
+    mSocket.get(),
+    reply.mIsoPackets.data(),
+    std::as_bytes(std::span {reply.mIsoPackets}).size());
+}
+
+std::expected<void, std::string> Client::Transfer(
+  const Submit& submit,
+  ReceivedReply& reply) {
+  if (const auto sent = Send(submit); !sent) {
+    return std::unexpected {sent.error()};
+  }
+  return Receive(reply);
+}
+
+std::expected<void, std::string> Client::SendBytes(
+  const std::span<const std::byte> bytes) {
+  const std::span<const std::byte> buffers[] {bytes};
+  return SendExactly(mSocket.get(), buffers);
+}
+
+std::string FormatLatencies(std::vector<Clock::duration>& latencies) {
+  if (latencies.empty()) {
+    return "no URBs";
+  }
+  std::ranges::sort(latencies);
+  const auto percentile = [&latencies](const std::size_t percent) {
+    const auto index
+      = std::min(latencies.size() - 1, (latencies.size() * percent) / 100);
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+             latencies[index])
+      .count();
+  };
+  return std::format(
+    "p50 {}us, p99 {}us, max {}us",
+    percentile(50),
+    percentile(99),
+    std::chrono::duration_cast<std::chrono::microseconds>(latencies.back())
+      .count());
+}
+
+}// namespace FredEmmott::USBVirtPP::Benchmark
@@ -0,0 +1,162 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+#pragma once
+
+/* Shared by the benchmarks: a server on a loopback port, and a minimal
+ * blocking USB/IP client to drive it in place of `vhci_hcd`.
+ */
+
+#include <FredEmmott/USBIP-VirtPP/Core.h>
+#include <FredEmmott/USBIP-VirtPP/Device.h>
+#include <FredEmmott/USBIP.hpp>
+#include "unique-fd.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace FredEmmott::USBVirtPP::Benchmark {
+
+using Clock = std::chrono::steady_clock;
+
+/* An instance listening on an ephemeral loopback port, with `Run()` on a
+ * background thread.
+ *
+ * Destroy any devices before the server.
+ */
+class Server final {
+ public:
+  // Returns null if the instance couldn't be created
+  [[nodiscard]]
+  static std::unique_ptr<Server> Create();
+  ~Server();
+
+  Server(const Server&) = delete;
+  Server& operator=(const Server&) = delete;
+
+  [[nodiscard]]
+  FredEmmott_USBIP_VirtPP_InstanceHandle GetInstance() const noexcept {
+    return mInstance;
+  }
+
+  [[nodiscard]]
+  uint16_t GetPortNumber() const noexcept {
+    return mPortNumber;
+  }
+
+ private:
+  Server() = default;
+
+  FredEmmott_USBIP_VirtPP_InstanceHandle mInstance {};
+  uint16_t mPortNumber {};
+  std::thread mRunner;
+};
+
+struct DeviceDeleter {
+  void operator()(const FredEmmott_USBIP_VirtPP_DeviceHandle h) const {
+    FredEmmott_USBIP_VirtPP_Device_Destroy(h);
+  }
+};
+// Declare after the `Server`, so it's destroyed first
+using unique_device
+  = std::unique_ptr<FredEmmott_USBIP_VirtPP_Device, DeviceDeleter>;
+
+/* A vendor-specific device with one interface, answering with `callbacks`.
+ *
+ * Returns null if the device couldn't be created.
+ */
+[[nodiscard]]
+unique_device CreateVendorDevice(
+  FredEmmott_USBIP_VirtPP_InstanceHandle,
+  const FredEmmott_USBIP_VirtPP_Device_Callbacks& callbacks,
+  void* userData = nullptr);
+
+// The bus ID of the `index`th device created on an instance, counting from
+// zero, if none have been destroyed
+[[nodiscard]]
+std::string GetBusID(std::size_t index);
+
+struct Submit {
+  USBIP::Direction mDirection {USBIP::Direction::In};
+  uint32_t mEndpoint {};
+  uint32_t mTransferBufferLength {};
+  USBIP::USBIP_CMD_SUBMIT::Setup mSetup {};
+  // OUT only; `mTransferBufferLength` bytes
+  std::span<const std::byte> mPayload;
+  // If non-zero, an isochronous transfer, split into packets of equal size
+  uint32_t mIsoPacketCount {};
+  // Microframes, or frames at full speed; isochronous only
+  uint32_t mInterval {1};
+};
+
+// A RET_SUBMIT; reused between calls to `Client::Receive()`
+struct ReceivedReply {
+  uint32_t mSequenceNumber {};
+  int32_t mStatus {};
+  uint32_t mActualLength {};
+  // IN only; for isochronous transfers, the packets' data back-to-back
+  std::vector<std::byte> mData;
+  std::vector<USBIP::USBIP_ISO_PACKET_DESCRIPTOR> mIsoPackets;
+};
+
+/* Imports one device, and exchanges URBs with it.
+ *
+ * Any number of URBs may be in flight. Not thread-safe.
+ */
+class Client final {
+ public:
+  [[nodiscard]]
+  static std::expected<Client, std::string> Import(
+    uint16_t port,
+    std::string_view busID);
+
+  // Returns the URB's sequence number
+  [[nodiscard]]
+  std::expected<uint32_t, std::string> Send(const Submit&);
+  // Blocks until the next RET_SUBMIT
+  [[nodiscard]]
+  std::expected<void, std::string> Receive(ReceivedReply&);
+  // `Send()`, then `Receive()`; nothing else may be in flight
+  [[nodiscard]]
+  std::expected<void, std::string> Transfer(const Submit&, ReceivedReply&);
+
+  // The CMD_SUBMIT that `Send()` would write, for `SendBytes()`
+  [[nodiscard]]
+  std::vector<std::byte> Encode(const Submit&);
+  // Write raw bytes to the socket, e.g. part of a PDU
+  [[nodiscard]]
+  std::expected<void, std::string> SendBytes(std::span<const std::byte>);
+
+ private:
+  struct PreparedSubmit {
+    uint32_t mSequenceNumber {};
+    USBIP::USBIP_CMD_SUBMIT mHeader {};
+    std::vector<USBIP::USBIP_ISO_PACKET_DESCRIPTOR> mIsoPackets;
+  };
+
+  Client() = default;
+
+  // Assigns a sequence number, and tracks the URB as in flight
+  PreparedSubmit Prepare(const Submit&);
+
+  unique_fd mSocket;
+  uint32_t mDeviceID {};
+  uint32_t mNextSequenceNumber {1};
+
+  // By sequence number; the size of a RET_SUBMIT depends on its direction
+  std::unordered_map<uint32_t, USBIP::Direction> mInFlight;
+};
+
+// "p50 ...us, p99 ...us, max ...us"; sorts `latencies`
+[[nodiscard]]
+std::string FormatLatencies(std::vector<Clock::duration>& latencies);
+
+}// namespace FredEmmott::USBVirtPP::Benchmark
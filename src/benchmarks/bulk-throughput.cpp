@@ -0,0 +1,218 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+/* Measures bulk throughput over loopback:
+ *
+ *   usbip_virtpp_benchmark_bulk_throughput [MIB]
+ *
+ * The client keeps a few 1MiB URBs in flight until it has transferred MIB
+ * mebibytes, for each of:
+ *
+ * - IN, answered with `Request_SendStreamingReply()`
+ * - IN, answered with `Request_SendReplyV()`
+ * - OUT, acknowledged with an empty reply
+ *
+ * Each device callback answers immediately, so this is the server's
+ * throughput, not the device's.
+ */
+
+#include "benchmark.hpp"
+
+#include <FredEmmott/USBIP-VirtPP/Request.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <print>
+#include <string_view>
+#include <vector>
+
+namespace USBIP = FredEmmott::USBIP;
+using namespace FredEmmott::USBVirtPP::Benchmark;
+
+namespace {
+
+constexpr std::size_t DefaultMiB = 256;
+constexpr uint32_t TransferSize = 1024 * 1024;
+// URBs in flight
+constexpr std::size_t PipelineDepth = 4;
+
+constexpr uint32_t StreamingEndpoint = 1;
+constexpr uint32_t OutEndpoint = 2;
+constexpr uint32_t ScatterGatherEndpoint = 3;
+
+constexpr std::byte Pattern {0xa5};
+
+// Two halves, to give `SendReplyV()` more than one buffer
+const std::vector<std::byte> HalfTransfer(TransferSize / 2, Pattern);
+
+void OnStreamRead(void*, void* const buffer, const size_t size) {
+  std::memset(buffer, std::to_integer<int>(Pattern), size);
+}
+
+constexpr FredEmmott_USBIP_VirtPP_StreamProducer StreamProducer {
+  .OnRead = &OnStreamRead,
+};
+
+FredEmmott_USBIP_VirtPP_Result OnInputRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  const uint32_t endpoint,
+  uint8_t,
+  uint8_t,
+  uint16_t,
+  uint16_t,
+  uint16_t) {
+  const auto length
+    = FredEmmott_USBIP_VirtPP_Request_GetTransferBufferLength(request);
+  switch (endpoint) {
+    case StreamingEndpoint:
+      return FredEmmott_USBIP_VirtPP_Request_SendStreamingReply(
+        request, length, &StreamProducer);
+    case ScatterGatherEndpoint: {
+      const std::array buffers {
+        FredEmmott_USBIP_VirtPP_Buffer {
+          HalfTransfer.data(), HalfTransfer.size()},
+        FredEmmott_USBIP_VirtPP_Buffer {
+          HalfTransfer.data(), HalfTransfer.size()},
+      };
+      return FredEmmott_USBIP_VirtPP_Request_SendReplyV(
+        request, buffers.data(), buffers.size());
+    }
+    default:
+      return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+  }
+}
+
+FredEmmott_USBIP_VirtPP_Result OnOutputRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  const uint32_t endpoint,
+  uint8_t,
+  uint8_t,
+  uint16_t,
+  uint16_t,
+  uint16_t,
+  const void*,
+  uint32_t) {
+  return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(
+    request, (endpoint == OutEndpoint) ? 0 : -EPIPE);
+}
+
+// Returns MB/s
+std::expected<double, std::string>
+Measure(Client& client, const Submit& submit, const std::size_t urbs) {
+  std::size_t sent {};
+  for (; sent < std::min(urbs, PipelineDepth); ++sent) {
+    if (const auto ok = client.Send(submit); !ok) {
+      return std::unexpected {ok.error()};
+    }
+  }
+
+  const auto start = Clock::now();
+  ReceivedReply reply;
+  for (std::size_t received = 0; received < urbs; ++received) {
+    if (const auto ok = client.Receive(reply); !ok) {
+      return std::unexpected {ok.error()};
+    }
+    if (reply.mStatus != 0) {
+      return std::unexpected {
+        std::format("URB failed with status {}", reply.mStatus)};
+    }
+    if (
+      submit.mDirection == USBIP::Direction::In
+      && reply.mActualLength != TransferSize) {
+      return std::unexpected {
+        std::format("short reply: {} bytes", reply.mActualLength)};
+    }
+    if (sent < urbs) {
+      if (const auto ok = client.Send(submit); !ok) {
+        return std::unexpected {ok.error()};
+      }
+      ++sent;
+    }
+  }
+  const auto elapsed = std::chrono::duration<double>(Clock::now() - start);
+  return static_cast<double>(urbs) * TransferSize / elapsed.count()
+    / 1'000'000;
+}
+
+}// namespace
+
+int main(int argc, char** argv) {
+  std::size_t mebibytes = DefaultMiB;
+  if (argc > 1) {
+    const std::string_view arg {argv[1]};
+    const auto [ptr, ec]
+      = std::from_chars(arg.data(), arg.data() + arg.size(), mebibytes);
+    if (
+      argc > 2 || ec != std::errc {} || ptr != arg.data() + arg.size()
+      || mebibytes == 0) {
+      std::println(stderr, "Usage: {} [MIB]", argv[0]);
+      return 2;
+    }
+  }
+  const auto urbs = (mebibytes * 1024 * 1024) / TransferSize;
+
+  const auto server = Server::Create();
+  if (!server) {
+    std::println(stderr, "Failed to create the instance");
+    return 2;
+  }
+  const FredEmmott_USBIP_VirtPP_Device_Callbacks callbacks {
+    .OnInputRequest = &OnInputRequest,
+    .OnOutputRequest = &OnOutputRequest,
+  };
+  const auto device = CreateVendorDevice(server->GetInstance(), callbacks);
+  if (!device) {
+    std::println(stderr, "Failed to create the device");
+    return 2;
+  }
+  auto client = Client::Import(server->GetPortNumber(), GetBusID(0));
+  if (!client) {
+    std::println(stderr, "Failed to import the device: {}", client.error());
+    return 2;
+  }
+
+  const std::vector<std::byte> payload(TransferSize, Pattern);
+  struct Mode {
+    std::string_view mLabel;
+    Submit mSubmit;
+  };
+  const Mode modes[] {
+    {
+      "IN, streaming reply",
+      {.mEndpoint = StreamingEndpoint, .mTransferBufferLength = TransferSize},
+    },
+    {
+      "IN, scatter-gather reply",
+      {
+        .mEndpoint = ScatterGatherEndpoint,
+        .mTransferBufferLength = TransferSize,
+      },
+    },
+    {
+      "OUT",
+      {
+        .mDirection = USBIP::Direction::Out,
+        .mEndpoint = OutEndpoint,
+        .mTransferBufferLength = TransferSize,
+        .mPayload = payload,
+      },
+    },
+  };
+
+  std::println(
+    "{} MiB each, {} 1MiB URBs in flight", mebibytes, PipelineDepth);
+  for (auto&& [label, submit]: modes) {
+    const auto throughput = Measure(*client, submit, urbs);
+    if (!throughput) {
+      std::println(stderr, "{} failed: {}", label, throughput.error());
+      return 2;
+    }
+    std::println("{:<25} {:.0f} MB/s", std::format("{}:", label), *throughput);
+  }
+  return 0;
+}
@@ -0,0 +1,328 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+/* Measures how long it takes to enumerate N functions:
+ *
+ *   usbip_virtpp_benchmark_composite_enumeration [REPEATS]
+ *
+ * For each N, this times connecting, importing, and enumerating as the host
+ * does - the device descriptor, the configuration descriptor, then
+ * SET_CONFIGURATION - either once for a CompositeDevice with N functions, or
+ * N times, for N separate devices. Each function has one interface, with an
+ * interrupt IN endpoint.
+ *
+ * This runs the USB/IP side only; attaching through `vhci_hcd` adds a fixed
+ * cost per import on top.
+ */
+
+#include "benchmark.hpp"
+
+#include <FredEmmott/USBIP-VirtPP/CompositeDevice.h>
+
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <print>
+#include <string_view>
+#include <vector>
+
+namespace USBIP = FredEmmott::USBIP;
+using namespace FredEmmott::USBVirtPP::Benchmark;
+
+namespace {
+
+constexpr std::size_t DefaultRepeats = 50;
+// USB allows 15 endpoints besides the control pipe, so that's the most
+// functions a composite device can have here
+constexpr std::array FunctionCounts {1uz, 2uz, 4uz, 8uz, 15uz};
+
+constexpr uint8_t GetDescriptor = 0x06;
+constexpr uint8_t SetConfiguration = 0x09;
+constexpr uint8_t DeviceDescriptorType = 0x01;
+constexpr uint8_t ConfigurationDescriptorType = 0x02;
+
+// Matches `CreateVendorDevice()`
+constexpr FredEmmott_USBSpec_DeviceDescriptor DeviceDescriptor {
+  .bLength = FredEmmott_USBSpec_DeviceDescriptor_Size,
+  .bDescriptorType = DeviceDescriptorType,
+  .bcdUSB = 0x0200,
+  .bMaxPacketSize0 = 64,
+  .idVendor = 0x1209,
+  .idProduct = 0x0001,
+  .bNumConfigurations = 1,
+};
+
+#pragma pack(push, 1)
+struct FunctionDescriptors {
+  FredEmmott_USBSpec_InterfaceDescriptor mInterface {
+    .bLength = FredEmmott_USBSpec_InterfaceDescriptor_Size,
+    .bDescriptorType = 0x04,// INTERFACE
+    .bNumEndpoints = 1,
+    .bInterfaceClass = 0xff,// Vendor-specific
+  };
+  FredEmmott_USBSpec_EndpointDescriptor mEndpoint {
+    .bLength = FredEmmott_USBSpec_EndPointDescriptor_Size,
+    .bDescriptorType = 0x05,// ENDPOINT
+    .bEndpointAddress = 0x81,// IN 1
+    .bmAttributes = 0x03,// Interrupt
+    .wMaxPacketSize = 8,
+    .bInterval = 1,
+  };
+};
+
+// For the separate devices
+struct ConfigurationDescriptor {
+  FredEmmott_USBSpec_ConfigurationDescriptor mConfiguration {
+    .bLength = FredEmmott_USBSpec_ConfigurationDescriptor_Size,
+    .bDescriptorType = ConfigurationDescriptorType,
+    .wTotalLength = sizeof(ConfigurationDescriptor),
+    .bNumInterfaces = 1,
+    .bConfigurationValue = 1,
+    .bmAttributes = 0x80,// bus-powered
+    .MaxPower = 0x32,// 100mA
+  };
+  FunctionDescriptors mFunction {};
+};
+#pragma pack(pop)
+
+FredEmmott_USBIP_VirtPP_Result OnInputRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  const uint32_t endpoint,
+  uint8_t,
+  const uint8_t requestCode,
+  const uint16_t value,
+  uint16_t,
+  uint16_t) {
+  if (endpoint != 0) {
+    const std::array<std::byte, 8> report {};
+    return FredEmmott_USBIP_VirtPP_Request_SendReply(request, report);
+  }
+  if (requestCode == GetDescriptor) {
+    switch (value >> 8) {
+      case DeviceDescriptorType:
+        return FredEmmott_USBIP_VirtPP_Request_SendReply(
+          request, DeviceDescriptor);
+      case ConfigurationDescriptorType:
+        return FredEmmott_USBIP_VirtPP_Request_SendReply(
+          request, ConfigurationDescriptor {});
+    }
+  }
+  return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+}
+
+FredEmmott_USBIP_VirtPP_Result OnOutputRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  const uint32_t endpoint,
+  uint8_t,
+  const uint8_t requestCode,
+  uint16_t,
+  uint16_t,
+  uint16_t,
+  const void*,
+  uint32_t) {
+  if (endpoint == 0 && requestCode == SetConfiguration) {
+    return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, 0);
+  }
+  return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+}
+
+constexpr FredEmmott_USBIP_VirtPP_Device_Callbacks Callbacks {
+  .OnInputRequest = &OnInputRequest,
+  .OnOutputRequest = &OnOutputRequest,
+};
+
+struct CompositeDeviceDeleter {
+  void operator()(const FredEmmott_USBIP_VirtPP_CompositeDeviceHandle h) const {
+    FredEmmott_USBIP_VirtPP_CompositeDevice_Destroy(h);
+  }
+};
+using unique_composite_device = std::unique_ptr<
+  FredEmmott_USBIP_VirtPP_CompositeDevice,
+  CompositeDeviceDeleter>;
+
+std::expected<void, std::string> ControlTransfer(
+  Client& client,
+  const Submit& submit,
+  ReceivedReply& reply) {
+  if (const auto ok = client.Transfer(submit, reply); !ok) {
+    return ok;
+  }
+  if (reply.mStatus != 0) {
+    return std::unexpected {std::format(
+      "request 0x{:02x} failed with status {}",
+      submit.mSetup.mRequest,
+      reply.mStatus)};
+  }
+  return {};
+}
+
+Submit GetDescriptorRequest(const uint8_t type, const uint16_t length) {
+  return {
+    .mTransferBufferLength = length,
+    .mSetup = {
+      .mRequestType = 0x80,// IN, standard, device
+      .mRequest = GetDescriptor,
+      .mValue = static_cast<uint16_t>(type << 8),
+      .mLength = length,
+    },
+  };
+}
+
+// Connects, imports, and enumerates one device, as the host would
+std::expected<void, std::string> Enumerate(
+  const uint16_t port,
+  const std::string_view busID) {
+  auto client = Client::Import(port, busID);
+  if (!client) {
+    return std::unexpected {client.error()};
+  }
+  ReceivedReply reply;
+  if (const auto ok = ControlTransfer(
+        *client,
+        GetDescriptorRequest(
+          DeviceDescriptorType, FredEmmott_USBSpec_DeviceDescriptor_Size),
+        reply);
+      !ok) {
+    return ok;
+  }
+  if (const auto ok = ControlTransfer(
+        *client,
+        GetDescriptorRequest(
+          ConfigurationDescriptorType,
+          FredEmmott_USBSpec_ConfigurationDescriptor_Size),
+        reply);
+      !ok) {
+    return ok;
+  }
+  if (reply.mData.size() < FredEmmott_USBSpec_ConfigurationDescriptor_Size) {
+    return std::unexpected {std::string {"short configuration descriptor"}};
+  }
+  FredEmmott_USBSpec_ConfigurationDescriptor configuration {};
+  std::memcpy(&configuration, reply.mData.data(), sizeof(configuration));
+  if (const auto ok = ControlTransfer(
+        *client,
+        GetDescriptorRequest(
+          ConfigurationDescriptorType, configuration.wTotalLength),
+        reply);
+      !ok) {
+    return ok;
+  }
+  if (reply.mData.size() != configuration.wTotalLength) {
+    return std::unexpected {std::string {"short configuration descriptor"}};
+  }
+  return ControlTransfer(
+    *client,
+    {
+      .mDirection = USBIP::Direction::Out,
+      .mSetup = {
+        .mRequest = SetConfiguration,
+        .mValue = configuration.bConfigurationValue,
+      },
+    },
+    reply);
+}
+
+// Times enumerating one composite device with `functionCount` functions
+std::expected<Clock::duration, std::string> TimeComposite(
+  const std::size_t functionCount) {
+  const auto server = Server::Create();
+  if (!server) {
+    return std::unexpected {std::string {"failed to create the instance"}};
+  }
+  const FunctionDescriptors descriptors {};
+  const std::vector functions(
+    functionCount,
+    FredEmmott_USBIP_VirtPP_CompositeDevice_Function {
+      .mCallbacks = Callbacks,
+      .mDescriptors = &descriptors,
+      .mDescriptorsLength = sizeof(descriptors),
+    });
+  const FredEmmott_USBIP_VirtPP_CompositeDevice_InitData initData {
+    .mVendorID = DeviceDescriptor.idVendor,
+    .mProductID = DeviceDescriptor.idProduct,
+    .mFunctionCount = functions.size(),
+    .mFunctions = functions.data(),
+  };
+  const unique_composite_device device {
+    FredEmmott_USBIP_VirtPP_CompositeDevice_Create(
+      server->GetInstance(), &initData)};
+  if (!device) {
+    return std::unexpected {std::string {"failed to create the device"}};
+  }
+
+  const auto start = Clock::now();
+  if (const auto ok = Enumerate(server->GetPortNumber(), GetBusID(0)); !ok) {
+    return std::unexpected {ok.error()};
+  }
+  return Clock::now() - start;
+}
+
+// Times enumerating `deviceCount` separate devices, one after another
+std::expected<Clock::duration, std::string> TimeSeparate(
+  const std::size_t deviceCount) {
+  const auto server = Server::Create();
+  if (!server) {
+    return std::unexpected {std::string {"failed to create the instance"}};
+  }
+  std::vector<unique_device> devices;
+  for (std::size_t i = 0; i < deviceCount; ++i) {
+    devices.push_back(CreateVendorDevice(server->GetInstance(), Callbacks));
+    if (!devices.back()) {
+      return std::unexpected {std::string {"failed to create a device"}};
+    }
+  }
+
+  const auto start = Clock::now();
+  for (std::size_t i = 0; i < deviceCount; ++i) {
+    if (const auto ok = Enumerate(server->GetPortNumber(), GetBusID(i));
+        !ok) {
+      return std::unexpected {ok.error()};
+    }
+  }
+  return Clock::now() - start;
+}
+
+}// namespace
+
+int main(int argc, char** argv) {
+  std::size_t repeats = DefaultRepeats;
+  if (argc > 1) {
+    const std::string_view arg {argv[1]};
+    const auto [ptr, ec]
+      = std::from_chars(arg.data(), arg.data() + arg.size(), repeats);
+    if (
+      argc > 2 || ec != std::errc {} || ptr != arg.data() + arg.size()
+      || repeats == 0) {
+      std::println(stderr, "Usage: {} [REPEATS]", argv[0]);
+      return 2;
+    }
+  }
+
+  std::println("{} repeats each", repeats);
+  for (auto&& count: FunctionCounts) {
+    std::vector<Clock::duration> composite;
+    std::vector<Clock::duration> separate;
+    for (std::size_t i = 0; i < repeats; ++i) {
+      const auto compositeTime = TimeComposite(count);
+      const auto separateTime = TimeSeparate(count);
+      if (!(compositeTime && separateTime)) {
+        std::println(
+          stderr,
+          "Enumerating {} functions failed: {}",
+          count,
+          compositeTime ? separateTime.error() : compositeTime.error());
+        return 2;
+      }
+      composite.push_back(*compositeTime);
+      separate.push_back(*separateTime);
+    }
+    std::println("N = {}:", count);
+    std::println("  One composite device: {}", FormatLatencies(composite));
+    std::println("  Separate devices:     {}", FormatLatencies(separate));
+  }
+  return 0;
+}
@@ -0,0 +1,233 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+/* Measures how evenly the server shares its loop thread between clients:
+ *
+ *   usbip_virtpp_benchmark_fairness [CLIENTS] [URBS]
+ *
+ * Each client imports its own device, and sends interrupt IN URBs one at a
+ * time from its own thread; we measure each round trip. This runs twice:
+ * first with just those clients, then while another client floods its
+ * device, keeping hundreds of URBs in flight. Every device answers
+ * immediately.
+ *
+ * For each run, this prints every client's latencies, and the spread of
+ * their p99s. With round-robin servicing, the flood should raise every
+ * client's latency by about the same amount, and no p99 should run away.
+ */
+
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <optional>
+#include <print>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace FredEmmott::USBVirtPP::Benchmark;
+
+namespace {
+
+constexpr std::size_t DefaultClients = 8;
+constexpr std::size_t DefaultURBs = 2000;
+constexpr uint32_t ReportSize = 8;
+// URBs the flooding client keeps in flight
+constexpr std::size_t FloodDepth = 256;
+
+constexpr Submit InterruptIn {
+  .mEndpoint = 1,
+  .mTransferBufferLength = ReportSize,
+};
+
+FredEmmott_USBIP_VirtPP_Result OnInputRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint32_t,
+  uint8_t,
+  uint8_t,
+  uint16_t,
+  uint16_t,
+  uint16_t) {
+  const std::array<std::byte, ReportSize> report {};
+  return FredEmmott_USBIP_VirtPP_Request_SendReply(request, report);
+}
+
+FredEmmott_USBIP_VirtPP_Result OnOutputRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint32_t,
+  uint8_t,
+  uint8_t,
+  uint16_t,
+  uint16_t,
+  uint16_t,
+  const void*,
+  uint32_t) {
+  return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+}
+
+struct ClientResult {
+  std::vector<Clock::duration> mLatencies;
+  std::string mError;
+};
+
+void MeasureRoundTrips(
+  Client& client,
+  const std::size_t count,
+  ClientResult& result) {
+  result.mLatencies.reserve(count);
+  ReceivedReply reply;
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto start = Clock::now();
+    if (const auto ok = client.Transfer(InterruptIn, reply); !ok) {
+      result.mError = ok.error();
+      return;
+    }
+    result.mLatencies.push_back(Clock::now() - start);
+  }
+}
+
+// Keeps `FloodDepth` URBs in flight until `stop`; returns how many were
+// answered
+std::size_t Flood(Client& client, const std::atomic_flag& stop) {
+  for (std::size_t i = 0; i < FloodDepth; ++i) {
+    if (!client.Send(InterruptIn)) {
+      return 0;
+    }
+  }
+  std::size_t answered {};
+  ReceivedReply reply;
+  while (!stop.test()) {
+    if (!(client.Receive(reply) && client.Send(InterruptIn))) {
+      break;
+    }
+    ++answered;
+  }
+  return answered;
+}
+
+// Returns false if any client failed
+bool Run(
+  const std::string_view label,
+  std::vector<Client>& clients,
+  const std::size_t urbs,
+  Client* flooder) {
+  std::atomic_flag stop;
+  std::size_t flooded {};
+  std::optional<std::thread> floodThread;
+  if (flooder) {
+    floodThread.emplace([&] { flooded = Flood(*flooder, stop); });
+  }
+
+  std::vector<ClientResult> results(clients.size());
+  const auto start = Clock::now();
+  {
+    std::vector<std::jthread> threads;
+    for (std::size_t i = 0; i < clients.size(); ++i) {
+      threads.emplace_back(
+        [&, i] { MeasureRoundTrips(clients[i], urbs, results[i]); });
+    }
+  }
+  const auto elapsed = std::chrono::duration<double>(Clock::now() - start);
+  stop.test_and_set();
+  if (floodThread) {
+    floodThread->join();
+  }
+
+  std::println("{}:", label);
+  std::vector<Clock::duration> p99s;
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    auto& latencies = results[i].mLatencies;
+    if (!results[i].mError.empty()) {
+      std::println(stderr, "  Client {} failed: {}", i, results[i].mError);
+      return false;
+    }
+    std::println("  Client {}: {}", i, FormatLatencies(latencies));
+    // Sorted by `FormatLatencies()`
+    p99s.push_back(latencies[(latencies.size() * 99) / 100]);
+  }
+  const auto [minP99, maxP99] = std::ranges::minmax(p99s);
+  const auto us = [](const Clock::duration value) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(value)
+      .count();
+  };
+  std::println(
+    "  p99 spread: {}us-{}us ({}us)",
+    us(minP99),
+    us(maxP99),
+    us(maxP99 - minP99));
+  if (flooder) {
+    std::println(
+      "  Flooding client: {:.0f} URBs/s",
+      static_cast<double>(flooded) / elapsed.count());
+  }
+  return true;
+}
+
+template <class T>
+bool ParseArg(const std::string_view arg, T& out) {
+  const auto end = arg.data() + arg.size();
+  const auto [ptr, ec] = std::from_chars(arg.data(), end, out);
+  return ec == std::errc {} && ptr == end && out > 0;
+}
+
+}// namespace
+
+int main(int argc, char** argv) {
+  std::size_t clientCount = DefaultClients;
+  std::size_t urbs = DefaultURBs;
+  if (
+    argc > 3 || (argc > 1 && !ParseArg(argv[1], clientCount))
+    || (argc > 2 && !ParseArg(argv[2], urbs))) {
+    std::println(stderr, "Usage: {} [CLIENTS] [URBS]", argv[0]);
+    return 2;
+  }
+
+  const auto server = Server::Create();
+  if (!server) {
+    std::println(stderr, "Failed to create the instance");
+    return 2;
+  }
+  const FredEmmott_USBIP_VirtPP_Device_Callbacks callbacks {
+    .OnInputRequest = &OnInputRequest,
+    .OnOutputRequest = &OnOutputRequest,
+  };
+  // The last one is for the flooding client
+  std::vector<unique_device> devices;
+  for (std::size_t i = 0; i <= clientCount; ++i) {
+    devices.push_back(CreateVendorDevice(server->GetInstance(), callbacks));
+    if (!devices.back()) {
+      std::println(stderr, "Failed to create a device");
+      return 2;
+    }
+  }
+
+  std::vector<Client> clients;
+  for (std::size_t i = 0; i < clientCount; ++i) {
+    auto client = Client::Import(server->GetPortNumber(), GetBusID(i));
+    if (!client) {
+      std::println(stderr, "Failed to import a device: {}", client.error());
+      return 2;
+    }
+    clients.push_back(std::move(*client));
+  }
+  auto flooder
+    = Client::Import(server->GetPortNumber(), GetBusID(clientCount));
+  if (!flooder) {
+    std::println(stderr, "Failed to import a device: {}", flooder.error());
+    return 2;
+  }
+
+  std::println("{} clients, {} round trips each", clientCount, urbs);
+  if (!Run("Without flooding", clients, urbs, nullptr)) {
+    return 2;
+  }
+  if (!Run("With a flooding client", clients, urbs, &*flooder)) {
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,288 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+/* Measures isochronous streaming with the UAC2 device:
+ *
+ *   usbip_virtpp_benchmark_iso_streaming [SECONDS]
+ *
+ * The client starts playback and capture, then keeps three 8ms transfers in
+ * flight in each direction, as Linux's `snd-usb-audio` does. Meanwhile, an
+ * app thread writes capture samples and reads playback samples in real time.
+ *
+ * Every transfer should complete 8ms after the previous one in the same
+ * direction; this prints how far the gaps were from that, the sustained
+ * rate, and the device's own counters. Any underruns or overruns mean the
+ * server didn't keep up.
+ */
+
+#include "benchmark.hpp"
+
+#include <FredEmmott/USBIP-VirtPP/UAC2Device.h>
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <print>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace USBIP = FredEmmott::USBIP;
+using namespace FredEmmott::USBVirtPP::Benchmark;
+
+namespace {
+
+constexpr std::chrono::seconds DefaultDuration {5};
+
+constexpr uint32_t SampleRate = FredEmmott_USBIP_VirtPP_UAC2Device_SampleRate;
+constexpr uint32_t ChannelCount
+  = FredEmmott_USBIP_VirtPP_UAC2Device_ChannelCount;
+constexpr uint32_t BytesPerFrame = ChannelCount * sizeof(int16_t);
+// Audio frames per 1ms USB frame
+constexpr uint32_t FramesPerPacket = SampleRate / 1000;
+constexpr uint32_t PacketSize = FramesPerPacket * BytesPerFrame;
+
+// Per transfer; one packet per 1ms USB frame
+constexpr uint32_t PacketsPerTransfer = 8;
+constexpr auto TransferDuration = std::chrono::milliseconds {8};
+constexpr uint32_t TransferSize = PacketsPerTransfer * PacketSize;
+// Per direction
+constexpr std::size_t TransfersInFlight = 3;
+// The first transfers are answered back-to-back
+constexpr std::size_t WarmUpTransfers = TransfersInFlight;
+
+constexpr uint32_t PlaybackEndpoint = 1;
+constexpr uint32_t CaptureEndpoint = 2;
+constexpr uint16_t PlaybackInterface = 1;
+constexpr uint16_t CaptureInterface = 2;
+
+constexpr auto AppInterval = std::chrono::milliseconds {10};
+constexpr std::size_t AppFrames
+  = (SampleRate * AppInterval.count()) / 1000;
+
+struct DeviceDeleter {
+  void operator()(const FredEmmott_USBIP_VirtPP_UAC2DeviceHandle h) const {
+    FredEmmott_USBIP_VirtPP_UAC2Device_Destroy(h);
+  }
+};
+using unique_uac2_device
+  = std::unique_ptr<FredEmmott_USBIP_VirtPP_UAC2Device, DeviceDeleter>;
+
+std::expected<void, std::string> StartStream(
+  Client& client,
+  const uint16_t interfaceNumber) {
+  const Submit setInterface {
+    .mDirection = USBIP::Direction::Out,
+    .mSetup = {
+      .mRequestType = 0x01,// Standard, interface
+      .mRequest = 0x0B,// SET_INTERFACE
+      .mValue = 1,
+      .mIndex = interfaceNumber,
+    },
+  };
+  ReceivedReply reply;
+  if (const auto ok = client.Transfer(setInterface, reply); !ok) {
+    return ok;
+  }
+  if (reply.mStatus != 0) {
+    return std::unexpected {
+      std::format("SET_INTERFACE failed with status {}", reply.mStatus)};
+  }
+  return {};
+}
+
+struct Direction {
+  std::string_view mLabel;
+  Submit mSubmit;
+  std::size_t mCompleted {};
+  Clock::time_point mLastCompletedAt {};
+  // How far each gap between completions was from `TransferDuration`
+  std::vector<Clock::duration> mJitter;
+};
+
+// Keeps `TransfersInFlight` transfers in flight in each direction until
+// `until`
+std::expected<void, std::string> Stream(
+  Client& client,
+  std::span<Direction> directions,
+  const Clock::time_point until) {
+  std::unordered_map<uint32_t, Direction*> inFlight;
+  const auto send = [&](Direction& direction) {
+    const auto sequenceNumber = client.Send(direction.mSubmit);
+    if (sequenceNumber) {
+      inFlight.emplace(*sequenceNumber, &direction);
+    }
+    return sequenceNumber;
+  };
+  for (auto&& direction: directions) {
+    for (std::size_t i = 0; i < TransfersInFlight; ++i) {
+      if (const auto ok = send(direction); !ok) {
+        return std::unexpected {ok.error()};
+      }
+    }
+  }
+
+  ReceivedReply reply;
+  while (!inFlight.empty()) {
+    if (const auto ok = client.Receive(reply); !ok) {
+      return ok;
+    }
+    const auto now = Clock::now();
+    const auto it = inFlight.find(reply.mSequenceNumber);
+    auto& direction = *it->second;
+    inFlight.erase(it);
+    if (reply.mStatus != 0) {
+      return std::unexpected {std::format(
+        "{} transfer failed with status {}", direction.mLabel, reply.mStatus)};
+    }
+
+    if (direction.mCompleted++ >= WarmUpTransfers) {
+      const auto gap = now - direction.mLastCompletedAt;
+      direction.mJitter.push_back(
+        (gap > TransferDuration) ? (gap - TransferDuration)
+                                 : (TransferDuration - gap));
+    }
+    direction.mLastCompletedAt = now;
+
+    if (now < until) {
+      if (const auto ok = send(direction); !ok) {
+        return std::unexpected {ok.error()};
+      }
+    }
+  }
+  return {};
+}
+
+// Writes capture samples and reads playback samples in real time until
+// `stop`; returns the playback frames read
+std::size_t RunApp(
+  const FredEmmott_USBIP_VirtPP_UAC2DeviceHandle device,
+  const std::atomic_flag& stop) {
+  std::vector<int16_t> capture(AppFrames * ChannelCount);
+  for (std::size_t i = 0; i < capture.size(); ++i) {
+    capture[i] = static_cast<int16_t>(i);
+  }
+  // Room for more than one interval, to catch up after a late wakeup
+  std::vector<int16_t> playback(2 * AppFrames * ChannelCount);
+
+  std::size_t played {};
+  auto next = Clock::now();
+  while (!stop.test()) {
+    FredEmmott_USBIP_VirtPP_UAC2Device_WriteCapture(
+      device, capture.data(), AppFrames);
+    played += FredEmmott_USBIP_VirtPP_UAC2Device_ReadPlayback(
+      device, playback.data(), 2 * AppFrames);
+    next += AppInterval;
+    std::this_thread::sleep_until(next);
+  }
+  return played;
+}
+
+}// namespace
+
+int main(int argc, char** argv) {
+  Clock::duration duration = DefaultDuration;
+  if (argc > 1) {
+    const std::string_view arg {argv[1]};
+    uint32_t seconds {};
+    const auto [ptr, ec]
+      = std::from_chars(arg.data(), arg.data() + arg.size(), seconds);
+    if (
+      argc > 2 || ec != std::errc {} || ptr != arg.data() + arg.size()
+      || seconds == 0) {
+      std::println(stderr, "Usage: {} [SECONDS]", argv[0]);
+      return 2;
+    }
+    duration = std::chrono::seconds {seconds};
+  }
+
+  const auto server = Server::Create();
+  if (!server) {
+    std::println(stderr, "Failed to create the instance");
+    return 2;
+  }
+  const FredEmmott_USBIP_VirtPP_UAC2Device_InitData initData {};
+  const unique_uac2_device device {
+    FredEmmott_USBIP_VirtPP_UAC2Device_Create(
+      server->GetInstance(), &initData)};
+  if (!device) {
+    std::println(stderr, "Failed to create the device");
+    return 2;
+  }
+  auto client = Client::Import(server->GetPortNumber(), GetBusID(0));
+  if (!client) {
+    std::println(stderr, "Failed to import the device: {}", client.error());
+    return 2;
+  }
+  for (auto&& interfaceNumber: {PlaybackInterface, CaptureInterface}) {
+    if (const auto ok = StartStream(*client, interfaceNumber); !ok) {
+      std::println(stderr, "Failed to start a stream: {}", ok.error());
+      return 2;
+    }
+  }
+
+  const std::vector<std::byte> silence(TransferSize);
+  std::array directions {
+    Direction {
+      .mLabel = "Playback",
+      .mSubmit = {
+        .mDirection = USBIP::Direction::Out,
+        .mEndpoint = PlaybackEndpoint,
+        .mTransferBufferLength = TransferSize,
+        .mPayload = silence,
+        .mIsoPacketCount = PacketsPerTransfer,
+      },
+    },
+    Direction {
+      .mLabel = "Capture",
+      .mSubmit = {
+        .mEndpoint = CaptureEndpoint,
+        .mTransferBufferLength = TransferSize,
+        .mIsoPacketCount = PacketsPerTransfer,
+      },
+    },
+  };
+
+  std::atomic_flag stop;
+  std::size_t played {};
+  std::thread app {[&] { played = RunApp(device.get(), stop); }};
+  const auto start = Clock::now();
+  const auto streamed = Stream(*client, directions, start + duration);
+  const auto elapsed
+    = std::chrono::duration<double>(Clock::now() - start).count();
+  stop.test_and_set();
+  app.join();
+  if (!streamed) {
+    std::println(stderr, "Streaming failed: {}", streamed.error());
+    return 2;
+  }
+
+  FredEmmott_USBIP_VirtPP_UAC2Device_Stats stats {};
+  FredEmmott_USBIP_VirtPP_UAC2Device_GetStats(device.get(), &stats);
+
+  std::println(
+    "{:.1f}s, {} transfers of {}ms in flight each way",
+    elapsed,
+    TransfersInFlight,
+    TransferDuration.count());
+  for (auto&& direction: directions) {
+    std::println(
+      "{} jitter: {}", direction.mLabel, FormatLatencies(direction.mJitter));
+  }
+  std::println(
+    "Playback: {:.0f} frames/s; {} overrun frames, max jitter {}us",
+    static_cast<double>(stats.mPlaybackFrames) / elapsed,
+    stats.mPlaybackOverrunFrames,
+    stats.mPlaybackMaxJitterMicroseconds);
+  std::println(
+    "Capture:  {:.0f} frames/s; {} underrun frames, max jitter {}us",
+    static_cast<double>(stats.mCaptureFrames) / elapsed,
+    stats.mCaptureUnderrunFrames,
+    stats.mCaptureMaxJitterMicroseconds);
+  std::println("The app read {} playback frames", played);
+  return 0;
+}
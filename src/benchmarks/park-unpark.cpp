@@ -0,0 +1,213 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+/* Compares `MPMCRing` with the mutex-guarded `std::queue` that HIDDevice and
+ * XPad used to park interrupt IN requests:
+ *
+ *   usbip_virtpp_benchmark_park_unpark [SECONDS]
+ *
+ * Paced: the loop thread parks a request every millisecond, as a host
+ * polling at 1kHz would, while the feeder thread updates the device at 8kHz,
+ * unparking a request if there is one. We time each park and unpark call,
+ * and how long each request stayed parked.
+ *
+ * Unpaced: two threads park and two threads unpark as fast as they can,
+ * yielding if the queue is full or empty, for the throughput under
+ * contention.
+ */
+
+#include "benchmark.hpp"
+#include "guarded_data.hpp"
+#include "mpmc-ring.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <format>
+#include <optional>
+#include <print>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace FredEmmott::USBVirtPP;
+using namespace FredEmmott::USBVirtPP::Benchmark;
+
+namespace {
+
+constexpr std::chrono::seconds DefaultDuration {2};
+// `MaxPendingInputRequests` in detail-hid.hpp
+constexpr std::size_t Capacity = 32;
+constexpr auto HostInterval = std::chrono::microseconds {1000};
+constexpr auto FeederInterval = std::chrono::microseconds {125};
+constexpr std::size_t UnpacedThreads = 2;
+
+struct ParkedRequest {
+  Clock::time_point mParkedAt {};
+};
+
+class MutexQueue final {
+ public:
+  [[nodiscard]]
+  bool TryPush(ParkedRequest&& value) {
+    auto queue = mQueue.lock();
+    if (queue->size() >= Capacity) {
+      return false;
+    }
+    queue->push(std::move(value));
+    return true;
+  }
+
+  [[nodiscard]]
+  std::optional<ParkedRequest> TryPop() {
+    auto queue = mQueue.lock();
+    if (queue->empty()) {
+      return std::nullopt;
+    }
+    std::optional<ParkedRequest> ret {std::move(queue->front())};
+    queue->pop();
+    return ret;
+  }
+
+ private:
+  guarded_data<std::queue<ParkedRequest>> mQueue;
+};
+
+using Ring = MPMCRing<ParkedRequest, Capacity>;
+
+// Like `FormatLatencies()`, in nanoseconds
+std::string FormatCallTimes(std::vector<Clock::duration>& times) {
+  if (times.empty()) {
+    return "no calls";
+  }
+  std::ranges::sort(times);
+  const auto percentile = [&times](const std::size_t percent) {
+    const auto index
+      = std::min(times.size() - 1, (times.size() * percent) / 100);
+    return std::chrono::nanoseconds {times[index]}.count();
+  };
+  return std::format(
+    "p50 {}ns, p99 {}ns, max {}ns",
+    percentile(50),
+    percentile(99),
+    std::chrono::nanoseconds {times.back()}.count());
+}
+
+template <class Queue>
+void RunPaced(const std::string_view label, const Clock::duration duration) {
+  Queue queue;
+  std::atomic_flag stop;
+  std::vector<Clock::duration> parkTimes;
+  std::vector<Clock::duration> unparkTimes;
+  std::vector<Clock::duration> parkedFor;
+  std::size_t full {};
+
+  std::thread host {[&] {
+    auto next = Clock::now();
+    while (!stop.test()) {
+      next += HostInterval;
+      std::this_thread::sleep_until(next);
+      const auto start = Clock::now();
+      const auto parked = queue.TryPush({start});
+      parkTimes.push_back(Clock::now() - start);
+      if (!parked) {
+        ++full;
+      }
+    }
+  }};
+  std::thread feeder {[&] {
+    auto next = Clock::now();
+    while (!stop.test()) {
+      next += FeederInterval;
+      std::this_thread::sleep_until(next);
+      const auto start = Clock::now();
+      const auto request = queue.TryPop();
+      const auto end = Clock::now();
+      unparkTimes.push_back(end - start);
+      if (request) {
+        parkedFor.push_back(end - request->mParkedAt);
+      }
+    }
+  }};
+  std::this_thread::sleep_for(duration);
+  stop.test_and_set();
+  host.join();
+  feeder.join();
+
+  std::println("{}, paced:", label);
+  std::println(
+    "  Park ({} calls, {} full): {}",
+    parkTimes.size(),
+    full,
+    FormatCallTimes(parkTimes));
+  std::println(
+    "  Unpark ({} calls): {}",
+    unparkTimes.size(),
+    FormatCallTimes(unparkTimes));
+  std::println("  Time parked: {}", FormatLatencies(parkedFor));
+}
+
+template <class Queue>
+void RunUnpaced(const std::string_view label, const Clock::duration duration) {
+  Queue queue;
+  std::atomic_flag stop;
+  std::atomic<uint64_t> unparked {};
+  {
+    std::vector<std::jthread> threads;
+    for (std::size_t i = 0; i < UnpacedThreads; ++i) {
+      threads.emplace_back([&] {
+        while (!stop.test()) {
+          if (!queue.TryPush({})) {
+            std::this_thread::yield();
+          }
+        }
+      });
+      threads.emplace_back([&] {
+        uint64_t count {};
+        while (!stop.test()) {
+          if (queue.TryPop()) {
+            ++count;
+          } else {
+            std::this_thread::yield();
+          }
+        }
+        unparked.fetch_add(count);
+      });
+    }
+    std::this_thread::sleep_for(duration);
+    stop.test_and_set();
+  }
+  std::println(
+    "{}, unpaced: {:.1f}M requests/s",
+    label,
+    static_cast<double>(unparked.load())
+      / std::chrono::duration<double>(duration).count() / 1'000'000);
+}
+
+}// namespace
+
+int main(int argc, char** argv) {
+  Clock::duration duration = DefaultDuration;
+  if (argc > 1) {
+    const std::string_view arg {argv[1]};
+    uint32_t seconds {};
+    const auto [ptr, ec]
+      = std::from_chars(arg.data(), arg.data() + arg.size(), seconds);
+    if (
+      argc > 2 || ec != std::errc {} || ptr != arg.data() + arg.size()
+      || seconds == 0) {
+      std::println(stderr, "Usage: {} [SECONDS]", argv[0]);
+      return 2;
+    }
+    duration = std::chrono::seconds {seconds};
+  }
+
+  RunPaced<MutexQueue>("Mutex and std::queue", duration);
+  RunPaced<Ring>("MPMCRing", duration);
+  RunUnpaced<MutexQueue>("Mutex and std::queue", duration);
+  RunUnpaced<Ring>("MPMCRing", duration);
+  return 0;
+}
@@ -0,0 +1,176 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+/* Measures how much a client that trickles its PDUs delays everyone else:
+ *
+ *   usbip_virtpp_benchmark_slow_client [URBS]
+ *
+ * A healthy client sends interrupt IN URBs one at a time, and we measure each
+ * round trip; first on its own, then while another client sends OUT URBs a
+ * byte every millisecond. The device answers immediately.
+ *
+ * The two sets of latencies should be about the same. If the server waited
+ * for complete PDUs, the healthy client would be stalled for most of each
+ * trickled PDU - over 100ms.
+ */
+
+#include "benchmark.hpp"
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <print>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace USBIP = FredEmmott::USBIP;
+using namespace FredEmmott::USBVirtPP::Benchmark;
+
+namespace {
+
+constexpr std::size_t DefaultURBs = 20000;
+constexpr uint32_t ReportSize = 8;
+constexpr uint32_t SlowPayloadSize = 64;
+constexpr auto TrickleInterval = std::chrono::milliseconds {1};
+
+FredEmmott_USBIP_VirtPP_Result OnInputRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint32_t,
+  uint8_t,
+  uint8_t,
+  uint16_t,
+  uint16_t,
+  uint16_t) {
+  const std::array<std::byte, ReportSize> report {};
+  return FredEmmott_USBIP_VirtPP_Request_SendReply(request, report);
+}
+
+FredEmmott_USBIP_VirtPP_Result OnOutputRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint32_t,
+  uint8_t,
+  uint8_t,
+  uint16_t,
+  uint16_t,
+  uint16_t,
+  const void*,
+  uint32_t) {
+  return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, 0);
+}
+
+std::expected<std::vector<Clock::duration>, std::string> MeasureRoundTrips(
+  Client& client,
+  const std::size_t count) {
+  std::vector<Clock::duration> ret;
+  ret.reserve(count);
+  ReceivedReply reply;
+  const Submit submit {
+    .mEndpoint = 1,
+    .mTransferBufferLength = ReportSize,
+  };
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto start = Clock::now();
+    if (const auto ok = client.Transfer(submit, reply); !ok) {
+      return std::unexpected {ok.error()};
+    }
+    ret.push_back(Clock::now() - start);
+  }
+  return ret;
+}
+
+// Sends OUT URBs a byte at a time until `stop`; returns the bytes sent
+std::size_t Trickle(Client& client, const std::atomic_flag& stop) {
+  const std::array<std::byte, SlowPayloadSize> payload {};
+  const Submit submit {
+    .mDirection = USBIP::Direction::Out,
+    .mEndpoint = 2,
+    .mTransferBufferLength = SlowPayloadSize,
+    .mPayload = payload,
+  };
+  std::size_t sent {};
+  auto next = Clock::now();
+  while (!stop.test()) {
+    const auto pdu = client.Encode(submit);
+    for (std::size_t i = 0; i < pdu.size() && !stop.test(); ++i) {
+      if (!client.SendBytes(std::span {pdu}.subspan(i, 1))) {
+        return sent;
+      }
+      ++sent;
+      next += TrickleInterval;
+      std::this_thread::sleep_until(next);
+    }
+  }
+  return sent;
+}
+
+}// namespace
+
+int main(int argc, char** argv) {
+  std::size_t urbs = DefaultURBs;
+  if (argc > 1) {
+    const std::string_view arg {argv[1]};
+    const auto [ptr, ec]
+      = std::from_chars(arg.data(), arg.data() + arg.size(), urbs);
+    if (ec != std::errc {} || ptr != arg.data() + arg.size() || urbs == 0) {
+      std::println(stderr, "Usage: {} [URBS]", argv[0]);
+      return 2;
+    }
+  }
+
+  const auto server = Server::Create();
+  if (!server) {
+    std::println(stderr, "Failed to create the instance");
+    return 2;
+  }
+  const FredEmmott_USBIP_VirtPP_Device_Callbacks callbacks {
+    .OnInputRequest = &OnInputRequest,
+    .OnOutputRequest = &OnOutputRequest,
+  };
+  const auto healthyDevice
+    = CreateVendorDevice(server->GetInstance(), callbacks);
+  const auto slowDevice = CreateVendorDevice(server->GetInstance(), callbacks);
+  if (!(healthyDevice && slowDevice)) {
+    std::println(stderr, "Failed to create the devices");
+    return 2;
+  }
+
+  auto healthy = Client::Import(server->GetPortNumber(), GetBusID(0));
+  auto slow = Client::Import(server->GetPortNumber(), GetBusID(1));
+  if (!(healthy && slow)) {
+    std::println(
+      stderr,
+      "Failed to import the devices: {}",
+      healthy ? slow.error() : healthy.error());
+    return 2;
+  }
+
+  auto alone = MeasureRoundTrips(*healthy, urbs);
+  if (!alone) {
+    std::println(stderr, "Healthy client failed: {}", alone.error());
+    return 2;
+  }
+
+  std::atomic_flag stop;
+  std::size_t trickled {};
+  std::thread trickler {[&] { trickled = Trickle(*slow, stop); }};
+  const auto start = Clock::now();
+  auto contended = MeasureRoundTrips(*healthy, urbs);
+  const auto elapsed = Clock::now() - start;
+  stop.test_and_set();
+  trickler.join();
+  if (!contended) {
+    std::println(stderr, "Healthy client failed: {}", contended.error());
+    return 2;
+  }
+
+  std::println("{} round trips each", urbs);
+  std::println("Alone:              {}", FormatLatencies(*alone));
+  std::println("With a slow client: {}", FormatLatencies(*contended));
+  std::println(
+    "The slow client sent {} bytes in {}ms",
+    trickled,
+    std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+  return 0;
+}
@@ -6,9 +6,15 @@
 #define AUTO_ATTACH FALSE
 #define ALLOW_REMOTE_CONNECTIONS TRUE
 
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
 
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 
 struct state_t {
@@ -30,21 +36,36 @@ void FeedXPad(
   FredEmmott_USBIP_VirtPP_XPadHandle handle,
   void* userData,
   struct FredEmmott_USBIP_VirtPP_XPad_State* state) {
+#ifdef _WIN32
   LARGE_INTEGER perfFrequency;
   LARGE_INTEGER perfCount;
   QueryPerformanceFrequency(&perfFrequency);
   QueryPerformanceCounter(&perfCount);
   // 100ms units
   uint64_t now = perfCount.QuadPart / (perfFrequency.QuadPart / 10);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // 100ms units
+  uint64_t now = (ts.tv_sec * 10) + (ts.tv_nsec / 100000000);
+#endif
   const float angle = (float)(now * 3.1415926 / 180.0f);
   state->wThumbLeftX = (int16_t)(32767 * cos(angle));
   state->wThumbLeftY = (int16_t)(32767 * sin(angle));
 }
 
+#ifdef _WIN32
 DWORD WINAPI FeedAll(void* userData) {
+#else
+void* FeedAll(void* userData) {
+#endif
   struct state_t* state = userData;
   while (1) {
+#ifdef _WIN32
     Sleep(100 /* ms */);
+#else
+    nanosleep(&(struct timespec) {.tv_nsec = 100000000 /* 100ms */}, NULL);
+#endif
     FredEmmott_USBIP_VirtPP_Mouse_UpdateInPlace(
       state->mMouse, NULL, &FeedMouse);
     FredEmmott_USBIP_VirtPP_XPad_UpdateInPlace(state->mXPad, NULL, &FeedXPad);
@@ -76,12 +97,21 @@ int main() {
   };
   state.mXPad = FredEmmott_USBIP_VirtPP_XPad_Create(state.mInstance, &xpadInit);
 
+#ifdef _WIN32
   HANDLE feederThread = CreateThread(NULL, 0, &FeedAll, &state, 0, NULL);
+#else
+  pthread_t feederThread;
+  pthread_create(&feederThread, NULL, &FeedAll, &state);
+#endif
 
   FredEmmott_USBIP_VirtPP_Instance_Run(state.mInstance);
 
+#ifdef _WIN32
   WaitForSingleObject(feederThread, INFINITE);
   CloseHandle(feederThread);
+#else
+  pthread_join(feederThread, NULL);
+#endif
 
   FredEmmott_USBIP_VirtPP_XPad_Destroy(state.mXPad);
   FredEmmott_USBIP_VirtPP_Mouse_Destroy(state.mMouse);
@@ -0,0 +1,380 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+/* Tests vhci-attach.cpp against a fake `vhci_hcd` sysfs directory, via
+ * `InitData::mVHCISysfsPath`, and a real server on loopback.
+ *
+ * `attach` is a regular file; this executable's `write()` handles what's
+ * written to it instead of the kernel: ports are marked as used in `status`,
+ * and writes are refused with `EBUSY` if the port is already used - as if
+ * another process took it first - or with `EINVAL` for a chosen device.
+ *
+ * Exits with 0 if every check passed.
+ */
+
+#include <FredEmmott/USBIP-VirtPP/Core.h>
+#include <FredEmmott/USBIP-VirtPP/Device.h>
+#include "posix-compat.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <print>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace {
+
+// Ports 0-3 are high-speed, and 4 is SuperSpeed; 1 is used by another device
+constexpr unsigned int PortCount = 5;
+constexpr unsigned int SuperSpeedPort = 4;
+const std::set<unsigned int> InitiallyUsedPorts {1};
+// `VDEV_ST_NULL` and `VDEV_ST_USED` in the kernel's `usbip_common.h`
+constexpr unsigned int PortFree = 4;
+constexpr unsigned int PortUsed = 6;
+// `MaxAttachAttempts` in vhci-attach.cpp
+constexpr std::size_t MaxAttachAttempts = 4;
+
+struct AttachCommand {
+  unsigned int mPort {};
+  uint32_t mDeviceID {};
+  bool mAccepted {};
+};
+
+struct FakeKernel {
+  std::mutex mMutex;
+  std::filesystem::path mSysfsPath;
+  dev_t mAttachDevice {};
+  ino_t mAttachInode {};
+
+  std::set<unsigned int> mUsedPorts;
+
+  // Every write to `attach`, including refused ones
+  std::vector<AttachCommand> mCommands;
+  // Refuse this many writes with `EBUSY`, even if the port is free
+  std::size_t mBusyWrites {};
+  // Refuse writes for this device with `EINVAL`
+  uint32_t mRejectedDeviceID {};
+  // Sockets we were given with a timeout still set
+  std::size_t mSocketsWithTimeouts {};
+};
+FakeKernel gKernel;
+
+int gFailures = 0;
+
+void Check(const bool ok, const std::string_view what) {
+  if (!ok) {
+    std::println(stderr, "FAILED: {}", what);
+    ++gFailures;
+  }
+}
+
+// Call with `gKernel.mMutex` held, or before `Run()`
+void WriteStatus() {
+  // Replace it atomically, as attaches on other threads may be reading it
+  const auto path = gKernel.mSysfsPath / "status";
+  auto temporary = path;
+  temporary += ".new";
+  {
+    std::ofstream status(temporary);
+    status << "hub port sta spd dev      sockfd local_busid\n";
+    for (unsigned int port = 0; port < PortCount; ++port) {
+      status << std::format(
+        "{}  {:04} {:03} 000 00000000 000000 0-0\n",
+        port == SuperSpeedPort ? "ss" : "hs",
+        port,
+        gKernel.mUsedPorts.contains(port) ? PortUsed : PortFree);
+    }
+  }
+  std::filesystem::rename(temporary, path);
+}
+
+// Detach everything we attached
+void ResetPorts() {
+  std::unique_lock lock(gKernel.mMutex);
+  gKernel.mUsedPorts = InitiallyUsedPorts;
+  WriteStatus();
+}
+
+bool HasTimeout(const int fd, const int option) {
+  timeval timeout {};
+  socklen_t size = sizeof(timeout);
+  if (getsockopt(fd, SOL_SOCKET, option, &timeout, &size) != 0) {
+    return true;
+  }
+  return timeout.tv_sec != 0 || timeout.tv_usec != 0;
+}
+
+bool IsAttachFile(const int fd) {
+  struct stat info {};
+  return gKernel.mAttachInode && fstat(fd, &info) == 0
+    && info.st_dev == gKernel.mAttachDevice
+    && info.st_ino == gKernel.mAttachInode;
+}
+
+ssize_t FakeAttach(const std::string_view command) {
+  unsigned int port {};
+  int sockfd {};
+  uint32_t deviceID {};
+  const std::string terminated {command};
+  if (
+    std::sscanf(terminated.c_str(), "%u %d %u", &port, &sockfd, &deviceID)
+    != 3) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  std::unique_lock lock(gKernel.mMutex);
+  auto& record = gKernel.mCommands.emplace_back(port, deviceID, false);
+  if (HasTimeout(sockfd, SO_RCVTIMEO) || HasTimeout(sockfd, SO_SNDTIMEO)) {
+    ++gKernel.mSocketsWithTimeouts;
+  }
+  if (gKernel.mBusyWrites) {
+    --gKernel.mBusyWrites;
+    errno = EBUSY;
+    return -1;
+  }
+  if (deviceID == gKernel.mRejectedDeviceID) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (
+    port >= PortCount || port == SuperSpeedPort
+    || !gKernel.mUsedPorts.emplace(port).second) {
+    errno = EBUSY;
+    return -1;
+  }
+  WriteStatus();
+  record.mAccepted = true;
+  return static_cast<ssize_t>(command.size());
+}
+
+std::vector<AttachCommand> TakeCommands() {
+  std::unique_lock lock(gKernel.mMutex);
+  return std::exchange(gKernel.mCommands, {});
+}
+
+std::vector<FredEmmott_USBIP_VirtPP_Result> AttachAll(
+  const std::span<const FredEmmott_USBIP_VirtPP_DeviceHandle> devices) {
+  std::vector<FredEmmott_USBIP_VirtPP_Result> results(devices.size());
+  std::ignore = FredEmmott_USBIP_VirtPP_Device_AttachAll(
+    devices.data(), devices.size(), results.data());
+  return results;
+}
+
+void TestPortReservation(
+  const std::span<const FredEmmott_USBIP_VirtPP_DeviceHandle> devices) {
+  ResetPorts();
+  const auto results = AttachAll(devices);
+  Check(
+    std::ranges::all_of(
+      results,
+      [](const auto result) {
+        return FredEmmott_USBIP_VirtPP_SUCCEEDED(result);
+      }),
+    "every device is attached");
+
+  // Concurrent attaches read the same `status`, so without reservations,
+  // they'd pick the same port, and all but one would be refused
+  std::set<unsigned int> ports;
+  std::set<uint32_t> deviceIDs;
+  for (auto&& command: TakeCommands()) {
+    Check(command.mAccepted, "attaches don't race each other for ports");
+    Check(
+      !InitiallyUsedPorts.contains(command.mPort),
+      "devices aren't attached to used ports");
+    Check(
+      command.mPort != SuperSpeedPort,
+      "full-speed devices are attached to the high-speed hub");
+    ports.emplace(command.mPort);
+    deviceIDs.emplace(command.mDeviceID);
+  }
+  Check(ports.size() == devices.size(), "each device gets its own port");
+  Check(deviceIDs.size() == devices.size(), "each device is attached once");
+
+  Check(
+    FredEmmott_USBIP_VirtPP_Device_Attach(devices.front())
+      == HRESULT_FROM_ERRNO(EBUSY),
+    "attaching fails with EBUSY once every port is used");
+}
+
+void TestRetries(const FredEmmott_USBIP_VirtPP_DeviceHandle device) {
+  ResetPorts();
+  gKernel.mBusyWrites = MaxAttachAttempts - 1;
+  Check(
+    FredEmmott_USBIP_VirtPP_SUCCEEDED(
+      FredEmmott_USBIP_VirtPP_Device_Attach(device)),
+    "attaching succeeds on the last attempt");
+  const auto retried = TakeCommands();
+  Check(retried.size() == MaxAttachAttempts, "each attempt writes `attach`");
+  Check(
+    !retried.empty() && retried.back().mAccepted,
+    "the last attempt is accepted");
+
+  ResetPorts();
+  gKernel.mBusyWrites = MaxAttachAttempts;
+  Check(
+    FredEmmott_USBIP_VirtPP_Device_Attach(device) == HRESULT_FROM_ERRNO(EBUSY),
+    "attaching fails with EBUSY once every attempt is refused");
+  Check(
+    TakeCommands().size() == MaxAttachAttempts,
+    "attaching gives up after `MaxAttachAttempts`");
+  gKernel.mBusyWrites = 0;
+}
+
+void TestPerDeviceResults(
+  const std::span<const FredEmmott_USBIP_VirtPP_DeviceHandle> devices,
+  const uint32_t rejectedDeviceID) {
+  ResetPorts();
+  gKernel.mRejectedDeviceID = rejectedDeviceID;
+  const auto results = AttachAll(devices);
+  gKernel.mRejectedDeviceID = 0;
+
+  std::vector<uint32_t> deviceIDs;
+  for (auto&& command: TakeCommands()) {
+    deviceIDs.push_back(command.mDeviceID);
+  }
+  std::ranges::sort(deviceIDs);
+  Check(
+    deviceIDs == std::vector<uint32_t> {0x1'0001, 0x1'0002, 0x1'0003},
+    "devices are numbered as bus 1, devices 1-3");
+  Check(
+    results.size() == 3 && FredEmmott_USBIP_VirtPP_SUCCEEDED(results[0])
+      && results[1] == HRESULT_FROM_ERRNO(EINVAL)
+      && FredEmmott_USBIP_VirtPP_SUCCEEDED(results[2]),
+    "`AttachAll()` reports each device's own result, in order");
+}
+
+// Nothing imports the devices for real, so there are no URBs; stall if so
+FredEmmott_USBIP_VirtPP_Result OnInputRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint32_t,
+  uint8_t,
+  uint8_t,
+  uint16_t,
+  uint16_t,
+  uint16_t) {
+  return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+}
+
+FredEmmott_USBIP_VirtPP_Result OnOutputRequest(
+  const FredEmmott_USBIP_VirtPP_RequestHandle request,
+  uint32_t,
+  uint8_t,
+  uint8_t,
+  uint16_t,
+  uint16_t,
+  uint16_t,
+  const void*,
+  uint32_t) {
+  return FredEmmott_USBIP_VirtPP_Request_SendErrorReply(request, -EPIPE);
+}
+
+}// namespace
+
+// Everything else goes to the real `write()`
+extern "C" ssize_t write(const int fd, const void* buf, const size_t count) {
+  if (IsAttachFile(fd)) {
+    return FakeAttach({static_cast<const char*>(buf), count});
+  }
+  return syscall(SYS_write, fd, buf, count);
+}
+
+int main() {
+  const auto sysfs = std::filesystem::temp_directory_path()
+    / std::format("usbip_virtpp_vhci_test.{}", getpid());
+  std::filesystem::create_directories(sysfs);
+  gKernel.mSysfsPath = sysfs;
+  ResetPorts();
+  std::ofstream(sysfs / "attach").flush();
+  struct stat attachInfo {};
+  if (stat((sysfs / "attach").c_str(), &attachInfo) != 0) {
+    std::println(stderr, "Failed to create the fake sysfs directory");
+    return 2;
+  }
+  gKernel.mAttachDevice = attachInfo.st_dev;
+  gKernel.mAttachInode = attachInfo.st_ino;
+
+  const FredEmmott_USBIP_VirtPP_Instance_InitData instanceInit {
+    .mVHCISysfsPath = sysfs.c_str(),
+    .mMinLogSeverity = FredEmmott_USBIP_VirtPP_LogSeverity_Error,
+  };
+  const auto instance = FredEmmott_USBIP_VirtPP_Instance_Create(&instanceInit);
+  if (!instance) {
+    std::println(stderr, "Failed to create the instance");
+    return 2;
+  }
+
+  const FredEmmott_USBSpec_DeviceDescriptor deviceDescriptor {
+    .bLength = FredEmmott_USBSpec_DeviceDescriptor_Size,
+    .bDescriptorType = 0x01,
+    .bcdUSB = 0x0200,
+    .bMaxPacketSize0 = 64,
+    .idVendor = 0x1209,
+    .idProduct = 0x0001,
+    .bNumConfigurations = 1,
+  };
+  const FredEmmott_USBSpec_InterfaceDescriptor interfaceDescriptor {
+    .bLength = FredEmmott_USBSpec_InterfaceDescriptor_Size,
+    .bDescriptorType = 0x04,
+    .bInterfaceClass = 0xff,
+  };
+  const FredEmmott_USBIP_VirtPP_Device_InitData deviceInit {
+    .mCallbacks = {
+      .OnInputRequest = &OnInputRequest,
+      .OnOutputRequest = &OnOutputRequest,
+    },
+    .mDeviceDescriptor = &deviceDescriptor,
+    .mNumInterfaces = 1,
+    .mInterfaceDescriptors = &interfaceDescriptor,
+  };
+  std::array<FredEmmott_USBIP_VirtPP_DeviceHandle, 3> devices {};
+  for (auto&& device: devices) {
+    device = FredEmmott_USBIP_VirtPP_Device_Create(instance, &deviceInit);
+    if (!device) {
+      std::println(stderr, "Failed to create a device");
+      return 2;
+    }
+  }
+
+  std::thread runner {[instance] {
+    FredEmmott_USBIP_VirtPP_Instance_Run(instance);
+  }};
+
+  TestPortReservation(devices);
+  TestRetries(devices.front());
+  TestPerDeviceResults(devices, 0x1'0002);
+  Check(
+    gKernel.mSocketsWithTimeouts == 0,
+    "sockets are handed to the kernel without timeouts");
+
+  FredEmmott_USBIP_VirtPP_Instance_RequestStop(instance);
+  runner.join();
+  for (auto&& device: devices) {
+    FredEmmott_USBIP_VirtPP_Device_Destroy(device);
+  }
+  FredEmmott_USBIP_VirtPP_Instance_Destroy(instance);
+  std::filesystem::remove_all(sysfs);
+
+  if (gFailures) {
+    return 1;
+  }
+  std::println("All checks passed");
+  return 0;
+}
@@ -0,0 +1,977 @@
+// Copyright 2025 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: MIT
+
+/* Replays a session recorded with `InitData::mRecordPath` against a running
+ * server, and checks its replies against the recorded ones:
+ *
+ *   usbip_virtpp_replay [--max-speed] [--ignore-data] [--host ADDRESS]
+ *     [--timeout SECONDS] --port PORT RECORDING
+ *
+ * The server needs the same devices, with the same bus IDs, as the one that
+ * was recorded.
+ *
+ * By default, the client's bytes are sent on the recorded timeline; with
+ * `--max-speed`, as fast as the server takes them. Either way, a recorded
+ * disconnect waits for the connection's outstanding replies, so connections
+ * only overlap if they did in the recording.
+ *
+ * Replies are matched by sequence number, not byte-for-byte, as replies for
+ * different endpoints can be reordered. The status, length, and data must
+ * match; use `--ignore-data` if the devices' data isn't deterministic. A
+ * RET_SUBMIT racing a CMD_UNLINK is optional, and the RET_UNLINK's status
+ * isn't checked.
+ *
+ * Exits with 0 if everything matched, 1 if not, or 2 for usage or I/O errors.
+ */
+
+#include <FredEmmott/USBIP.hpp>
+#include "pdu-parser.hpp"
+#include "session-file.hpp"
+#include "unique-fd.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <expected>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <print>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+namespace USBIP = FredEmmott::USBIP;
+using namespace FredEmmott::USBVirtPP;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Print this many problems, then just count them
+constexpr std::size_t MaxPrintedProblems = 20;
+constexpr std::size_t ReceiveChunkSize = 64 * 1024;
+
+enum ExitCode : int {
+  ExitMatched = 0,
+  ExitMismatched = 1,
+  ExitError = 2,
+};
+
+struct Options {
+  bool mMaxSpeed {false};
+  bool mIgnoreData {false};
+  std::string mHost {"127.0.0.1"};
+  uint16_t mPort {};
+  std::chrono::seconds mTimeout {5};
+  std::string mPath;
+};
+
+struct Chunk {
+  std::chrono::nanoseconds mTime {};
+  uint64_t mConnectionID {};
+  SessionChunkType mType {};
+  std::span<const std::byte> mData;
+};
+
+// A CMD_SUBMIT or CMD_UNLINK from the recorded client
+struct Command {
+  bool mIsInput {};
+  // Offset of the end of the PDU, in everything the client sent
+  std::size_t mEnd {};
+  std::chrono::nanoseconds mRecordedTime {};
+  // When the replayed PDU was completely sent
+  Clock::time_point mSentAt {};
+};
+
+// A PDU from the server
+struct Reply {
+  USBIP::CommandCode mCommandCode {};
+  // For OP_REP_*, the index of the reply on the connection
+  uint32_t mSequenceNumber {};
+  std::span<const std::byte> mPDU;
+};
+
+struct ExpectedReply {
+  USBIP::CommandCode mCommandCode {};
+  uint32_t mSequenceNumber {};
+  std::vector<std::byte> mPDU;
+  // A RET_SUBMIT racing a CMD_UNLINK
+  bool mOptional {false};
+  bool mReceived {false};
+};
+
+/* Splits the server's stream into PDUs.
+ *
+ * Unlike client PDUs, the size of a RET_SUBMIT depends on the CMD_SUBMIT
+ * it's replying to, so this needs the client's commands.
+ */
+class ReplyParser final {
+ public:
+  // Returns the reply at the start of `buffer` if it's complete, or an error
+  // if it's not a server PDU
+  [[nodiscard]]
+  std::expected<std::optional<Reply>, std::string> Parse(
+    std::span<const std::byte> buffer,
+    const std::unordered_map<uint32_t, Command>& commands);
+
+ private:
+  uint32_t mOpReplies {};
+};
+
+struct ReplayedConnection {
+  uint64_t mID {};
+
+  // Everything the recorded client sent, by sequence number
+  std::unordered_map<uint32_t, Command> mCommands;
+  // Sequence numbers in the order the client sent them
+  std::vector<uint32_t> mCommandOrder;
+  // URBs the client tried to unlink
+  std::unordered_set<uint32_t> mUnlinked;
+  // Keyed by `GetReplyKey()`
+  std::unordered_map<uint64_t, ExpectedReply> mExpected;
+  // Expected replies that aren't optional, and haven't been received yet
+  std::size_t mOutstanding {};
+
+  unique_fd mSocket;
+  ReplyParser mParser;
+  std::vector<std::byte> mOut;
+  std::vector<std::byte> mIn;
+  std::size_t mBytesSent {};
+  // Index into `mCommandOrder` of the first command that isn't completely
+  // sent
+  std::size_t mNextUnsentCommand {};
+  std::optional<Clock::time_point> mCloseDeadline;
+};
+
+struct Results {
+  uint64_t mURBs {};
+  uint64_t mBytesSent {};
+  uint64_t mBytesReceived {};
+  std::vector<std::chrono::nanoseconds> mLatencies;
+  std::vector<std::chrono::nanoseconds> mRecordedLatencies;
+  std::size_t mMismatched {};
+  std::size_t mMissing {};
+  std::size_t mUnexpected {};
+
+  template <class... Args>
+  void Report(
+    std::size_t Results::* counter,
+    std::format_string<Args...> format,
+    Args&&... args) {
+    if (mMismatched + mMissing + mUnexpected < MaxPrintedProblems) {
+      std::println(stderr, format, std::forward<Args>(args)...);
+    }
+    ++(this->*counter);
+  }
+};
+
+const char* GetName(const USBIP::CommandCode code) {
+  switch (code) {
+    case USBIP::CommandCode::OP_REP_DEVLIST:
+      return "OP_REP_DEVLIST";
+    case USBIP::CommandCode::OP_REP_IMPORT:
+      return "OP_REP_IMPORT";
+    case USBIP::CommandCode::USBIP_RET_SUBMIT:
+      return "RET_SUBMIT";
+    case USBIP::CommandCode::USBIP_RET_UNLINK:
+      return "RET_UNLINK";
+    default:
+      return "unknown PDU";
+  }
+}
+
+uint64_t GetReplyKey(
+  const USBIP::CommandCode code,
+  const uint32_t sequenceNumber) {
+  return (uint64_t {std::to_underlying(code)} << 32) | sequenceNumber;
+}
+
+std::expected<std::optional<Reply>, std::string> ReplyParser::Parse(
+  const std::span<const std::byte> buffer,
+  const std::unordered_map<uint32_t, Command>& commands) {
+  if (buffer.size() < sizeof(USBIP::CommandCode)) {
+    return std::nullopt;
+  }
+  const auto code = GetCommandCode(buffer);
+  const auto complete = [&](const std::size_t size, const uint32_t sequence) {
+    return (buffer.size() < size)
+      ? std::nullopt
+      : std::optional<Reply> {{code, sequence, buffer.first(size)}};
+  };
+  const auto completeOp = [&](const std::size_t size) {
+    auto ret = complete(size, mOpReplies);
+    if (ret) {
+      ++mOpReplies;
+    }
+    return ret;
+  };
+
+  switch (code) {
+    case USBIP::CommandCode::OP_REP_DEVLIST: {
+      std::size_t size = sizeof(USBIP::OP_REP_DEVLIST);
+      if (buffer.size() < size) {
+        return std::nullopt;
+      }
+      const uint32_t count = PDUAs<USBIP::OP_REP_DEVLIST>(buffer).mNumDevices;
+      for (uint32_t i = 0; i < count; ++i) {
+        if (buffer.size() < size + sizeof(USBIP::Device)) {
+          return std::nullopt;
+        }
+        const auto& device = PDUAs<USBIP::Device>(buffer.subspan(size));
+        size += sizeof(USBIP::Device)
+          + (std::size_t {device.mNumInterfaces} * sizeof(USBIP::Interface));
+      }
+      return completeOp(size);
+    }
+    case USBIP::CommandCode::OP_REP_IMPORT:
+      // The server always sends the device, even for errors
+      return completeOp(sizeof(USBIP::OP_REP_IMPORT));
+    case USBIP::CommandCode::USBIP_RET_SUBMIT: {
+      if (buffer.size() < sizeof(USBIP::USBIP_RET_SUBMIT)) {
+        return std::nullopt;
+      }
+      const auto& header = PDUAs<USBIP::USBIP_RET_SUBMIT>(buffer);
+      const auto sequence = ntohl(header.mHeader.mSequenceNumber);
+      const auto it = commands.find(sequence);
+      if (it == commands.end()) {
+        return std::unexpected(
+          std::format("RET_SUBMIT for unknown URB #{}", sequence));
+      }
+      const uint32_t packets = header.mNumberOfPackets;
+      std::size_t size = sizeof(header);
+      if (packets != 0xffff'ffff) {
+        size += std::size_t {packets}
+          * sizeof(USBIP::USBIP_ISO_PACKET_DESCRIPTOR);
+      }
+      if (it->second.mIsInput) {
+        size += header.mActualLength.NativeValue();
+      }
+      return complete(size, sequence);
+    }
+    case USBIP::CommandCode::USBIP_RET_UNLINK:
+      if (buffer.size() < sizeof(USBIP::USBIP_RET_UNLINK)) {
+        return std::nullopt;
+      }
+      return complete(
+        sizeof(USBIP::USBIP_RET_UNLINK),
+        ntohl(PDUAs<USBIP::USBIP_RET_UNLINK>(buffer).mHeader.mSequenceNumber));
+    default:
+      return std::unexpected(
+        std::format(
+          "unhandled command code 0x{:x}", std::to_underlying(code)));
+  }
+}
+
+void PrintUsage() {
+  std::println(
+    stderr,
+    "Usage: usbip_virtpp_replay [--max-speed] [--ignore-data] "
+    "[--host ADDRESS] [--timeout SECONDS] --port PORT RECORDING");
+}
+
+template <class T>
+bool ParseNumber(const std::string_view text, T& out) {
+  const auto end = text.data() + text.size();
+  const auto [ptr, ec] = std::from_chars(text.data(), end, out);
+  return ec == std::errc {} && ptr == end;
+}
+
+std::optional<Options> ParseArgs(const std::span<char*> args) {
+  Options ret;
+  bool havePort = false;
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    const std::string_view arg {args[i]};
+    const auto value = [&]() -> std::optional<std::string_view> {
+      if (i + 1 == args.size()) {
+        std::println(stderr, "{} needs a value", arg);
+        return std::nullopt;
+      }
+      return args[++i];
+    };
+    if (arg == "--max-speed") {
+      ret.mMaxSpeed = true;
+    } else if (arg == "--ignore-data") {
+      ret.mIgnoreData = true;
+    } else if (arg == "--host") {
+      const auto host = value();
+      if (!host) {
+        return std::nullopt;
+      }
+      ret.mHost = *host;
+    } else if (arg == "--port") {
+      const auto port = value();
+      if (!(port && ParseNumber(*port, ret.mPort))) {
+        return std::nullopt;
+      }
+      havePort = true;
+    } else if (arg == "--timeout") {
+      const auto timeout = value();
+      uint32_t seconds {};
+      if (!(timeout && ParseNumber(*timeout, seconds))) {
+        return std::nullopt;
+      }
+      ret.mTimeout = std::chrono::seconds {seconds};
+    } else if (arg.starts_with("--") || !ret.mPath.empty()) {
+      std::println(stderr, "Unexpected argument `{}`", arg);
+      return std::nullopt;
+    } else {
+      ret.mPath = arg;
+    }
+  }
+  if (!havePort || ret.mPath.empty()) {
+    return std::nullopt;
+  }
+  return ret;
+}
+
+std::optional<std::vector<std::byte>> ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    std::println(stderr, "Failed to open `{}`", path);
+    return std::nullopt;
+  }
+  std::vector<std::byte> ret(static_cast<std::size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(
+    reinterpret_cast<char*>(ret.data()),
+    static_cast<std::streamsize>(ret.size()));
+  if (!file) {
+    std::println(stderr, "Failed to read `{}`", path);
+    return std::nullopt;
+  }
+  return ret;
+}
+
+std::optional<std::vector<Chunk>> ParseChunks(
+  std::span<const std::byte> file) {
+  if (
+    file.size() < sizeof(SessionFileHeader)
+    || PDUAs<SessionFileHeader>(file).mMagic
+      != SessionFileHeader::ExpectedMagic) {
+    std::println(stderr, "Not a session recording");
+    return std::nullopt;
+  }
+  if (const auto version = PDUAs<SessionFileHeader>(file).mVersion;
+      version != SessionFileHeader::CurrentVersion) {
+    std::println(stderr, "Unsupported recording version {}", version);
+    return std::nullopt;
+  }
+  file = file.subspan(sizeof(SessionFileHeader));
+
+  std::vector<Chunk> ret;
+  std::unordered_set<uint64_t> open;
+  while (!file.empty()) {
+    SessionChunkHeader header {};
+    if (file.size() < sizeof(header)) {
+      std::println(stderr, "Recording is truncated; replaying what's there");
+      break;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    file = file.subspan(sizeof(header));
+    if (file.size() < header.mLength) {
+      std::println(stderr, "Recording is truncated; replaying what's there");
+      break;
+    }
+    const auto connected = open.contains(header.mConnectionID);
+    switch (header.mType) {
+      case SessionChunkType::Connected:
+        if (connected) {
+          std::println(
+            stderr, "Connection {} connected twice", header.mConnectionID);
+          return std::nullopt;
+        }
+        open.insert(header.mConnectionID);
+        break;
+      case SessionChunkType::FromClient:
+      case SessionChunkType::ToClient:
+      case SessionChunkType::Closed:
+        if (!connected) {
+          std::println(
+            stderr,
+            "Data for connection {} while it's not connected",
+            header.mConnectionID);
+          return std::nullopt;
+        }
+        if (header.mType == SessionChunkType::Closed) {
+          open.erase(header.mConnectionID);
+        }
+        break;
+      default:
+        std::println(
+          stderr,
+          "Unknown chunk type {}",
+          std::to_underlying(header.mType));
+        return std::nullopt;
+    }
+    ret.push_back({
+      .mTime = std::chrono::nanoseconds {header.mNanoseconds},
+      .mConnectionID = header.mConnectionID,
+      .mType = header.mType,
+      .mData = file.first(header.mLength),
+    });
+    file = file.subspan(header.mLength);
+  }
+
+  // The server was stopped, or crashed, with connections still open
+  const auto end = ret.empty() ? std::chrono::nanoseconds {} : ret.back().mTime;
+  for (auto&& id: open) {
+    ret.push_back({
+      .mTime = end,
+      .mConnectionID = id,
+      .mType = SessionChunkType::Closed,
+      .mData = {},
+    });
+  }
+  return ret;
+}
+
+/* Find every command, and every recorded reply, in the recorded streams.
+ *
+ * Replies are always recorded after the commands they're replying to, so one
+ * pass is enough.
+ */
+bool LoadExpectations(
+  const std::span<const Chunk> chunks,
+  std::unordered_map<uint64_t, ReplayedConnection>& connections,
+  Results& results) {
+  struct Streams {
+    PDUParser mClientParser;
+    std::vector<std::byte> mClient;
+    std::size_t mClientConsumed {};
+    ReplyParser mServerParser;
+    std::vector<std::byte> mServer;
+  };
+  std::unordered_map<uint64_t, Streams> streams;
+
+  for (auto&& chunk: chunks) {
+    auto& connection = connections[chunk.mConnectionID];
+    connection.mID = chunk.mConnectionID;
+    auto& stream = streams[chunk.mConnectionID];
+
+    if (chunk.mType == SessionChunkType::FromClient) {
+      stream.mClient.insert(
+        stream.mClient.end(), chunk.mData.begin(), chunk.mData.end());
+      std::span<const std::byte> remaining {stream.mClient};
+      while (const auto size = stream.mClientParser.Parse(remaining)) {
+        const auto pdu = remaining.first(*size);
+        remaining = remaining.subspan(*size);
+        stream.mClientConsumed += *size;
+        const Command command {
+          .mEnd = stream.mClientConsumed,
+          .mRecordedTime = chunk.mTime,
+        };
+        switch (GetCommandCode(pdu)) {
+          case USBIP::CommandCode::OP_REQ_DEVLIST:
+          case USBIP::CommandCode::OP_REQ_IMPORT:
+            break;
+          case USBIP::CommandCode::USBIP_CMD_SUBMIT: {
+            const auto& header
+              = PDUAs<USBIP::USBIP_CMD_SUBMIT>(pdu).mHeader;
+            const auto sequence = ntohl(header.mSequenceNumber);
+            auto& submit = connection.mCommands[sequence] = command;
+            submit.mIsInput = header.mDirection == USBIP::Direction::In;
+            connection.mCommandOrder.push_back(sequence);
+            break;
+          }
+          case USBIP::CommandCode::USBIP_CMD_UNLINK: {
+            const auto& unlink = PDUAs<USBIP::USBIP_CMD_UNLINK>(pdu);
+            const auto sequence = ntohl(unlink.mHeader.mSequenceNumber);
+            connection.mCommands[sequence] = command;
+            connection.mCommandOrder.push_back(sequence);
+            connection.mUnlinked.insert(unlink.mUnlinkSequenceNumber);
+            break;
+          }
+          default:
+            std::println(
+              stderr,
+              "Connection {}: the client sent an unhandled command code 0x{:x}",
+              connection.mID,
+              std::to_underlying(GetCommandCode(pdu)));
+            return false;
+        }
+      }
+      stream.mClient.erase(
+        stream.mClient.begin(),
+        stream.mClient.end() - static_cast<std::ptrdiff_t>(remaining.size()));
+      continue;
+    }
+
+    if (chunk.mType != SessionChunkType::ToClient) {
+      continue;
+    }
+    stream.mServer.insert(
+      stream.mServer.end(), chunk.mData.begin(), chunk.mData.end());
+    std::span<const std::byte> remaining {stream.mServer};
+    while (true) {
+      const auto reply
+        = stream.mServerParser.Parse(remaining, connection.mCommands);
+      if (!reply) {
+        std::println(
+          stderr,
+          "Connection {}: bad reply in the recording: {}",
+          connection.mID,
+          reply.error());
+        return false;
+      }
+      if (!*reply) {
+        break;
+      }
+      const auto& [code, sequence, pdu] = **reply;
+      remaining = remaining.subspan(pdu.size());
+      connection.mExpected.insert_or_assign(
+        GetReplyKey(code, sequence),
+        ExpectedReply {
+          .mCommandCode = code,
+          .mSequenceNumber = sequence,
+          .mPDU = {pdu.begin(), pdu.end()},
+        });
+      if (code == USBIP::CommandCode::USBIP_RET_SUBMIT) {
+        results.mRecordedLatencies.push_back(
+          chunk.mTime - connection.mCommands.at(sequence).mRecordedTime);
+      }
+    }
+    stream.mServer.erase(
+      stream.mServer.begin(),
+      stream.mServer.end() - static_cast<std::ptrdiff_t>(remaining.size()));
+  }
+
+  for (auto&& connection: connections | std::views::values) {
+    for (auto&& expected: connection.mExpected | std::views::values) {
+      expected.mOptional
+        = expected.mCommandCode == USBIP::CommandCode::USBIP_RET_SUBMIT
+        && connection.mUnlinked.contains(expected.mSequenceNumber);
+      if (!expected.mOptional) {
+        ++connection.mOutstanding;
+      }
+    }
+  }
+  return true;
+}
+
+// Returns a description of the difference, if any
+std::optional<std::string> Compare(
+  const Options& options,
+  const ExpectedReply& expected,
+  const std::span<const std::byte> actual) {
+  const std::span<const std::byte> want {expected.mPDU};
+  switch (expected.mCommandCode) {
+    case USBIP::CommandCode::USBIP_RET_SUBMIT: {
+      const auto& wantHeader = PDUAs<USBIP::USBIP_RET_SUBMIT>(want);
+      const auto& header = PDUAs<USBIP::USBIP_RET_SUBMIT>(actual);
+      if (header.mStatus != wantHeader.mStatus) {
+        return std::format(
+          "status {} instead of {}",
+          header.mStatus.NativeValue(),
+          wantHeader.mStatus.NativeValue());
+      }
+      if (header.mActualLength != wantHeader.mActualLength) {
+        return std::format(
+          "{} bytes instead of {}",
+          header.mActualLength.NativeValue(),
+          wantHeader.mActualLength.NativeValue());
+      }
+      if (header.mNumberOfPackets != wantHeader.mNumberOfPackets) {
+        return std::format(
+          "{} isochronous packets instead of {}",
+          header.mNumberOfPackets.NativeValue(),
+          wantHeader.mNumberOfPackets.NativeValue());
+      }
+      break;
+    }
+    case USBIP::CommandCode::USBIP_RET_UNLINK:
+      // Depends on whether the URB completed before the unlink arrived
+      return std::nullopt;
+    default: {
+      const auto status = PDUAs<USBIP::SetupHeader>(actual).mStatus;
+      const auto wantStatus = PDUAs<USBIP::SetupHeader>(want).mStatus;
+      if (status != wantStatus) {
+        return std::format(
+          "status {} instead of {}",
+          status.NativeValue(),
+          wantStatus.NativeValue());
+      }
+      if (actual.size() != want.size()) {
+        return std::format(
+          "{} bytes instead of {}", actual.size(), want.size());
+      }
+      break;
+    }
+  }
+  if (!(options.mIgnoreData || std::ranges::equal(actual, want))) {
+    return "different data";
+  }
+  return std::nullopt;
+}
+
+void OnReply(
+  const Options& options,
+  ReplayedConnection& connection,
+  const Reply& reply,
+  Results& results) {
+  const auto& [code, sequence, pdu] = reply;
+  const auto it = connection.mExpected.find(GetReplyKey(code, sequence));
+  if (it == connection.mExpected.end() || it->second.mReceived) {
+    if (
+      code == USBIP::CommandCode::USBIP_RET_SUBMIT
+      && connection.mUnlinked.contains(sequence)) {
+      return;
+    }
+    results.Report(
+      &Results::mUnexpected,
+      "Connection {}: unexpected {} for #{}",
+      connection.mID,
+      GetName(code),
+      sequence);
+    return;
+  }
+  auto& expected = it->second;
+  expected.mReceived = true;
+  if (!expected.mOptional) {
+    --connection.mOutstanding;
+  }
+
+  if (code == USBIP::CommandCode::USBIP_RET_SUBMIT) {
+    ++results.mURBs;
+    results.mLatencies.push_back(
+      Clock::now() - connection.mCommands.at(sequence).mSentAt);
+  }
+  if (const auto difference = Compare(options, expected, pdu)) {
+    results.Report(
+      &Results::mMismatched,
+      "Connection {}: {} for #{}: {}",
+      connection.mID,
+      GetName(code),
+      sequence,
+      *difference);
+  }
+}
+
+bool Connect(const Options& options, ReplayedConnection& connection) {
+  sockaddr_in address {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(options.mPort);
+  if (inet_pton(AF_INET, options.mHost.c_str(), &address.sin_addr) != 1) {
+    std::println(stderr, "Invalid IPv4 address `{}`", options.mHost);
+    return false;
+  }
+  unique_fd fd {socket(AF_INET, SOCK_STREAM, 0)};
+  if (!fd) {
+    std::println(stderr, "socket() failed: {}", std::strerror(errno));
+    return false;
+  }
+  // Like the kernel's client; we're measuring latency
+  const int noDelay = 1;
+  setsockopt(fd.get(), IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  if (
+    connect(fd.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address))
+    != 0) {
+    std::println(
+      stderr,
+      "Failed to connect to {}:{}: {}",
+      options.mHost,
+      options.mPort,
+      std::strerror(errno));
+    return false;
+  }
+  fcntl(fd.get(), F_SETFL, fcntl(fd.get(), F_GETFL) | O_NONBLOCK);
+  connection.mSocket = std::move(fd);
+  return true;
+}
+
+void Flush(ReplayedConnection& connection, Results& results) {
+  while (connection.mSocket && !connection.mOut.empty()) {
+    const auto sent = send(
+      connection.mSocket.get(),
+      connection.mOut.data(),
+      connection.mOut.size(),
+      MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        // Reported as missing replies
+        connection.mSocket.reset();
+        connection.mOut.clear();
+      }
+      return;
+    }
+    connection.mOut.erase(
+      connection.mOut.begin(), connection.mOut.begin() + sent);
+    connection.mBytesSent += static_cast<std::size_t>(sent);
+    results.mBytesSent += static_cast<std::size_t>(sent);
+
+    const auto now = Clock::now();
+    auto& next = connection.mNextUnsentCommand;
+    for (; next < connection.mCommandOrder.size(); ++next) {
+      auto& command = connection.mCommands.at(connection.mCommandOrder[next]);
+      if (command.mEnd > connection.mBytesSent) {
+        break;
+      }
+      command.mSentAt = now;
+    }
+  }
+}
+
+void Receive(
+  const Options& options,
+  ReplayedConnection& connection,
+  Results& results) {
+  while (connection.mSocket) {
+    const auto offset = connection.mIn.size();
+    connection.mIn.resize(offset + ReceiveChunkSize);
+    const auto received = recv(
+      connection.mSocket.get(),
+      connection.mIn.data() + offset,
+      ReceiveChunkSize,
+      0);
+    connection.mIn.resize(offset + std::max<ssize_t>(received, 0));
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (received <= 0) {
+      // Closed by the server; reported as missing replies
+      connection.mSocket.reset();
+      return;
+    }
+    results.mBytesReceived += static_cast<std::size_t>(received);
+
+    std::span<const std::byte> remaining {connection.mIn};
+    while (true) {
+      const auto reply
+        = connection.mParser.Parse(remaining, connection.mCommands);
+      if (!reply) {
+        results.Report(
+          &Results::mUnexpected,
+          "Connection {}: bad reply from the server: {}; disconnecting",
+          connection.mID,
+          reply.error());
+        connection.mSocket.reset();
+        return;
+      }
+      if (!*reply) {
+        break;
+      }
+      remaining = remaining.subspan((*reply)->mPDU.size());
+      OnReply(options, connection, **reply, results);
+    }
+    connection.mIn.erase(
+      connection.mIn.begin(),
+      connection.mIn.end() - static_cast<std::ptrdiff_t>(remaining.size()));
+  }
+}
+
+void Close(ReplayedConnection& connection, Results& results) {
+  connection.mSocket.reset();
+  for (auto&& expected: connection.mExpected | std::views::values) {
+    if (expected.mReceived || expected.mOptional) {
+      continue;
+    }
+    results.Report(
+      &Results::mMissing,
+      "Connection {}: no {} for #{}",
+      connection.mID,
+      GetName(expected.mCommandCode),
+      expected.mSequenceNumber);
+  }
+}
+
+// Everything's been sent, and every reply received, or we can't send or
+// receive any more
+bool IsSettled(const ReplayedConnection& connection) {
+  return !connection.mSocket
+    || (connection.mOut.empty() && connection.mOutstanding == 0);
+}
+
+bool Replay(
+  const Options& options,
+  const std::span<const Chunk> chunks,
+  std::unordered_map<uint64_t, ReplayedConnection>& connections,
+  Results& results) {
+  const auto start = Clock::now();
+  // How far behind the recorded timeline we are, from waiting for replies
+  Clock::duration lag {};
+  std::size_t next {};
+  std::vector<pollfd> fds;
+  std::vector<ReplayedConnection*> polled;
+
+  while (true) {
+    auto now = Clock::now();
+    std::optional<Clock::time_point> wakeAt;
+    for (; next < chunks.size(); ++next) {
+      const auto& chunk = chunks[next];
+      auto& connection = connections.at(chunk.mConnectionID);
+      const auto due = options.mMaxSpeed ? start : (start + lag + chunk.mTime);
+      if (now < due) {
+        wakeAt = due;
+        break;
+      }
+
+      if (chunk.mType == SessionChunkType::Closed) {
+        if (!connection.mCloseDeadline) {
+          connection.mCloseDeadline = now + options.mTimeout;
+        }
+        if (!(IsSettled(connection) || now >= *connection.mCloseDeadline)) {
+          wakeAt = connection.mCloseDeadline;
+          break;
+        }
+        Close(connection, results);
+        if (!options.mMaxSpeed) {
+          lag += now - due;
+        }
+        continue;
+      }
+      if (chunk.mType == SessionChunkType::Connected) {
+        if (!Connect(options, connection)) {
+          return false;
+        }
+        continue;
+      }
+      if (chunk.mType == SessionChunkType::FromClient && connection.mSocket) {
+        connection.mOut.insert(
+          connection.mOut.end(), chunk.mData.begin(), chunk.mData.end());
+        Flush(connection, results);
+      }
+    }
+    if (next == chunks.size()) {
+      return true;
+    }
+
+    fds.clear();
+    polled.clear();
+    for (auto&& connection: connections | std::views::values) {
+      if (!connection.mSocket) {
+        continue;
+      }
+      fds.push_back({
+        .fd = connection.mSocket.get(),
+        .events = static_cast<short>(
+          POLLIN | (connection.mOut.empty() ? 0 : POLLOUT)),
+        .revents = 0,
+      });
+      polled.push_back(&connection);
+    }
+    now = Clock::now();
+    const auto wait = std::max(
+      Clock::duration::zero(), wakeAt.value_or(now) - now);
+    const auto seconds = std::chrono::floor<std::chrono::seconds>(wait);
+    const timespec timeout {
+      .tv_sec = static_cast<time_t>(seconds.count()),
+      .tv_nsec = static_cast<long>(
+        std::chrono::nanoseconds {wait - seconds}.count()),
+    };
+    if (ppoll(fds.data(), fds.size(), &timeout, nullptr) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::println(stderr, "ppoll() failed: {}", std::strerror(errno));
+      return false;
+    }
+    for (std::size_t i = 0; i < fds.size(); ++i) {
+      if (fds[i].revents & POLLOUT) {
+        Flush(*polled[i], results);
+      }
+      if (fds[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+        Receive(options, *polled[i], results);
+      }
+    }
+  }
+}
+
+std::string FormatLatencies(std::vector<std::chrono::nanoseconds>& latencies) {
+  if (latencies.empty()) {
+    return "no URBs";
+  }
+  std::ranges::sort(latencies);
+  const auto percentile = [&latencies](const std::size_t percent) {
+    const auto index
+      = std::min(latencies.size() - 1, (latencies.size() * percent) / 100);
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+             latencies[index])
+      .count();
+  };
+  return std::format(
+    "p50 {}us, p99 {}us, max {}us",
+    percentile(50),
+    percentile(99),
+    std::chrono::duration_cast<std::chrono::microseconds>(latencies.back())
+      .count());
+}
+
+void PrintResults(
+  const std::size_t connectionCount,
+  const Clock::duration elapsed,
+  Results& results) {
+  const auto seconds = std::chrono::duration<double>(elapsed).count();
+  const auto perSecond = [seconds](const double value) {
+    return (seconds > 0) ? (value / seconds) : 0.0;
+  };
+  constexpr double MiB = 1024 * 1024;
+  std::println(
+    "Replayed {} connections, with {} URBs, in {:.3f}s: {:.0f} URBs/s; "
+    "{:.2f} MiB/s to the server, {:.2f} MiB/s from the server",
+    connectionCount,
+    results.mURBs,
+    seconds,
+    perSecond(static_cast<double>(results.mURBs)),
+    perSecond(static_cast<double>(results.mBytesSent) / MiB),
+    perSecond(static_cast<double>(results.mBytesReceived) / MiB));
+  std::println("Latency: {}", FormatLatencies(results.mLatencies));
+  std::println(
+    "Recorded latency: {}", FormatLatencies(results.mRecordedLatencies));
+  std::println(
+    "{} mismatched, {} missing, and {} unexpected replies",
+    results.mMismatched,
+    results.mMissing,
+    results.mUnexpected);
+}
+}// namespace
+
+int main(int argc, char** argv) {
+  const auto options
+    = ParseArgs({argv + 1, static_cast<std::size_t>(argc - 1)});
+  if (!options) {
+    PrintUsage();
+    return ExitError;
+  }
+  const auto file = ReadFile(options->mPath);
+  if (!file) {
+    return ExitError;
+  }
+  const auto chunks = ParseChunks(*file);
+  if (!chunks) {
+    return ExitError;
+  }
+
+  Results results;
+  std::unordered_map<uint64_t, ReplayedConnection> connections;
+  if (!LoadExpectations(*chunks, connections, results)) {
+    return ExitError;
+  }
+  const auto start = Clock::now();
+  if (!Replay(*options, *chunks, connections, results)) {
+    return ExitError;
+  }
+  PrintResults(connections.size(), Clock::now() - start, results);
+  return (results.mMismatched + results.mMissing + results.mUnexpected)
+    ? ExitMismatched
+    : ExitMatched;
+}